@@ -1,644 +1,781 @@
 
+#define _POSIX_C_SOURCE 200809L
+/**
+ * Kommandozeile des HU Risc-V Emulators: liest die Dateien, richtet die Maschinen ueber die
+ * Bibliothek (rv_emu.h) ein und gibt die Ergebnisse aus.
+ */
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/stat.h>
 #include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stddef.h>
+#include <sys/stat.h>
 
+#include "rv_emu.h"
+#include "server.h"
 
-enum opcode_decode {R = 0x33, I = 0x13, S = 0x23, L = 0x03, B = 0x63, JALR = 0x67, JAL = 0x6F, AUIPC = 0x17, LUI = 0x37};
+#define CPU_STEP_BUDGET 1000000
+#define BBV_INTERVAL 10000000
 
-typedef struct {
-    size_t data_mem_size_;
-    uint32_t regfile_[32];
-    uint32_t pc_;
-    uint8_t* instr_mem_;
-    uint8_t* data_mem_;
-} CPU;
-
-void CPU_open_instruction_mem(CPU* cpu, const char* filename);
-void CPU_load_data_mem(CPU* cpu, const char* filename);
-
-CPU* CPU_init(const char* path_to_inst_mem, const char* path_to_data_mem) {
-	CPU* cpu = (CPU*) malloc(sizeof(CPU));
-	cpu->data_mem_size_ = 0x400000;
-    cpu->pc_ = 0x0;
-    CPU_open_instruction_mem(cpu, path_to_inst_mem);
-    CPU_load_data_mem(cpu, path_to_data_mem);
-    return cpu;
-}
+#define CLI_MAX_CACHES 16
+#define CLI_MAX_PREDICTORS 8
+#define CLI_TOP_FUNCTIONS 5
+#define CLI_TOP_BRANCHES 5
 
-void CPU_open_instruction_mem(CPU* cpu, const char* filename) {
-	uint32_t  instr_mem_size;
-	FILE* input_file = fopen(filename, "r");
-	if (!input_file) {
+/*Kommandozeile: Optionen beginnen mit --, der Rest sind Dateien (Instruktions-, dann Datenspeicher)*/
+typedef struct {
+    int lockstep_;
+    int schedule_;
+    int workers_;
+    uint64_t quantum_;
+    uint64_t seed_;
+    int harts_;
+    const char* serve_;
+    int no_spin_skip_;
+    int host_pages_; //host_pages for RAM and decoded program
+    int misaligned_trap_;
+    int code_in_ram_;
+    int timing_;
+    CPU_TimingConfig latency_;
+    CPU_CacheConfig caches_[CLI_MAX_CACHES];
+    int cache_count_;
+    uint64_t cache_sample_[3]; //period, length, warmup
+    CPU_PredictorConfig predictors_[CLI_MAX_PREDICTORS];
+    int predictor_count_;
+    int btb_bits_; //-1 = default
+    int ras_;
+    uint64_t budget_;
+    const char* bbv_file_;
+    uint64_t bbv_interval_;
+    const char* simpoints_file_;
+    const char* weights_file_;
+    uint64_t warmup_;
+    const char* block_file_;
+    const char* cache_dir_;
+    const char* aot_emit_;
+    const char* aot_lib_;
+    const char* symbols_file_;
+    SymbolTable* symbols_;
+    char** hooks_;
+    int hook_count_;
+    char** files_;
+    int file_count_;
+} Options;
+
+/*Datei zum Lesen oeffnen und ihre Groesse melden; -1 wenn es sie nicht gibt*/
+static int open_input(const char* filename, const char* what) {
+	int fd = open(filename, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
 			printf("no input\n");
-			exit(EXIT_FAILURE);
+			return -1;
 	}
 	struct stat sb;
-	if (stat(filename, &sb) == -1) {
+	if (fstat(fd, &sb) == -1) {
 			printf("error stat\n");
 			perror("stat");
-		    exit(EXIT_FAILURE);
-	}
-	printf("size of instruction memory: %d Byte\n\n",sb.st_size);
-	instr_mem_size =  sb.st_size;
-	cpu->instr_mem_ = malloc(instr_mem_size);
-	fread(cpu->instr_mem_, sb.st_size, 1, input_file);
-	fclose(input_file);
-	return;
+			close(fd);
+			return -1;
+	}
+	printf("%s: %zu Byte\n\n", what, (size_t)sb.st_size);
+	return fd;
 }
 
-void CPU_load_data_mem(CPU* cpu, const char* filename) {
-	FILE* input_file = fopen(filename, "r");
-	if (!input_file) {
-			printf("no input\n");
-			exit(EXIT_FAILURE);
+/*Neue CPU mit dem Instruktionsspeicher aus filename (image == NULL) oder dem Programm von image*/
+static CPU* load_program(const char* filename, const CPU* image, const Options* opt) {
+	if (image) {
+		return CPU_clone_program(image);
 	}
-	struct stat sb;
-	if (stat(filename, &sb) == -1) {
-			printf("error stat\n");
-			perror("stat");
-		    exit(EXIT_FAILURE);
+	int fd = open_input(filename, "size of instruction memory");
+	if (fd < 0) {
+		return NULL;
 	}
-	printf("read data for data memory: %d Byte\n\n",sb.st_size);
+	CPU* cpu = CPU_create();
+	if (cpu && opt->host_pages_) {
+		static const char* const page_names[] = { "normal pages", "thp", "hugetlb" };
+		int pages = CPU_set_host_pages(cpu, opt->host_pages_);
+		if (pages >= 0 && pages < opt->host_pages_) {
+			fprintf(stderr, "huge pages: %s not available, using %s\n", page_names[opt->host_pages_], page_names[pages]);
+		}
+	}
+	int source = cpu ? CPU_load_program_fd(cpu, fd, opt->cache_dir_) : -1;
+	close(fd);
+	if (source >= 0 && opt->code_in_ram_ && CPU_enable_code_in_ram(cpu) < 0) {
+		printf("program does not fit into data memory\n");
+		source = -1;
+	}
+	if (source < 0) {
+		CPU_destroy(cpu);
+		return NULL;
+	}
+	if (source == PROGRAM_FROM_CACHE) {
+		printf("decoded program loaded from cache\n\n");
+	}
+	else if (source == PROGRAM_CACHED) {
+		printf("decoded program stored in cache\n\n");
+	}
+	return cpu;
+}
 
-    cpu->data_mem_ = malloc(cpu->data_mem_size_);
-	fread(cpu->data_mem_, sb.st_size, 1, input_file);
-	fclose(input_file);
-	return;
+static int load_data(CPU* cpu, const char* filename) {
+	int fd = open_input(filename, "read data for data memory");
+	if (fd < 0) {
+		return -1;
+	}
+	int result = CPU_load_data_fd(cpu, fd);
+	close(fd);
+	return result;
 }
 
+/*CPU fuer Programm und Datenspeicher laden und wie auf der Kommandozeile angegeben einrichten*/
+static CPU* setup_cpu(const char* program, const char* data, const CPU* image, const Options* opt) {
+	CPU* cpu = load_program(program, image, opt);
+	if (!cpu || load_data(cpu, data) < 0) {
+		CPU_destroy(cpu);
+		return NULL;
+	}
+	return cpu;
+}
 
-/**
- * Instruction fetch Instruction decode, Execute, Memory access, Write back
- */
+/*--latency <name>=<cycles>*/
+static int parse_latency(CPU_TimingConfig* config, const char* arg) {
+	static const struct { const char* name_; size_t offset_; } fields[] = {
+		{ "fetch", offsetof(CPU_TimingConfig, fetch_) }, { "load", offsetof(CPU_TimingConfig, load_) },
+		{ "store", offsetof(CPU_TimingConfig, store_) }, { "mmio", offsetof(CPU_TimingConfig, mmio_) },
+		{ "fdiv", offsetof(CPU_TimingConfig, fdiv_) }, { "branch", offsetof(CPU_TimingConfig, branch_) },
+		{ "jump", offsetof(CPU_TimingConfig, jump_) },
+	};
+	const char* eq = strchr(arg, '=');
+	for (size_t i = 0; eq && i < sizeof(fields) / sizeof(fields[0]); i++) {
+		if (strlen(fields[i].name_) == (size_t)(eq - arg) && strncmp(arg, fields[i].name_, eq - arg) == 0) {
+			*(uint32_t*)((char*)config + fields[i].offset_) = (uint32_t)strtoul(eq + 1, NULL, 0);
+			return 0;
+		}
+	}
+	return -1;
+}
 
-/*Vorbereitung (Opcode, Func3, Func7, Registeroperanten und Immediates extrahieren)*/
- uint8_t get_opcode(uint32_t instruction){
-	 uint32_t instructioncode = (instruction & 0x0000007F);
-	 return instructioncode;
- }
-
- uint8_t get_rd(uint32_t instruction) {
-	 uint32_t vorbereitung = (instruction >>7);
-	 uint32_t rd = (vorbereitung & 0x0000001f);
-	 return (uint8_t) rd;
- }
-
- uint8_t get_func3(uint32_t instruction) {
-	 uint32_t vorbereitung = (instruction >>12);
-	 uint32_t func3 = (vorbereitung & 0x00000007);
-	 return (uint8_t) func3;
- }
-
- uint8_t get_rs1(uint32_t instruction) {
-	 uint32_t vorbereitung = (instruction >> 15);
-	 uint32_t rs1 = (vorbereitung & 0x0000001f);
-	 return (uint8_t) rs1;
- }
-
- uint8_t get_rs2(uint32_t instruction) {
-	 uint32_t vorbereitung = (instruction >>20);
-	 uint32_t rs2 = (vorbereitung & 0x0000001f);
-	 return (uint8_t) rs2;
- }
-
- uint8_t get_func7(uint32_t instruction) {
-	 uint32_t vorbereitung = (instruction >>25);
-	 uint32_t func7 = (vorbereitung & 0x0000007f);
-	 return (uint8_t) func7;
- }
-
-
- uint32_t immediateITyp(uint32_t instruction) {
-	 uint32_t immediate = (instruction >> 20);
-	 if (immediate & 0x800) {
-		 immediate = 0xFFFFF000 | immediate;
-	 }
-	 else;
-	 //printf("Immediate I typ %X\n", immediate);
-	 return immediate;
- }
-
- uint8_t shiftimmediate(uint32_t instruction) {
-	 uint32_t immediate = immediateITyp(instruction);
-	 uint8_t shamt = (uint8_t) (immediate & 0x1f);
-	 return shamt;
- }
-
- uint32_t immediateStyp(uint32_t instruction) {
-	 uint32_t vorbereitung1 = (instruction & 0x00000F80); //alle bits auer [4:0] sind 0
-	 uint32_t ersterteil = (vorbereitung1 >> 7); //verschiebung um die richtige Position
-	 uint32_t vorbereitung2 = (instruction & 0xFE000000); //alle bits auer [11:5] sind 0
-	 uint32_t zweiterteil = (vorbereitung2 >> 20); //Verschiebung um die richtige Position >>25 aber danach <<5 d.h >>20
-	 uint32_t immediate = (ersterteil | zweiterteil);
-	
-	 if (immediate & 0x800) {
-		 immediate = 0xFFFFF000 | immediate;
-	 }
-	 else;
-	// printf("Immediate S Typ :  %X\n", immediate);
-	 return immediate;
- }
-
-int32_t immediateBtyp(uint32_t instruction) {
-		 int32_t imm = (0x1E & (uint16_t)(instruction >> 7))
-			 | (0x7E0 & (instruction >> 20))
-			 | (0x800 & (instruction << 4))
-			 | (0x1000 & (instruction >> 19));
-
-		 if (imm & 0x1000) imm = imm | 0xFFFFE000;
-
-		 // printf("Immediate B Typ :  %X\n", immediate);
-		 return imm;
+/*--cache i|d:<size>[k|m]:<ways>:<line>[:lru|plru|random][:wb|wt]*/
+static int parse_cache(CPU_CacheConfig* config, const char* arg) {
+	static const char* const policies[] = { "lru", "plru", "random" };
+	memset(config, 0, sizeof(*config));
+	config->write_back_ = 1;
+	if ((arg[0] != 'i' && arg[0] != 'd') || arg[1] != ':') {
+		return -1;
+	}
+	config->instruction_ = arg[0] == 'i';
+	char* end;
+	unsigned long long size = strtoull(arg + 2, &end, 0);
+	if (*end == 'k' || *end == 'K') size <<= 10, end++;
+	else if (*end == 'm' || *end == 'M') size <<= 20, end++;
+	if (*end != ':' || size > UINT32_MAX) {
+		return -1;
+	}
+	config->size_ = (uint32_t)size;
+	config->ways_ = (uint32_t)strtoul(end + 1, &end, 0);
+	if (*end != ':') {
+		return -1;
+	}
+	config->line_ = (uint32_t)strtoul(end + 1, &end, 0);
+	while (*end == ':') {
+		const char* word = end + 1;
+		end = strchr(word, ':');
+		if (!end) end = (char*)word + strlen(word);
+		size_t len = (size_t)(end - word);
+		int known = 0;
+		for (uint32_t p = 0; p < sizeof(policies) / sizeof(policies[0]); p++) {
+			if (strlen(policies[p]) == len && strncmp(word, policies[p], len) == 0) {
+				config->policy_ = p;
+				known = 1;
+			}
+		}
+		if (len == 2 && (strncmp(word, "wb", 2) == 0 || strncmp(word, "wt", 2) == 0)) {
+			config->write_back_ = word[1] == 'b';
+			known = 1;
+		}
+		if (!known) {
+			return -1;
+		}
+	}
+	return *end ? -1 : 0;
 }
 
- uint32_t immediateUTyp(uint32_t instruction) {
-	 uint32_t immediate = (instruction & 0xFFFFF000);
-	// printf("Immediate U Typ :  %X\n", immediate);
-	 return immediate;
- }
-
- uint32_t immediateJTyp(uint32_t instruction) {
-	 uint32_t vorbereitung1 = (instruction & 0x7FE00000); //alle bits auer [10:1] sind 0
-	 uint32_t vorbereitung2 = (vorbereitung1 >> 20); //verschiebung der [10:1] bits um die richtige Position
-	 uint32_t vorbereitung3 = (instruction & 0x00100000); //alle bits auer [11] sind 0
-	 uint32_t vorbereitung4 = (vorbereitung3 >> 9); //verschiebung des [11] bits um die richtige Position
-	 uint32_t vorbereitung5 = (instruction & 0x000FF000); //alle bits auer [19:12] sind 0
-	 uint32_t vorbereitung6 = (instruction & 0x80000000); //alle bits auer [20] sind 0
-	 uint32_t vorbereitung7 = vorbereitung6 >> 11; //verschiebung um die richtige Position
-	 uint32_t erstesteil = (vorbereitung4 | vorbereitung2); //[11|10:1]
-	 uint32_t immediate = (vorbereitung7 | vorbereitung5 | erstesteil); //[20|19:12|11|10:1]
-
-	 if (immediate & 0x800) {
-		 immediate = 0xFFF00000 | immediate;
-	 }
-	 else;
-	// printf("Immediate J Typ :  %X\n", immediate);
-	 return immediate;
- }
-
- /*Vorbereitung Ende*/
-
- /*Instruktionen*/
- void lui(CPU* cpu, uint32_t instruction) {
-	 cpu->regfile_[get_rd(instruction)] = immediateUTyp(instruction);
-	 cpu->pc_ = (cpu->pc_ + 4);
- }
-
- void auipc(CPU* cpu, uint32_t instruction) {
-	 cpu->regfile_[get_rd(instruction)] = (cpu->pc_ + immediateUTyp(instruction));
-	 cpu->pc_ = (cpu->pc_ + 4);
- }
-
-
- void jal(CPU* cpu, uint32_t instruction) {
-	 cpu->regfile_[get_rd(instruction)] = (cpu->pc_ + 4);
-	 cpu->pc_ = (cpu->pc_ + ((int32_t)immediateJTyp(instruction)));
- }
-
- void jalr(CPU* cpu, uint32_t instruction) {
-	 cpu->regfile_[get_rd(instruction)] = (cpu->pc_ + 4);
-	 cpu->pc_ = (cpu->regfile_[get_rs1(instruction)] + ((int32_t)immediateITyp(instruction)));
- }
-
- void beq(CPU* cpu, uint32_t instruction) {
-	 if (cpu->regfile_[get_rs1(instruction)] == cpu->regfile_[get_rs2(instruction)]) {
-		 cpu->pc_ = (cpu->pc_ + ((int32_t)immediateBtyp(instruction)));
-	 }
-	 else {
-		 cpu->pc_ = (cpu->pc_ + 4);
-	 }
- }
-
- void bne(CPU* cpu, uint32_t instruction) {
-	 if (cpu->regfile_[get_rs1(instruction)] != cpu->regfile_[get_rs2(instruction)]) {
-		 cpu->pc_ = (cpu->pc_ + ((int32_t)immediateBtyp(instruction)));
-	 }
-	 else {
-		 cpu->pc_ = (cpu->pc_ + 4);
-	 }
- }
-
- void blt(CPU* cpu, uint32_t instruction) {
-	 if (cpu->regfile_[get_rs1(instruction)] < cpu->regfile_[get_rs2(instruction)]) {
-		 cpu->pc_ = (cpu->pc_ + ((int32_t)immediateBtyp(instruction)));
-	 }
-	 else {
-		 cpu->pc_ = (cpu->pc_ + 4);
-	 }
- }
-
- void bge(CPU* cpu, uint32_t instruction) {
-	 if ((int32_t)cpu->regfile_[get_rs1(instruction)] >=(int32_t) cpu->regfile_[get_rs2(instruction)]) {
-		 cpu->pc_ = (cpu->pc_ + ((int32_t)immediateBtyp(instruction)));
-	 }
-	 else {
-		 cpu->pc_ = (cpu->pc_ + 4);
-	 }
- }
-
-
- void bltu(CPU* cpu, uint32_t instruction) {
-	 if (cpu->regfile_[get_rs1(instruction)] < cpu->regfile_[get_rs2(instruction)]) {
-		 cpu->pc_ = (cpu->pc_ + ((int32_t)immediateBtyp(instruction)));
-	 }
-	 else {
-		 cpu->pc_ = (cpu->pc_ + 4);
-	 }
- }
-
-
- void bgeu(CPU* cpu, uint32_t instruction) {
-	 if (cpu->regfile_[get_rs1(instruction)] >= cpu->regfile_[get_rs2(instruction)]) {
-		 cpu->pc_ = (cpu->pc_ + ((int32_t)immediateBtyp(instruction)));
-	 }
-	 else {
-		 cpu->pc_ = (cpu->pc_ + 4);
-	 }
- }
-
- void lb(CPU* cpu, uint32_t instruction) {
-	 cpu->regfile_[get_rd(instruction)] = cpu->data_mem_[(cpu->regfile_[get_rs1(instruction)]) + immediateITyp(instruction)];
-
-	 if (cpu->regfile_[get_rd(instruction)] & 0x80) {
-		 cpu->regfile_[get_rd(instruction)] = 0xFFFFFF00 | cpu->regfile_[get_rd(instruction)];
-	 }
-	 else;
-	 cpu->pc_ = (cpu->pc_ + 4);
- }
-
- void lh(CPU* cpu, uint32_t instruction) {
-	 cpu->regfile_[get_rd(instruction)] = (*(uint16_t*)((cpu->regfile_[get_rs1(instruction)]) + immediateITyp(instruction) + (cpu->data_mem_)));
-	 if (cpu->regfile_[get_rd(instruction)] & 0x80) {
-		 cpu->regfile_[get_rd(instruction)] = 0xFFFFFF00 | cpu->regfile_[get_rd(instruction)];
-	 }
-	 else;
-	 cpu->pc_ = (cpu->pc_ + 4);
- }
-
- void lw(CPU* cpu, uint32_t instruction) {
-	 cpu->regfile_[get_rd(instruction)] = (*(uint32_t*)((cpu->regfile_[get_rs1(instruction)]) + immediateITyp(instruction) + (cpu->data_mem_)));
-	 cpu->pc_ = (cpu->pc_ + 4);
- }
-
- void lbu(CPU* cpu, uint32_t instruction) {
-	 cpu->regfile_[get_rd(instruction)] = (cpu->data_mem_[(cpu->regfile_[get_rs1(instruction)] + immediateITyp(instruction))]);
-	 cpu->pc_ = (cpu->pc_ + 4);
- }
-
- void lhu(CPU* cpu, uint32_t instruction) {
-	 cpu->regfile_[get_rd(instruction)] = (*(uint16_t*)(cpu->regfile_[get_rs1(instruction)] + immediateITyp(instruction) + cpu->data_mem_));
-	 cpu->pc_ = (cpu->pc_ + 4);
- }
-
- void sb(CPU* cpu, uint32_t instruction) {
-	 if (cpu->regfile_[get_rs1(instruction)] + (immediateStyp(instruction)) == 0x5000) {
-		 putchar(cpu->regfile_[get_rs2(instruction)]);
-
-	 }
-	 else {
-		 cpu->data_mem_[cpu->regfile_[get_rs1(instruction)] + ((int32_t)(immediateStyp(instruction)))] = ((uint8_t)(cpu->regfile_[get_rs2(instruction)]));
-	 }
-	 cpu->pc_ = (cpu->pc_ + 4);
-
- }
-
- void sh(CPU* cpu, uint32_t instruction) {
-	 (*(uint16_t*)(cpu->data_mem_ + cpu->regfile_[get_rs1(instruction)] + immediateStyp(instruction))) = ((uint16_t)(cpu->regfile_[get_rs2(instruction)]));
-	 cpu->pc_ = (cpu->pc_ + 4);
- }
-
- void sw(CPU* cpu, uint32_t instruction) {
-	 *(uint32_t*)(cpu->data_mem_ + cpu->regfile_[get_rs1(instruction)] + (int32_t)immediateStyp(instruction)) = ((uint32_t)(cpu->regfile_[get_rs2(instruction)]));
-	 cpu->pc_ = (cpu->pc_ + 4);
- }
-
- void addi(CPU* cpu, uint32_t instruction) {
-	 cpu->regfile_[get_rd(instruction)] = (cpu->regfile_[get_rs1(instruction)] + immediateITyp(instruction));
-	 cpu->pc_ = (cpu->pc_ + 4);
- }
-
- void slti(CPU* cpu, uint32_t instruction) {
-	 cpu->regfile_[get_rd(instruction)] = (cpu->regfile_[get_rs1(instruction)] < immediateITyp(instruction));
-	 cpu->pc_ = (cpu->pc_ + 4);
- }
-
-
- void sltiu(CPU* cpu, uint32_t instruction) {
-	 cpu->regfile_[get_rd(instruction)] = (cpu->regfile_[get_rs1(instruction)] < immediateITyp(instruction));
-	 cpu->pc_ = (cpu->pc_ + 4);
- }
-
- void xori(CPU* cpu, uint32_t instruction) {
-	 cpu->regfile_[get_rd(instruction)] = (cpu->regfile_[get_rs1(instruction)] ^ immediateITyp(instruction));
-	 cpu->pc_ = (cpu->pc_ + 4);
- }
-
- void ori(CPU* cpu, uint32_t instruction) {
-	 cpu->regfile_[get_rd(instruction)] = (cpu->regfile_[get_rs1(instruction)] | immediateITyp(instruction));
-	 cpu->pc_ = (cpu->pc_ + 4);
- }
-
- void andi(CPU* cpu, uint32_t instruction) {
-	 cpu->regfile_[get_rd(instruction)] = (cpu->regfile_[get_rs1(instruction)] & immediateITyp(instruction));
-	 cpu->pc_ = (cpu->pc_ + 4);
- }
-
- void slli(CPU* cpu, uint32_t instruction) {
-	 cpu->regfile_[get_rd(instruction)] = (cpu->regfile_[get_rs1(instruction)] << shiftimmediate(instruction));
-	 cpu->pc_ = (cpu->pc_ + 4);
- }
-
- void srli(CPU* cpu, uint32_t instruction) {
-	 cpu->regfile_[get_rd(instruction)] = (cpu->regfile_[get_rs1(instruction)] >> shiftimmediate(instruction));
-	 cpu->pc_ = (cpu->pc_ + 4);
- }
-
-
- void srai(CPU* cpu, uint32_t instruction) {
-	 cpu->regfile_[get_rd(instruction)] = (int8_t)(cpu->regfile_[get_rs1(instruction)] >> (int8_t)shiftimmediate(instruction));
-	 cpu->pc_ = (cpu->pc_ + 4);
- }
-
- void add(CPU* cpu, uint32_t instruction) {
-	 cpu->regfile_[get_rd(instruction)] = ((cpu->regfile_[get_rs1(instruction)]) + (cpu->regfile_[get_rs2(instruction)]));
-	 cpu->pc_ = (cpu->pc_ + 4);
- }
-
- void sub(CPU* cpu, uint32_t instruction) {
-	 cpu->regfile_[get_rd(instruction)] = ((cpu->regfile_[get_rs1(instruction)]) - (cpu->regfile_[get_rs2(instruction)]));
-	 cpu->pc_ = (cpu->pc_ + 4);
- }
-
- void sll(CPU* cpu, uint32_t instruction) {
-	 cpu->regfile_[get_rd(instruction)] = ((cpu->regfile_[get_rs1(instruction)]) << (cpu->regfile_[get_rs2(instruction)]));
-	 cpu->pc_ = (cpu->pc_ + 4);
- }
-
- void slt(CPU* cpu, uint32_t instruction) {
-	 cpu->regfile_[get_rd(instruction)] = ((int32_t)(cpu->regfile_[get_rs1(instruction)]) < ((int32_t)(cpu->regfile_[get_rs2(instruction)])));
-	 cpu->pc_ = (cpu->pc_ + 4);
- }
-
- void sltu(CPU* cpu, uint32_t instruction) {
-	 cpu->regfile_[get_rd(instruction)] = ((cpu->regfile_[get_rs1(instruction)]) < (cpu->regfile_[get_rs2(instruction)]));
-	 cpu->pc_ = (cpu->pc_ + 4);
- }
-
-
- void xorOperation(CPU* cpu, uint32_t instruction) {
-	 cpu->regfile_[get_rd(instruction)] = ((cpu->regfile_[get_rs1(instruction)]) ^ (cpu->regfile_[get_rs2(instruction)]));
-	 cpu->pc_ = (cpu->pc_ + 4);
- }
-
- void srl(CPU* cpu, uint32_t instruction) {
-	 cpu->regfile_[get_rd(instruction)] = ((cpu->regfile_[get_rs1(instruction)]) >> (cpu->regfile_[get_rs2(instruction)]));
-	 cpu->pc_ = (cpu->pc_ + 4);
- }
-
- void sra(CPU* cpu, uint32_t instruction) {
-	 cpu->regfile_[get_rd(instruction)] = ((int32_t)(cpu->regfile_[get_rs1(instruction)]) >> (cpu->regfile_[get_rs2(instruction)]));
-	 cpu->pc_ = (cpu->pc_ + 4);
- }
-
- void orOperation(CPU* cpu, uint32_t instruction) {
-	 cpu->regfile_[get_rd(instruction)] = ((cpu->regfile_[get_rs1(instruction)]) | (cpu->regfile_[get_rs2(instruction)]));
-	 cpu->pc_ = (cpu->pc_ + 4);
- }
-
- void andOparation(CPU* cpu, uint32_t instruction) {
-	 cpu->regfile_[get_rd(instruction)] = ((cpu->regfile_[get_rs1(instruction)]) & (cpu->regfile_[get_rs2(instruction)]));
-	 cpu->pc_ = (cpu->pc_ + 4);
- }
- 
- /*Ende Instruktionen*/
-
-void CPU_execute(CPU* cpu) {
-
-	uint32_t instruction = *(uint32_t*)(cpu->instr_mem_ + (cpu->pc_  & 0xFFFFF)); //line given by professor
-
-	uint32_t opcode = get_opcode(instruction);
-	uint32_t function3 = get_func3(instruction);
-	uint32_t function7 = get_func7(instruction);
-
-	switch (opcode)
-	{
-	case LUI: //binary: 0110111
-	//	printf("LUI Operation\n");
-		lui(cpu, instruction);
-		break;
-	case AUIPC: //binary: 0010111
-		//printf("AUIPC Operation\n");
-		auipc(cpu, instruction);
-		break;
-	case JAL: //binary: 1101111
-		//printf("JAL Opeartion\n");
-		jal(cpu, instruction);
-		break;
-	case JALR: // binary: 1100111
-	//	printf("JALR Operation\n");
-		jalr(cpu, instruction);
-		break;
-	case B: //binary: 1100011 
-		switch (function3) {
-		case 0x0: //BEQ
-			//printf("BEQ Operation\n");
-			beq(cpu, instruction);
-			break;
-		case 0x1: //BNE
-			//printf("BNE Operation\n");
-			bne(cpu, instruction);
-			break;
-		case 0x4: //BLT
-			//printf("BLT Operation\n");
-			blt(cpu, instruction);
-			break;
-		case 0x5://BGE
-			//printf("BGE Operation\n");
-			bge(cpu, instruction);
-			break;
-		case 0x6://BLTU
-			//printf("BLTU Operation\n");
-			bltu(cpu, instruction);
-			break;
-		case 0x7://BGEU
-			//printf("BGEU Operation\n");
-			bgeu(cpu, instruction);
-			break;
+/*--cache-sample <period>:<length>[:<warmup>]*/
+static int parse_cache_sample(uint64_t sample[3], const char* arg) {
+	char* end;
+	sample[0] = strtoull(arg, &end, 0);
+	if (*end != ':') {
+		return -1;
+	}
+	sample[1] = strtoull(end + 1, &end, 0);
+	sample[2] = 0;
+	if (*end == ':') {
+		sample[2] = strtoull(end + 1, &end, 0);
+	}
+	return *end ? -1 : 0;
+}
+
+/*--predictor bimodal|gshare|tage[:<bits>[:<history>]]*/
+static int parse_predictor(CPU_PredictorConfig* config, const char* arg) {
+	static const char* const kinds[] = { "bimodal", "gshare", "tage" };
+	const char* colon = strchr(arg, ':');
+	size_t len = colon ? (size_t)(colon - arg) : strlen(arg);
+	uint32_t kind = 0;
+	while (kind < 3 && (strlen(kinds[kind]) != len || strncmp(arg, kinds[kind], len) != 0)) {
+		kind++;
+	}
+	if (kind == 3) {
+		return -1;
+	}
+	CPU_predictor_defaults(config, kind);
+	char* end = (char*)arg + len;
+	if (*end == ':') {
+		config->bits_ = (uint32_t)strtoul(end + 1, &end, 0);
+	}
+	if (*end == ':') {
+		config->history_ = (uint32_t)strtoul(end + 1, &end, 0);
+	}
+	return *end ? -1 : 0;
+}
+
+/*Modelle (--timing, --cache, --predictor); ctx = Options, auch fuer die Sample-CPUs von --simpoints*/
+static int configure_models(CPU* cpu, void* ctx) {
+	const Options* opt = ctx;
+	if (opt->timing_ && CPU_enable_timing(cpu, &opt->latency_) < 0) {
+		return -1;
+	}
+	for (int i = 0; i < opt->cache_count_; i++) {
+		if (CPU_add_cache(cpu, &opt->caches_[i]) < 0) {
+			printf("invalid cache configuration\n");
+			return -1;
 		}
-		break;
-	case L: //binary 0000011
-		switch (function3) {
-		case 0x0: //LB
-			//printf("LB Operation\n");
-			lb(cpu, instruction);
-			break;
-		case 0x1: //LH
-			//printf("LH Operation\n");
-			lh(cpu, instruction);
-			break;
-		case 0x2: //LW 
-			//printf("LW Operation\n");
-			lw(cpu,instruction);
-			break;
-		case 0x4: //LBU
-			//printf("LBU Operation\n");
-			lbu(cpu, instruction);
-			break;
-		case 0x5: //LHU
-			//printf("LHU Operation\n");
-			lhu(cpu, instruction);
-			break;
+	}
+	for (int i = 0; i < opt->predictor_count_; i++) {
+		CPU_PredictorConfig config = opt->predictors_[i];
+		if (opt->btb_bits_ >= 0) config.btb_bits_ = (uint32_t)opt->btb_bits_;
+		if (opt->ras_ >= 0) config.ras_ = (uint32_t)opt->ras_;
+		if (CPU_add_predictor(cpu, &config) < 0) {
+			printf("invalid predictor configuration\n");
+			return -1;
 		}
-		break;
-	case S: //bianry: 0100011
-		switch (function3)
-		{
-		case 0x0: //SB
-			//printf("SB Operation\n");
-			sb(cpu, instruction);
-			break;
-		case 0x1: //SH
-			//printf("SH Operation\n");
-			sh(cpu, instruction);
-			break;
-		case 0x2: //SW
-			//printf("SW Operation\n");
-			sw(cpu, instruction);
-			break;
+	}
+	if (opt->cache_count_ && CPU_set_cache_sampling(cpu, opt->cache_sample_[0], opt->cache_sample_[1], opt->cache_sample_[2]) < 0) {
+		printf("invalid cache sampling\n");
+		return -1;
+	}
+	return 0;
+}
+
+static int add_hooks(CPU* cpu, const Options* opt) {
+	for (int i = 0; i < opt->hook_count_; i++) {
+		if (CPU_add_hook(cpu, opt->hooks_[i]) < 0) {
+			return -1;
 		}
-		break;
-	case I: //binary 0010011
-		switch (function3)
-		{
-		case 0x0: //ADDI
-			//printf("ADDI Operation\n");
-			addi(cpu, instruction);
-			break;
-		case 0x2: //SLTI
-			//printf("SLTI Operation\n");
-			slti(cpu, instruction);
-			break;
-		case 0x3: //SLTIU
-			//printf("SLTIU Operation\n");
-			sltiu(cpu, instruction);
-			break;
-		case 0x4: // XORI 
-			//printf("XORI Operation\n");
-			xori(cpu, instruction);
-			break;
-		case 0x6: //ORI
-			//printf("ORI Operation\n");
-			ori(cpu, instruction);
-			break;
-		case 0x7: //ANDI
-			//printf("ANDI Operation\n");
-			andi(cpu, instruction);
-			break;
-		case 0x1: //SLLI
-			//printf("SLLI Operation\n");
-			slli(cpu, instruction);
+	}
+	return 0;
+}
+
+/*Gemeinsame Einrichtung aller Kommandozeilen-CPUs; mit --simpoints spult diese CPU nur vor und bekommt keine Modelle*/
+static int configure_cpu(CPU* cpu, const Options* opt) {
+	CPU_set_spin_skip(cpu, !opt->no_spin_skip_);
+	CPU_set_misaligned_trap(cpu, opt->misaligned_trap_);
+	if (opt->block_file_ && CPU_attach_block_device(cpu, opt->block_file_) < 0) {
+		return -1;
+	}
+	if (opt->aot_lib_ && CPU_aot_load(cpu, opt->aot_lib_) < 0) {
+		return -1;
+	}
+	CPU_set_symbols(cpu, opt->symbols_);
+	if (!opt->simpoints_file_ && configure_models(cpu, (void*)opt) < 0) {
+		return -1;
+	}
+	return add_hooks(cpu, opt);
+}
+
+/*Einrichtung einer Sample-CPU von --simpoints*/
+static int configure_sample(CPU* cpu, void* ctx) {
+	const Options* opt = ctx;
+	CPU_set_symbols(cpu, opt->symbols_);
+	if (configure_models(cpu, ctx) < 0) {
+		return -1;
+	}
+	return add_hooks(cpu, opt);
+}
+
+/*SimPoint-Ausgabe: Zeilen "<interval> <cluster>" und "<weight> <cluster>"; Rueckgabe Zahl der Punkte, -1 bei Fehlern*/
+static long read_simpoints(const char* simpoints_file, const char* weights_file, CPU_SamplePoint** points) {
+	FILE* sp = fopen(simpoints_file, "r");
+	FILE* wf = weights_file ? fopen(weights_file, "r") : NULL;
+	long count = 0;
+	*points = NULL;
+	unsigned long long interval;
+	size_t cluster;
+	while (sp && wf && count >= 0 && fscanf(sp, "%llu %zu", &interval, &cluster) == 2) {
+		double weight, w;
+		size_t id;
+		int found = 0;
+		rewind(wf);
+		while (!found && fscanf(wf, "%lf %zu", &w, &id) == 2) {
+			if (id == cluster) {
+				weight = w;
+				found = 1;
+			}
+		}
+		CPU_SamplePoint* grown = realloc(*points, (size_t)(count + 1) * sizeof(CPU_SamplePoint));
+		if (!found || !grown) {
+			count = -1;
 			break;
-		case 0x5:
-			/*TODO*/
-			if ((immediateITyp(instruction)&0xFF0) == 0x000) { //SLRI
-				//printf("Operation SRLI\n");
-				srli(cpu, instruction);
+		}
+		*points = grown;
+		(*points)[count].interval_ = interval;
+		(*points)[count].weight_ = weight;
+		count++;
+	}
+	if (!sp || !wf) {
+		count = -1;
+	}
+	if (sp) fclose(sp);
+	if (wf) fclose(wf);
+	return count;
+}
+
+/*hu_risc-v_emu --simpoints <file> --weights <file> [--warmup <n>] [Modelle] instruction_mem.bin data_mem.bin*/
+static int sampled_main(CPU* cpu, const Options* opt) {
+	CPU_SamplePoint* points;
+	long count = read_simpoints(opt->simpoints_file_, opt->weights_file_, &points);
+	if (count <= 0) {
+		printf("no simulation points in %s / %s\n", opt->simpoints_file_, opt->weights_file_ ? opt->weights_file_ : "-");
+		free(points);
+		return EXIT_FAILURE;
+	}
+	CPU_Sampling sampling = {
+		opt->bbv_interval_, opt->warmup_, opt->workers_ > 0 ? (size_t)opt->workers_ : 4, configure_sample, (void*)opt
+	};
+	CPU** samples = calloc((size_t)count, sizeof(CPU*));
+	if (!samples || CPU_run_sampled(cpu, points, (size_t)count, &sampling, samples) < 0) {
+		printf("sampled simulation failed\n");
+		free(samples);
+		free(points);
+		return EXIT_FAILURE;
+	}
+	CPU_print_sampled(samples, points, (size_t)count, &sampling);
+	fflush(stdout);
+	for (long i = 0; i < count; i++) {
+		CPU_destroy(samples[i]);
+	}
+	free(samples);
+	free(points);
+	return 0;
+}
+
+/*Maschinen in umgekehrter Reihenfolge freigeben: die ersten teilen ihr Programm bzw. ihren Speicher mit den spaeteren*/
+static void destroy_cpus(CPU** cpus, size_t count) {
+	for (size_t i = count; i-- > 0;) {
+		CPU_destroy(cpus[i]);
+	}
+}
+
+/*hu_risc-v_emu --lockstep instruction_mem.bin data_mem1.bin [data_mem2.bin ...]*/
+int lockstep_main(const Options* opt) {
+	int argc = opt->file_count_;
+	char** argv = opt->files_;
+	if (argc < 2) {
+		printf("usage: --lockstep <instruction_mem.bin> <data_mem.bin>...\n");
+		return EXIT_FAILURE;
+	}
+	size_t lane_count = (size_t)argc - 1;
+	CPU** lanes = malloc(lane_count * sizeof(CPU*));
+	if (!lanes) {
+		printf("out of memory\n");
+		return EXIT_FAILURE;
+	}
+	for (size_t i = 0; i < lane_count; i++) {
+		lanes[i] = setup_cpu(argv[0], argv[i + 1], i ? lanes[0] : NULL, opt);
+		if (!lanes[i]) {
+			destroy_cpus(lanes, i);
+			free(lanes);
+			return EXIT_FAILURE;
+		}
+	}
+	for (size_t i = 0; i < lane_count; i++) {
+		if (configure_cpu(lanes[i], opt) < 0) {
+			destroy_cpus(lanes, lane_count);
+			free(lanes);
+			return EXIT_FAILURE;
+		}
+	}
+
+	CPU_run_lockstep(lanes, lane_count, (const char* const*)argv + 1, opt->budget_);
+	fflush(stdout);
+	destroy_cpus(lanes, lane_count);
+	free(lanes);
+	return 0;
+}
+
+static void usage(void) {
+	printf("usage: hu_risc-v_emu [options] <instruction_mem.bin> <data_mem.bin>\n"
+			"       hu_risc-v_emu --lockstep [options] <instruction_mem.bin> <data_mem.bin>...\n"
+			"       hu_risc-v_emu --harts <n> [options] <instruction_mem.bin> <data_mem.bin>\n"
+			"       hu_risc-v_emu --schedule [--workers <n>] [--quantum <n>] [--seed <n>] [options] <instruction_mem.bin> <data_mem.bin>...\n"
+			"       hu_risc-v_emu --serve <socket> [--workers <n>] [--cache-dir <dir>] [--no-spin-skip]\n"
+			"options:\n"
+			"  --budget <n>         run at most <n> instructions (%d, per guest or hart)\n"
+			"  --block <file>       attach <file> as block device at 0x%X\n"
+			"  --cache-dir <dir>    keep decoded programs in <dir>, keyed by image hash\n"
+			"  --aot-emit <file.c>  translate the instruction memory to C and exit\n"
+			"  --aot <file.so>      run with the translated and compiled instruction memory\n"
+			"  --no-spin-skip       execute idle loops instead of skipping to the next event\n"
+			"  --misaligned emulate|trap\n"
+			"                       misaligned loads/stores: carry out (default) or raise an address-misaligned\n"
+			"                       exception (halts the guest without trap handler)\n"
+			"  --code-in-ram        copy the program to data address 0 and fetch from the first MiB of RAM:\n"
+			"                       stores change the running code (self-modifying code, loaders, JITs)\n"
+			"  --huge-pages thp|hugetlb\n"
+			"                       back guest RAM and large decoded programs with 2 MiB host pages\n"
+			"                       (transparent or reserved), falls back to normal pages\n"
+			"  --symbols <file>     guest symbols from an ELF file or a map file (nm, ld --Map)\n"
+			"  --hook <symbol>      run <symbol> natively (__udivsi3, _putchar, _ntoa_long, ..., all)\n"
+			"  --timing             5-stage pipeline timing model, reports CPI, stalls and stage occupancy\n"
+			"  --latency <name>=<n> timing model latency in cycles: fetch, load, store, mmio, fdiv (1),\n"
+			"                       cycles lost by a taken branch or jalr (branch, 2) and by jal (jump, 1)\n"
+			"  --cache i|d:<size>[k|m]:<ways>:<line>[:lru|plru|random][:wb|wt]\n"
+			"                       simulate an L1 instruction or data cache (repeatable, up to %d),\n"
+			"                       reports hits, misses, writebacks and the functions with most misses\n"
+			"  --cache-sample <period>:<length>[:<warmup>]\n"
+			"                       count <length> of every <period> instructions after <warmup> warm-up\n"
+			"  --predictor bimodal|gshare|tage[:<bits>[:<history>]]\n"
+			"                       branch predictor with 2^<bits> entries (12) and <history> global history\n"
+			"                       bits (gshare 12, tage 32); repeatable, up to %d, reports mispredictions\n"
+			"                       overall and for the branches with most mispredictions\n"
+			"  --btb <bits>         BTB of 2^<bits> entries for jal/jalr (9, 0 = none)\n"
+			"  --ras <n>            return address stack depth (16, 0 = none)\n"
+			"  --bbv <file>         write SimPoint basic block vectors to <file> (single run, not with --aot)\n"
+			"  --bbv-interval <n>   instructions per basic block vector (%d), also per --simpoints interval\n"
+			"  --simpoints <file> --weights <file> [--warmup <n>] [--workers <n>]\n"
+			"                       run only the SimPoint intervals: fast-forward to each, checkpoint, and\n"
+			"                       measure them in parallel with the models after <n> warm-up instructions\n",
+			CPU_STEP_BUDGET, BLOCK_BASE, CLI_MAX_CACHES, CLI_MAX_PREDICTORS, BBV_INTERVAL);
+}
+
+/*hu_risc-v_emu --harts N instruction_mem.bin data_mem.bin: N Harts auf einem Datenspeicher, alle starten bei 0*/
+int smp_main(const Options* opt) {
+	if (opt->file_count_ != 2 || opt->harts_ < 1 || opt->harts_ > SMP_MAX_HARTS) {
+		usage();
+		return EXIT_FAILURE;
+	}
+	size_t count = (size_t)opt->harts_;
+	CPU* harts[SMP_MAX_HARTS];
+	harts[0] = setup_cpu(opt->files_[0], opt->files_[1], NULL, opt);
+	if (!harts[0]) {
+		return EXIT_FAILURE;
+	}
+	size_t created = 1;
+	while (created < count && (harts[created] = CPU_create_hart(harts[0], (uint32_t)created))) {
+		created++;
+	}
+	if (created < count) {
+		printf("cannot create hart %zu\n", created);
+		destroy_cpus(harts, created);
+		return EXIT_FAILURE;
+	}
+	for (size_t i = 0; i < count; i++) {
+		if (configure_cpu(harts[i], opt) < 0) {
+			destroy_cpus(harts, count);
+			return EXIT_FAILURE;
+		}
+	}
+	CPU_run_smp(harts, count, opt->budget_);
+	int exit_code = 0;
+	for (size_t i = 0; i < count; i++) {
+		printf("\nhart %zu:", i);
+		CPU_print_regfile(harts[i]);
+		CPU_print_timing(harts[i]);
+		CPU_print_caches(harts[i], CLI_TOP_FUNCTIONS);
+		CPU_print_predictors(harts[i], CLI_TOP_BRANCHES);
+		if (CPU_halt_reason(harts[i]) == HALT_EXIT && exit_code == 0) {
+			exit_code = CPU_exit_code(harts[i]);
+		}
+	}
+	CPU_print_hooks(harts[0]);
+	fflush(stdout);
+	destroy_cpus(harts, count);
+	return exit_code;
+}
+
+/*hu_risc-v_emu --schedule [--workers n] [--quantum n] [--seed n] instruction_mem.bin data_mem.bin...*/
+int sched_main(const Options* opt) {
+	if (opt->file_count_ < 2 || opt->workers_ > SCHED_MAX_WORKERS) {
+		usage();
+		return EXIT_FAILURE;
+	}
+	size_t count = (size_t)opt->file_count_ - 1;
+	const char* const* names = (const char* const*)opt->files_ + 1;
+	CPU** guests = malloc(count * sizeof(CPU*));
+	if (!guests) {
+		printf("out of memory\n");
+		return EXIT_FAILURE;
+	}
+	for (size_t g = 0; g < count; g++) {
+		guests[g] = setup_cpu(opt->files_[0], names[g], g ? guests[0] : NULL, opt);
+		if (!guests[g]) {
+			destroy_cpus(guests, g);
+			free(guests);
+			return EXIT_FAILURE;
+		}
+	}
+	for (size_t g = 0; g < count; g++) {
+		if (configure_cpu(guests[g], opt) < 0) {
+			destroy_cpus(guests, count);
+			free(guests);
+			return EXIT_FAILURE;
+		}
+	}
+	CPU_Schedule schedule = {
+		opt->workers_ ? (size_t)opt->workers_ : 4, opt->quantum_ ? opt->quantum_ : 10000, opt->seed_, opt->budget_, NULL
+	};
+	uint64_t rounds = CPU_run_scheduled(guests, count, &schedule);
+
+	for (size_t g = 0; g < count; g++) {
+		printf("\n======================= guest %zu: %s =======================", g, names[g]);
+		CPU_print_regfile(guests[g]);
+		CPU_print_timing(guests[g]);
+		CPU_print_caches(guests[g], CLI_TOP_FUNCTIONS);
+		CPU_print_predictors(guests[g], CLI_TOP_BRANCHES);
+	}
+	printf("\nscheduler: %zu guests, %zu workers, quantum %llu, seed %llu, %llu rounds\n", count, schedule.workers_,
+			(unsigned long long)schedule.quantum_, (unsigned long long)schedule.seed_, (unsigned long long)rounds);
+	fflush(stdout);
+	destroy_cpus(guests, count);
+	free(guests);
+	return 0;
+}
+
+/*Kommandozeile nach opt; -1 bei einer ungueltigen Option (usage() ist dann schon ausgegeben)*/
+static int parse_options(int argc, char* argv[], Options* opt) {
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--lockstep") == 0) {
+			opt->lockstep_ = 1;
+		}
+		else if (strcmp(argv[i], "--schedule") == 0) {
+			opt->schedule_ = 1;
+		}
+		else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+			opt->workers_ = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--quantum") == 0 && i + 1 < argc) {
+			opt->quantum_ = strtoull(argv[++i], NULL, 0);
+		}
+		else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+			opt->seed_ = strtoull(argv[++i], NULL, 0);
+		}
+		else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+			opt->serve_ = argv[++i];
+		}
+		else if (strcmp(argv[i], "--harts") == 0 && i + 1 < argc) {
+			opt->harts_ = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--timing") == 0) {
+			opt->timing_ = 1;
+		}
+		else if (strcmp(argv[i], "--latency") == 0 && i + 1 < argc) {
+			opt->timing_ = 1;
+			if (parse_latency(&opt->latency_, argv[++i]) < 0) {
+				usage();
+				return -1;
 			}
-			else {
-				//printf("Operation SRAI\n");
-				srai(cpu, instruction);
+		}
+		else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc) {
+			if (opt->cache_count_ == CLI_MAX_CACHES || parse_cache(&opt->caches_[opt->cache_count_++], argv[++i]) < 0) {
+				usage();
+				return -1;
 			}
-			break;
 		}
-		break;
-	case R: //binary: 0110011
-		switch (function3)
-		{
-		case 0x0:
-			if (function7 == 0x00) { //ADD 
-				//printf("ADD Operation\n");
-				add(cpu, instruction);
+		else if (strcmp(argv[i], "--cache-sample") == 0 && i + 1 < argc) {
+			if (parse_cache_sample(opt->cache_sample_, argv[++i]) < 0) {
+				usage();
+				return -1;
 			}
-			else if (function7 == 0x20) { //SUB
-				//printf("SUB Operation\n");
-				sub(cpu, instruction);
+		}
+		else if (strcmp(argv[i], "--predictor") == 0 && i + 1 < argc) {
+			if (opt->predictor_count_ == CLI_MAX_PREDICTORS || parse_predictor(&opt->predictors_[opt->predictor_count_++], argv[++i]) < 0) {
+				usage();
+				return -1;
 			}
-			else;
-			break;
-		case 0x1: //SLL
-			//printf("SLL Operation\n");
-			sll(cpu, instruction);
-			break;
-		case 0x2: //SLT
-			//printf("SLT Operation\n");
-			slt(cpu, instruction);
-			break;
-		case 0x3: //SLTU
-			//printf("SLTU Operation\n");
-			sltu(cpu, instruction);
-			break;
-		case 0x4: //XOR
-			//printf("XOR Operation\n");
-			xorOperation(cpu, instruction);
-			break;
-		case 0x5:
-			if (function7 == 0x00) { //SRL
-				//printf("SRL Operation\n");
-				srl(cpu, instruction);
+		}
+		else if (strcmp(argv[i], "--btb") == 0 && i + 1 < argc) {
+			opt->btb_bits_ = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--ras") == 0 && i + 1 < argc) {
+			opt->ras_ = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--budget") == 0 && i + 1 < argc) {
+			opt->budget_ = strtoull(argv[++i], NULL, 0);
+		}
+		else if (strcmp(argv[i], "--bbv") == 0 && i + 1 < argc) {
+			opt->bbv_file_ = argv[++i];
+		}
+		else if (strcmp(argv[i], "--bbv-interval") == 0 && i + 1 < argc) {
+			opt->bbv_interval_ = strtoull(argv[++i], NULL, 0);
+		}
+		else if (strcmp(argv[i], "--simpoints") == 0 && i + 1 < argc) {
+			opt->simpoints_file_ = argv[++i];
+		}
+		else if (strcmp(argv[i], "--weights") == 0 && i + 1 < argc) {
+			opt->weights_file_ = argv[++i];
+		}
+		else if (strcmp(argv[i], "--warmup") == 0 && i + 1 < argc) {
+			opt->warmup_ = strtoull(argv[++i], NULL, 0);
+		}
+		else if (strcmp(argv[i], "--no-spin-skip") == 0) {
+			opt->no_spin_skip_ = 1;
+		}
+		else if (strcmp(argv[i], "--misaligned") == 0 && i + 1 < argc) {
+			i++;
+			if (strcmp(argv[i], "trap") != 0 && strcmp(argv[i], "emulate") != 0) {
+				usage();
+				return -1;
 			}
-			else if (function7 == 0x20) { // SRA
-				//printf("SRA Operation\n");
-				sra(cpu, instruction);
+			opt->misaligned_trap_ = strcmp(argv[i], "trap") == 0;
+		}
+		else if (strcmp(argv[i], "--code-in-ram") == 0) {
+			opt->code_in_ram_ = 1;
+		}
+		else if (strcmp(argv[i], "--huge-pages") == 0 && i + 1 < argc) {
+			i++;
+			opt->host_pages_ = strcmp(argv[i], "hugetlb") == 0 ? HOST_PAGES_HUGETLB
+				: strcmp(argv[i], "thp") == 0 ? HOST_PAGES_TRANSPARENT : -1;
+			if (opt->host_pages_ < 0) {
+				usage();
+				return -1;
 			}
-			else;
-			break;
-		case 0x6: //OR
-		//	printf("OR Operation\n");
-			orOperation(cpu, instruction);
-			break;
-		case 0x7: //AND
-		//	printf("AND Operation\n");
-			andOparation(cpu, instruction);
-			break;
 		}
-		break;
-
+		else if (strcmp(argv[i], "--block") == 0 && i + 1 < argc) {
+			opt->block_file_ = argv[++i];
+		}
+		else if (strcmp(argv[i], "--cache-dir") == 0 && i + 1 < argc) {
+			opt->cache_dir_ = argv[++i];
+		}
+		else if (strcmp(argv[i], "--aot-emit") == 0 && i + 1 < argc) {
+			opt->aot_emit_ = argv[++i];
+		}
+		else if (strcmp(argv[i], "--aot") == 0 && i + 1 < argc) {
+			opt->aot_lib_ = argv[++i];
+		}
+		else if (strcmp(argv[i], "--symbols") == 0 && i + 1 < argc) {
+			opt->symbols_file_ = argv[++i];
+		}
+		else if (strcmp(argv[i], "--hook") == 0 && i + 1 < argc) {
+			opt->hooks_[opt->hook_count_++] = argv[++i];
+		}
+		else if (strncmp(argv[i], "--", 2) == 0) {
+			usage();
+			return -1;
+		}
+		else {
+			opt->files_[opt->file_count_++] = argv[i];
+		}
 	}
-	cpu->regfile_[0] = 0;
-	/*ends here*/
-	// TODO
-
+	return 0;
 }
 
-int main(int argc, char* argv[]) {
-	printf("C Praktikum\nHU Risc-V  Emulator 2022\n");
+/*Alles nach dem Einlesen der Optionen: Server, Mehrmaschinenlaeufe oder eine einzelne CPU*/
+static int run_main(Options* opt) {
+	if (opt->symbols_file_ && !(opt->symbols_ = symbols_load(opt->symbols_file_))) {
+		return EXIT_FAILURE;
+	}
+	if (opt->serve_) {
+		ServerOptions server = { opt->serve_, opt->workers_ > 0 ? (size_t)opt->workers_ : 4, opt->cache_dir_, !opt->no_spin_skip_ };
+		return server_main(&server);
+	}
+	if (opt->lockstep_) {
+		return lockstep_main(opt);
+	}
+	if (opt->harts_) {
+		return smp_main(opt);
+	}
+	if (opt->schedule_) {
+		return sched_main(opt);
+	}
+	if (opt->file_count_ != 2) {
+		usage();
+		return EXIT_FAILURE;
+	}
 
 	CPU* cpu_inst;
 
-	cpu_inst = CPU_init(argv[1], argv[2]);
+	cpu_inst = setup_cpu(opt->files_[0], opt->files_[1], NULL, opt);
+	if (!cpu_inst) {
+		return EXIT_FAILURE;
+	}
+	if (opt->aot_emit_) {
+		int result = CPU_aot_emit(cpu_inst, opt->aot_emit_) == 0 ? 0 : EXIT_FAILURE;
+		CPU_destroy(cpu_inst);
+		return result;
+	}
+	if (configure_cpu(cpu_inst, opt) < 0) {
+		CPU_destroy(cpu_inst);
+		return EXIT_FAILURE;
+	}
+	if (opt->simpoints_file_) {
+		int result = sampled_main(cpu_inst, opt);
+		CPU_destroy(cpu_inst);
+		return result;
+	}
 	
-    for(uint32_t i = 0; i < 1000000; i++) { // run 70000 cycles //was i<1000000
-    	CPU_execute(cpu_inst);
-		//printf("i = %d\n", i);
-		//output Regfile
-		/*for (uint32_t j = 0; j <= 31; j++) {
-			printf("%d: %X\n", j, cpu_inst->regfile_[j]);
+	FILE* bbv = NULL;
+	if (opt->bbv_file_) {
+		bbv = fopen(opt->bbv_file_, "w");
+		if (!bbv || CPU_enable_bbv(cpu_inst, opt->bbv_interval_, bbv) < 0) {
+			printf("cannot write basic block vectors to %s\n", opt->bbv_file_);
+			if (bbv) {
+				fclose(bbv);
+			}
+			CPU_destroy(cpu_inst);
+			return EXIT_FAILURE;
 		}
-		printf("\n");
-		printf("\n");
-		*/
 	}
 
-	printf("\n-----------------------RISC-V program terminate------------------------\nRegfile values:\n");
+	int halted = CPU_run(cpu_inst, opt->budget_); // run 70000 cycles //was i<1000000
 
 	//output Regfile
-	for(uint32_t i = 0; i <= 31; i++) {
-    	printf("%d: %X\n",i,cpu_inst->regfile_[i]);
-    }
-    fflush(stdout);
+	CPU_print_regfile(cpu_inst);
+	CPU_print_timing(cpu_inst);
+	CPU_print_caches(cpu_inst, CLI_TOP_FUNCTIONS);
+	CPU_print_predictors(cpu_inst, CLI_TOP_BRANCHES);
+	if (bbv) {
+		printf("\nbbv: %llu intervals of %llu instructions in %s\n", (unsigned long long)CPU_bbv_flush(cpu_inst),
+				(unsigned long long)opt->bbv_interval_, opt->bbv_file_);
+		fclose(bbv);
+	}
+	CPU_print_hooks(cpu_inst);
+	fflush(stdout);
 
-	return 0;
+	int exit_code = halted == HALT_EXIT ? CPU_exit_code(cpu_inst) : 0;
+	CPU_destroy(cpu_inst);
+	return exit_code;
+}
+
+int main(int argc, char* argv[]) {
+	printf("C Praktikum\nHU Risc-V  Emulator 2022\n");
+
+	Options opt = { 0 };
+	CPU_timing_defaults(&opt.latency_);
+	opt.btb_bits_ = -1;
+	opt.budget_ = CPU_STEP_BUDGET;
+	opt.bbv_interval_ = BBV_INTERVAL;
+	opt.ras_ = -1;
+	opt.files_ = malloc(argc * sizeof(char*));
+	opt.hooks_ = malloc(argc * sizeof(char*));
+	int result = EXIT_FAILURE;
+	if (!opt.files_ || !opt.hooks_) {
+		printf("out of memory\n");
+	}
+	else if (parse_options(argc, argv, &opt) == 0) {
+		result = run_main(&opt);
+	}
+	free(opt.files_);
+	free(opt.hooks_);
+	symbols_free(opt.symbols_);
+	return result;
 }
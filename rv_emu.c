@@ -0,0 +1,6628 @@
+
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE //MAP_ANONYMOUS, MAP_HUGETLB, madvise
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <elf.h>
+#include <math.h>
+#include <fenv.h>
+#include <float.h>
+
+#include "rv_emu.h"
+
+
+enum opcode_decode {R = 0x33, I = 0x13, S = 0x23, L = 0x03, B = 0x63, JALR = 0x67, JAL = 0x6F, AUIPC = 0x17, LUI = 0x37, SYSTEM = 0x73,
+	LOAD_FP = 0x07, STORE_FP = 0x27, MADD = 0x43, MSUB = 0x47, NMSUB = 0x4B, NMADD = 0x4F, FP_OP = 0x53, VECTOR = 0x57,
+	MISC_MEM = 0x0F, AMO = 0x2F, I_32 = 0x1B, R_32 = 0x3B};
+enum amo_funct5 { AMO_ADD = 0x00, AMO_SWAP = 0x01, AMO_LR = 0x02, AMO_SC = 0x03, AMO_XOR = 0x04, AMO_OR = 0x08, AMO_AND = 0x0C,
+	AMO_MIN = 0x10, AMO_MAX = 0x14, AMO_MINU = 0x18, AMO_MAXU = 0x1C};
+
+/*Operationen nach der Dekodierung (Opcode, Func3 und Func7 aufgeloest)*/
+enum instruction_op {
+	OP_ILLEGAL = 0,
+	OP_LUI, OP_AUIPC, OP_JAL, OP_JALR,
+	OP_BEQ, OP_BNE, OP_BLT, OP_BGE, OP_BLTU, OP_BGEU,
+	OP_LB, OP_LH, OP_LW, OP_LBU, OP_LHU, OP_LWU, OP_LD, //lwu, ld, sd and the *w ops only with RV_XLEN 64
+	OP_SB, OP_SH, OP_SW, OP_SD,
+	OP_ADDI, OP_SLTI, OP_SLTIU, OP_XORI, OP_ORI, OP_ANDI, OP_SLLI, OP_SRLI, OP_SRAI,
+	OP_ADD, OP_SUB, OP_SLL, OP_SLT, OP_SLTU, OP_XOR, OP_SRL, OP_SRA, OP_OR, OP_AND,
+	OP_ADDIW, OP_SLLIW, OP_SRLIW, OP_SRAIW, OP_ADDW, OP_SUBW, OP_SLLW, OP_SRLW, OP_SRAW,
+	OP_ECALL, OP_EBREAK, OP_MRET, OP_WFI,
+	OP_CSRRW, OP_CSRRS, OP_CSRRC, OP_CSRRWI, OP_CSRRSI, OP_CSRRCI,
+	OP_FLW, OP_FLD, OP_FSW, OP_FSD, //F/D: fmt (S or D) is taken from raw_ by the handler
+	OP_FMADD, OP_FMSUB, OP_FNMSUB, OP_FNMADD,
+	OP_FADD, OP_FSUB, OP_FMUL, OP_FDIV, OP_FSQRT, OP_FSGNJ, OP_FMINMAX, OP_FCVT_F_F, OP_FCMP,
+	OP_FCVT_W, OP_FCVT_F_W, OP_FMV_X_FCLASS, OP_FMV_W_X,
+	OP_VSETVL, OP_VLOAD, OP_VSTORE, OP_VINT, OP_VMISC, //V: funct3/funct6 are taken from raw_ by the handler
+	OP_FENCE, OP_FENCE_I, OP_LR_W, OP_SC_W, OP_AMO_W, //A: the amo operation is funct5 of raw_
+	OP_SPIN_BRANCH, //back edge of a possible idle loop, executes base_op_ and checks for spinning
+	OP_HOOK, //entry of a guest function replaced by a native one (aux_ = index in hooks_)
+	OP_UNDECODED, //code in RAM: page not decoded yet, decodes it on the first fetch
+	OP_COUNT
+};
+
+typedef struct {
+    uint8_t op_; //operation dispatched by CPU_execute
+    uint8_t rd_;
+    uint8_t rs1_;
+    uint8_t rs2_;
+    uint32_t imm_;
+    uint32_t raw_;
+    uint8_t base_op_; //operation of raw_; differs from op_ when the decoder wrapped it
+    uint8_t flags_;
+    uint16_t aux_; //OP_SPIN_BRANCH: instructions per loop iteration
+} DecodedInstruction;
+
+/*flags_ einer Warteschleifen-Rueckkante*/
+#define SPIN_POLLS 0x1 //loop body loads from memory, so a device or interrupt handler can end it
+#define SPIN_CONDITIONAL 0x2 //back edge is a conditional branch (counted as taken branch)
+#define SPIN_MAX_BODY 32
+
+#define CPU_MAX_FDS 32
+#define CPU_MAX_EVENTS 16
+#define CPU_MAX_DEVICES 8
+#define CPU_MAX_HOOKS 32
+#define SMP_QUANTUM 4096 //instructions a hart runs before it looks at IPIs and the stop flag again
+#define PAGE_SHIFT 12
+#ifndef RVV_VLEN
+#define RVV_VLEN 128 //bits per vector register, -DRVV_VLEN=256 for a wider machine
+#endif
+#if RVV_VLEN < 32 || (RVV_VLEN & (RVV_VLEN - 1))
+#error "RVV_VLEN must be a power of two >= 32"
+#endif
+#define RVV_VLENB (RVV_VLEN / 8)
+
+/*Registerbreite, -DRV_XLEN=64 fuer RV64I; Adressen bleiben 32 Bit (der Gastspeicher liegt darunter)*/
+#ifndef RV_XLEN
+#define RV_XLEN 32
+#endif
+#if RV_XLEN == 32
+typedef uint32_t xreg_t;
+typedef int32_t sxreg_t;
+#elif RV_XLEN == 64
+typedef uint64_t xreg_t;
+typedef int64_t sxreg_t;
+#else
+#error "RV_XLEN must be 32 or 64"
+#endif
+#define XLEN_SHIFT_MASK (RV_XLEN - 1)
+#define SEXT32(x) ((xreg_t)(sxreg_t)(int32_t)(x)) //32-bit result to register width
+#define VTYPE_VILL 0x80000000u
+#define PAGE_COUNT (1u << (32 - PAGE_SHIFT))
+
+enum page_attribute { PAGE_RAM = 0, PAGE_CODE = 1, PAGE_MMIO = 2, PAGE_UNMAPPED = 3 }; //PAGE_CODE: RAM holding decoded code
+
+/*Zahl der Loads/Stores vor einem Instruktionswort; Ereignisse einer Strecke [a, b) sind p[b] - p[a]*/
+typedef struct {
+    uint32_t loads_;
+    uint32_t stores_;
+} CounterPrefix;
+
+/*Basisblockvektoren (SimPoint): Instruktionen je Streckenanfang im laufenden Intervall*/
+struct BlockVectors {
+    uint64_t interval_; //instructions per interval
+    uint64_t next_; //retired count at the end of the current interval
+    uint64_t intervals_; //written so far
+    uint64_t* counts_; //decoded_size_ + 1 entries
+    size_t size_;
+    FILE* out_;
+};
+
+/*Symbolverzeichnis des Gastprogramms (ELF .symtab oder Map-Datei)*/
+typedef struct {
+    char* name_;
+    uint32_t addr_;
+} Symbol;
+
+struct SymbolTable {
+    Symbol* symbols_;
+    size_t count_;
+};
+
+/*Native Implementierung einer Gastfunktion; 0 = ablehnen, der Gastcode laeuft dann normal*/
+typedef struct {
+    const char* name_;
+    int (*call_)(CPU* cpu);
+} NativeFunction;
+
+typedef struct {
+    const NativeFunction* native_;
+    uint32_t addr_;
+    uint64_t calls_;
+} Hook;
+typedef void (*event_callback)(CPU* cpu, uint32_t arg);
+
+typedef struct Device Device;
+typedef uint32_t (*device_read)(CPU* cpu, Device* dev, uint32_t offset);
+typedef void (*device_write)(CPU* cpu, Device* dev, uint32_t offset, uint32_t value);
+
+/*MMIO-Geraet im Bereich [base_, base_ + size_), Funktionen je Zugriffsbreite 1, 2, 4 Byte*/
+struct Device {
+    const char* name_;
+    uint32_t base_;
+    uint32_t size_;
+    device_read read_[3];
+    device_write write_[3];
+    void* state_;
+    void (*release_)(void* state); //CPU_destroy, NULL if state_ needs no cleanup
+};
+
+/*Ereignis zu einem Zeitpunkt in Instruktionen (cycle_)*/
+typedef struct {
+    uint64_t deadline_;
+    event_callback fire_;
+    uint32_t arg_;
+} CPU_Event;
+
+/*Gemeinsamer Zustand aller Harts eines SMP-Gasts*/
+typedef struct {
+    CPU* harts_[SMP_MAX_HARTS];
+    size_t count_;
+    uint64_t budget_; //instructions per hart
+    atomic_int stop_; //a hart ended the program, all others leave their run loop
+    size_t running_; //harts whose thread has not returned, under lock_
+    size_t waiting_; //harts blocked in wfi, under lock_
+    pthread_mutex_t lock_;
+    pthread_cond_t wake_;
+} Smp;
+
+struct CPU {
+    size_t data_mem_size_;
+    xreg_t regfile_[32];
+    uint64_t fregs_[32]; //F/D registers, single precision values NaN-boxed
+    uint32_t fcsr_; //frm << 5 | fflags
+    uint8_t vregs_[32][RVV_VLENB]; //V registers, a group of LMUL registers is contiguous
+    uint32_t vl_;
+    uint32_t vtype_; //as written by vset{i}vl{i}, VTYPE_VILL if unsupported
+    uint32_t vsew_; //element width in bytes
+    uint32_t vlmul_; //registers per group
+    uint32_t pc_;
+    uint8_t* instr_mem_;
+    uint8_t* data_mem_;
+    size_t instr_mem_size_;
+    int owns_program_; //instr_mem_, decoded_ and counter_prefix_ are freed with this CPU
+    int owns_data_;
+    int data_mapped_; //data_mem_ is a private file mapping (CPU_map_data), unmapped instead of freed
+    int data_pages_; //host_pages of data_mem_; not HOST_PAGES_NORMAL: an anonymous mapping
+    int misaligned_trap_; //misaligned loads/stores raise an exception instead of being emulated
+    int host_pages_; //host_pages asked for by CPU_set_host_pages
+    DecodedInstruction* decoded_; //instr_mem_ once decoded, one entry per word
+    size_t decoded_size_;
+    void* decoded_mapping_; //decode cache file mapping or huge page mapping that holds decoded_, if any
+    size_t decoded_mapping_size_;
+    uint32_t code_end_; //CPU_enable_code_in_ram: decoded_ mirrors RAM [0, code_end_), 0 = separate instruction memory
+    uint64_t code_redecoded_; //words decoded again after the guest changed them
+    int halted_; //halt_reason
+    int32_t exit_code_;
+    uint32_t brk_; //program break for the brk syscall
+    int fds_[CPU_MAX_FDS]; //guest fd -> host fd, -1 if closed
+
+    /*Zeit und Unterbrechungen: cycle_ zaehlt ausgefuehrte Instruktionen plus per wfi uebersprungene*/
+    uint64_t cycle_;
+    uint64_t idle_cycles_;
+    uint64_t slice_limit_; //run loop executes while cycle_ < slice_limit_; 0 forces a reschedule
+    uint64_t next_event_;
+    CPU_Event events_[CPU_MAX_EVENTS]; //min-heap by deadline_
+    size_t event_count_;
+    uint64_t mtimecmp_;
+    uint32_t mstatus_;
+    uint32_t mie_;
+    uint32_t mip_;
+    uint32_t mtvec_;
+    uint32_t mscratch_;
+    uint32_t mepc_;
+    uint32_t mcause_;
+    uint32_t mtval_;
+
+    /*Erkennung von Warteschleifen: Zustand beim letzten Durchlauf der Rueckkante spin_head_*/
+    int spin_detect_;
+    uint32_t spin_head_;
+    uint64_t spin_seen_; //cycle_ + 1 of that pass, 0 = no snapshot
+    xreg_t spin_regs_[32];
+    uint64_t spin_skipped_; //instructions not executed because the loop could not make progress
+    uint64_t run_end_; //retired-instruction count at which the current CPU_run returns
+
+    /*Leistungszaehler, pro durchlaufener gerader Strecke statt pro Instruktion gezaehlt*/
+    const CounterPrefix* counter_prefix_; //decoded_size_ + 1 entries
+    size_t block_start_; //instruction index where the current straight-line run began
+    uint64_t loads_;
+    uint64_t stores_;
+    uint64_t taken_branches_;
+    uint64_t counter_offset_[COUNTER_COUNT]; //guest writes to mcycle/minstret/mhpmcounterN
+
+    void* aot_run_; //rv_aot_run of a loaded --aot library, NULL when interpreting
+    void* aot_lib_; //dlopen handle of that library
+    struct Timing* timing_; //pipeline timing model, NULL when off
+    struct CacheModel* caches_; //cache simulation, NULL when off
+    struct PredictorModel* predictors_; //branch prediction, NULL when off
+    struct BlockVectors* bbv_; //basic block vectors, NULL when off
+    uint64_t aot_exits_;
+
+    const SymbolTable* symbols_;
+    Hook hooks_[CPU_MAX_HOOKS];
+    size_t hook_count_;
+    uint32_t out_addr_[4]; //_out_char/_out_buffer/_out_null by enum native_output, resolved in CPU_add_hook
+    unsigned out_found_; //bit per resolved entry of out_addr_
+
+    uint8_t* page_attr_; //page_attribute per 4 KiB page of the guest address space
+    Device devices_[CPU_MAX_DEVICES];
+    size_t device_count_;
+
+    uint32_t hartid_;
+    Smp* smp_; //NULL for a single hart
+    atomic_uint msip_; //msip as written through the CLINT, also by other harts
+    uint32_t lr_addr_; //reservation of the last lr.w
+    uint32_t lr_value_;
+    int lr_valid_;
+
+    CPU_Console console_; //UART, fd 0/1 and putchar hooks; stdout/stdin without functions
+    int console_eof_; //the last read_ found no input
+    int virtual_time_; //clock_gettime reports cycle_ (1 ns per instruction) instead of host time
+    int park_; //wfi ends CPU_run with parked_ instead of skipping past the end of the run
+    int parked_;
+};
+
+/*Konsole des Gasts: Rueckrufe des Aufrufers, ohne sie stdout (ueber den stdio-Puffer) und stdin*/
+static void CPU_console_write(CPU* cpu, const void* data, size_t len) {
+	if (cpu->console_.write_) {
+		cpu->console_.write_(cpu->console_.ctx_, data, len);
+	}
+	else {
+		fwrite(data, 1, len, stdout);
+	}
+}
+
+static void CPU_console_putc(CPU* cpu, char c) {
+	if (cpu->console_.write_) {
+		cpu->console_.write_(cpu->console_.ctx_, &c, 1);
+	}
+	else {
+		putchar((int)(uint8_t)c);
+	}
+}
+
+/*Naechstes Eingabebyte, -1 am Ende der Eingabe*/
+static int CPU_console_getc(CPU* cpu) {
+	if (!cpu->console_.read_) {
+		fflush(stdout);
+		int c = getchar();
+		return c == EOF ? -1 : c;
+	}
+	int c = cpu->console_.read_(cpu->console_.ctx_);
+	cpu->console_eof_ = c < 0;
+	return c < 0 ? -1 : c;
+}
+
+static int CPU_console_eof(const CPU* cpu) {
+	return cpu->console_.read_ ? cpu->console_eof_ : feof(stdin);
+}
+
+int CPU_decode_program(CPU* cpu);
+int CPU_init_counters(CPU* cpu);
+void CPU_init_syscalls(CPU* cpu);
+int CPU_init_memory_map(CPU* cpu);
+void CPU_init_devices(CPU* cpu);
+uint64_t CPU_image_hash(const CPU* cpu);
+int CPU_load_decode_cache(CPU* cpu, const char* dir, uint64_t hash);
+int CPU_store_decode_cache(const CPU* cpu, const char* dir, uint64_t hash);
+void CPU_set_pc(CPU* cpu, uint32_t pc);
+void CPU_code_written(CPU* cpu, uint32_t addr, uint32_t len);
+
+/**
+ * Host-Speicher fuer Gast-RAM und dekodiertes Programm auf grossen Seiten (2 MiB): HOST_PAGES_HUGETLB
+ * nimmt reservierte Seiten (vm.nr_hugepages), HOST_PAGES_TRANSPARENT eine an 2 MiB ausgerichtete
+ * Abbildung mit MADV_HUGEPAGE. Gibt es die Seitenart nicht, wird auf die naechste zurueckgefallen,
+ * zuletzt auf calloc. Bereiche unter 2 MiB bleiben auf normalen Seiten.
+ */
+#define HUGE_PAGE_SIZE (2u << 20)
+
+static size_t huge_size(size_t size) {
+	return (size + HUGE_PAGE_SIZE - 1) & ~(size_t)(HUGE_PAGE_SIZE - 1);
+}
+
+/*size Byte mit Nullen; *kind = erhaltene Seitenart*/
+static void* host_alloc(size_t size, int pages, int* kind) {
+	size_t len = huge_size(size);
+	if (size < HUGE_PAGE_SIZE) {
+		pages = HOST_PAGES_NORMAL;
+	}
+#ifdef MAP_HUGETLB
+	if (pages == HOST_PAGES_HUGETLB) {
+		void* map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (map != MAP_FAILED) {
+			*kind = HOST_PAGES_HUGETLB;
+			return map;
+		}
+	}
+#endif
+#ifdef MADV_HUGEPAGE
+	if (pages != HOST_PAGES_NORMAL) {
+		uint8_t* map = mmap(NULL, len + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (map != MAP_FAILED) {
+			//keep the aligned part only
+			uint8_t* aligned = (uint8_t*)(((uintptr_t)map + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1));
+			size_t head = (size_t)(aligned - map);
+			if (head) munmap(map, head);
+			munmap(aligned + len, HUGE_PAGE_SIZE - head);
+			if (madvise(aligned, len, MADV_HUGEPAGE) == 0) {
+				*kind = HOST_PAGES_TRANSPARENT;
+				return aligned;
+			}
+			munmap(aligned, len);
+		}
+	}
+#endif
+	*kind = HOST_PAGES_NORMAL;
+	return calloc(1, size);
+}
+
+static void host_free(void* mem, size_t size, int kind) {
+	if (kind == HOST_PAGES_NORMAL) {
+		free(mem);
+	}
+	else if (mem) {
+		munmap(mem, huge_size(size));
+	}
+}
+
+/*Leere Maschine: RAM mit Nullen, Standardgeraete, ohne Programm (jeder Fetch ist eine illegale Instruktion)*/
+CPU* CPU_create(void) {
+	CPU* cpu = (CPU*) calloc(1, sizeof(CPU));
+	if (!cpu) {
+		return NULL;
+	}
+	cpu->data_mem_size_ = CPU_DATA_MEM_SIZE;
+	cpu->pc_ = 0x0;
+	cpu->spin_detect_ = 1;
+	cpu->vtype_ = VTYPE_VILL;
+	cpu->data_mem_ = calloc(1, cpu->data_mem_size_);
+	cpu->owns_data_ = 1;
+	cpu->owns_program_ = 1;
+	CPU_init_syscalls(cpu);
+	if (!cpu->data_mem_ || CPU_init_counters(cpu) < 0 || CPU_init_memory_map(cpu) < 0) {
+		CPU_destroy(cpu);
+		return NULL;
+	}
+	CPU_init_devices(cpu);
+	return cpu;
+}
+
+static void CPU_free_program(CPU* cpu) {
+	if (cpu->owns_program_) {
+		if (cpu->decoded_mapping_) {
+			munmap(cpu->decoded_mapping_, cpu->decoded_mapping_size_);
+		}
+		else {
+			free(cpu->decoded_);
+		}
+		free(cpu->instr_mem_);
+		free((void*)cpu->counter_prefix_);
+	}
+	cpu->instr_mem_ = NULL;
+	cpu->decoded_ = NULL;
+	cpu->decoded_mapping_ = NULL;
+	cpu->counter_prefix_ = NULL;
+}
+
+/*nach einem Fehler beim Laden: leere Maschine ohne Programm wie nach CPU_create*/
+static void CPU_drop_program(CPU* cpu) {
+	CPU_free_program(cpu);
+	cpu->owns_program_ = 1;
+	cpu->instr_mem_size_ = 0;
+	cpu->decoded_size_ = 0;
+	cpu->code_end_ = 0;
+	CPU_set_pc(cpu, cpu->pc_);
+}
+
+static void CPU_free_data(CPU* cpu) {
+	if (cpu->owns_data_ && cpu->data_mapped_) {
+		munmap(cpu->data_mem_, cpu->data_mem_size_);
+	}
+	else if (cpu->owns_data_) {
+		host_free(cpu->data_mem_, cpu->data_mem_size_, cpu->data_pages_);
+	}
+	cpu->data_mem_ = NULL;
+	cpu->owns_data_ = 0;
+	cpu->data_mapped_ = 0;
+	cpu->data_pages_ = HOST_PAGES_NORMAL;
+}
+
+/*RAM neu anlegen (Seitenart host_pages_, zuerst beruehrt vom aufrufenden Thread, also auf dessen
+  NUMA-Knoten) und die Seiten kopieren, die keine Nullen enthalten; nie beruehrte bleiben unbelegt*/
+static int CPU_reback_data(CPU* cpu) {
+	static const uint8_t zero[1u << PAGE_SHIFT];
+	if (!cpu->owns_data_ || cpu->data_mapped_) {
+		return cpu->data_pages_;
+	}
+	int kind;
+	uint8_t* mem = host_alloc(cpu->data_mem_size_, cpu->host_pages_, &kind);
+	if (!mem) {
+		return -1;
+	}
+	for (size_t offset = 0; offset < cpu->data_mem_size_; offset += sizeof(zero)) {
+		if (memcmp(cpu->data_mem_ + offset, zero, sizeof(zero)) != 0) {
+			memcpy(mem + offset, cpu->data_mem_ + offset, sizeof(zero));
+		}
+	}
+	host_free(cpu->data_mem_, cpu->data_mem_size_, cpu->data_pages_);
+	cpu->data_mem_ = mem;
+	cpu->data_pages_ = kind;
+	return kind;
+}
+
+int CPU_set_host_pages(CPU* cpu, int pages) {
+	if (pages < HOST_PAGES_NORMAL || pages > HOST_PAGES_HUGETLB) {
+		return -1;
+	}
+	cpu->host_pages_ = pages;
+	return CPU_reback_data(cpu);
+}
+
+static void CPU_share_program(CPU* cpu, const CPU* image) {
+	CPU_free_program(cpu);
+	cpu->owns_program_ = 0;
+	cpu->instr_mem_ = image->instr_mem_;
+	cpu->instr_mem_size_ = image->instr_mem_size_;
+	cpu->decoded_ = image->decoded_;
+	cpu->decoded_size_ = image->decoded_size_;
+	cpu->counter_prefix_ = image->counter_prefix_;
+}
+
+/*Weitere CPU fuer dasselbe Programm: teilt Instruktionsspeicher und Dekodierung, eigener Datenspeicher*/
+CPU* CPU_clone_program(const CPU* image) {
+	CPU* cpu = CPU_create();
+	if (cpu) {
+		CPU_share_program(cpu, image);
+		cpu->host_pages_ = image->host_pages_; //for the next CPU_load_data
+		if (image->code_end_ && CPU_enable_code_in_ram(cpu) < 0) {
+			CPU_destroy(cpu);
+			return NULL;
+		}
+	}
+	return cpu;
+}
+
+/*Weiterer Hart: teilt Programm, Dekodierung und Datenspeicher mit boot, eigene Register, Geraete und Zeit*/
+CPU* CPU_create_hart(CPU* boot, uint32_t hartid) {
+	CPU* cpu = CPU_clone_program(boot);
+	if (!cpu) {
+		return NULL;
+	}
+	CPU_free_data(cpu);
+	cpu->data_mem_ = boot->data_mem_;
+	cpu->brk_ = boot->brk_;
+	cpu->hartid_ = hartid;
+	return cpu;
+}
+
+void CPU_free_caches(CPU* cpu);
+void CPU_free_predictors(CPU* cpu);
+void CPU_disable_bbv(CPU* cpu);
+
+void CPU_destroy(CPU* cpu) {
+	if (!cpu) {
+		return;
+	}
+	for (size_t i = 0; i < cpu->device_count_; i++) {
+		if (cpu->devices_[i].release_) {
+			cpu->devices_[i].release_(cpu->devices_[i].state_);
+		}
+	}
+	for (int i = 3; i < CPU_MAX_FDS; i++) {
+		if (cpu->fds_[i] > STDERR_FILENO) {
+			close(cpu->fds_[i]);
+		}
+	}
+	if (cpu->aot_lib_) {
+		dlclose(cpu->aot_lib_);
+	}
+	free(cpu->timing_);
+	CPU_free_caches(cpu);
+	CPU_free_predictors(cpu);
+	CPU_disable_bbv(cpu);
+	CPU_free_program(cpu);
+	CPU_free_data(cpu);
+	free(cpu->page_attr_);
+	free(cpu);
+}
+
+/*Instruktionsspeicher kopieren und dekodieren; cache_dir != NULL: Dekodierung aus dem persistenten
+  Cache nehmen bzw. dort ablegen. Rueckgabe program_source, -1 ohne Speicher*/
+int CPU_load_program(CPU* cpu, const void* code, size_t size, const char* cache_dir) {
+	uint8_t* copy = malloc(size ? size : 1);
+	if (!copy) {
+		return -1;
+	}
+	memcpy(copy, code, size);
+	CPU_free_program(cpu);
+	cpu->owns_program_ = 1;
+	cpu->instr_mem_ = copy;
+	cpu->instr_mem_size_ = size;
+	int source = PROGRAM_DECODED;
+	uint64_t hash = cache_dir ? CPU_image_hash(cpu) : 0;
+	if (cache_dir && CPU_load_decode_cache(cpu, cache_dir, hash)) {
+		source = PROGRAM_FROM_CACHE;
+	}
+	else if (CPU_decode_program(cpu) < 0) {
+		CPU_drop_program(cpu);
+		return -1;
+	}
+	else if (cache_dir && CPU_store_decode_cache(cpu, cache_dir, hash) == 0) {
+		source = PROGRAM_CACHED;
+	}
+	if (CPU_init_counters(cpu) < 0) {
+		CPU_drop_program(cpu);
+		return -1;
+	}
+	CPU_set_pc(cpu, cpu->pc_);
+	return source;
+}
+
+/*Code im RAM: Daten unterhalb des Programmendes wuerden vom Programm ueberschrieben; erlaubt sind
+  nur Nullen und das Programm selbst*/
+static int CPU_data_overlaps_code(const CPU* cpu, const uint8_t* data, size_t size) {
+	size_t end = size < cpu->instr_mem_size_ ? size : cpu->instr_mem_size_;
+	for (size_t i = 0; i < end; i++) {
+		if (data[i] && data[i] != cpu->instr_mem_[i]) {
+			fprintf(stderr, "code in RAM: the data memory has contents at %zX, below the end of the program (%zX)\n",
+					i, cpu->instr_mem_size_);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*Code im RAM (CPU_enable_code_in_ram): Programm ueber den Anfang des Datenspeichers legen und die
+  dekodierten Seiten mit dem neuen Inhalt abgleichen*/
+static void CPU_place_code(CPU* cpu) {
+	if (!cpu->code_end_) {
+		return;
+	}
+	memcpy(cpu->data_mem_, cpu->instr_mem_, cpu->instr_mem_size_);
+	if (cpu->brk_ < cpu->instr_mem_size_) {
+		cpu->brk_ = (uint32_t)((cpu->instr_mem_size_ + 15) & ~(size_t)15);
+	}
+	CPU_code_written(cpu, 0, cpu->code_end_);
+}
+
+/*Datenspeicher ab Adresse 0 fuellen, der Rest wird 0; der Heap (brk) beginnt hinter den Daten*/
+int CPU_load_data(CPU* cpu, const void* data, size_t size) {
+	if (size > cpu->data_mem_size_ || (cpu->code_end_ && CPU_data_overlaps_code(cpu, data, size))) {
+		return -1;
+	}
+	if (cpu->owns_data_) {
+		//fresh zero pages instead of clearing (and touching) all 4 MiB
+		int kind;
+		uint8_t* mem = host_alloc(cpu->data_mem_size_, cpu->host_pages_, &kind);
+		if (!mem) {
+			return -1;
+		}
+		CPU_free_data(cpu);
+		cpu->data_mem_ = mem;
+		cpu->owns_data_ = 1;
+		cpu->data_pages_ = kind;
+	}
+	else {
+		memset(cpu->data_mem_ + size, 0, cpu->data_mem_size_ - size);
+	}
+	memcpy(cpu->data_mem_, data, size);
+	cpu->brk_ = (size + 15) & ~15u;
+	CPU_place_code(cpu);
+	return 0;
+}
+
+/*Datenspeicher als private Abbildung von fd (mindestens data_mem_size_ Byte): Seiten werden erst beim
+  Schreiben kopiert, viele CPUs koennen so ein Speicherabbild teilen. size = Laenge der Daten (brk)*/
+int CPU_map_data(CPU* cpu, int fd, size_t size) {
+	if (size > cpu->data_mem_size_) {
+		return -1;
+	}
+	void* map = mmap(NULL, cpu->data_mem_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+		return -1;
+	}
+	if (cpu->code_end_ && CPU_data_overlaps_code(cpu, map, size)) {
+		munmap(map, cpu->data_mem_size_);
+		return -1;
+	}
+	CPU_free_data(cpu);
+	cpu->data_mem_ = map;
+	cpu->owns_data_ = 1;
+	cpu->data_mapped_ = 1;
+	cpu->brk_ = (size + 15) & ~15u;
+	CPU_place_code(cpu);
+	return 0;
+}
+
+/*Inhalt eines fd bis EOF lesen (auch Pipes und Sockets)*/
+static uint8_t* read_fd(int fd, size_t* size) {
+	size_t len = 0, cap = 4096;
+	uint8_t* buffer = malloc(cap);
+	for (;;) {
+		if (!buffer) {
+			return NULL;
+		}
+		if (len == cap) {
+			uint8_t* grown = realloc(buffer, cap *= 2);
+			if (!grown) {
+				free(buffer);
+				return NULL;
+			}
+			buffer = grown;
+		}
+		ssize_t n = read(fd, buffer + len, cap - len);
+		if (n < 0 && errno == EINTR) continue;
+		if (n < 0) {
+			free(buffer);
+			return NULL;
+		}
+		if (n == 0) break;
+		len += (size_t)n;
+	}
+	*size = len;
+	return buffer;
+}
+
+int CPU_load_program_fd(CPU* cpu, int fd, const char* cache_dir) {
+	size_t size;
+	uint8_t* code = read_fd(fd, &size);
+	if (!code) {
+		return -1;
+	}
+	int source = CPU_load_program(cpu, code, size, cache_dir);
+	free(code);
+	return source;
+}
+
+int CPU_load_data_fd(CPU* cpu, int fd) {
+	size_t size;
+	uint8_t* data = read_fd(fd, &size);
+	if (!data) {
+		return -1;
+	}
+	int result = CPU_load_data(cpu, data, size);
+	free(data);
+	return result;
+}
+
+/*Laufschleife neu planen lassen (neues Ereignis, Interrupt freigegeben, Halt)*/
+static void CPU_reschedule(CPU* cpu) {
+	cpu->slice_limit_ = 0;
+}
+
+static size_t counter_index(const CPU* cpu, uint32_t pc) {
+	size_t index = (pc & 0xFFFFF) >> 2;
+	return index < cpu->decoded_size_ ? index : cpu->decoded_size_;
+}
+
+/*Gerade Strecke [block_start_, end) abrechnen*/
+static void CPU_end_run(CPU* cpu, size_t end) {
+	const CounterPrefix* p = cpu->counter_prefix_;
+	if (end > cpu->block_start_) {
+		cpu->loads_ += p[end].loads_ - p[cpu->block_start_].loads_;
+		cpu->stores_ += p[end].stores_ - p[cpu->block_start_].stores_;
+		if (cpu->bbv_) cpu->bbv_->counts_[cpu->block_start_] += end - cpu->block_start_;
+	}
+}
+
+/*pc setzen und dort eine neue Strecke beginnen, ohne die alte abzurechnen (uebersetzter Code, Lockstep)*/
+void CPU_set_pc(CPU* cpu, uint32_t pc) {
+	cpu->pc_ = pc;
+	cpu->block_start_ = counter_index(cpu, pc);
+}
+
+/*Sprung nach Ausfuehrung der Instruktion bei pc_*/
+static void CPU_jump(CPU* cpu, uint32_t target) {
+	size_t end = counter_index(cpu, cpu->pc_) + 1;
+	CPU_end_run(cpu, end < cpu->decoded_size_ ? end : cpu->decoded_size_);
+	CPU_set_pc(cpu, target);
+}
+
+/*Systemaufrufe (ecall): Linux/newlib RV32 ABI, Nummer in a7, Argumente in a0-a5, Ergebnis in a0*/
+enum syscall_number {
+	SYS_OPENAT = 56, SYS_CLOSE = 57, SYS_LSEEK = 62, SYS_READ = 63, SYS_WRITE = 64, SYS_FSTAT = 80,
+	SYS_EXIT = 93, SYS_EXIT_GROUP = 94, SYS_CLOCK_GETTIME = 113, SYS_BRK = 214, SYS_CLOCK_GETTIME64 = 403
+};
+
+//open flags of the Linux generic ABI, as used by RV32 guests
+#define GUEST_O_ACCMODE 03
+#define GUEST_O_CREAT 0100
+#define GUEST_O_EXCL 0200
+#define GUEST_O_TRUNC 01000
+#define GUEST_O_APPEND 02000
+#define GUEST_O_DIRECTORY 0200000
+#define GUEST_AT_FDCWD (-100)
+
+void CPU_init_syscalls(CPU* cpu) {
+	for (int i = 0; i < CPU_MAX_FDS; i++) {
+		cpu->fds_[i] = (i <= 2) ? i : -1;
+	}
+}
+
+/*Zeiger in data_mem_ fuer [addr, addr+len), NULL wenn ausserhalb*/
+uint8_t* CPU_guest_ptr(CPU* cpu, uint32_t addr, uint32_t len) {
+	if ((uint64_t)addr + len > cpu->data_mem_size_) {
+		return NULL;
+	}
+	return cpu->data_mem_ + addr;
+}
+
+static int syscall_host_fd(CPU* cpu, uint32_t guest_fd) {
+	return guest_fd < CPU_MAX_FDS ? cpu->fds_[guest_fd] : -1;
+}
+
+/*Ausgabe auf stdout geht ueber den stdio-Puffer: viele kleine writes werden zu einem Host-write
+  zusammengefasst, grosse writes gehen ohne Kopie direkt aus data_mem_ hinaus*/
+static int32_t syscall_write(CPU* cpu, uint32_t fd, uint32_t buf, uint32_t len) {
+	int host_fd = syscall_host_fd(cpu, fd);
+	uint8_t* p = CPU_guest_ptr(cpu, buf, len);
+	if (host_fd < 0) return -EBADF;
+	if (!p) return -EFAULT;
+	if (host_fd == STDOUT_FILENO) {
+		CPU_console_write(cpu, p, len);
+		return (int32_t)len;
+	}
+	fflush(stdout);
+	ssize_t n = write(host_fd, p, len);
+	return n < 0 ? -errno : (int32_t)n;
+}
+
+static int32_t syscall_read(CPU* cpu, uint32_t fd, uint32_t buf, uint32_t len) {
+	int host_fd = syscall_host_fd(cpu, fd);
+	uint8_t* p = CPU_guest_ptr(cpu, buf, len);
+	if (host_fd < 0) return -EBADF;
+	if (!p) return -EFAULT;
+	if (host_fd == STDIN_FILENO && cpu->console_.read_) {
+		//up to the end of a line, like a terminal
+		uint32_t n = 0;
+		int c;
+		while (n < len && (c = CPU_console_getc(cpu)) >= 0) {
+			p[n++] = (uint8_t)c;
+			if (c == '\n') break;
+		}
+		CPU_code_written(cpu, buf, n);
+		return (int32_t)n;
+	}
+	if (host_fd == STDIN_FILENO) {
+		fflush(stdout);
+	}
+	ssize_t n = read(host_fd, p, len);
+	if (n > 0) {
+		CPU_code_written(cpu, buf, (uint32_t)n); //a loader reading a program into memory
+	}
+	return n < 0 ? -errno : (int32_t)n;
+}
+
+static int32_t syscall_openat(CPU* cpu, int32_t dirfd, uint32_t path, uint32_t guest_flags, uint32_t mode) {
+	uint8_t* p = CPU_guest_ptr(cpu, path, 1);
+	if (!p || !memchr(p, 0, cpu->data_mem_size_ - path)) return -EFAULT;
+
+	int host_dirfd = AT_FDCWD;
+	if (dirfd != GUEST_AT_FDCWD) {
+		host_dirfd = syscall_host_fd(cpu, (uint32_t)dirfd);
+		if (host_dirfd < 0) return -EBADF;
+	}
+
+	int guest_fd = 3;
+	while (guest_fd < CPU_MAX_FDS && cpu->fds_[guest_fd] >= 0) guest_fd++;
+	if (guest_fd == CPU_MAX_FDS) return -EMFILE;
+
+	int flags = O_CLOEXEC;
+	switch (guest_flags & GUEST_O_ACCMODE) {
+	case 0: flags |= O_RDONLY; break;
+	case 1: flags |= O_WRONLY; break;
+	default: flags |= O_RDWR; break;
+	}
+	if (guest_flags & GUEST_O_CREAT) flags |= O_CREAT;
+	if (guest_flags & GUEST_O_EXCL) flags |= O_EXCL;
+	if (guest_flags & GUEST_O_TRUNC) flags |= O_TRUNC;
+	if (guest_flags & GUEST_O_APPEND) flags |= O_APPEND;
+	if (guest_flags & GUEST_O_DIRECTORY) flags |= O_DIRECTORY;
+
+	int host_fd = openat(host_dirfd, (const char*)p, flags, (mode_t)mode);
+	if (host_fd < 0) return -errno;
+	cpu->fds_[guest_fd] = host_fd;
+	return guest_fd;
+}
+
+static int32_t syscall_close(CPU* cpu, uint32_t fd) {
+	int host_fd = syscall_host_fd(cpu, fd);
+	if (host_fd < 0) return -EBADF;
+	cpu->fds_[fd] = -1;
+	if (host_fd <= STDERR_FILENO) return 0; //the emulator's own stdio stays open
+	return close(host_fd) < 0 ? -errno : 0;
+}
+
+//newlib lseek(fd, offset, whence); the offset is 32 bit
+static int32_t syscall_lseek(CPU* cpu, uint32_t fd, int32_t offset, uint32_t whence) {
+	int host_fd = syscall_host_fd(cpu, fd);
+	if (host_fd < 0) return -EBADF;
+	if (host_fd == STDOUT_FILENO) fflush(stdout);
+	off_t pos = lseek(host_fd, offset, (int)whence);
+	if (pos < 0) return -errno;
+	return pos > INT32_MAX ? -EOVERFLOW : (int32_t)pos;
+}
+
+static void put_u32(uint8_t* p, uint32_t v) { memcpy(p, &v, 4); }
+static void put_u64(uint8_t* p, uint64_t v) { memcpy(p, &v, 8); }
+
+/*struct kernel_stat von newlib/libgloss (RV32, 64-bit time_t), 128 Byte*/
+static int32_t syscall_fstat(CPU* cpu, uint32_t fd, uint32_t buf) {
+	int host_fd = syscall_host_fd(cpu, fd);
+	uint8_t* p = CPU_guest_ptr(cpu, buf, 128);
+	if (host_fd < 0) return -EBADF;
+	if (!p) return -EFAULT;
+	struct stat st;
+	if (fstat(host_fd, &st) < 0) return -errno;
+	memset(p, 0, 128);
+	put_u64(p + 0, st.st_dev);
+	put_u64(p + 8, st.st_ino);
+	put_u32(p + 16, st.st_mode);
+	put_u32(p + 20, st.st_nlink);
+	put_u32(p + 24, st.st_uid);
+	put_u32(p + 28, st.st_gid);
+	put_u64(p + 32, st.st_rdev);
+	put_u64(p + 48, st.st_size);
+	put_u32(p + 56, st.st_blksize);
+	put_u64(p + 64, st.st_blocks);
+	put_u64(p + 72, st.st_atim.tv_sec);
+	put_u32(p + 80, st.st_atim.tv_nsec);
+	put_u64(p + 88, st.st_mtim.tv_sec);
+	put_u32(p + 96, st.st_mtim.tv_nsec);
+	put_u64(p + 104, st.st_ctim.tv_sec);
+	put_u32(p + 112, st.st_ctim.tv_nsec);
+	return 0;
+}
+
+static int32_t syscall_brk(CPU* cpu, uint32_t addr) {
+	if (addr != 0 && addr >= cpu->brk_ && addr <= cpu->data_mem_size_) {
+		cpu->brk_ = addr;
+	}
+	return (int32_t)cpu->brk_;
+}
+
+/*clock_gettime schreibt {int32 sec, int32 nsec}, clock_gettime64 {int64 sec, int32 nsec, pad}*/
+static int32_t syscall_clock_gettime(CPU* cpu, uint32_t clock_id, uint32_t buf, int wide) {
+	uint8_t* p = CPU_guest_ptr(cpu, buf, wide ? 16 : 8);
+	if (!p) return -EFAULT;
+	if (clock_id != CLOCK_REALTIME && clock_id != CLOCK_MONOTONIC) return -EINVAL;
+	struct timespec ts;
+	if (cpu->virtual_time_) {
+		ts.tv_sec = (time_t)(cpu->cycle_ / 1000000000u);
+		ts.tv_nsec = (long)(cpu->cycle_ % 1000000000u);
+	}
+	else {
+		clock_gettime((clockid_t)clock_id, &ts);
+	}
+	if (wide) {
+		put_u64(p, (uint64_t)ts.tv_sec);
+		put_u64(p + 8, (uint64_t)ts.tv_nsec);
+	}
+	else {
+		put_u32(p, (uint32_t)ts.tv_sec);
+		put_u32(p + 4, (uint32_t)ts.tv_nsec);
+	}
+	return 0;
+}
+
+void CPU_syscall(CPU* cpu) {
+	xreg_t* a = &cpu->regfile_[10]; //a0..a7 = x10..x17
+	int32_t ret;
+
+	switch (a[7]) {
+	case SYS_WRITE: ret = syscall_write(cpu, a[0], a[1], a[2]); break;
+	case SYS_READ: ret = syscall_read(cpu, a[0], a[1], a[2]); break;
+	case SYS_OPENAT: ret = syscall_openat(cpu, (int32_t)a[0], a[1], a[2], a[3]); break;
+	case SYS_CLOSE: ret = syscall_close(cpu, a[0]); break;
+	case SYS_LSEEK: ret = syscall_lseek(cpu, a[0], (int32_t)a[1], a[2]); break;
+	case SYS_FSTAT: ret = syscall_fstat(cpu, a[0], a[1]); break;
+	case SYS_BRK: ret = syscall_brk(cpu, a[0]); break;
+	case SYS_CLOCK_GETTIME: ret = syscall_clock_gettime(cpu, a[0], a[1], 0); break;
+	case SYS_CLOCK_GETTIME64: ret = syscall_clock_gettime(cpu, a[0], a[1], 1); break;
+	case SYS_EXIT:
+	case SYS_EXIT_GROUP:
+		cpu->halted_ = HALT_EXIT;
+		cpu->exit_code_ = (int32_t)a[0];
+		CPU_reschedule(cpu);
+		return;
+	default:
+		ret = -ENOSYS;
+		break;
+	}
+	a[0] = SEXT32(ret);
+}
+
+/*Ereignisse und Unterbrechungen (CLINT-Timer, externe Interrupts, Traps)*/
+#define MSTATUS_MIE 0x8
+#define MSTATUS_MPIE 0x80
+#define MSTATUS_MPP 0x1800
+#define MIP_MSIP 0x8
+#define MIP_MTIP 0x80
+#define MIP_MEIP 0x800
+#define MCAUSE_INTERRUPT 0x80000000u
+#define CAUSE_ILLEGAL_INSTRUCTION 2
+
+#define CLINT_SIZE 0x10000u
+#define CLINT_MSIP 0x0000
+#define CLINT_MTIMECMP 0x4000
+#define CLINT_MTIME 0xBFF8
+
+enum csr_address {
+	CSR_FFLAGS = 0x001, CSR_FRM = 0x002, CSR_FCSR = 0x003, CSR_VSTART = 0x008,
+	CSR_VL = 0xC20, CSR_VTYPE = 0xC21, CSR_VLENB = 0xC22,
+	CSR_MSTATUS = 0x300, CSR_MISA = 0x301, CSR_MIE = 0x304, CSR_MTVEC = 0x305,
+	CSR_MSCRATCH = 0x340, CSR_MEPC = 0x341, CSR_MCAUSE = 0x342, CSR_MTVAL = 0x343, CSR_MIP = 0x344,
+	CSR_MHARTID = 0xF14,
+	CSR_MHPMEVENT3 = 0x323, CSR_MHPMEVENT31 = 0x33F,
+	CSR_MCYCLE = 0xB00, CSR_MCYCLEH = 0xB80, CSR_CYCLE = 0xC00, CSR_CYCLEH = 0xC80
+};
+
+static void event_swap(CPU_Event* a, CPU_Event* b) {
+	CPU_Event t = *a;
+	*a = *b;
+	*b = t;
+}
+
+static void event_sift_down(CPU* cpu, size_t i) {
+	for (;;) {
+		size_t min = i, l = 2 * i + 1, r = 2 * i + 2;
+		if (l < cpu->event_count_ && cpu->events_[l].deadline_ < cpu->events_[min].deadline_) min = l;
+		if (r < cpu->event_count_ && cpu->events_[r].deadline_ < cpu->events_[min].deadline_) min = r;
+		if (min == i) return;
+		event_swap(&cpu->events_[i], &cpu->events_[min]);
+		i = min;
+	}
+}
+
+static void event_sift_up(CPU* cpu, size_t i) {
+	while (i > 0 && cpu->events_[(i - 1) / 2].deadline_ > cpu->events_[i].deadline_) {
+		event_swap(&cpu->events_[i], &cpu->events_[(i - 1) / 2]);
+		i = (i - 1) / 2;
+	}
+}
+
+static void event_update_next(CPU* cpu) {
+	cpu->next_event_ = cpu->event_count_ ? cpu->events_[0].deadline_ : UINT64_MAX;
+}
+
+int CPU_schedule_event(CPU* cpu, uint64_t deadline, event_callback fire, uint32_t arg) {
+	if (cpu->event_count_ == CPU_MAX_EVENTS) {
+		return -1;
+	}
+	CPU_Event* e = &cpu->events_[cpu->event_count_++];
+	e->deadline_ = deadline;
+	e->fire_ = fire;
+	e->arg_ = arg;
+	event_sift_up(cpu, cpu->event_count_ - 1);
+	if (deadline < cpu->next_event_) {
+		event_update_next(cpu);
+		CPU_reschedule(cpu);
+	}
+	return 0;
+}
+
+void CPU_cancel_events(CPU* cpu, event_callback fire, uint32_t arg) {
+	size_t kept = 0;
+	for (size_t i = 0; i < cpu->event_count_; i++) {
+		if (cpu->events_[i].fire_ != fire || cpu->events_[i].arg_ != arg) {
+			cpu->events_[kept++] = cpu->events_[i];
+		}
+	}
+	cpu->event_count_ = kept;
+	for (size_t i = kept / 2; i-- > 0;) {
+		event_sift_down(cpu, i);
+	}
+	event_update_next(cpu);
+}
+
+/*Externe Interruptleitung (MEIP) setzen oder loeschen*/
+void CPU_set_irq(CPU* cpu, uint32_t mip_bit, int level) {
+	if (level) cpu->mip_ |= mip_bit;
+	else cpu->mip_ &= ~mip_bit;
+	CPU_reschedule(cpu);
+}
+
+/**
+ * SMP: jeder Hart ist eine eigene CPU in einem eigenen Host-Thread, data_mem_ ist gemeinsam.
+ * Zwischen den Harts laeuft nur msip (Interprozessor-Interrupt ueber den CLINT) und das
+ * Programmende; beides wird am Anfang jeder Zeitscheibe (hoechstens SMP_QUANTUM Instruktionen)
+ * abgefragt, sonst laufen die Harts ohne Synchronisation.
+ */
+static int smp_poll(CPU* cpu) {
+	if (atomic_load_explicit(&cpu->smp_->stop_, memory_order_acquire)) {
+		return 1;
+	}
+	uint32_t level = atomic_load_explicit(&cpu->msip_, memory_order_acquire);
+	if (level != ((cpu->mip_ & MIP_MSIP) != 0)) {
+		CPU_set_irq(cpu, MIP_MSIP, level);
+	}
+	return 0;
+}
+
+static void smp_stop(Smp* smp) {
+	atomic_store(&smp->stop_, 1);
+	pthread_cond_broadcast(&smp->wake_);
+}
+
+static void smp_send_ipi(CPU* target, uint32_t level) {
+	Smp* smp = target->smp_;
+	atomic_store(&target->msip_, level);
+	if (level) {
+		pthread_mutex_lock(&smp->lock_);
+		pthread_cond_broadcast(&smp->wake_);
+		pthread_mutex_unlock(&smp->lock_);
+	}
+}
+
+/*wfi ohne eigene Ereignisse: blockieren, bis ein anderer Hart msip setzt; warten alle, ist der Gast fertig*/
+static void smp_wait(CPU* cpu) {
+	Smp* smp = cpu->smp_;
+	pthread_mutex_lock(&smp->lock_);
+	if (++smp->waiting_ == smp->running_) {
+		cpu->halted_ = HALT_IDLE;
+		smp_stop(smp);
+	}
+	while (!(atomic_load(&cpu->msip_) && (cpu->mie_ & MIP_MSIP)) && !atomic_load(&smp->stop_)) {
+		pthread_cond_wait(&smp->wake_, &smp->lock_);
+	}
+	smp->waiting_--;
+	pthread_mutex_unlock(&smp->lock_);
+}
+
+/*Hart-Thread ist fertig: Exit, ebreak oder Fehler eines Harts beenden den ganzen Gast*/
+static void smp_leave(CPU* cpu) {
+	Smp* smp = cpu->smp_;
+	pthread_mutex_lock(&smp->lock_);
+	smp->running_--;
+	if (cpu->halted_ == HALT_EXIT || cpu->halted_ == HALT_EBREAK || cpu->halted_ == HALT_FAULT
+			|| (smp->running_ && smp->waiting_ == smp->running_)) {
+		smp_stop(smp);
+	}
+	pthread_mutex_unlock(&smp->lock_);
+}
+
+static void clint_timer_fire(CPU* cpu, uint32_t arg) {
+	if (cpu->cycle_ >= cpu->mtimecmp_) {
+		CPU_set_irq(cpu, MIP_MTIP, 1);
+	}
+}
+
+static void clint_set_mtimecmp(CPU* cpu, uint64_t mtimecmp) {
+	cpu->mtimecmp_ = mtimecmp;
+	CPU_cancel_events(cpu, clint_timer_fire, 0);
+	if (cpu->cycle_ >= mtimecmp) {
+		CPU_set_irq(cpu, MIP_MTIP, 1);
+	}
+	else {
+		CPU_set_irq(cpu, MIP_MTIP, 0);
+		CPU_schedule_event(cpu, mtimecmp, clint_timer_fire, 0);
+	}
+}
+
+/*Hart hinter msip-Register hart, NULL wenn es ihn nicht gibt*/
+static CPU* clint_hart(CPU* cpu, uint32_t hart) {
+	if (hart == cpu->hartid_) return cpu;
+	return (cpu->smp_ && hart < cpu->smp_->count_) ? cpu->smp_->harts_[hart] : NULL;
+}
+
+/*CLINT-Register: msip je Hart, eigenes mtimecmp und mtime (mtime zaehlt in Instruktionen des Harts)*/
+int CPU_clint_load(CPU* cpu, uint32_t addr, uint32_t* value) {
+	uint32_t offset = addr - CLINT_BASE;
+	if (offset < CLINT_MTIMECMP) {
+		CPU* hart = clint_hart(cpu, offset / 4);
+		*value = (hart == cpu) ? (cpu->mip_ & MIP_MSIP) != 0 : hart ? atomic_load(&hart->msip_) : 0;
+		return 1;
+	}
+	if (offset < CLINT_MTIME) {
+		offset -= 8 * cpu->hartid_; //mtimecmp of other harts reads as 0
+	}
+	switch (offset) {
+	case CLINT_MTIMECMP: *value = (uint32_t)cpu->mtimecmp_; break;
+	case CLINT_MTIMECMP + 4: *value = (uint32_t)(cpu->mtimecmp_ >> 32); break;
+	case CLINT_MTIME: *value = (uint32_t)cpu->cycle_; break;
+	case CLINT_MTIME + 4: *value = (uint32_t)(cpu->cycle_ >> 32); break;
+	default: *value = 0; break;
+	}
+	return 1;
+}
+
+int CPU_clint_store(CPU* cpu, uint32_t addr, uint32_t value) {
+	uint32_t offset = addr - CLINT_BASE;
+	if (offset < CLINT_MTIMECMP) {
+		CPU* hart = clint_hart(cpu, offset / 4);
+		if (hart == cpu) {
+			atomic_store(&cpu->msip_, value & 1);
+			CPU_set_irq(cpu, MIP_MSIP, value & 1);
+		}
+		else if (hart) {
+			smp_send_ipi(hart, value & 1);
+		}
+		return 1;
+	}
+	if (offset < CLINT_MTIME) {
+		offset -= 8 * cpu->hartid_;
+	}
+	switch (offset) {
+	case CLINT_MTIMECMP: clint_set_mtimecmp(cpu, (cpu->mtimecmp_ & 0xFFFFFFFF00000000ull) | value); break;
+	case CLINT_MTIMECMP + 4: clint_set_mtimecmp(cpu, (cpu->mtimecmp_ & 0xFFFFFFFFull) | ((uint64_t)value << 32)); break;
+	default: break; //mtime is read-only here: time is the instruction count
+	}
+	return 1;
+}
+
+/*Trap nehmen: mepc/mcause/mtval setzen, MIE sichern, nach mtvec springen*/
+void CPU_trap(CPU* cpu, uint32_t cause, uint32_t tval) {
+	CPU_end_run(cpu, counter_index(cpu, cpu->pc_)); //the trapping instruction did not complete
+	cpu->mepc_ = cpu->pc_;
+	cpu->mcause_ = cause;
+	cpu->mtval_ = tval;
+	cpu->mstatus_ = (cpu->mstatus_ & ~(MSTATUS_MPIE | MSTATUS_MIE))
+		| ((cpu->mstatus_ & MSTATUS_MIE) ? MSTATUS_MPIE : 0)
+		| MSTATUS_MPP;
+	uint32_t base = cpu->mtvec_ & ~3u;
+	if ((cpu->mtvec_ & 1) && (cause & MCAUSE_INTERRUPT)) {
+		cpu->pc_ = base + 4 * (cause & ~MCAUSE_INTERRUPT);
+	}
+	else {
+		cpu->pc_ = base;
+	}
+	CPU_set_pc(cpu, cpu->pc_);
+}
+
+/*Faellige Ereignisse ausloesen, dann einen freigegebenen Interrupt zustellen*/
+static void CPU_service_events(CPU* cpu) {
+	while (cpu->event_count_ && cpu->events_[0].deadline_ <= cpu->cycle_) {
+		CPU_Event e = cpu->events_[0];
+		cpu->events_[0] = cpu->events_[--cpu->event_count_];
+		event_sift_down(cpu, 0);
+		e.fire_(cpu, e.arg_);
+	}
+	event_update_next(cpu);
+
+	uint32_t pending = cpu->mip_ & cpu->mie_;
+	if (pending && (cpu->mstatus_ & MSTATUS_MIE)) {
+		uint32_t irq = (pending & MIP_MEIP) ? 11 : (pending & MIP_MSIP) ? 3 : 7;
+		CPU_trap(cpu, MCAUSE_INTERRUPT | irq, 0);
+	}
+}
+
+/*wfi: bis zum naechsten Ereignis vorspulen statt Instruktionen abzuarbeiten*/
+void CPU_wait_for_interrupt(CPU* cpu) {
+	if (cpu->mip_ & cpu->mie_) {
+		return;
+	}
+	if (cpu->smp_ && cpu->event_count_ == 0) {
+		smp_wait(cpu); //another hart may still send an IPI
+	}
+	else if (cpu->event_count_ == 0) {
+		cpu->halted_ = HALT_IDLE; //nothing can wake this hart again
+	}
+	else if (cpu->park_ && cpu->next_event_ > cpu->run_end_ + cpu->idle_cycles_) {
+		cpu->parked_ = 1; //the scheduler resumes the guest when its time has come
+	}
+	else if (cpu->next_event_ > cpu->cycle_ + 1) {
+		//the wfi itself retires one cycle in the run loop
+		cpu->idle_cycles_ += cpu->next_event_ - cpu->cycle_ - 1;
+		cpu->cycle_ = cpu->next_event_ - 1;
+	}
+	CPU_reschedule(cpu);
+}
+
+/**
+ * Warteschleifen: der Dekoder markiert kurze, speicherschreibfreie Schleifen (OP_SPIN_BRANCH).
+ * Kommt der Gast zweimal hintereinander mit identischen Registern an derselben Rueckkante an,
+ * kann die Schleife nur noch ein Ereignis beenden: Geraetezustand (SPIN_POLLS) oder ein
+ * Interrupt-Handler. Dann wird bis zum naechsten Ereignis vorgespult bzw. angehalten, wenn
+ * nichts den Gast mehr wecken kann. Die uebersprungenen Instruktionen zaehlen als ausgefuehrt.
+ */
+void CPU_spin_reset(CPU* cpu) {
+	cpu->spin_seen_ = 0;
+}
+
+static void CPU_spin_skip(CPU* cpu, uint32_t iteration, uint8_t flags) {
+	int interruptible = (cpu->mstatus_ & MSTATUS_MIE) && cpu->mie_;
+	if (cpu->event_count_ == 0 || (!(flags & SPIN_POLLS) && !interruptible)) {
+		//the back edge itself still retires in the run loop
+		uint64_t retired = cpu->cycle_ - cpu->idle_cycles_ + 1;
+		cpu->spin_skipped_ += cpu->run_end_ > retired ? cpu->run_end_ - retired : 0;
+		cpu->halted_ = HALT_IDLE;
+	}
+	else if (cpu->slice_limit_ > cpu->cycle_ + 1) {
+		uint64_t skipped = cpu->slice_limit_ - cpu->cycle_ - 1;
+		cpu->spin_skipped_ += skipped;
+		cpu->cycle_ = cpu->slice_limit_ - 1;
+		//the skipped iterations still count for the performance counters (pc_ is the loop head)
+		const CounterPrefix* p = cpu->counter_prefix_;
+		size_t head = counter_index(cpu, cpu->pc_);
+		uint64_t iterations = skipped / iteration;
+		cpu->loads_ += iterations * (p[head + iteration].loads_ - p[head].loads_);
+		cpu->taken_branches_ += (flags & SPIN_CONDITIONAL) ? iterations : 0;
+		if (cpu->bbv_) cpu->bbv_->counts_[head] += iterations * iteration;
+	}
+	cpu->spin_seen_ = 0;
+	CPU_reschedule(cpu);
+}
+
+/*Nach einer genommenen Rueckkante (pc_ = Schleifenkopf); iteration = Instruktionen je Durchlauf*/
+void CPU_spin_check(CPU* cpu, uint32_t iteration, uint8_t flags) {
+	//exactly one iteration since the last pass, otherwise other code (or a trap) ran in between
+	if (cpu->spin_seen_ && cpu->spin_head_ == cpu->pc_ && cpu->cycle_ + 1 - cpu->spin_seen_ == iteration
+			&& memcmp(cpu->spin_regs_, cpu->regfile_, sizeof(cpu->regfile_)) == 0) {
+		CPU_spin_skip(cpu, iteration, flags);
+		return;
+	}
+	cpu->spin_head_ = cpu->pc_;
+	cpu->spin_seen_ = cpu->cycle_ + 1;
+	memcpy(cpu->spin_regs_, cpu->regfile_, sizeof(cpu->regfile_));
+}
+
+/*Zaehlerstand zum Zeitpunkt der gerade ausgefuehrten Instruktion*/
+uint64_t CPU_counter(const CPU* cpu, uint32_t id) {
+	const CounterPrefix* p = cpu->counter_prefix_;
+	size_t now = counter_index(cpu, cpu->pc_);
+	size_t start = cpu->block_start_ < now ? cpu->block_start_ : now; //open run [block_start_, pc_)
+	uint64_t value;
+	switch (id) {
+	case COUNTER_CYCLE: case COUNTER_TIME: value = cpu->cycle_; break;
+	case COUNTER_INSTRET: value = cpu->cycle_ - cpu->idle_cycles_; break;
+	case HPM_LOADS: value = cpu->loads_ + p[now].loads_ - p[start].loads_; break;
+	case HPM_STORES: value = cpu->stores_ + p[now].stores_ - p[start].stores_; break;
+	case HPM_TAKEN_BRANCHES: value = cpu->taken_branches_; break;
+	case HPM_JIT_EXITS: value = cpu->aot_exits_; break;
+	default: return 0;
+	}
+	return value + cpu->counter_offset_[id];
+}
+
+/*cycle/time/instret/hpmcounterN (0xC00) und mcycle/minstret/mhpmcounterN (0xB00), +0x80 obere Haelfte*/
+static int counter_csr(uint32_t csr, uint32_t* id, int* high) {
+	uint32_t base = csr & ~0x9Fu;
+	*id = csr & 0x1F;
+	*high = (csr & 0x80) != 0;
+	return base == CSR_CYCLE || (base == CSR_MCYCLE && *id != COUNTER_TIME);
+}
+
+int CPU_csr_read(CPU* cpu, uint32_t csr, xreg_t* value) {
+	uint32_t id;
+	int high;
+	if (counter_csr(csr, &id, &high)) {
+		uint64_t count = CPU_counter(cpu, id);
+		*value = high ? (xreg_t)(count >> 32) : (xreg_t)count; //RV64: the whole counter
+		return 1;
+	}
+	if (csr >= CSR_MHPMEVENT3 && csr <= CSR_MHPMEVENT31) {
+		//hardwired: mhpmcounterN counts event N
+		*value = (csr - CSR_MHPMEVENT3 + HPM_LOADS < COUNTER_COUNT) ? csr - CSR_MHPMEVENT3 + HPM_LOADS : 0;
+		return 1;
+	}
+	switch (csr) {
+	case CSR_MSTATUS: *value = cpu->mstatus_; break;
+	case CSR_MISA: *value = (xreg_t)(RV_XLEN / 32) << (RV_XLEN - 2) | 0x129; break; //RV32IAFD / RV64IAFD
+	case CSR_FFLAGS: *value = cpu->fcsr_ & 0x1F; break;
+	case CSR_FRM: *value = cpu->fcsr_ >> 5; break;
+	case CSR_FCSR: *value = cpu->fcsr_; break;
+	case CSR_VSTART: *value = 0; break; //vector instructions are never interrupted halfway
+	case CSR_VL: *value = cpu->vl_; break;
+	case CSR_VTYPE: *value = cpu->vtype_; break;
+	case CSR_VLENB: *value = RVV_VLENB; break;
+	case CSR_MIE: *value = cpu->mie_; break;
+	case CSR_MTVEC: *value = cpu->mtvec_; break;
+	case CSR_MSCRATCH: *value = cpu->mscratch_; break;
+	case CSR_MEPC: *value = cpu->mepc_; break;
+	case CSR_MCAUSE: *value = cpu->mcause_; break;
+	case CSR_MTVAL: *value = cpu->mtval_; break;
+	case CSR_MIP: *value = cpu->mip_; break;
+	case CSR_MHARTID: *value = cpu->hartid_; break;
+	default: return 0;
+	}
+	return 1;
+}
+
+int CPU_csr_write(CPU* cpu, uint32_t csr, uint32_t value) {
+	uint32_t id;
+	int high;
+	if (counter_csr(csr, &id, &high)) {
+		if (id < COUNTER_COUNT) {
+			uint64_t count = CPU_counter(cpu, id);
+			uint64_t next = high ? (count & 0xFFFFFFFFu) | ((uint64_t)value << 32)
+				: (count & ~(uint64_t)0xFFFFFFFFu) | value;
+			cpu->counter_offset_[id] += next - count;
+		}
+		return 1;
+	}
+	if (csr >= CSR_MHPMEVENT3 && csr <= CSR_MHPMEVENT31) {
+		return 1;
+	}
+	switch (csr) {
+	case CSR_MSTATUS: cpu->mstatus_ = (value & (MSTATUS_MIE | MSTATUS_MPIE)) | MSTATUS_MPP; break;
+	case CSR_MIE: cpu->mie_ = value & (MIP_MSIP | MIP_MTIP | MIP_MEIP); break;
+	case CSR_MTVEC: cpu->mtvec_ = value; break;
+	case CSR_MSCRATCH: cpu->mscratch_ = value; break;
+	case CSR_MEPC: cpu->mepc_ = value & ~3u; break;
+	case CSR_MCAUSE: cpu->mcause_ = value; break;
+	case CSR_MTVAL: cpu->mtval_ = value; break;
+	case CSR_MIP: break; //MSIP/MTIP/MEIP are driven by the CLINT and devices
+	case CSR_MISA: case CSR_MHARTID: break;
+	case CSR_FFLAGS: cpu->fcsr_ = (cpu->fcsr_ & ~0x1Fu) | (value & 0x1F); break;
+	case CSR_FRM: cpu->fcsr_ = (cpu->fcsr_ & 0x1F) | ((value & 7) << 5); break;
+	case CSR_FCSR: cpu->fcsr_ = value & 0xFF; break;
+	case CSR_VSTART: break;
+	default: return 0;
+	}
+	//mstatus/mie may have just enabled a pending interrupt
+	CPU_reschedule(cpu);
+	return 1;
+}
+
+/*Unbekannte Instruktion: Trap, falls der Gast einen Handler eingerichtet hat, sonst bleibt pc stehen*/
+void CPU_illegal_instruction(CPU* cpu, uint32_t instruction) {
+	if (cpu->mtvec_) {
+		CPU_trap(cpu, CAUSE_ILLEGAL_INSTRUCTION, instruction);
+	}
+}
+
+/**
+ * MMIO-Geraete: jedes Geraet belegt einen Adressbereich und hat Lese-/Schreibfunktionen je
+ * Zugriffsbreite (1, 2, 4 Byte; NULL = Zugriffsfehler). Die Seitentabelle page_attr_ markiert
+ * RAM-Seiten, so dass normale Loads/Stores mit einem einzigen Tabellenzugriff auskommen und
+ * nur Zugriffe auf MMIO- oder unbelegte Seiten in CPU_mmio_load/CPU_mmio_store landen.
+ * Der Teil einer MMIO-Seite, den kein Geraet belegt, bleibt RAM (langsamer Pfad).
+ */
+#define UART_DATA 0x0
+#define UART_STATUS 0x4
+#define UART_STATUS_TX_READY 0x1
+#define UART_STATUS_RX_READY 0x2
+
+#define BLOCK_SECTOR_SIZE 512
+enum block_register {
+	BLOCK_SECTOR = 0x00, BLOCK_BUFFER = 0x04, BLOCK_COUNT = 0x08, BLOCK_COMMAND = 0x0C,
+	BLOCK_STATUS = 0x10, BLOCK_CAPACITY = 0x14
+};
+enum block_command { BLOCK_CMD_READ = 1, BLOCK_CMD_WRITE = 2 };
+
+enum dma_register {
+	DMA_SRC = 0x00, DMA_DST = 0x04, DMA_LEN = 0x08, DMA_VALUE = 0x0C, DMA_COMMAND = 0x10,
+	DMA_STATUS = 0x14, DMA_RESULT = 0x18
+};
+enum dma_command { DMA_CMD_COPY = 1, DMA_CMD_FILL = 2, DMA_CMD_FIND = 3 };
+
+#define CAUSE_LOAD_MISALIGNED 4
+#define CAUSE_LOAD_ACCESS_FAULT 5
+#define CAUSE_STORE_MISALIGNED 6
+#define CAUSE_STORE_ACCESS_FAULT 7
+
+static int width_index(uint32_t width) {
+	return width == 4 ? 2 : width == 2 ? 1 : 0;
+}
+
+int CPU_init_memory_map(CPU* cpu) {
+	cpu->page_attr_ = malloc(PAGE_COUNT);
+	if (!cpu->page_attr_) {
+		return -1;
+	}
+	memset(cpu->page_attr_, PAGE_UNMAPPED, PAGE_COUNT);
+	memset(cpu->page_attr_, PAGE_RAM, cpu->data_mem_size_ >> PAGE_SHIFT);
+	cpu->device_count_ = 0;
+	return 0;
+}
+
+int CPU_add_device(CPU* cpu, const Device* device) {
+	if (cpu->device_count_ == CPU_MAX_DEVICES || device->size_ == 0) {
+		return -1;
+	}
+	cpu->devices_[cpu->device_count_++] = *device;
+	uint32_t last = (device->base_ + device->size_ - 1) >> PAGE_SHIFT;
+	for (uint32_t page = device->base_ >> PAGE_SHIFT; page <= last; page++) {
+		cpu->page_attr_[page] = PAGE_MMIO;
+	}
+	return 0;
+}
+
+static Device* CPU_find_device(CPU* cpu, uint32_t addr) {
+	for (size_t i = 0; i < cpu->device_count_; i++) {
+		if (addr - cpu->devices_[i].base_ < cpu->devices_[i].size_) {
+			return &cpu->devices_[i];
+		}
+	}
+	return NULL;
+}
+
+/*[addr, addr + len) beruehrt kein Geraet*/
+static int CPU_device_free(const CPU* cpu, uint32_t addr, uint32_t len) {
+	for (size_t i = 0; i < cpu->device_count_; i++) {
+		const Device* dev = &cpu->devices_[i];
+		if ((uint64_t)addr < (uint64_t)dev->base_ + dev->size_ && (uint64_t)addr + len > dev->base_) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/*RAM im Datenspeicher: RAM- und Codeseiten, auf MMIO-Seiten alles ausserhalb der Geraete*/
+static int CPU_is_ram(const CPU* cpu, uint32_t addr, uint32_t len) {
+	if ((uint64_t)addr + len > cpu->data_mem_size_) return 0;
+	for (uint32_t page = addr >> PAGE_SHIFT; len && page <= (addr + len - 1) >> PAGE_SHIFT; page++) {
+		if (cpu->page_attr_[page] == PAGE_MMIO) return CPU_device_free(cpu, addr, len);
+		if (cpu->page_attr_[page] > PAGE_CODE) return 0;
+	}
+	return 1;
+}
+
+/*Zugriffsfehler: Trap, falls ein Handler eingerichtet ist, sonst anhalten*/
+static void CPU_access_fault(CPU* cpu, uint32_t cause, uint32_t addr) {
+	if (cpu->mtvec_) {
+		CPU_trap(cpu, cause, addr);
+		return;
+	}
+	fflush(stdout);
+	fprintf(stderr, "%s %s at pc %X: address %X\n",
+			cause <= CAUSE_LOAD_ACCESS_FAULT ? "load" : "store",
+			(cause == CAUSE_LOAD_MISALIGNED || cause == CAUSE_STORE_MISALIGNED) ? "address misaligned" : "access fault", cpu->pc_, addr);
+	cpu->halted_ = HALT_FAULT;
+	CPU_reschedule(cpu);
+}
+
+/*Langsamer Pfad fuer Nicht-RAM-Seiten; 0 wenn ein Trap genommen wurde*/
+int CPU_mmio_load(CPU* cpu, uint32_t addr, uint32_t width, uint32_t* value) {
+	Device* dev = CPU_find_device(cpu, addr);
+	if (!dev && CPU_is_ram(cpu, addr, width)) {
+		*value = 0;
+		memcpy(value, cpu->data_mem_ + addr, width);
+		return 1;
+	}
+	if (!dev || !dev->read_[width_index(width)]) {
+		CPU_access_fault(cpu, CAUSE_LOAD_ACCESS_FAULT, addr);
+		return 0;
+	}
+	*value = dev->read_[width_index(width)](cpu, dev, addr - dev->base_);
+	return 1;
+}
+
+int CPU_mmio_store(CPU* cpu, uint32_t addr, uint32_t width, uint32_t value) {
+	Device* dev = CPU_find_device(cpu, addr);
+	if (!dev && CPU_is_ram(cpu, addr, width)) {
+		memcpy(cpu->data_mem_ + addr, &value, width);
+		return 1;
+	}
+	if (!dev || !dev->write_[width_index(width)]) {
+		CPU_access_fault(cpu, CAUSE_STORE_ACCESS_FAULT, addr);
+		return 0;
+	}
+	dev->write_[width_index(width)](cpu, dev, addr - dev->base_, value);
+	return 1;
+}
+
+/*UART: Datenregister schreibt auf stdout und liest von stdin (-1 bei EOF), Statusregister meldet Bereitschaft*/
+static uint32_t uart_read(CPU* cpu, Device* dev, uint32_t offset) {
+	if (offset == UART_DATA) {
+		CPU_spin_reset(cpu); //takes a byte from the input: two equal bytes in a row are not idling
+		int c = CPU_console_getc(cpu);
+		return c < 0 ? 0xFFFFFFFF : (uint32_t)c;
+	}
+	if (offset == UART_STATUS) {
+		return UART_STATUS_TX_READY | (CPU_console_eof(cpu) ? 0 : UART_STATUS_RX_READY);
+	}
+	return 0;
+}
+
+static void uart_write(CPU* cpu, Device* dev, uint32_t offset, uint32_t value) {
+	if (offset == UART_DATA) {
+		CPU_console_putc(cpu, (char)value);
+	}
+}
+
+static uint32_t clint_read(CPU* cpu, Device* dev, uint32_t offset) {
+	uint32_t value;
+	CPU_clint_load(cpu, CLINT_BASE + offset, &value);
+	if (offset >= CLINT_MTIME) {
+		CPU_spin_reset(cpu); //mtime advances without an event, a loop polling it is not idle
+	}
+	return value;
+}
+
+static void clint_write(CPU* cpu, Device* dev, uint32_t offset, uint32_t value) {
+	CPU_clint_store(cpu, CLINT_BASE + offset, value);
+}
+
+/*tohost (HTIF-Konvention): Wert mit gesetztem Bit 0 beendet den Gast mit Exitcode value >> 1*/
+static uint32_t tohost_read(CPU* cpu, Device* dev, uint32_t offset) {
+	return 0;
+}
+
+static void tohost_write(CPU* cpu, Device* dev, uint32_t offset, uint32_t value) {
+	if (offset == 0 && (value & 1)) {
+		cpu->halted_ = HALT_EXIT;
+		cpu->exit_code_ = (int32_t)(value >> 1);
+		CPU_reschedule(cpu);
+	}
+}
+
+/*Blockgeraet: COUNT Sektoren ab SECTOR per DMA zwischen Datei und BUFFER kopieren*/
+typedef struct {
+    int fd_;
+    uint32_t sector_;
+    uint32_t buffer_;
+    uint32_t count_;
+    uint32_t status_;
+    uint32_t capacity_;
+} BlockDevice;
+
+
+static void block_transfer(CPU* cpu, BlockDevice* blk, uint32_t command) {
+	uint64_t len = (uint64_t)blk->count_ * BLOCK_SECTOR_SIZE;
+	off_t pos = (off_t)blk->sector_ * BLOCK_SECTOR_SIZE;
+	if (len > UINT32_MAX || !CPU_is_ram(cpu, blk->buffer_, (uint32_t)len)
+			|| (uint64_t)blk->sector_ + blk->count_ > blk->capacity_) {
+		blk->status_ = 1;
+		return;
+	}
+	uint8_t* p = cpu->data_mem_ + blk->buffer_;
+	ssize_t n = (command == BLOCK_CMD_READ) ? pread(blk->fd_, p, len, pos) : pwrite(blk->fd_, p, len, pos);
+	blk->status_ = (n == (ssize_t)len) ? 0 : 1;
+	if (command == BLOCK_CMD_READ) {
+		CPU_code_written(cpu, blk->buffer_, (uint32_t)len);
+	}
+}
+
+static uint32_t block_read(CPU* cpu, Device* dev, uint32_t offset) {
+	BlockDevice* blk = dev->state_;
+	switch (offset) {
+	case BLOCK_SECTOR: return blk->sector_;
+	case BLOCK_BUFFER: return blk->buffer_;
+	case BLOCK_COUNT: return blk->count_;
+	case BLOCK_STATUS: return blk->status_;
+	case BLOCK_CAPACITY: return blk->capacity_;
+	default: return 0;
+	}
+}
+
+static void block_write(CPU* cpu, Device* dev, uint32_t offset, uint32_t value) {
+	BlockDevice* blk = dev->state_;
+	switch (offset) {
+	case BLOCK_SECTOR: blk->sector_ = value; break;
+	case BLOCK_BUFFER: blk->buffer_ = value; break;
+	case BLOCK_COUNT: blk->count_ = value; break;
+	case BLOCK_COMMAND:
+		if (value == BLOCK_CMD_READ || value == BLOCK_CMD_WRITE) block_transfer(cpu, blk, value);
+		else blk->status_ = 1;
+		break;
+	default: break;
+	}
+}
+
+/*Anzahl zusammenhaengender RAM-Bytes ab addr, hoechstens max*/
+static uint32_t CPU_ram_span(const CPU* cpu, uint32_t addr, uint32_t max) {
+	uint64_t end = (uint64_t)addr + max;
+	if (end > cpu->data_mem_size_) end = cpu->data_mem_size_;
+	uint64_t pos = addr;
+	while (pos < end && cpu->page_attr_[pos >> PAGE_SHIFT] <= PAGE_CODE) {
+		pos = ((pos >> PAGE_SHIFT) + 1) << PAGE_SHIFT;
+	}
+	if (pos > end) pos = end;
+	return pos > addr ? (uint32_t)(pos - addr) : 0;
+}
+
+/*DMA-Geraet: Kopieren (ueberlappend erlaubt), Fuellen und Byte-Suche auf dem Host, nur innerhalb des RAMs*/
+typedef struct {
+    uint32_t src_;
+    uint32_t dst_;
+    uint32_t len_;
+    uint32_t value_;
+    uint32_t status_;
+    uint32_t result_;
+} DmaDevice;
+
+static void dma_execute(CPU* cpu, DmaDevice* dma, uint32_t command) {
+	dma->status_ = 0;
+	switch (command) {
+	case DMA_CMD_COPY:
+		if (!CPU_is_ram(cpu, dma->src_, dma->len_) || !CPU_is_ram(cpu, dma->dst_, dma->len_)) break;
+		memmove(cpu->data_mem_ + dma->dst_, cpu->data_mem_ + dma->src_, dma->len_);
+		CPU_code_written(cpu, dma->dst_, dma->len_);
+		return;
+	case DMA_CMD_FILL:
+		if (!CPU_is_ram(cpu, dma->dst_, dma->len_)) break;
+		memset(cpu->data_mem_ + dma->dst_, (int)(uint8_t)dma->value_, dma->len_);
+		CPU_code_written(cpu, dma->dst_, dma->len_);
+		return;
+	case DMA_CMD_FIND: {
+		//RESULT = offset of the first byte equal to VALUE, LEN if there is none
+		if (!CPU_is_ram(cpu, dma->src_, dma->len_)) break;
+		const uint8_t* p = cpu->data_mem_ + dma->src_;
+		const uint8_t* hit = memchr(p, (int)(uint8_t)dma->value_, dma->len_);
+		dma->result_ = hit ? (uint32_t)(hit - p) : dma->len_;
+		return;
+	}
+	}
+	dma->status_ = 1;
+}
+
+static uint32_t dma_read(CPU* cpu, Device* dev, uint32_t offset) {
+	DmaDevice* dma = dev->state_;
+	switch (offset) {
+	case DMA_SRC: return dma->src_;
+	case DMA_DST: return dma->dst_;
+	case DMA_LEN: return dma->len_;
+	case DMA_VALUE: return dma->value_;
+	case DMA_STATUS: return dma->status_;
+	case DMA_RESULT: return dma->result_;
+	default: return 0;
+	}
+}
+
+static void dma_write(CPU* cpu, Device* dev, uint32_t offset, uint32_t value) {
+	DmaDevice* dma = dev->state_;
+	switch (offset) {
+	case DMA_SRC: dma->src_ = value; break;
+	case DMA_DST: dma->dst_ = value; break;
+	case DMA_LEN: dma->len_ = value; break;
+	case DMA_VALUE: dma->value_ = value; break;
+	case DMA_COMMAND: dma_execute(cpu, dma, value); break;
+	default: break;
+	}
+}
+
+/*Standardgeraete: UART (alle Breiten), CLINT, tohost und DMA (nur Wortzugriffe)*/
+void CPU_init_devices(CPU* cpu) {
+	Device uart = { .name_ = "uart", .base_ = UART_BASE, .size_ = 0x8,
+		.read_ = { uart_read, uart_read, uart_read }, .write_ = { uart_write, uart_write, uart_write } };
+	Device clint = { .name_ = "clint", .base_ = CLINT_BASE, .size_ = CLINT_SIZE,
+		.read_ = { [2] = clint_read }, .write_ = { [2] = clint_write } };
+	Device tohost = { .name_ = "tohost", .base_ = TOHOST_BASE, .size_ = 0x8,
+		.read_ = { [2] = tohost_read }, .write_ = { [2] = tohost_write } };
+	CPU_add_device(cpu, &uart);
+	CPU_add_device(cpu, &clint);
+	CPU_add_device(cpu, &tohost);
+	Device dma = { .name_ = "dma", .base_ = DMA_BASE, .size_ = 0x20, .read_ = { [2] = dma_read }, .write_ = { [2] = dma_write },
+		.state_ = calloc(1, sizeof(DmaDevice)), .release_ = free };
+	CPU_add_device(cpu, &dma);
+}
+
+static void block_release(void* state) {
+	BlockDevice* blk = state;
+	close(blk->fd_);
+	free(blk);
+}
+
+/*Blockgeraet mit einer Host-Datei als Speicher anmelden*/
+int CPU_attach_block_device(CPU* cpu, const char* filename) {
+	int fd = open(filename, O_RDWR | O_CLOEXEC);
+	if (fd < 0) {
+		perror(filename);
+		return -1;
+	}
+	struct stat sb;
+	fstat(fd, &sb);
+	BlockDevice* blk = calloc(1, sizeof(BlockDevice));
+	blk->fd_ = fd;
+	blk->capacity_ = (uint32_t)(sb.st_size / BLOCK_SECTOR_SIZE);
+	Device block = { .name_ = "block", .base_ = BLOCK_BASE, .size_ = 0x18, .read_ = { [2] = block_read }, .write_ = { [2] = block_write },
+		.state_ = blk, .release_ = block_release };
+	if (CPU_add_device(cpu, &block) < 0) {
+		block_release(blk);
+		return -1;
+	}
+	return 0;
+}
+
+/*Bis zu budget Instruktionen ausfuehren; laeuft ohne Abfragen bis zum naechsten Ereignis*/
+void CPU_execute(CPU* cpu);
+void CPU_run_slice_aot(CPU* cpu);
+void CPU_run_slice_models(CPU* cpu);
+void CPU_bbv_interval(CPU* cpu);
+
+int CPU_run(CPU* cpu, uint64_t budget) {
+	uint64_t end = cpu->cycle_ - cpu->idle_cycles_ + budget;
+	cpu->run_end_ = end;
+	for (;;) {
+		if (cpu->smp_ && smp_poll(cpu)) {
+			break;
+		}
+		CPU_service_events(cpu);
+		uint64_t retired = cpu->cycle_ - cpu->idle_cycles_;
+		if (cpu->halted_ || cpu->parked_ || retired >= end) {
+			break;
+		}
+		if (cpu->bbv_ && retired >= cpu->bbv_->next_) {
+			CPU_bbv_interval(cpu);
+		}
+		uint64_t limit = cpu->cycle_ + (end - retired);
+		if (cpu->bbv_ && cpu->bbv_->next_ < end) limit = cpu->cycle_ + (cpu->bbv_->next_ - retired);
+		if (cpu->next_event_ < limit) limit = cpu->next_event_;
+		if (cpu->smp_ && limit > cpu->cycle_ + SMP_QUANTUM) limit = cpu->cycle_ + SMP_QUANTUM;
+		cpu->slice_limit_ = limit;
+		if (cpu->timing_ || cpu->caches_ || cpu->predictors_) {
+			CPU_run_slice_models(cpu);
+			continue;
+		}
+		if (cpu->aot_run_) {
+			CPU_run_slice_aot(cpu);
+			continue;
+		}
+		while (cpu->cycle_ < cpu->slice_limit_) {
+			CPU_execute(cpu);
+			cpu->cycle_++;
+		}
+	}
+	return cpu->halted_;
+}
+
+/*Zustand und Einrichtung von aussen (Bibliotheksschnittstelle)*/
+uint64_t CPU_get_reg(const CPU* cpu, uint32_t reg) {
+	return reg < 32 ? cpu->regfile_[reg] : 0;
+}
+
+void CPU_set_reg(CPU* cpu, uint32_t reg, uint64_t value) {
+	if (reg != 0 && reg < 32) {
+		cpu->regfile_[reg] = (xreg_t)value;
+	}
+}
+
+uint32_t CPU_get_pc(const CPU* cpu) {
+	return cpu->pc_;
+}
+
+int CPU_read_mem(const CPU* cpu, uint32_t addr, void* buffer, uint32_t len) {
+	if (!CPU_is_ram(cpu, addr, len)) {
+		return -1;
+	}
+	memcpy(buffer, cpu->data_mem_ + addr, len);
+	return 0;
+}
+
+int CPU_write_mem(CPU* cpu, uint32_t addr, const void* buffer, uint32_t len) {
+	if (!CPU_is_ram(cpu, addr, len)) {
+		return -1;
+	}
+	memcpy(cpu->data_mem_ + addr, buffer, len);
+	CPU_code_written(cpu, addr, len);
+	return 0;
+}
+
+int CPU_halt_reason(const CPU* cpu) {
+	return cpu->halted_;
+}
+
+int32_t CPU_exit_code(const CPU* cpu) {
+	return cpu->exit_code_;
+}
+
+void CPU_set_console(CPU* cpu, const CPU_Console* console) {
+	cpu->console_ = console ? *console : (CPU_Console){ 0 };
+	cpu->console_eof_ = 0;
+}
+
+void CPU_set_spin_skip(CPU* cpu, int enabled) {
+	cpu->spin_detect_ = enabled != 0;
+}
+
+void CPU_set_misaligned_trap(CPU* cpu, int enabled) {
+	cpu->misaligned_trap_ = enabled != 0;
+}
+
+void CPU_set_symbols(CPU* cpu, const SymbolTable* symbols) {
+	cpu->symbols_ = symbols;
+}
+
+static void* smp_thread(void* arg) {
+	CPU* cpu = arg;
+	CPU_run(cpu, cpu->smp_->budget_);
+	smp_leave(cpu);
+	return NULL;
+}
+
+/*Harts (harts[0] = boot, die anderen aus CPU_create_hart) je auf einem Host-Thread bis zum Ende ausfuehren*/
+int CPU_run_smp(CPU** harts, size_t count, uint64_t budget) {
+	if (count < 1 || count > SMP_MAX_HARTS) {
+		return -1;
+	}
+	Smp* smp = calloc(1, sizeof(Smp));
+	if (!smp) {
+		return -1;
+	}
+	pthread_mutex_init(&smp->lock_, NULL);
+	pthread_cond_init(&smp->wake_, NULL);
+	smp->count_ = smp->running_ = count;
+	smp->budget_ = budget;
+	for (size_t i = 0; i < count; i++) {
+		smp->harts_[i] = harts[i];
+		harts[i]->smp_ = smp;
+		harts[i]->spin_detect_ = 0; //memory a loop polls can change under it
+	}
+	pthread_t threads[SMP_MAX_HARTS];
+	for (size_t i = 0; i < count; i++) {
+		pthread_create(&threads[i], NULL, smp_thread, harts[i]);
+	}
+	for (size_t i = 0; i < count; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	for (size_t i = 0; i < count; i++) {
+		harts[i]->smp_ = NULL;
+	}
+	pthread_cond_destroy(&smp->wake_);
+	pthread_mutex_destroy(&smp->lock_);
+	free(smp);
+	return 0;
+}
+
+
+/**
+ * Instruction fetch Instruction decode, Execute, Memory access, Write back
+ */
+
+/*Vorbereitung (Opcode, Func3, Func7, Registeroperanten und Immediates extrahieren)*/
+ uint8_t get_opcode(uint32_t instruction){
+	 uint32_t instructioncode = (instruction & 0x0000007F);
+	 return instructioncode;
+ }
+
+ uint8_t get_rd(uint32_t instruction) {
+	 uint32_t vorbereitung = (instruction >>7);
+	 uint32_t rd = (vorbereitung & 0x0000001f);
+	 return (uint8_t) rd;
+ }
+
+ uint8_t get_func3(uint32_t instruction) {
+	 uint32_t vorbereitung = (instruction >>12);
+	 uint32_t func3 = (vorbereitung & 0x00000007);
+	 return (uint8_t) func3;
+ }
+
+ uint8_t get_rs1(uint32_t instruction) {
+	 uint32_t vorbereitung = (instruction >> 15);
+	 uint32_t rs1 = (vorbereitung & 0x0000001f);
+	 return (uint8_t) rs1;
+ }
+
+ uint8_t get_rs2(uint32_t instruction) {
+	 uint32_t vorbereitung = (instruction >>20);
+	 uint32_t rs2 = (vorbereitung & 0x0000001f);
+	 return (uint8_t) rs2;
+ }
+
+ uint8_t get_func7(uint32_t instruction) {
+	 uint32_t vorbereitung = (instruction >>25);
+	 uint32_t func7 = (vorbereitung & 0x0000007f);
+	 return (uint8_t) func7;
+ }
+
+
+ uint32_t immediateITyp(uint32_t instruction) {
+	 uint32_t immediate = (instruction >> 20);
+	 if (immediate & 0x800) {
+		 immediate = 0xFFFFF000 | immediate;
+	 }
+	 else;
+	 //printf("Immediate I typ %X\n", immediate);
+	 return immediate;
+ }
+
+ uint8_t shiftimmediate(uint32_t instruction) {
+	 uint32_t immediate = immediateITyp(instruction);
+	 uint8_t shamt = (uint8_t) (immediate & XLEN_SHIFT_MASK);
+	 return shamt;
+ }
+
+ uint32_t immediateStyp(uint32_t instruction) {
+	 uint32_t vorbereitung1 = (instruction & 0x00000F80); //alle bits auer [4:0] sind 0
+	 uint32_t ersterteil = (vorbereitung1 >> 7); //verschiebung um die richtige Position
+	 uint32_t vorbereitung2 = (instruction & 0xFE000000); //alle bits auer [11:5] sind 0
+	 uint32_t zweiterteil = (vorbereitung2 >> 20); //Verschiebung um die richtige Position >>25 aber danach <<5 d.h >>20
+	 uint32_t immediate = (ersterteil | zweiterteil);
+	
+	 if (immediate & 0x800) {
+		 immediate = 0xFFFFF000 | immediate;
+	 }
+	 else;
+	// printf("Immediate S Typ :  %X\n", immediate);
+	 return immediate;
+ }
+
+int32_t immediateBtyp(uint32_t instruction) {
+		 int32_t imm = (0x1E & (uint16_t)(instruction >> 7))
+			 | (0x7E0 & (instruction >> 20))
+			 | (0x800 & (instruction << 4))
+			 | (0x1000 & (instruction >> 19));
+
+		 if (imm & 0x1000) imm = imm | 0xFFFFE000;
+
+		 // printf("Immediate B Typ :  %X\n", immediate);
+		 return imm;
+}
+
+ uint32_t immediateUTyp(uint32_t instruction) {
+	 uint32_t immediate = (instruction & 0xFFFFF000);
+	// printf("Immediate U Typ :  %X\n", immediate);
+	 return immediate;
+ }
+
+ uint32_t immediateJTyp(uint32_t instruction) {
+	 uint32_t vorbereitung1 = (instruction & 0x7FE00000); //alle bits auer [10:1] sind 0
+	 uint32_t vorbereitung2 = (vorbereitung1 >> 20); //verschiebung der [10:1] bits um die richtige Position
+	 uint32_t vorbereitung3 = (instruction & 0x00100000); //alle bits auer [11] sind 0
+	 uint32_t vorbereitung4 = (vorbereitung3 >> 9); //verschiebung des [11] bits um die richtige Position
+	 uint32_t vorbereitung5 = (instruction & 0x000FF000); //alle bits auer [19:12] sind 0
+	 uint32_t vorbereitung6 = (instruction & 0x80000000); //alle bits auer [20] sind 0
+	 uint32_t vorbereitung7 = vorbereitung6 >> 11; //verschiebung um die richtige Position
+	 uint32_t erstesteil = (vorbereitung4 | vorbereitung2); //[11|10:1]
+	 uint32_t immediate = (vorbereitung7 | vorbereitung5 | erstesteil); //[20|19:12|11|10:1]
+
+	 if (immediate & 0x800) {
+		 immediate = 0xFFF00000 | immediate;
+	 }
+	 else;
+	// printf("Immediate J Typ :  %X\n", immediate);
+	 return immediate;
+ }
+
+ /*Vorbereitung Ende*/
+
+ /*Instruktionen*/
+ void lui(CPU* cpu, uint32_t instruction) {
+	 cpu->regfile_[get_rd(instruction)] = SEXT32(immediateUTyp(instruction));
+	 cpu->pc_ = (cpu->pc_ + 4);
+ }
+
+ void auipc(CPU* cpu, uint32_t instruction) {
+	 cpu->regfile_[get_rd(instruction)] = (cpu->pc_ + SEXT32(immediateUTyp(instruction)));
+	 cpu->pc_ = (cpu->pc_ + 4);
+ }
+
+
+ void jal(CPU* cpu, uint32_t instruction) {
+	 cpu->regfile_[get_rd(instruction)] = (cpu->pc_ + 4);
+	 CPU_jump(cpu, cpu->pc_ + ((int32_t)immediateJTyp(instruction)));
+ }
+
+ void jalr(CPU* cpu, uint32_t instruction) {
+	 uint32_t target = (cpu->regfile_[get_rs1(instruction)] + ((int32_t)immediateITyp(instruction))) & ~1u; //before rd, which may be rs1
+	 cpu->regfile_[get_rd(instruction)] = (cpu->pc_ + 4);
+	 CPU_jump(cpu, target);
+ }
+
+ void beq(CPU* cpu, uint32_t instruction) {
+	 if (cpu->regfile_[get_rs1(instruction)] == cpu->regfile_[get_rs2(instruction)]) {
+		 CPU_jump(cpu, cpu->pc_ + ((int32_t)immediateBtyp(instruction)));
+		 cpu->taken_branches_++;
+	 }
+	 else {
+		 cpu->pc_ = (cpu->pc_ + 4);
+	 }
+ }
+
+ void bne(CPU* cpu, uint32_t instruction) {
+	 if (cpu->regfile_[get_rs1(instruction)] != cpu->regfile_[get_rs2(instruction)]) {
+		 CPU_jump(cpu, cpu->pc_ + ((int32_t)immediateBtyp(instruction)));
+		 cpu->taken_branches_++;
+	 }
+	 else {
+		 cpu->pc_ = (cpu->pc_ + 4);
+	 }
+ }
+
+ void blt(CPU* cpu, uint32_t instruction) {
+	 if ((sxreg_t)cpu->regfile_[get_rs1(instruction)] < (sxreg_t)cpu->regfile_[get_rs2(instruction)]) {
+		 CPU_jump(cpu, cpu->pc_ + ((int32_t)immediateBtyp(instruction)));
+		 cpu->taken_branches_++;
+	 }
+	 else {
+		 cpu->pc_ = (cpu->pc_ + 4);
+	 }
+ }
+
+ void bge(CPU* cpu, uint32_t instruction) {
+	 if ((sxreg_t)cpu->regfile_[get_rs1(instruction)] >=(sxreg_t) cpu->regfile_[get_rs2(instruction)]) {
+		 CPU_jump(cpu, cpu->pc_ + ((int32_t)immediateBtyp(instruction)));
+		 cpu->taken_branches_++;
+	 }
+	 else {
+		 cpu->pc_ = (cpu->pc_ + 4);
+	 }
+ }
+
+
+ void bltu(CPU* cpu, uint32_t instruction) {
+	 if (cpu->regfile_[get_rs1(instruction)] < cpu->regfile_[get_rs2(instruction)]) {
+		 CPU_jump(cpu, cpu->pc_ + ((int32_t)immediateBtyp(instruction)));
+		 cpu->taken_branches_++;
+	 }
+	 else {
+		 cpu->pc_ = (cpu->pc_ + 4);
+	 }
+ }
+
+
+ void bgeu(CPU* cpu, uint32_t instruction) {
+	 if (cpu->regfile_[get_rs1(instruction)] >= cpu->regfile_[get_rs2(instruction)]) {
+		 CPU_jump(cpu, cpu->pc_ + ((int32_t)immediateBtyp(instruction)));
+		 cpu->taken_branches_++;
+	 }
+	 else {
+		 cpu->pc_ = (cpu->pc_ + 4);
+	 }
+ }
+
+ /**
+  * Speicherzugriffe der Loads/Stores, eine Funktion je Breite: ausgerichtete Zugriffe auf RAM-Seiten
+  * sind ein memcpy fester Laenge (ein einzelner Move). Alles andere geht ueber mem_access_slow:
+  * Geraete (ausgerichtet, 8 Byte als zwei Wortzugriffe, niederwertiges zuerst) und fehlausgerichtete
+  * Zugriffe, die mit CPU_set_misaligned_trap eine Ausnahme ausloesen und sonst emuliert werden
+  * (nur im RAM, auch ueber Seitengrenzen; sonst Zugriffsfehler). Loads lesen Codeseiten (PAGE_CODE)
+  * direkt, Stores dorthin nehmen den langsamen Pfad und dekodieren die geaenderten Worte neu.
+  */
+ static int mem_access_slow(CPU* cpu, uint32_t addr, uint32_t width, void* value, int store) {
+	 if (addr & (width - 1)) {
+		 if (cpu->misaligned_trap_) {
+			 CPU_access_fault(cpu, store ? CAUSE_STORE_MISALIGNED : CAUSE_LOAD_MISALIGNED, addr);
+			 return 0;
+		 }
+		 if (!CPU_is_ram(cpu, addr, width)) {
+			 CPU_access_fault(cpu, store ? CAUSE_STORE_ACCESS_FAULT : CAUSE_LOAD_ACCESS_FAULT, addr);
+			 return 0;
+		 }
+		 if (store) {
+			 memcpy(cpu->data_mem_ + addr, value, width);
+			 CPU_code_written(cpu, addr, width);
+		 }
+		 else memcpy(value, cpu->data_mem_ + addr, width);
+		 return 1;
+	 }
+	 if (store && cpu->page_attr_[addr >> PAGE_SHIFT] == PAGE_CODE) {
+		 memcpy(cpu->data_mem_ + addr, value, width);
+		 CPU_code_written(cpu, addr, width);
+		 return 1;
+	 }
+	 for (uint32_t done = 0; done < width; done += 4) {
+		 uint32_t part = width < 4 ? width : 4;
+		 uint32_t word = 0;
+		 if (store) {
+			 memcpy(&word, (uint8_t*)value + done, part);
+			 if (!CPU_mmio_store(cpu, addr + done, part, word)) return 0;
+		 }
+		 else {
+			 if (!CPU_mmio_load(cpu, addr + done, part, &word)) return 0;
+			 memcpy((uint8_t*)value + done, &word, part);
+		 }
+	 }
+	 return 1;
+ }
+
+ #define MEM_ACCESS(bits) \
+ static inline int mem_load##bits(CPU* cpu, uint32_t addr, uint##bits##_t* value) { \
+	 if (!(addr & (bits / 8 - 1)) && cpu->page_attr_[addr >> PAGE_SHIFT] <= PAGE_CODE) { \
+		 memcpy(value, cpu->data_mem_ + addr, bits / 8); \
+		 return 1; \
+	 } \
+	 return mem_access_slow(cpu, addr, bits / 8, value, 0); \
+ } \
+ static inline int mem_store##bits(CPU* cpu, uint32_t addr, uint##bits##_t value) { \
+	 if (!(addr & (bits / 8 - 1)) && cpu->page_attr_[addr >> PAGE_SHIFT] == PAGE_RAM) { \
+		 memcpy(cpu->data_mem_ + addr, &value, bits / 8); \
+		 return 1; \
+	 } \
+	 return mem_access_slow(cpu, addr, bits / 8, &value, 1); \
+ }
+
+ MEM_ACCESS(8)
+ MEM_ACCESS(16)
+ MEM_ACCESS(32)
+ MEM_ACCESS(64)
+
+ /*Loads und Stores*/
+ void lb(CPU* cpu, uint32_t instruction) {
+	 uint32_t addr = cpu->regfile_[get_rs1(instruction)] + immediateITyp(instruction);
+	 uint8_t value;
+	 if (!mem_load8(cpu, addr, &value)) {
+		 return;
+	 }
+	 cpu->regfile_[get_rd(instruction)] = (xreg_t)(sxreg_t)(int8_t)value;
+	 cpu->pc_ = (cpu->pc_ + 4);
+ }
+
+ void lh(CPU* cpu, uint32_t instruction) {
+	 uint32_t addr = cpu->regfile_[get_rs1(instruction)] + immediateITyp(instruction);
+	 uint16_t value;
+	 if (!mem_load16(cpu, addr, &value)) {
+		 return;
+	 }
+	 cpu->regfile_[get_rd(instruction)] = (xreg_t)(sxreg_t)(int16_t)value;
+	 cpu->pc_ = (cpu->pc_ + 4);
+ }
+
+ void lw(CPU* cpu, uint32_t instruction) {
+	 uint32_t addr = cpu->regfile_[get_rs1(instruction)] + immediateITyp(instruction);
+	 uint32_t value;
+	 if (!mem_load32(cpu, addr, &value)) {
+		 return;
+	 }
+	 cpu->regfile_[get_rd(instruction)] = SEXT32(value);
+	 cpu->pc_ = (cpu->pc_ + 4);
+ }
+
+ void lbu(CPU* cpu, uint32_t instruction) {
+	 uint32_t addr = cpu->regfile_[get_rs1(instruction)] + immediateITyp(instruction);
+	 uint8_t value;
+	 if (!mem_load8(cpu, addr, &value)) {
+		 return;
+	 }
+	 cpu->regfile_[get_rd(instruction)] = value;
+	 cpu->pc_ = (cpu->pc_ + 4);
+ }
+
+ void lhu(CPU* cpu, uint32_t instruction) {
+	 uint32_t addr = cpu->regfile_[get_rs1(instruction)] + immediateITyp(instruction);
+	 uint16_t value;
+	 if (!mem_load16(cpu, addr, &value)) {
+		 return;
+	 }
+	 cpu->regfile_[get_rd(instruction)] = value;
+	 cpu->pc_ = (cpu->pc_ + 4);
+ }
+
+ void sb(CPU* cpu, uint32_t instruction) {
+	 uint32_t addr = cpu->regfile_[get_rs1(instruction)] + immediateStyp(instruction);
+	 if (!mem_store8(cpu, addr, (uint8_t)cpu->regfile_[get_rs2(instruction)])) {
+		 return;
+	 }
+	 cpu->pc_ = (cpu->pc_ + 4);
+ }
+
+ void sh(CPU* cpu, uint32_t instruction) {
+	 uint32_t addr = cpu->regfile_[get_rs1(instruction)] + immediateStyp(instruction);
+	 if (!mem_store16(cpu, addr, (uint16_t)cpu->regfile_[get_rs2(instruction)])) {
+		 return;
+	 }
+	 cpu->pc_ = (cpu->pc_ + 4);
+ }
+
+ void sw(CPU* cpu, uint32_t instruction) {
+	 uint32_t addr = cpu->regfile_[get_rs1(instruction)] + immediateStyp(instruction);
+	 if (!mem_store32(cpu, addr, (uint32_t)cpu->regfile_[get_rs2(instruction)])) {
+		 return;
+	 }
+	 cpu->pc_ = (cpu->pc_ + 4);
+ }
+
+ void addi(CPU* cpu, uint32_t instruction) {
+	 cpu->regfile_[get_rd(instruction)] = (cpu->regfile_[get_rs1(instruction)] + SEXT32(immediateITyp(instruction)));
+	 cpu->pc_ = (cpu->pc_ + 4);
+ }
+
+ void slti(CPU* cpu, uint32_t instruction) {
+	 cpu->regfile_[get_rd(instruction)] = ((sxreg_t)cpu->regfile_[get_rs1(instruction)] < (int32_t)immediateITyp(instruction));
+	 cpu->pc_ = (cpu->pc_ + 4);
+ }
+
+
+ void sltiu(CPU* cpu, uint32_t instruction) {
+	 cpu->regfile_[get_rd(instruction)] = (cpu->regfile_[get_rs1(instruction)] < SEXT32(immediateITyp(instruction)));
+	 cpu->pc_ = (cpu->pc_ + 4);
+ }
+
+ void xori(CPU* cpu, uint32_t instruction) {
+	 cpu->regfile_[get_rd(instruction)] = (cpu->regfile_[get_rs1(instruction)] ^ SEXT32(immediateITyp(instruction)));
+	 cpu->pc_ = (cpu->pc_ + 4);
+ }
+
+ void ori(CPU* cpu, uint32_t instruction) {
+	 cpu->regfile_[get_rd(instruction)] = (cpu->regfile_[get_rs1(instruction)] | SEXT32(immediateITyp(instruction)));
+	 cpu->pc_ = (cpu->pc_ + 4);
+ }
+
+ void andi(CPU* cpu, uint32_t instruction) {
+	 cpu->regfile_[get_rd(instruction)] = (cpu->regfile_[get_rs1(instruction)] & SEXT32(immediateITyp(instruction)));
+	 cpu->pc_ = (cpu->pc_ + 4);
+ }
+
+ void slli(CPU* cpu, uint32_t instruction) {
+	 cpu->regfile_[get_rd(instruction)] = (cpu->regfile_[get_rs1(instruction)] << shiftimmediate(instruction));
+	 cpu->pc_ = (cpu->pc_ + 4);
+ }
+
+ void srli(CPU* cpu, uint32_t instruction) {
+	 cpu->regfile_[get_rd(instruction)] = (cpu->regfile_[get_rs1(instruction)] >> shiftimmediate(instruction));
+	 cpu->pc_ = (cpu->pc_ + 4);
+ }
+
+
+ void srai(CPU* cpu, uint32_t instruction) {
+	 cpu->regfile_[get_rd(instruction)] = ((sxreg_t)cpu->regfile_[get_rs1(instruction)] >> shiftimmediate(instruction));
+	 cpu->pc_ = (cpu->pc_ + 4);
+ }
+
+ void add(CPU* cpu, uint32_t instruction) {
+	 cpu->regfile_[get_rd(instruction)] = ((cpu->regfile_[get_rs1(instruction)]) + (cpu->regfile_[get_rs2(instruction)]));
+	 cpu->pc_ = (cpu->pc_ + 4);
+ }
+
+ void sub(CPU* cpu, uint32_t instruction) {
+	 cpu->regfile_[get_rd(instruction)] = ((cpu->regfile_[get_rs1(instruction)]) - (cpu->regfile_[get_rs2(instruction)]));
+	 cpu->pc_ = (cpu->pc_ + 4);
+ }
+
+ void sll(CPU* cpu, uint32_t instruction) {
+	 cpu->regfile_[get_rd(instruction)] = ((cpu->regfile_[get_rs1(instruction)]) << (cpu->regfile_[get_rs2(instruction)] & XLEN_SHIFT_MASK));
+	 cpu->pc_ = (cpu->pc_ + 4);
+ }
+
+ void slt(CPU* cpu, uint32_t instruction) {
+	 cpu->regfile_[get_rd(instruction)] = ((sxreg_t)(cpu->regfile_[get_rs1(instruction)]) < ((sxreg_t)(cpu->regfile_[get_rs2(instruction)])));
+	 cpu->pc_ = (cpu->pc_ + 4);
+ }
+
+ void sltu(CPU* cpu, uint32_t instruction) {
+	 cpu->regfile_[get_rd(instruction)] = ((cpu->regfile_[get_rs1(instruction)]) < (cpu->regfile_[get_rs2(instruction)]));
+	 cpu->pc_ = (cpu->pc_ + 4);
+ }
+
+
+ void xorOperation(CPU* cpu, uint32_t instruction) {
+	 cpu->regfile_[get_rd(instruction)] = ((cpu->regfile_[get_rs1(instruction)]) ^ (cpu->regfile_[get_rs2(instruction)]));
+	 cpu->pc_ = (cpu->pc_ + 4);
+ }
+
+ void srl(CPU* cpu, uint32_t instruction) {
+	 cpu->regfile_[get_rd(instruction)] = ((cpu->regfile_[get_rs1(instruction)]) >> (cpu->regfile_[get_rs2(instruction)] & XLEN_SHIFT_MASK));
+	 cpu->pc_ = (cpu->pc_ + 4);
+ }
+
+ void sra(CPU* cpu, uint32_t instruction) {
+	 cpu->regfile_[get_rd(instruction)] = ((sxreg_t)(cpu->regfile_[get_rs1(instruction)]) >> (cpu->regfile_[get_rs2(instruction)] & XLEN_SHIFT_MASK));
+	 cpu->pc_ = (cpu->pc_ + 4);
+ }
+
+ void orOperation(CPU* cpu, uint32_t instruction) {
+	 cpu->regfile_[get_rd(instruction)] = ((cpu->regfile_[get_rs1(instruction)]) | (cpu->regfile_[get_rs2(instruction)]));
+	 cpu->pc_ = (cpu->pc_ + 4);
+ }
+
+ void andOparation(CPU* cpu, uint32_t instruction) {
+	 cpu->regfile_[get_rd(instruction)] = ((cpu->regfile_[get_rs1(instruction)]) & (cpu->regfile_[get_rs2(instruction)]));
+	 cpu->pc_ = (cpu->pc_ + 4);
+ }
+
+#if RV_XLEN == 64
+ /*RV64I: lwu, ld, sd und die *w-Operationen (rechnen auf 32 Bit, Ergebnis vorzeichenerweitert)*/
+ void lwu(CPU* cpu, uint32_t instruction) {
+	 uint32_t addr = cpu->regfile_[get_rs1(instruction)] + immediateITyp(instruction);
+	 uint32_t value;
+	 if (!mem_load32(cpu, addr, &value)) {
+		 return;
+	 }
+	 cpu->regfile_[get_rd(instruction)] = value;
+	 cpu->pc_ = (cpu->pc_ + 4);
+ }
+
+ void ld(CPU* cpu, uint32_t instruction) {
+	 uint32_t addr = cpu->regfile_[get_rs1(instruction)] + immediateITyp(instruction);
+	 uint64_t value;
+	 if (!mem_load64(cpu, addr, &value)) {
+		 return;
+	 }
+	 cpu->regfile_[get_rd(instruction)] = value;
+	 cpu->pc_ = (cpu->pc_ + 4);
+ }
+
+ void sd(CPU* cpu, uint32_t instruction) {
+	 uint32_t addr = cpu->regfile_[get_rs1(instruction)] + immediateStyp(instruction);
+	 if (!mem_store64(cpu, addr, (uint64_t)cpu->regfile_[get_rs2(instruction)])) {
+		 return;
+	 }
+	 cpu->pc_ = (cpu->pc_ + 4);
+ }
+
+ void addiw(CPU* cpu, uint32_t instruction) {
+	 cpu->regfile_[get_rd(instruction)] = SEXT32((uint32_t)cpu->regfile_[get_rs1(instruction)] + immediateITyp(instruction));
+	 cpu->pc_ = (cpu->pc_ + 4);
+ }
+
+ void slliw(CPU* cpu, uint32_t instruction) {
+	 cpu->regfile_[get_rd(instruction)] = SEXT32((uint32_t)cpu->regfile_[get_rs1(instruction)] << (shiftimmediate(instruction) & 0x1f));
+	 cpu->pc_ = (cpu->pc_ + 4);
+ }
+
+ void srliw(CPU* cpu, uint32_t instruction) {
+	 cpu->regfile_[get_rd(instruction)] = SEXT32((uint32_t)cpu->regfile_[get_rs1(instruction)] >> (shiftimmediate(instruction) & 0x1f));
+	 cpu->pc_ = (cpu->pc_ + 4);
+ }
+
+ void sraiw(CPU* cpu, uint32_t instruction) {
+	 cpu->regfile_[get_rd(instruction)] = SEXT32((int32_t)cpu->regfile_[get_rs1(instruction)] >> (shiftimmediate(instruction) & 0x1f));
+	 cpu->pc_ = (cpu->pc_ + 4);
+ }
+
+ void addw(CPU* cpu, uint32_t instruction) {
+	 cpu->regfile_[get_rd(instruction)] = SEXT32((uint32_t)cpu->regfile_[get_rs1(instruction)] + (uint32_t)cpu->regfile_[get_rs2(instruction)]);
+	 cpu->pc_ = (cpu->pc_ + 4);
+ }
+
+ void subw(CPU* cpu, uint32_t instruction) {
+	 cpu->regfile_[get_rd(instruction)] = SEXT32((uint32_t)cpu->regfile_[get_rs1(instruction)] - (uint32_t)cpu->regfile_[get_rs2(instruction)]);
+	 cpu->pc_ = (cpu->pc_ + 4);
+ }
+
+ void sllw(CPU* cpu, uint32_t instruction) {
+	 cpu->regfile_[get_rd(instruction)] = SEXT32((uint32_t)cpu->regfile_[get_rs1(instruction)] << (cpu->regfile_[get_rs2(instruction)] & 0x1f));
+	 cpu->pc_ = (cpu->pc_ + 4);
+ }
+
+ void srlw(CPU* cpu, uint32_t instruction) {
+	 cpu->regfile_[get_rd(instruction)] = SEXT32((uint32_t)cpu->regfile_[get_rs1(instruction)] >> (cpu->regfile_[get_rs2(instruction)] & 0x1f));
+	 cpu->pc_ = (cpu->pc_ + 4);
+ }
+
+ void sraw(CPU* cpu, uint32_t instruction) {
+	 cpu->regfile_[get_rd(instruction)] = SEXT32((int32_t)cpu->regfile_[get_rs1(instruction)] >> (cpu->regfile_[get_rs2(instruction)] & 0x1f));
+	 cpu->pc_ = (cpu->pc_ + 4);
+ }
+#endif
+ 
+ void ecall(CPU* cpu, uint32_t instruction) {
+	 CPU_syscall(cpu);
+	 cpu->pc_ = (cpu->pc_ + 4);
+ }
+
+ void ebreak(CPU* cpu, uint32_t instruction) {
+	 cpu->halted_ = HALT_EBREAK; //sbreak am Ende von start.S
+	 CPU_reschedule(cpu);
+ }
+
+ void mret(CPU* cpu, uint32_t instruction) {
+	 cpu->mstatus_ = (cpu->mstatus_ & ~MSTATUS_MIE) | ((cpu->mstatus_ & MSTATUS_MPIE) ? MSTATUS_MIE : 0) | MSTATUS_MPIE;
+	 CPU_jump(cpu, cpu->mepc_);
+	 CPU_reschedule(cpu);
+ }
+
+ void wfi(CPU* cpu, uint32_t instruction) {
+	 CPU_wait_for_interrupt(cpu);
+	 cpu->pc_ = (cpu->pc_ + 4);
+ }
+
+ /*Zicsr: rd = alter Wert, dann schreiben (w), Bits setzen (s) oder loeschen (c); rs1 = x0 bzw. uimm = 0 schreibt nicht*/
+ void csr_operation(CPU* cpu, uint32_t instruction, xreg_t operand, int kind, int writes) {
+	 uint32_t csr = instruction >> 20;
+	 xreg_t old;
+	 if (!CPU_csr_read(cpu, csr, &old) || (writes && (csr >> 10) == 3)) { //0xC00-0xFFF are read-only
+		 CPU_illegal_instruction(cpu, instruction);
+		 return;
+	 }
+	 if (writes) {
+		 xreg_t value = (kind == 0) ? operand : (kind == 1) ? (old | operand) : (old & ~operand);
+		 CPU_csr_write(cpu, csr, value);
+	 }
+	 cpu->regfile_[get_rd(instruction)] = old;
+	 cpu->pc_ = (cpu->pc_ + 4);
+ }
+
+ void csrrw(CPU* cpu, uint32_t instruction) {
+	 csr_operation(cpu, instruction, cpu->regfile_[get_rs1(instruction)], 0, 1);
+ }
+
+ void csrrs(CPU* cpu, uint32_t instruction) {
+	 csr_operation(cpu, instruction, cpu->regfile_[get_rs1(instruction)], 1, get_rs1(instruction) != 0);
+ }
+
+ void csrrc(CPU* cpu, uint32_t instruction) {
+	 csr_operation(cpu, instruction, cpu->regfile_[get_rs1(instruction)], 2, get_rs1(instruction) != 0);
+ }
+
+ void csrrwi(CPU* cpu, uint32_t instruction) {
+	 csr_operation(cpu, instruction, get_rs1(instruction), 0, 1);
+ }
+
+ void csrrsi(CPU* cpu, uint32_t instruction) {
+	 csr_operation(cpu, instruction, get_rs1(instruction), 1, get_rs1(instruction) != 0);
+ }
+
+ void csrrci(CPU* cpu, uint32_t instruction) {
+	 csr_operation(cpu, instruction, get_rs1(instruction), 2, get_rs1(instruction) != 0);
+ }
+
+ /*fence: Gastspeicher ist Host-Speicher, zwischen Harts genuegt ein Host-Fence. fence.i gleicht mit Code
+   im RAM den ganzen Codebereich ab (Schreibzugriffe anderer Harts und von Systemaufrufen), sonst leer*/
+ void fence(CPU* cpu, uint32_t instruction) {
+	 if (cpu->smp_) {
+		 atomic_thread_fence(memory_order_seq_cst);
+	 }
+	 cpu->pc_ = (cpu->pc_ + 4);
+ }
+
+ void fence_i(CPU* cpu, uint32_t instruction) {
+	 CPU_code_written(cpu, 0, cpu->code_end_);
+	 cpu->pc_ = (cpu->pc_ + 4);
+ }
+
+ /**
+  * A-Erweiterung: lr/sc und amo*.w als Host-Atomics (seq_cst, deckt aq/rl ab) direkt auf dem
+  * gemeinsamen data_mem_. sc.w ist ein compare-and-swap gegen den von lr.w gelesenen Wert.
+  * Nur ausgerichtete RAM-Woerter; alles andere ist ein Zugriffsfehler (auch fehlausgerichtet).
+  */
+ static _Atomic uint32_t* amo_word(CPU* cpu, uint32_t addr, uint32_t cause) {
+	 if ((addr & 3) || !CPU_is_ram(cpu, addr, 4)) {
+		 CPU_access_fault(cpu, cause, addr);
+		 return NULL;
+	 }
+	 return (_Atomic uint32_t*)(cpu->data_mem_ + addr);
+ }
+
+ void lr_w(CPU* cpu, uint32_t instruction) {
+	 uint32_t addr = cpu->regfile_[get_rs1(instruction)];
+	 _Atomic uint32_t* word = amo_word(cpu, addr, CAUSE_LOAD_ACCESS_FAULT);
+	 if (!word) return;
+	 cpu->lr_value_ = atomic_load(word);
+	 cpu->lr_addr_ = addr;
+	 cpu->lr_valid_ = 1;
+	 cpu->regfile_[get_rd(instruction)] = SEXT32(cpu->lr_value_);
+	 cpu->regfile_[0] = 0;
+	 cpu->pc_ = (cpu->pc_ + 4);
+ }
+
+ void sc_w(CPU* cpu, uint32_t instruction) {
+	 uint32_t addr = cpu->regfile_[get_rs1(instruction)];
+	 _Atomic uint32_t* word = amo_word(cpu, addr, CAUSE_STORE_ACCESS_FAULT);
+	 if (!word) return;
+	 uint32_t expected = cpu->lr_value_;
+	 int stored = cpu->lr_valid_ && cpu->lr_addr_ == addr
+		 && atomic_compare_exchange_strong(word, &expected, cpu->regfile_[get_rs2(instruction)]);
+	 cpu->lr_valid_ = 0;
+	 if (stored) CPU_code_written(cpu, addr, 4);
+	 cpu->regfile_[get_rd(instruction)] = stored ? 0 : 1;
+	 cpu->regfile_[0] = 0;
+	 cpu->pc_ = (cpu->pc_ + 4);
+ }
+
+ void amo_w(CPU* cpu, uint32_t instruction) {
+	 uint32_t addr = cpu->regfile_[get_rs1(instruction)];
+	 uint32_t value = cpu->regfile_[get_rs2(instruction)];
+	 _Atomic uint32_t* word = amo_word(cpu, addr, CAUSE_STORE_ACCESS_FAULT);
+	 if (!word) return;
+	 uint32_t old;
+	 switch (instruction >> 27) {
+	 case AMO_SWAP: old = atomic_exchange(word, value); break;
+	 case AMO_ADD: old = atomic_fetch_add(word, value); break;
+	 case AMO_XOR: old = atomic_fetch_xor(word, value); break;
+	 case AMO_AND: old = atomic_fetch_and(word, value); break;
+	 case AMO_OR: old = atomic_fetch_or(word, value); break;
+	 default: { //min/max: compare-and-swap loop
+		 uint32_t kind = instruction >> 27;
+		 old = atomic_load(word);
+		 for (;;) {
+			 int take = (kind == AMO_MIN) ? (int32_t)value < (int32_t)old
+				 : (kind == AMO_MAX) ? (int32_t)value > (int32_t)old
+				 : (kind == AMO_MINU) ? value < old : value > old;
+			 if (!take || atomic_compare_exchange_weak(word, &old, value)) break;
+		 }
+		 break;
+	 }
+	 }
+	 CPU_code_written(cpu, addr, 4);
+	 cpu->regfile_[get_rd(instruction)] = SEXT32(old);
+	 cpu->regfile_[0] = 0;
+	 cpu->pc_ = (cpu->pc_ + 4);
+ }
+
+ /**
+  * F- und D-Erweiterung: fregs_ sind 64 Bit breit, einfach genaue Werte stehen NaN-geboxt in den
+  * unteren 32 Bit (obere Haelfte alle Einsen, sonst gilt der Wert als kanonisches NaN). Gerechnet
+  * wird mit den skalaren SSE-Befehlen des Hosts; fuer andere Rundungsmodi als RNE wird der Host-
+  * Rundungsmodus nur fuer die Dauer der Instruktion umgestellt, die Host-Ausnahmeflags werden
+  * nach fflags uebernommen. Ergebnis-NaNs werden kanonisiert.
+  */
+ enum fp_round { RM_RNE = 0, RM_RTZ = 1, RM_RDN = 2, RM_RUP = 3, RM_RMM = 4, RM_DYN = 7 };
+ enum fp_flag { FFLAG_NX = 0x01, FFLAG_UF = 0x02, FFLAG_OF = 0x04, FFLAG_DZ = 0x08, FFLAG_NV = 0x10 };
+ enum fp_operation { FP_ADD, FP_SUB, FP_MUL, FP_DIV, FP_SQRT, FP_MIN, FP_MAX };
+ #define FP_BOX 0xFFFFFFFF00000000ull
+ #define FP_CANONICAL_NAN_S 0x7FC00000u
+ #define FP_CANONICAL_NAN_D 0x7FF8000000000000ull
+
+ static int fp_double(uint32_t instruction) {
+	 return (instruction >> 25) & 1; //fmt: 0 = S, 1 = D
+ }
+
+ static uint32_t fp_bits_s(const CPU* cpu, uint32_t reg) {
+	 uint64_t value = cpu->fregs_[reg];
+	 return (value & FP_BOX) == FP_BOX ? (uint32_t)value : FP_CANONICAL_NAN_S;
+ }
+
+ static float fp_get_s(const CPU* cpu, uint32_t reg) {
+	 uint32_t bits = fp_bits_s(cpu, reg);
+	 float value;
+	 memcpy(&value, &bits, 4);
+	 return value;
+ }
+
+ static double fp_get_d(const CPU* cpu, uint32_t reg) {
+	 double value;
+	 memcpy(&value, &cpu->fregs_[reg], 8);
+	 return value;
+ }
+
+ static void fp_set_bits_s(CPU* cpu, uint32_t reg, uint32_t bits) {
+	 cpu->fregs_[reg] = FP_BOX | bits;
+ }
+
+ static void fp_set_s(CPU* cpu, uint32_t reg, float value) {
+	 uint32_t bits;
+	 memcpy(&bits, &value, 4);
+	 fp_set_bits_s(cpu, reg, isnan(value) ? FP_CANONICAL_NAN_S : bits);
+ }
+
+ static void fp_set_d(CPU* cpu, uint32_t reg, double value) {
+	 uint64_t bits;
+	 memcpy(&bits, &value, 8);
+	 cpu->fregs_[reg] = isnan(value) ? FP_CANONICAL_NAN_D : bits;
+ }
+
+ static int fp_signaling_s(float value) {
+	 uint32_t bits;
+	 memcpy(&bits, &value, 4);
+	 return isnan(value) && !(bits & 0x00400000);
+ }
+
+ static int fp_signaling_d(double value) {
+	 uint64_t bits;
+	 memcpy(&bits, &value, 8);
+	 return isnan(value) && !(bits & 0x0008000000000000ull);
+ }
+
+ /*Rundungsmodus der Instruktion aufloesen und auf dem Host einstellen; -1 = ungueltig (illegal)*/
+ static int fp_begin(CPU* cpu, uint32_t instruction) {
+	 static const int host_mode[] = { FE_TONEAREST, FE_TOWARDZERO, FE_DOWNWARD, FE_UPWARD, FE_TOWARDZERO };
+	 int rm = get_func3(instruction);
+	 if (rm == RM_DYN) {
+		 rm = (cpu->fcsr_ >> 5) & 7;
+	 }
+	 if (rm > RM_RMM) {
+		 CPU_illegal_instruction(cpu, instruction);
+		 return -1;
+	 }
+	 if (rm != RM_RNE) {
+		 fesetround(host_mode[rm]); //RMM: truncated in a wider type, see fp_round_away_s
+	 }
+	 feclearexcept(FE_ALL_EXCEPT);
+	 return rm;
+ }
+
+ /*Host-Ausnahmen nach fflags, Rundungsmodus zuruecksetzen, naechste Instruktion*/
+ static void fp_end(CPU* cpu, int rm) {
+	 int raised = fetestexcept(FE_ALL_EXCEPT);
+	 cpu->fcsr_ |= ((raised & FE_INEXACT) ? FFLAG_NX : 0) | ((raised & FE_UNDERFLOW) ? FFLAG_UF : 0)
+		 | ((raised & FE_OVERFLOW) ? FFLAG_OF : 0) | ((raised & FE_DIVBYZERO) ? FFLAG_DZ : 0)
+		 | ((raised & FE_INVALID) ? FFLAG_NV : 0);
+	 if (rm != RM_RNE) {
+		 fesetround(FE_TONEAREST);
+	 }
+	 cpu->pc_ = (cpu->pc_ + 4);
+ }
+
+ /**
+  * RMM (Gleichstand vom Betrag weg) kennt der Host nicht: das Ergebnis wird im breiteren Typ
+  * (double fuer S, long double fuer D) zur Null hin abgeschnitten und hier gerundet. Die Mitte
+  * zwischen zwei Nachbarn ist im breiteren Typ darstellbar, das Abschneiden aendert den Vergleich
+  * mit ihr also nicht. Der Host rundet dabei zur Null hin (fp_begin).
+  */
+ #if LDBL_MANT_DIG <= DBL_MANT_DIG
+ #error "rmm for double precision needs a long double wider than double"
+ #endif
+
+ static float fp_round_away_s(double x) {
+	 volatile float y = (float)x;
+	 if (isfinite(x) && x != (double)y) {
+		 float away = nextafterf(y, copysignf(INFINITY, y));
+		 double gap = isinf(away) ? (double)y - nextafterf(y, 0.0f) : (double)away - y;
+		 if (fabs(x - y) >= fabs(gap) / 2) y = away;
+	 }
+	 return y;
+ }
+
+ static double fp_round_away_d(long double x) {
+	 volatile double y = (double)x;
+	 if (isfinite(x) && x != (long double)y) {
+		 double away = nextafter(y, copysign(INFINITY, y));
+		 long double gap = isinf(away) ? (long double)y - nextafter(y, 0.0) : (long double)away - y;
+		 if (fabsl(x - y) >= fabsl(gap) / 2) y = away;
+	 }
+	 return y;
+ }
+
+ static void fp_arith(CPU* cpu, uint32_t instruction, int operation) {
+	 int rm = fp_begin(cpu, instruction);
+	 if (rm < 0) return;
+	 uint32_t rd = get_rd(instruction), rs1 = get_rs1(instruction), rs2 = get_rs2(instruction);
+	 if (fp_double(instruction)) {
+		 double a = fp_get_d(cpu, rs1), b = fp_get_d(cpu, rs2);
+		 volatile double r; //keeps the operation ahead of fetestexcept
+		 if (rm == RM_RMM) {
+			 long double x = a, y = b;
+			 volatile long double wide;
+			 switch (operation) {
+			 case FP_ADD: wide = x + y; break;
+			 case FP_SUB: wide = x - y; break;
+			 case FP_MUL: wide = x * y; break;
+			 case FP_DIV: wide = x / y; break;
+			 default: wide = sqrtl(x); break;
+			 }
+			 r = fp_round_away_d(wide);
+		 }
+		 else switch (operation) {
+		 case FP_ADD: r = a + b; break;
+		 case FP_SUB: r = a - b; break;
+		 case FP_MUL: r = a * b; break;
+		 case FP_DIV: r = a / b; break;
+		 default: r = sqrt(a); break;
+		 }
+		 fp_set_d(cpu, rd, r);
+	 }
+	 else {
+		 float a = fp_get_s(cpu, rs1), b = fp_get_s(cpu, rs2);
+		 volatile float r;
+		 if (rm == RM_RMM) {
+			 double x = a, y = b;
+			 volatile double wide;
+			 switch (operation) {
+			 case FP_ADD: wide = x + y; break;
+			 case FP_SUB: wide = x - y; break;
+			 case FP_MUL: wide = x * y; break;
+			 case FP_DIV: wide = x / y; break;
+			 default: wide = sqrt(x); break;
+			 }
+			 r = fp_round_away_s(wide);
+		 }
+		 else switch (operation) {
+		 case FP_ADD: r = a + b; break;
+		 case FP_SUB: r = a - b; break;
+		 case FP_MUL: r = a * b; break;
+		 case FP_DIV: r = a / b; break;
+		 default: r = sqrtf(a); break;
+		 }
+		 fp_set_s(cpu, rd, r);
+	 }
+	 fp_end(cpu, rm);
+ }
+
+ /*fmadd/fmsub/fnmsub/fnmadd: (+-rs1 * rs2) +- rs3 mit einer Rundung*/
+ static void fp_fused(CPU* cpu, uint32_t instruction, int negate_product, int negate_addend) {
+	 int rm = fp_begin(cpu, instruction);
+	 if (rm < 0) return;
+	 uint32_t rd = get_rd(instruction), rs1 = get_rs1(instruction), rs2 = get_rs2(instruction), rs3 = instruction >> 27;
+	 if (fp_double(instruction)) {
+		 double a = fp_get_d(cpu, rs1), c = fp_get_d(cpu, rs3);
+		 double b = fp_get_d(cpu, rs2);
+		 volatile double r = (rm == RM_RMM)
+			 ? fp_round_away_d(fmal(negate_product ? -a : a, b, negate_addend ? -c : c))
+			 : fma(negate_product ? -a : a, b, negate_addend ? -c : c);
+		 fp_set_d(cpu, rd, r);
+	 }
+	 else {
+		 float a = fp_get_s(cpu, rs1), c = fp_get_s(cpu, rs3);
+		 float b = fp_get_s(cpu, rs2);
+		 volatile float r = (rm == RM_RMM)
+			 ? fp_round_away_s(fma(negate_product ? -a : a, b, negate_addend ? -c : c))
+			 : fmaf(negate_product ? -a : a, b, negate_addend ? -c : c);
+		 fp_set_s(cpu, rd, r);
+	 }
+	 fp_end(cpu, rm);
+ }
+
+ /*fsgnj/fsgnjn/fsgnjx: Betrag von rs1, Vorzeichen aus rs2 (kind 0), invertiert (1) oder xor (2)*/
+ static void fp_sign_inject(CPU* cpu, uint32_t instruction, int kind) {
+	 uint32_t rd = get_rd(instruction), rs1 = get_rs1(instruction), rs2 = get_rs2(instruction);
+	 if (fp_double(instruction)) {
+		 uint64_t a = cpu->fregs_[rs1], b = cpu->fregs_[rs2], sign = 1ull << 63;
+		 uint64_t s = (kind == 0) ? (b & sign) : (kind == 1) ? (~b & sign) : ((a ^ b) & sign);
+		 cpu->fregs_[rd] = (a & ~sign) | s;
+	 }
+	 else {
+		 uint32_t a = fp_bits_s(cpu, rs1), b = fp_bits_s(cpu, rs2), sign = 1u << 31;
+		 uint32_t s = (kind == 0) ? (b & sign) : (kind == 1) ? (~b & sign) : ((a ^ b) & sign);
+		 fp_set_bits_s(cpu, rd, (a & ~sign) | s);
+	 }
+	 cpu->pc_ = (cpu->pc_ + 4);
+ }
+
+ /*fmin/fmax nach IEEE 754-2019 minimumNumber/maximumNumber: ein NaN-Operand wird ignoriert, -0 < +0*/
+ static void fp_min_max(CPU* cpu, uint32_t instruction, int operation) {
+	 uint32_t rd = get_rd(instruction), rs1 = get_rs1(instruction), rs2 = get_rs2(instruction);
+	 double a, b;
+	 int signaling;
+	 if (fp_double(instruction)) {
+		 a = fp_get_d(cpu, rs1);
+		 b = fp_get_d(cpu, rs2);
+		 signaling = fp_signaling_d(a) || fp_signaling_d(b);
+	 }
+	 else {
+		 float fa = fp_get_s(cpu, rs1), fb = fp_get_s(cpu, rs2);
+		 signaling = fp_signaling_s(fa) || fp_signaling_s(fb);
+		 a = fa; //exact, and min/max of the widened values is the widened min/max
+		 b = fb;
+	 }
+	 double r;
+	 if (isnan(a) || isnan(b)) {
+		 r = isnan(a) ? b : a; //NaN if both are, canonicalised by fp_set_*
+	 }
+	 else if (a == b) {
+		 r = (operation == FP_MIN) == (signbit(a) != 0) ? a : b;
+	 }
+	 else {
+		 r = (operation == FP_MIN) == (a < b) ? a : b;
+	 }
+	 if (fp_double(instruction)) fp_set_d(cpu, rd, r);
+	 else fp_set_s(cpu, rd, (float)r);
+	 cpu->fcsr_ |= signaling ? FFLAG_NV : 0;
+	 cpu->pc_ = (cpu->pc_ + 4);
+ }
+
+ /*feq (leise, NV nur bei sNaN), flt/fle (NV bei jedem NaN)*/
+ static void fp_compare(CPU* cpu, uint32_t instruction) {
+	 uint32_t rs1 = get_rs1(instruction), rs2 = get_rs2(instruction), kind = get_func3(instruction);
+	 double a, b;
+	 int signaling;
+	 if (fp_double(instruction)) {
+		 a = fp_get_d(cpu, rs1);
+		 b = fp_get_d(cpu, rs2);
+		 signaling = fp_signaling_d(a) || fp_signaling_d(b);
+	 }
+	 else {
+		 float fa = fp_get_s(cpu, rs1), fb = fp_get_s(cpu, rs2);
+		 signaling = fp_signaling_s(fa) || fp_signaling_s(fb);
+		 a = fa;
+		 b = fb;
+	 }
+	 int unordered = isnan(a) || isnan(b);
+	 uint32_t result = 0;
+	 if (!unordered) {
+		 result = (kind == 2) ? (a == b) : (kind == 1) ? (a < b) : (a <= b);
+	 }
+	 if (signaling || (unordered && kind != 2)) {
+		 cpu->fcsr_ |= FFLAG_NV;
+	 }
+	 cpu->regfile_[get_rd(instruction)] = result;
+	 cpu->pc_ = (cpu->pc_ + 4);
+ }
+
+ /*fcvt.w[u].{s,d}: nach rm runden, ausserhalb des Bereichs (und NaN) saettigen mit NV*/
+ static void fp_to_int(CPU* cpu, uint32_t instruction, int is_unsigned) {
+	 int rm = get_func3(instruction);
+	 if (rm == RM_DYN) {
+		 rm = (cpu->fcsr_ >> 5) & 7;
+	 }
+	 if (rm > RM_RMM) {
+		 CPU_illegal_instruction(cpu, instruction);
+		 return;
+	 }
+	 double x = fp_double(instruction) ? fp_get_d(cpu, get_rs1(instruction)) : fp_get_s(cpu, get_rs1(instruction));
+	 double r = (rm == RM_RTZ) ? trunc(x) : (rm == RM_RDN) ? floor(x) : (rm == RM_RUP) ? ceil(x)
+		 : (rm == RM_RMM) ? round(x) : nearbyint(x);
+	 double low = is_unsigned ? 0.0 : -2147483648.0, high = is_unsigned ? 4294967295.0 : 2147483647.0;
+	 uint32_t result;
+	 if (isnan(x) || r > high) {
+		 result = is_unsigned ? 0xFFFFFFFF : 0x7FFFFFFF;
+		 cpu->fcsr_ |= FFLAG_NV;
+	 }
+	 else if (r < low) {
+		 result = is_unsigned ? 0 : 0x80000000;
+		 cpu->fcsr_ |= FFLAG_NV;
+	 }
+	 else {
+		 result = is_unsigned ? (uint32_t)r : (uint32_t)(int32_t)r;
+		 cpu->fcsr_ |= (r != x) ? FFLAG_NX : 0;
+	 }
+	 cpu->regfile_[get_rd(instruction)] = SEXT32(result); //also fcvt.wu
+	 cpu->pc_ = (cpu->pc_ + 4);
+ }
+
+ static void fp_from_int(CPU* cpu, uint32_t instruction, int is_unsigned) {
+	 int rm = fp_begin(cpu, instruction);
+	 if (rm < 0) return;
+	 uint32_t x = cpu->regfile_[get_rs1(instruction)];
+	 if (fp_double(instruction)) {
+		 fp_set_d(cpu, get_rd(instruction), is_unsigned ? (double)x : (double)(int32_t)x); //exact
+	 }
+	 else {
+		 double exact = is_unsigned ? (double)x : (double)(int32_t)x;
+		 volatile float r = (rm == RM_RMM) ? fp_round_away_s(exact) : (float)exact;
+		 fp_set_s(cpu, get_rd(instruction), r);
+	 }
+	 fp_end(cpu, rm);
+ }
+
+ static uint32_t fp_classify(double x, int signaling) {
+	 int negative = signbit(x) != 0;
+	 switch (fpclassify(x)) {
+	 case FP_INFINITE: return negative ? 1u << 0 : 1u << 7;
+	 case FP_NORMAL: return negative ? 1u << 1 : 1u << 6;
+	 case FP_SUBNORMAL: return negative ? 1u << 2 : 1u << 5;
+	 case FP_ZERO: return negative ? 1u << 3 : 1u << 4;
+	 default: return signaling ? 1u << 8 : 1u << 9;
+	 }
+ }
+
+ void flw(CPU* cpu, uint32_t instruction) {
+	 uint32_t addr = cpu->regfile_[get_rs1(instruction)] + immediateITyp(instruction);
+	 uint32_t value;
+	 if (!mem_load32(cpu, addr, &value)) {
+		 return;
+	 }
+	 fp_set_bits_s(cpu, get_rd(instruction), value);
+	 cpu->pc_ = (cpu->pc_ + 4);
+ }
+
+ void fld(CPU* cpu, uint32_t instruction) {
+	 uint32_t addr = cpu->regfile_[get_rs1(instruction)] + immediateITyp(instruction);
+	 uint64_t value;
+	 if (!mem_load64(cpu, addr, &value)) {
+		 return;
+	 }
+	 cpu->fregs_[get_rd(instruction)] = value;
+	 cpu->pc_ = (cpu->pc_ + 4);
+ }
+
+ void fsw(CPU* cpu, uint32_t instruction) {
+	 uint32_t addr = cpu->regfile_[get_rs1(instruction)] + immediateStyp(instruction);
+	 if (!mem_store32(cpu, addr, (uint32_t)cpu->fregs_[get_rs2(instruction)])) {
+		 return;
+	 }
+	 cpu->pc_ = (cpu->pc_ + 4);
+ }
+
+ void fsd(CPU* cpu, uint32_t instruction) {
+	 uint32_t addr = cpu->regfile_[get_rs1(instruction)] + immediateStyp(instruction);
+	 if (!mem_store64(cpu, addr, cpu->fregs_[get_rs2(instruction)])) {
+		 return;
+	 }
+	 cpu->pc_ = (cpu->pc_ + 4);
+ }
+
+ void fmadd(CPU* cpu, uint32_t instruction) {
+	 fp_fused(cpu, instruction, 0, 0);
+ }
+ void fmsub(CPU* cpu, uint32_t instruction) {
+	 fp_fused(cpu, instruction, 0, 1);
+ }
+ void fnmsub(CPU* cpu, uint32_t instruction) {
+	 fp_fused(cpu, instruction, 1, 0);
+ }
+ void fnmadd(CPU* cpu, uint32_t instruction) {
+	 fp_fused(cpu, instruction, 1, 1);
+ }
+ void fadd(CPU* cpu, uint32_t instruction) {
+	 fp_arith(cpu, instruction, FP_ADD);
+ }
+ void fsub(CPU* cpu, uint32_t instruction) {
+	 fp_arith(cpu, instruction, FP_SUB);
+ }
+ void fmul(CPU* cpu, uint32_t instruction) {
+	 fp_arith(cpu, instruction, FP_MUL);
+ }
+ void fdiv(CPU* cpu, uint32_t instruction) {
+	 fp_arith(cpu, instruction, FP_DIV);
+ }
+ void fsqrt(CPU* cpu, uint32_t instruction) {
+	 fp_arith(cpu, instruction, FP_SQRT);
+ }
+ void fsgnj(CPU* cpu, uint32_t instruction) {
+	 fp_sign_inject(cpu, instruction, get_func3(instruction));
+ }
+ void fmin_max(CPU* cpu, uint32_t instruction) {
+	 fp_min_max(cpu, instruction, get_func3(instruction) ? FP_MAX : FP_MIN);
+ }
+ void fcmp(CPU* cpu, uint32_t instruction) {
+	 fp_compare(cpu, instruction);
+ }
+ void fcvt_w(CPU* cpu, uint32_t instruction) {
+	 fp_to_int(cpu, instruction, get_rs2(instruction) == 1);
+ }
+ void fcvt_f_w(CPU* cpu, uint32_t instruction) {
+	 fp_from_int(cpu, instruction, get_rs2(instruction) == 1);
+ }
+
+ /*fcvt.s.d (fmt S, Quelle D) und fcvt.d.s (fmt D, Quelle S)*/
+ void fcvt_f_f(CPU* cpu, uint32_t instruction) {
+	 int rm = fp_begin(cpu, instruction);
+	 if (rm < 0) return;
+	 if (fp_double(instruction)) {
+		 volatile double r = fp_get_s(cpu, get_rs1(instruction));
+		 fp_set_d(cpu, get_rd(instruction), r);
+	 }
+	 else {
+		 double x = fp_get_d(cpu, get_rs1(instruction));
+		 volatile float r = (rm == RM_RMM) ? fp_round_away_s(x) : (float)x;
+		 fp_set_s(cpu, get_rd(instruction), r);
+	 }
+	 fp_end(cpu, rm);
+ }
+
+ /*fmv.x.w (funct3 0) und fclass (funct3 1)*/
+ void fmv_x_fclass(CPU* cpu, uint32_t instruction) {
+	 uint32_t rs1 = get_rs1(instruction);
+	 uint32_t result;
+	 if (get_func3(instruction) == 0) {
+		 result = (uint32_t)cpu->fregs_[rs1];
+	 }
+	 else if (fp_double(instruction)) {
+		 double x = fp_get_d(cpu, rs1);
+		 result = fp_classify(x, fp_signaling_d(x));
+	 }
+	 else {
+		 float x = fp_get_s(cpu, rs1);
+		 result = fp_classify(x, fp_signaling_s(x));
+	 }
+	 cpu->regfile_[get_rd(instruction)] = SEXT32(result);
+	 cpu->pc_ = (cpu->pc_ + 4);
+ }
+
+ void fmv_w_x(CPU* cpu, uint32_t instruction) {
+	 fp_set_bits_s(cpu, get_rd(instruction), cpu->regfile_[get_rs1(instruction)]);
+	 cpu->pc_ = (cpu->pc_ + 4);
+ }
+
+ /**
+  * Vektorerweiterung (Teilmenge von RVV 1.0 / Zve32x): SEW 8/16/32, LMUL 1-8, VLEN = RVV_VLEN.
+  * Jede Instruktion arbeitet auf ganzen Registergruppen: Operanden werden in lokale Felder
+  * kopiert, elementweise ohne Verzweigung berechnet und per Maske (v0 bzw. Schwanz ab vl) in
+  * das Zielregister eingeblendet. Diese Schleifen uebersetzt der Compiler in SIMD-Befehle
+  * (SSE2, mit -march=native AVX2). Unit-stride-Zugriffe auf RAM sind ein memcpy.
+  */
+ enum rvv_width { VW_8 = 0, VW_16 = 5, VW_32 = 6 }; //width field of vector loads/stores
+ enum rvv_category { OPIVV = 0, OPMVV = 2, OPIVI = 3, OPIVX = 4, OPMVX = 6, OPCFG = 7 };
+ enum rvv_funct6 {
+	 V_ADD = 0x00, V_SUB = 0x02, V_RSUB = 0x03, V_MINU = 0x04, V_MIN = 0x05, V_MAXU = 0x06, V_MAX = 0x07,
+	 V_AND = 0x09, V_OR = 0x0A, V_XOR = 0x0B, V_MERGE = 0x17,
+	 V_MSEQ = 0x18, V_MSNE = 0x19, V_MSLTU = 0x1A, V_MSLT = 0x1B, V_MSLEU = 0x1C, V_MSLE = 0x1D,
+	 V_MSGTU = 0x1E, V_MSGT = 0x1F, V_SLL = 0x25, V_SRL = 0x28, V_SRA = 0x29,
+	 /*OPMVV/OPMVX*/
+	 V_REDSUM = 0x00, V_REDAND = 0x01, V_REDOR = 0x02, V_REDXOR = 0x03,
+	 V_REDMINU = 0x04, V_REDMIN = 0x05, V_REDMAXU = 0x06, V_REDMAX = 0x07,
+	 V_WXUNARY0 = 0x10, V_MUNARY0 = 0x14,
+	 V_MANDN = 0x18, V_MAND = 0x19, V_MOR = 0x1A, V_MXOR = 0x1B, V_MORN = 0x1C, V_MNAND = 0x1D, V_MNOR = 0x1E, V_MXNOR = 0x1F,
+	 V_MUL = 0x25, V_MACC = 0x2D
+ };
+ #define RVV_MAX_ELEMENTS (8 * RVV_VLENB) //LMUL = 8, SEW = 8
+ /*Elemente eines Registers; Gruppen werden registerweise abgearbeitet, die feste Anzahl vektorisiert schon -O2*/
+ #define RVV_LOOP for (uint32_t i = 0; i < RVV_VLENB / sizeof(T); i++)
+
+ /*Elementbreite in Byte fuer jede Instruktion: T = unsigned, ST = signed (nicht jede braucht beide)*/
+ #define RVV_FOR_SEW(sew, ...) \
+	 switch (sew) { \
+	 case 1: { typedef uint8_t T __attribute__((unused)); typedef int8_t ST __attribute__((unused)); __VA_ARGS__ } break; \
+	 case 2: { typedef uint16_t T __attribute__((unused)); typedef int16_t ST __attribute__((unused)); __VA_ARGS__ } break; \
+	 default: { typedef uint32_t T __attribute__((unused)); typedef int32_t ST __attribute__((unused)); __VA_ARGS__ } break; \
+	 }
+
+ static uint8_t* rvv_reg(CPU* cpu, uint32_t reg) {
+	 return cpu->vregs_[reg];
+ }
+
+ static int rvv_mask_bit(const uint8_t* mask, uint32_t i) {
+	 return (mask[i >> 3] >> (i & 7)) & 1;
+ }
+
+ /*vsetvli/vsetivli/vsetvl*/
+ void vsetvl(CPU* cpu, uint32_t instruction) {
+	 uint32_t rd = get_rd(instruction), rs1 = get_rs1(instruction);
+	 uint32_t vtype, avl;
+	 if (!(instruction >> 31)) { //vsetvli
+		 vtype = (instruction >> 20) & 0x7FF;
+		 avl = cpu->regfile_[rs1];
+	 }
+	 else if ((instruction >> 30) == 3) { //vsetivli
+		 vtype = (instruction >> 20) & 0x3FF;
+		 avl = rs1;
+	 }
+	 else {
+		 vtype = cpu->regfile_[get_rs2(instruction)];
+		 avl = cpu->regfile_[rs1];
+	 }
+	 uint32_t sew = 1u << ((vtype >> 3) & 7), lmul = 1u << (vtype & 7);
+	 if ((vtype & ~0xFFu) || sew > 4 || (vtype & 7) > 3) {
+		 //reserved SEW/LMUL (fractional LMUL, SEW=64) are not implemented
+		 cpu->vtype_ = VTYPE_VILL;
+		 cpu->vl_ = 0;
+	 }
+	 else {
+		 uint32_t vlmax = lmul * RVV_VLENB / sew;
+		 if ((instruction >> 30) != 3 && rs1 == 0) {
+			 avl = rd ? vlmax : cpu->vl_; //rd = x0, rs1 = x0: keep vl
+		 }
+		 cpu->vtype_ = vtype;
+		 cpu->vsew_ = sew;
+		 cpu->vlmul_ = lmul;
+		 cpu->vl_ = avl < vlmax ? avl : vlmax;
+	 }
+	 cpu->regfile_[rd] = cpu->vl_;
+	 cpu->pc_ = (cpu->pc_ + 4);
+ }
+
+ /*Registergruppe muss an LMUL ausgerichtet sein, vtype gueltig*/
+ static int rvv_check(CPU* cpu, uint32_t instruction, uint32_t regs, uint32_t a, uint32_t b, uint32_t c) {
+	 if ((cpu->vtype_ & VTYPE_VILL) || a % regs || b % regs || c % regs) {
+		 CPU_illegal_instruction(cpu, instruction);
+		 return 0;
+	 }
+	 return 1;
+ }
+
+ /*Maske der aktiven Elemente (alle Bits gesetzt bzw. 0) fuer i < count*/
+ static void rvv_active(const CPU* cpu, uint32_t instruction, uint8_t* active, uint32_t count) {
+	 int unmasked = (instruction >> 25) & 1;
+	 for (uint32_t i = 0; i < count; i++) {
+		 active[i] = (i < cpu->vl_ && (unmasked || rvv_mask_bit(cpu->vregs_[0], i))) ? 0xFF : 0;
+	 }
+ }
+
+ /*Maskenbits [0, vl) von vd schreiben, nur fuer aktive Elemente*/
+ static void rvv_write_mask(CPU* cpu, uint32_t vd, const uint8_t* bits, const uint8_t* active) {
+	 uint8_t* d = rvv_reg(cpu, vd);
+	 for (uint32_t i = 0; i < cpu->vl_; i++) {
+		 if (active[i]) {
+			 d[i >> 3] = (uint8_t)((d[i >> 3] & ~(1u << (i & 7))) | (bits[i] << (i & 7)));
+		 }
+	 }
+ }
+
+ /*Ganzzahl-Operationen OPIVV/OPIVX/OPIVI*/
+ void vint(CPU* cpu, uint32_t instruction) {
+	 uint32_t funct6 = instruction >> 26, category = get_func3(instruction);
+	 uint32_t vd = get_rd(instruction), vs1 = get_rs1(instruction), vs2 = get_rs2(instruction);
+	 int is_mask_result = funct6 >= V_MSEQ && funct6 <= V_MSGT;
+	 uint32_t regs = cpu->vlmul_;
+	 if (!rvv_check(cpu, instruction, regs, is_mask_result ? 0 : vd, vs2, category == OPIVV ? vs1 : 0)) return;
+	 uint32_t scalar = (category == OPIVX) ? cpu->regfile_[vs1]
+		 : (funct6 == V_SLL || funct6 == V_SRL || funct6 == V_SRA) ? vs1 : (uint32_t)((int32_t)(vs1 << 27) >> 27);
+	 int merge_mask = funct6 == V_MERGE && !((instruction >> 25) & 1);
+	 uint8_t active[RVV_MAX_ELEMENTS], bits[RVV_MAX_ELEMENTS];
+	 //vmerge writes every element below vl, v0 only selects the source
+	 rvv_active(cpu, instruction | (funct6 == V_MERGE ? 1u << 25 : 0), active, regs * RVV_VLENB / cpu->vsew_);
+	 int supported = 1;
+	 RVV_FOR_SEW(cpu->vsew_, {
+		 T splat[RVV_VLENB / sizeof(T)], r[RVV_VLENB / sizeof(T)], m[RVV_VLENB / sizeof(T)];
+		 T shift = (T)(8 * sizeof(T) - 1);
+		 RVV_LOOP splat[i] = (T)scalar;
+		 for (uint32_t g = 0; g < regs && supported; g++) {
+			 const T* a = (const T*)rvv_reg(cpu, vs2 + g);
+			 const T* b = (category == OPIVV) ? (const T*)rvv_reg(cpu, vs1 + g) : splat;
+			 T* d = (T*)rvv_reg(cpu, vd + g);
+			 uint32_t base = g * (RVV_VLENB / sizeof(T));
+			 const uint8_t* act = active + base;
+			 uint8_t* c = bits + base;
+			 RVV_LOOP m[i] = act[i] ? (T)~(T)0 : 0;
+			 switch (funct6) {
+			 case V_ADD: RVV_LOOP r[i] = a[i] + b[i]; break;
+			 case V_SUB: RVV_LOOP r[i] = a[i] - b[i]; break;
+			 case V_RSUB: RVV_LOOP r[i] = b[i] - a[i]; break;
+			 case V_MINU: RVV_LOOP r[i] = a[i] < b[i] ? a[i] : b[i]; break;
+			 case V_MIN: RVV_LOOP r[i] = (ST)a[i] < (ST)b[i] ? a[i] : b[i]; break;
+			 case V_MAXU: RVV_LOOP r[i] = a[i] > b[i] ? a[i] : b[i]; break;
+			 case V_MAX: RVV_LOOP r[i] = (ST)a[i] > (ST)b[i] ? a[i] : b[i]; break;
+			 case V_AND: RVV_LOOP r[i] = a[i] & b[i]; break;
+			 case V_OR: RVV_LOOP r[i] = a[i] | b[i]; break;
+			 case V_XOR: RVV_LOOP r[i] = a[i] ^ b[i]; break;
+			 case V_SLL: RVV_LOOP r[i] = (T)((uint32_t)a[i] << (b[i] & shift)); break;
+			 case V_SRL: RVV_LOOP r[i] = a[i] >> (b[i] & shift); break;
+			 case V_SRA: RVV_LOOP r[i] = (T)((ST)a[i] >> (b[i] & shift)); break;
+			 case V_MERGE: //vmerge: v0 selects b, else a; vmv.v.*: b
+				 RVV_LOOP r[i] = (!merge_mask || rvv_mask_bit(cpu->vregs_[0], base + i)) ? b[i] : a[i];
+				 break;
+			 case V_MSEQ: RVV_LOOP c[i] = a[i] == b[i]; break;
+			 case V_MSNE: RVV_LOOP c[i] = a[i] != b[i]; break;
+			 case V_MSLTU: RVV_LOOP c[i] = a[i] < b[i]; break;
+			 case V_MSLT: RVV_LOOP c[i] = (ST)a[i] < (ST)b[i]; break;
+			 case V_MSLEU: RVV_LOOP c[i] = a[i] <= b[i]; break;
+			 case V_MSLE: RVV_LOOP c[i] = (ST)a[i] <= (ST)b[i]; break;
+			 case V_MSGTU: RVV_LOOP c[i] = a[i] > b[i]; break;
+			 case V_MSGT: RVV_LOOP c[i] = (ST)a[i] > (ST)b[i]; break;
+			 default: supported = 0; break;
+			 }
+			 if (supported && !is_mask_result) {
+				 RVV_LOOP d[i] = (r[i] & m[i]) | (d[i] & ~m[i]);
+			 }
+		 }
+	 })
+	 if (!supported) {
+		 CPU_illegal_instruction(cpu, instruction);
+		 return;
+	 }
+	 if (is_mask_result) {
+		 rvv_write_mask(cpu, vd, bits, active);
+	 }
+	 cpu->pc_ = (cpu->pc_ + 4);
+ }
+
+ /*Maskenregister-Logik vm<op>.mm, bitweise ueber [0, vl)*/
+ static void rvv_mask_logical(CPU* cpu, uint32_t instruction, uint32_t funct6) {
+	 const uint8_t* a = rvv_reg(cpu, get_rs2(instruction));
+	 const uint8_t* b = rvv_reg(cpu, get_rs1(instruction));
+	 uint8_t bits[RVV_MAX_ELEMENTS], active[RVV_MAX_ELEMENTS];
+	 for (uint32_t i = 0; i < cpu->vl_; i++) {
+		 int x = rvv_mask_bit(a, i), y = rvv_mask_bit(b, i);
+		 switch (funct6) {
+		 case V_MANDN: bits[i] = x & !y; break;
+		 case V_MAND: bits[i] = x & y; break;
+		 case V_MOR: bits[i] = x | y; break;
+		 case V_MXOR: bits[i] = x ^ y; break;
+		 case V_MORN: bits[i] = x | !y; break;
+		 case V_MNAND: bits[i] = !(x & y); break;
+		 case V_MNOR: bits[i] = !(x | y); break;
+		 default: bits[i] = !(x ^ y); break;
+		 }
+		 active[i] = 1;
+	 }
+	 rvv_write_mask(cpu, get_rd(instruction), bits, active);
+ }
+
+ /*Multiplikation, Reduktionen, Maskenoperationen und Skalar-Transfers (OPMVV/OPMVX)*/
+ void vmisc(CPU* cpu, uint32_t instruction) {
+	 uint32_t funct6 = instruction >> 26, category = get_func3(instruction);
+	 uint32_t vd = get_rd(instruction), vs1 = get_rs1(instruction), vs2 = get_rs2(instruction);
+	 uint32_t regs = cpu->vlmul_;
+	 if (cpu->vtype_ & VTYPE_VILL) {
+		 CPU_illegal_instruction(cpu, instruction);
+		 return;
+	 }
+	 uint32_t n = regs * RVV_VLENB / cpu->vsew_;
+	 uint8_t active[RVV_MAX_ELEMENTS];
+	 rvv_active(cpu, instruction, active, n);
+
+	 if (category == OPMVV && funct6 >= V_MANDN && funct6 <= V_MXNOR) {
+		 rvv_mask_logical(cpu, instruction, funct6);
+	 }
+	 else if (category == OPMVV && funct6 == V_WXUNARY0 && (vs1 == 0x10 || vs1 == 0x11)) {
+		 //vcpop.m / vfirst.m
+		 const uint8_t* mask = rvv_reg(cpu, vs2);
+		 uint32_t count = 0, first = 0xFFFFFFFF;
+		 for (uint32_t i = 0; i < cpu->vl_; i++) {
+			 if (active[i] && rvv_mask_bit(mask, i)) {
+				 count++;
+				 if (first == 0xFFFFFFFF) first = i;
+			 }
+		 }
+		 cpu->regfile_[vd] = (vs1 == 0x10) ? count : SEXT32(first);
+	 }
+	 else if (category == OPMVV && funct6 == V_WXUNARY0 && vs1 == 0) {
+		 //vmv.x.s: element 0, sign-extended
+		 RVV_FOR_SEW(cpu->vsew_, { cpu->regfile_[vd] = (xreg_t)(sxreg_t)((ST*)rvv_reg(cpu, vs2))[0]; })
+	 }
+	 else if (category == OPMVX && funct6 == V_WXUNARY0 && vs2 == 0) {
+		 //vmv.s.x
+		 if (cpu->vl_) RVV_FOR_SEW(cpu->vsew_, { ((T*)rvv_reg(cpu, vd))[0] = (T)cpu->regfile_[vs1]; })
+	 }
+	 else if (category == OPMVV && funct6 == V_MUNARY0 && vs1 == 0x11 && vs2 == 0) {
+		 //vid.v
+		 if (!rvv_check(cpu, instruction, regs, vd, 0, 0)) return;
+		 RVV_FOR_SEW(cpu->vsew_, {
+			 for (uint32_t g = 0; g < regs; g++) {
+				 T* d = (T*)rvv_reg(cpu, vd + g);
+				 uint32_t base = g * (RVV_VLENB / sizeof(T));
+				 RVV_LOOP d[i] = active[base + i] ? (T)(base + i) : d[i];
+			 }
+		 })
+	 }
+	 else if (category == OPMVV && funct6 <= V_REDMAX) {
+		 //vred<op>.vs: vd[0] = vs1[0] op vs2[aktive Elemente]
+		 if (!rvv_check(cpu, instruction, regs, 0, vs2, 0)) return;
+		 if (cpu->vl_) RVV_FOR_SEW(cpu->vsew_, {
+			 const T* a = (const T*)rvv_reg(cpu, vs2);
+			 T acc = ((const T*)rvv_reg(cpu, vs1))[0];
+			 for (uint32_t i = 0; i < cpu->vl_; i++) {
+				 T x = a[i];
+				 if (!active[i]) continue;
+				 switch (funct6) {
+				 case V_REDSUM: acc += x; break;
+				 case V_REDAND: acc &= x; break;
+				 case V_REDOR: acc |= x; break;
+				 case V_REDXOR: acc ^= x; break;
+				 case V_REDMINU: acc = x < acc ? x : acc; break;
+				 case V_REDMIN: acc = (ST)x < (ST)acc ? x : acc; break;
+				 case V_REDMAXU: acc = x > acc ? x : acc; break;
+				 default: acc = (ST)x > (ST)acc ? x : acc; break;
+				 }
+			 }
+			 ((T*)rvv_reg(cpu, vd))[0] = acc;
+		 })
+	 }
+	 else if (funct6 == V_MUL || funct6 == V_MACC) {
+		 if (!rvv_check(cpu, instruction, regs, vd, vs2, category == OPMVV ? vs1 : 0)) return;
+		 RVV_FOR_SEW(cpu->vsew_, {
+			 T splat[RVV_VLENB / sizeof(T)], r[RVV_VLENB / sizeof(T)], m[RVV_VLENB / sizeof(T)];
+			 RVV_LOOP splat[i] = (T)cpu->regfile_[vs1];
+			 for (uint32_t g = 0; g < regs; g++) {
+				 const T* a = (const T*)rvv_reg(cpu, vs2 + g);
+				 const T* b = (category == OPMVV) ? (const T*)rvv_reg(cpu, vs1 + g) : splat;
+				 T* d = (T*)rvv_reg(cpu, vd + g);
+				 const uint8_t* act = active + g * (RVV_VLENB / sizeof(T));
+				 RVV_LOOP m[i] = act[i] ? (T)~(T)0 : 0;
+				 if (funct6 == V_MUL) RVV_LOOP r[i] = (T)((uint32_t)a[i] * b[i]);
+				 else RVV_LOOP r[i] = (T)(d[i] + (uint32_t)a[i] * b[i]);
+				 RVV_LOOP d[i] = (r[i] & m[i]) | (d[i] & ~m[i]);
+			 }
+		 })
+	 }
+	 else {
+		 CPU_illegal_instruction(cpu, instruction);
+		 return;
+	 }
+	 cpu->pc_ = (cpu->pc_ + 4);
+ }
+
+ /**
+  * Vektor-Loads/Stores: unit-stride (auch vlm.v/vsm.v) und strided, EEW 8/16/32. Liegt ein
+  * unmaskierter unit-stride-Zugriff ganz im RAM, wird er mit einem memcpy erledigt, sonst
+  * elementweise (MMIO, Maske, Stride).
+  */
+ static void rvv_memory(CPU* cpu, uint32_t instruction, int store) {
+	 uint32_t width = get_func3(instruction), mop = (instruction >> 26) & 3, lumop = get_rs2(instruction);
+	 uint32_t eew = (width == VW_8) ? 1 : (width == VW_16) ? 2 : 4;
+	 uint32_t vd = get_rd(instruction), addr = cpu->regfile_[get_rs1(instruction)];
+	 int mask_transfer = mop == 0 && lumop == 0x0B;
+	 //EMUL = EEW / SEW * LMUL register groups
+	 uint32_t regs = (cpu->vsew_ && !(cpu->vtype_ & VTYPE_VILL)) ? eew * cpu->vlmul_ / cpu->vsew_ : 0;
+	 if ((instruction >> 29) || (mop & 1) || (mop == 0 && lumop != 0 && !mask_transfer)
+			 || (!mask_transfer && (regs == 0 || regs > 8 || vd % regs))
+			 || (mask_transfer && (cpu->vtype_ & VTYPE_VILL))) {
+		 //segments, indexed, whole-register and fault-only-first accesses are not implemented
+		 CPU_illegal_instruction(cpu, instruction);
+		 return;
+	 }
+	 uint32_t count = mask_transfer ? (cpu->vl_ + 7) / 8 : cpu->vl_;
+	 uint32_t stride = (mop == 2) ? cpu->regfile_[get_rs2(instruction)] : eew;
+	 if (mask_transfer) {
+		 eew = 1;
+		 stride = 1;
+	 }
+	 uint8_t* v = rvv_reg(cpu, vd);
+	 uint8_t active[RVV_MAX_ELEMENTS];
+	 int unmasked = mask_transfer || ((instruction >> 25) & 1);
+	 if (unmasked && stride == eew && CPU_is_ram(cpu, addr, count * eew)) {
+		 if (store) {
+			 memcpy(cpu->data_mem_ + addr, v, count * eew);
+			 CPU_code_written(cpu, addr, count * eew);
+		 }
+		 else memcpy(v, cpu->data_mem_ + addr, count * eew);
+		 cpu->pc_ = (cpu->pc_ + 4);
+		 return;
+	 }
+	 for (uint32_t i = 0; i < count; i++) {
+		 active[i] = unmasked || rvv_mask_bit(cpu->vregs_[0], i);
+	 }
+	 for (uint32_t i = 0; i < count; i++, addr += stride) {
+		 if (!active[i]) continue;
+		 uint32_t value = 0;
+		 if (store) {
+			 memcpy(&value, v + i * eew, eew);
+			 if (CPU_is_ram(cpu, addr, eew)) {
+				 memcpy(cpu->data_mem_ + addr, &value, eew);
+				 CPU_code_written(cpu, addr, eew);
+			 }
+			 else if (!CPU_mmio_store(cpu, addr, eew, value)) return;
+		 }
+		 else {
+			 if (CPU_is_ram(cpu, addr, eew)) memcpy(&value, cpu->data_mem_ + addr, eew);
+			 else if (!CPU_mmio_load(cpu, addr, eew, &value)) return;
+			 memcpy(v + i * eew, &value, eew);
+		 }
+	 }
+	 cpu->pc_ = (cpu->pc_ + 4);
+ }
+
+ void vload(CPU* cpu, uint32_t instruction) {
+	 rvv_memory(cpu, instruction, 0);
+ }
+
+ void vstore(CPU* cpu, uint32_t instruction) {
+	 rvv_memory(cpu, instruction, 1);
+ }
+
+ void illegal(CPU* cpu, uint32_t instruction) {
+	 CPU_illegal_instruction(cpu, instruction);
+ }
+ 
+ /*Ende Instruktionen*/
+
+/*Dekodierung: Opcode, Func3 und Func7 werden einmal pro Instruktionswort aufgeloest*/
+void CPU_decode(uint32_t instruction, DecodedInstruction* d) {
+
+	uint32_t opcode = get_opcode(instruction);
+	uint32_t function3 = get_func3(instruction);
+	uint32_t function7 = get_func7(instruction);
+
+	d->op_ = OP_ILLEGAL;
+	d->rd_ = get_rd(instruction);
+	d->rs1_ = get_rs1(instruction);
+	d->rs2_ = get_rs2(instruction);
+	d->imm_ = 0;
+	d->raw_ = instruction;
+	d->flags_ = 0;
+	d->aux_ = 0;
+
+	switch (opcode)
+	{
+	case LUI: //binary: 0110111
+		d->op_ = OP_LUI;
+		d->imm_ = immediateUTyp(instruction);
+		break;
+	case AUIPC: //binary: 0010111
+		d->op_ = OP_AUIPC;
+		d->imm_ = immediateUTyp(instruction);
+		break;
+	case JAL: //binary: 1101111
+		d->op_ = OP_JAL;
+		d->imm_ = immediateJTyp(instruction);
+		break;
+	case JALR: // binary: 1100111
+		d->op_ = OP_JALR;
+		d->imm_ = immediateITyp(instruction);
+		break;
+	case B: //binary: 1100011
+		d->imm_ = (uint32_t)immediateBtyp(instruction);
+		switch (function3) {
+		case 0x0: d->op_ = OP_BEQ; break;
+		case 0x1: d->op_ = OP_BNE; break;
+		case 0x4: d->op_ = OP_BLT; break;
+		case 0x5: d->op_ = OP_BGE; break;
+		case 0x6: d->op_ = OP_BLTU; break;
+		case 0x7: d->op_ = OP_BGEU; break;
+		}
+		break;
+	case L: //binary 0000011
+		d->imm_ = immediateITyp(instruction);
+		switch (function3) {
+		case 0x0: d->op_ = OP_LB; break;
+		case 0x1: d->op_ = OP_LH; break;
+		case 0x2: d->op_ = OP_LW; break;
+		case 0x4: d->op_ = OP_LBU; break;
+		case 0x5: d->op_ = OP_LHU; break;
+#if RV_XLEN == 64
+		case 0x6: d->op_ = OP_LWU; break;
+		case 0x3: d->op_ = OP_LD; break;
+#endif
+		}
+		break;
+	case S: //bianry: 0100011
+		d->imm_ = immediateStyp(instruction);
+		switch (function3) {
+		case 0x0: d->op_ = OP_SB; break;
+		case 0x1: d->op_ = OP_SH; break;
+		case 0x2: d->op_ = OP_SW; break;
+#if RV_XLEN == 64
+		case 0x3: d->op_ = OP_SD; break;
+#endif
+		}
+		break;
+	case I: //binary 0010011
+		d->imm_ = immediateITyp(instruction);
+		switch (function3) {
+		case 0x0: d->op_ = OP_ADDI; break;
+		case 0x2: d->op_ = OP_SLTI; break;
+		case 0x3: d->op_ = OP_SLTIU; break;
+		case 0x4: d->op_ = OP_XORI; break;
+		case 0x6: d->op_ = OP_ORI; break;
+		case 0x7: d->op_ = OP_ANDI; break;
+		case 0x1: //SLLI
+			d->op_ = OP_SLLI;
+			d->imm_ = shiftimmediate(instruction);
+			break;
+		case 0x5:
+			if ((function7 & 0x20) == 0) { //SLRI, bit 25 is shamt[5] on RV64
+				d->op_ = OP_SRLI;
+			}
+			else { //SRAI
+				d->op_ = OP_SRAI;
+			}
+			d->imm_ = shiftimmediate(instruction);
+			break;
+		}
+		break;
+	case R: //binary: 0110011
+		switch (function3) {
+		case 0x0:
+			if (function7 == 0x00) d->op_ = OP_ADD;
+			else if (function7 == 0x20) d->op_ = OP_SUB;
+			break;
+		case 0x1: d->op_ = OP_SLL; break;
+		case 0x2: d->op_ = OP_SLT; break;
+		case 0x3: d->op_ = OP_SLTU; break;
+		case 0x4: d->op_ = OP_XOR; break;
+		case 0x5:
+			if (function7 == 0x00) d->op_ = OP_SRL;
+			else if (function7 == 0x20) d->op_ = OP_SRA;
+			break;
+		case 0x6: d->op_ = OP_OR; break;
+		case 0x7: d->op_ = OP_AND; break;
+		}
+		break;
+#if RV_XLEN == 64
+	case I_32: //binary 0011011
+		d->imm_ = immediateITyp(instruction);
+		if (function3 == 0x0) d->op_ = OP_ADDIW;
+		else if (function3 == 0x1 && function7 == 0x00) d->op_ = OP_SLLIW;
+		else if (function3 == 0x5 && function7 == 0x00) d->op_ = OP_SRLIW;
+		else if (function3 == 0x5 && function7 == 0x20) d->op_ = OP_SRAIW;
+		break;
+	case R_32: //binary 0111011
+		if (function3 == 0x0 && function7 == 0x00) d->op_ = OP_ADDW;
+		else if (function3 == 0x0 && function7 == 0x20) d->op_ = OP_SUBW;
+		else if (function3 == 0x1 && function7 == 0x00) d->op_ = OP_SLLW;
+		else if (function3 == 0x5 && function7 == 0x00) d->op_ = OP_SRLW;
+		else if (function3 == 0x5 && function7 == 0x20) d->op_ = OP_SRAW;
+		break;
+#endif
+	case SYSTEM: //binary: 1110011
+		d->imm_ = instruction >> 20; //csr
+		switch (function3) {
+		case 0x0:
+			if (instruction == 0x00000073) d->op_ = OP_ECALL;
+			else if (instruction == 0x00100073) d->op_ = OP_EBREAK;
+			else if (instruction == 0x30200073) d->op_ = OP_MRET;
+			else if (instruction == 0x10500073) d->op_ = OP_WFI;
+			break;
+		case 0x1: d->op_ = OP_CSRRW; break;
+		case 0x2: d->op_ = OP_CSRRS; break;
+		case 0x3: d->op_ = OP_CSRRC; break;
+		case 0x5: d->op_ = OP_CSRRWI; break;
+		case 0x6: d->op_ = OP_CSRRSI; break;
+		case 0x7: d->op_ = OP_CSRRCI; break;
+		}
+		break;
+	case LOAD_FP: //binary: 0000111
+		d->imm_ = immediateITyp(instruction);
+		if (function3 == 0x2) d->op_ = OP_FLW;
+		else if (function3 == 0x3) d->op_ = OP_FLD;
+		else if (function3 == 0x0 || function3 == 0x5 || function3 == 0x6) d->op_ = OP_VLOAD; //vle8/16/32, vlse, vlm
+		break;
+	case STORE_FP: //binary: 0100111
+		d->imm_ = immediateStyp(instruction);
+		if (function3 == 0x2) d->op_ = OP_FSW;
+		else if (function3 == 0x3) d->op_ = OP_FSD;
+		else if (function3 == 0x0 || function3 == 0x5 || function3 == 0x6) d->op_ = OP_VSTORE;
+		break;
+	case MISC_MEM: //binary: 0001111
+		if (function3 == 0x0) d->op_ = OP_FENCE; //also fence.tso and pause
+		else if (function3 == 0x1) d->op_ = OP_FENCE_I;
+		break;
+	case AMO: //binary: 0101111
+		if (function3 != 0x2) break;
+		switch (instruction >> 27) {
+		case AMO_LR: if (d->rs2_ == 0) d->op_ = OP_LR_W; break;
+		case AMO_SC: d->op_ = OP_SC_W; break;
+		case AMO_ADD: case AMO_SWAP: case AMO_XOR: case AMO_OR: case AMO_AND:
+		case AMO_MIN: case AMO_MAX: case AMO_MINU: case AMO_MAXU: d->op_ = OP_AMO_W; break;
+		}
+		break;
+	case VECTOR: //binary: 1010111
+		switch (function3) {
+		case 0x0: case 0x3: case 0x4: d->op_ = OP_VINT; break; //OPIVV, OPIVI, OPIVX
+		case 0x2: case 0x6: d->op_ = OP_VMISC; break; //OPMVV, OPMVX
+		case 0x7: d->op_ = OP_VSETVL; break;
+		}
+		break;
+	case MADD: case MSUB: case NMSUB: case NMADD:
+		if ((function7 & 3) <= 1) { //fmt S or D
+			d->op_ = (opcode == MADD) ? OP_FMADD : (opcode == MSUB) ? OP_FMSUB : (opcode == NMSUB) ? OP_FNMSUB : OP_FNMADD;
+		}
+		break;
+	case FP_OP: //binary: 1010011
+		if ((function7 & 3) > 1) {
+			break;
+		}
+		switch (function7 >> 2) {
+		case 0x00: d->op_ = OP_FADD; break;
+		case 0x01: d->op_ = OP_FSUB; break;
+		case 0x02: d->op_ = OP_FMUL; break;
+		case 0x03: d->op_ = OP_FDIV; break;
+		case 0x0B: if (d->rs2_ == 0) d->op_ = OP_FSQRT; break;
+		case 0x04: if (function3 <= 2) d->op_ = OP_FSGNJ; break;
+		case 0x05: if (function3 <= 1) d->op_ = OP_FMINMAX; break;
+		case 0x08: if (d->rs2_ == ((function7 & 1) ^ 1)) d->op_ = OP_FCVT_F_F; break; //fcvt.s.d / fcvt.d.s
+		case 0x14: if (function3 <= 2) d->op_ = OP_FCMP; break;
+		case 0x18: if (d->rs2_ <= 1) d->op_ = OP_FCVT_W; break;
+		case 0x1A: if (d->rs2_ <= 1) d->op_ = OP_FCVT_F_W; break;
+		case 0x1C: //fmv.x.w only exists for S on RV32
+			if (d->rs2_ == 0 && (function3 == 1 || (function3 == 0 && function7 == 0x70))) d->op_ = OP_FMV_X_FCLASS;
+			break;
+		case 0x1E: if (d->rs2_ == 0 && function3 == 0 && function7 == 0x78) d->op_ = OP_FMV_W_X; break;
+		}
+		break;
+	}
+	d->base_op_ = d->op_;
+}
+
+static int is_branch(uint8_t op) {
+	return op >= OP_BEQ && op <= OP_BGEU;
+}
+
+/**
+ * Rueckkanten von Warteschleifen markieren: Sprung auf eine hoechstens SPIN_MAX_BODY Worte
+ * fruehere Adresse, dazwischen nur Rechen- und Ladebefehle sowie Verzweigungen aus der
+ * Schleife heraus. Jeder Durchlauf fuehrt dann genau die Worte [Kopf, Rueckkante] aus und
+ * aendert ausser Registern nichts.
+ */
+static void CPU_mark_spin_loop(CPU* cpu, size_t i) {
+	DecodedInstruction* d = &cpu->decoded_[i];
+	if ((d->op_ != OP_JAL && !is_branch(d->op_)) || (int32_t)d->imm_ > 0
+			|| (uint32_t)-(int32_t)d->imm_ / 4 >= SPIN_MAX_BODY || (uint32_t)-(int32_t)d->imm_ / 4 > i) {
+		return;
+	}
+	size_t head = i - (uint32_t)-(int32_t)d->imm_ / 4;
+	uint8_t flags = 0;
+	size_t k;
+	for (k = head; k < i; k++) {
+		const DecodedInstruction* b = &cpu->decoded_[k];
+		if (b->op_ >= OP_LB && b->op_ <= OP_LD) {
+			flags |= SPIN_POLLS;
+		}
+		else if (is_branch(b->op_)) {
+			uint32_t target = k + (int32_t)b->imm_ / 4;
+			if (target >= head && target <= i) {
+				break;
+			}
+		}
+		else if (!(b->op_ == OP_LUI || b->op_ == OP_AUIPC || (b->op_ >= OP_ADDI && b->op_ <= OP_SRAW))) {
+			break;
+		}
+	}
+	if (k == i) {
+		d->op_ = OP_SPIN_BRANCH;
+		d->flags_ = flags | (is_branch(d->base_op_) ? SPIN_CONDITIONAL : 0);
+		d->aux_ = (uint16_t)(i - head + 1);
+	}
+}
+
+static void CPU_mark_spin_loops(CPU* cpu) {
+	for (size_t i = 0; i < cpu->decoded_size_; i++) {
+		CPU_mark_spin_loop(cpu, i);
+	}
+}
+
+int CPU_decode_program(CPU* cpu) {
+	cpu->decoded_size_ = cpu->instr_mem_size_ / 4;
+	size_t size = cpu->decoded_size_ * sizeof(DecodedInstruction) + 1;
+	int kind;
+	cpu->decoded_ = host_alloc(size, cpu->host_pages_, &kind);
+	if (!cpu->decoded_) {
+		return -1;
+	}
+	if (kind != HOST_PAGES_NORMAL) {
+		cpu->decoded_mapping_ = cpu->decoded_;
+		cpu->decoded_mapping_size_ = huge_size(size);
+	}
+	for (size_t i = 0; i < cpu->decoded_size_; i++) {
+		uint32_t instruction;
+		memcpy(&instruction, cpu->instr_mem_ + 4 * i, 4);
+		CPU_decode(instruction, &cpu->decoded_[i]);
+	}
+	CPU_mark_spin_loops(cpu);
+	return 0;
+}
+
+/**
+ * Code im RAM (CPU_enable_code_in_ram): das Programm liegt ab Adresse 0 im Datenspeicher, decoded_
+ * deckt als Cache des RAMs das ganze Fetch-Fenster ab. Dekodiert wird seitenweise, die Seiten des
+ * Abbilds sofort, alle anderen beim ersten Fetch (OP_UNDECODED). Seiten mit dekodiertem Code sind
+ * PAGE_CODE: Stores dorthin verlassen den schnellen Pfad (der nur PAGE_RAM kennt) und kommen in
+ * CPU_code_written, Datenseiten zahlen nichts extra. Neu dekodiert werden nur die Worte, die sich
+ * gegen raw_ geaendert haben, dazu die Warteschleifen, deren Rumpf sie enthalten koennte. Eine
+ * geladene AOT-Uebersetzung gilt fuer das ganze Abbild und wird verworfen. Die Praefixsummen der
+ * Leistungszaehler bleiben die vom Einschalten.
+ */
+#define CODE_WINDOW 0x100000u //CPU_fetch: pc & 0xFFFFF
+
+/*Warteschleifen mit Rueckkante in [first, end) neu bestimmen*/
+static void CPU_remark_spin_loops(CPU* cpu, size_t first, size_t end) {
+	for (size_t i = first; i < end && i < cpu->decoded_size_; i++) {
+		DecodedInstruction* d = &cpu->decoded_[i];
+		if (d->op_ == OP_SPIN_BRANCH) {
+			d->op_ = d->base_op_;
+			d->flags_ = 0;
+			d->aux_ = 0;
+		}
+		CPU_mark_spin_loop(cpu, i);
+	}
+}
+
+/*Seite page des Fetch-Fensters aus dem RAM dekodieren; auf Geraeteseiten liegt kein Code*/
+static void CPU_decode_page(CPU* cpu, uint32_t page) {
+	size_t first = (size_t)page << (PAGE_SHIFT - 2);
+	size_t end = first + (1u << (PAGE_SHIFT - 2));
+	int ram = cpu->page_attr_[page] <= PAGE_CODE;
+	for (size_t i = first; i < end; i++) {
+		uint32_t word = 0;
+		if (ram) memcpy(&word, cpu->data_mem_ + 4 * i, 4);
+		CPU_decode(word, &cpu->decoded_[i]);
+	}
+	if (ram) cpu->page_attr_[page] = PAGE_CODE;
+	CPU_remark_spin_loops(cpu, first, end + SPIN_MAX_BODY);
+}
+
+/*Erster Fetch aus einer Seite: dekodieren, dann die eigentliche Instruktion ausfuehren*/
+void undecoded(CPU* cpu, uint32_t instruction) {
+	CPU_decode_page(cpu, (cpu->pc_ & (CODE_WINDOW - 1)) >> PAGE_SHIFT);
+	CPU_execute(cpu);
+}
+
+void CPU_code_written(CPU* cpu, uint32_t addr, uint32_t len) {
+	if (addr >= cpu->code_end_ || len == 0) {
+		return;
+	}
+	uint64_t stop = (uint64_t)addr + len < cpu->code_end_ ? (uint64_t)addr + len : cpu->code_end_;
+	size_t first = SIZE_MAX, last = 0;
+	for (uint64_t page = addr >> PAGE_SHIFT; page <= (stop - 1) >> PAGE_SHIFT; page++) {
+		if (cpu->page_attr_[page] != PAGE_CODE) {
+			continue;
+		}
+		uint64_t from = (page << PAGE_SHIFT) > addr ? (page << PAGE_SHIFT) : addr;
+		uint64_t to = ((page + 1) << PAGE_SHIFT) < stop ? ((page + 1) << PAGE_SHIFT) : stop;
+		for (size_t i = from / 4; i < (to + 3) / 4; i++) {
+			uint32_t word;
+			memcpy(&word, cpu->data_mem_ + 4 * i, 4);
+			if (word != cpu->decoded_[i].raw_) {
+				CPU_decode(word, &cpu->decoded_[i]);
+				cpu->code_redecoded_++;
+				if (first == SIZE_MAX) first = i;
+				last = i;
+			}
+		}
+	}
+	if (first == SIZE_MAX) {
+		return;
+	}
+	CPU_remark_spin_loops(cpu, first, last + SPIN_MAX_BODY);
+	CPU_spin_reset(cpu);
+	cpu->aot_run_ = NULL;
+}
+
+int CPU_enable_code_in_ram(CPU* cpu) {
+	if (cpu->code_end_) {
+		return 0;
+	}
+	size_t window = (cpu->data_mem_size_ < CODE_WINDOW ? cpu->data_mem_size_ : CODE_WINDOW) / 4;
+	size_t size = window * sizeof(DecodedInstruction);
+	if (cpu->instr_mem_size_ > 4 * window || CPU_data_overlaps_code(cpu, cpu->data_mem_, cpu->instr_mem_size_)) {
+		return -1;
+	}
+	int kind;
+	DecodedInstruction* decoded = host_alloc(size, cpu->host_pages_, &kind);
+	uint8_t* instr = cpu->owns_program_ ? cpu->instr_mem_ : malloc(cpu->instr_mem_size_ ? cpu->instr_mem_size_ : 1);
+	if (!decoded || !instr) {
+		host_free(decoded, size, kind);
+		return -1;
+	}
+	//a clone gets its own copy: the guest changes the code of this CPU only
+	if (!cpu->owns_program_) {
+		memcpy(instr, cpu->instr_mem_, cpu->instr_mem_size_);
+	}
+	size_t image = cpu->instr_mem_size_ / 4;
+	size_t image_end = ((image * 4 + (1u << PAGE_SHIFT) - 1) >> PAGE_SHIFT) << (PAGE_SHIFT - 2);
+	//only the program itself: a clone's decoded_ may already cover pages the source decoded from its own RAM
+	size_t copied = cpu->decoded_size_ < image ? cpu->decoded_size_ : image;
+	memcpy(decoded, cpu->decoded_, copied * sizeof(DecodedInstruction));
+	for (size_t i = copied; i < window; i++) {
+		uint32_t word;
+		memcpy(&word, cpu->data_mem_ + 4 * i, 4);
+		if (i < image_end) CPU_decode(word, &decoded[i]); //rest of the last page of the program
+		else decoded[i] = (DecodedInstruction){ .op_ = OP_UNDECODED, .base_op_ = OP_UNDECODED };
+	}
+	if (cpu->owns_program_) {
+		cpu->instr_mem_ = NULL; //stays, only decoded_ and counter_prefix_ are replaced
+	}
+	CPU_free_program(cpu);
+	cpu->owns_program_ = 1;
+	cpu->instr_mem_ = instr;
+	cpu->decoded_ = decoded;
+	cpu->decoded_size_ = window;
+	if (kind != HOST_PAGES_NORMAL) {
+		cpu->decoded_mapping_ = decoded;
+		cpu->decoded_mapping_size_ = huge_size(size);
+	}
+	CPU_remark_spin_loops(cpu, copied, image_end + SPIN_MAX_BODY);
+	if (CPU_init_counters(cpu) < 0) {
+		CPU_drop_program(cpu);
+		return -1;
+	}
+	for (uint32_t page = 0; page < (uint32_t)(image_end >> (PAGE_SHIFT - 2)); page++) {
+		if (cpu->page_attr_[page] == PAGE_RAM) cpu->page_attr_[page] = PAGE_CODE;
+	}
+	cpu->code_end_ = (uint32_t)(4 * window);
+	CPU_place_code(cpu);
+	return 0;
+}
+
+/*Praefixsummen der Loads/Stores fuer die Leistungszaehler (nicht im Dekodier-Cache, da billig)*/
+int CPU_init_counters(CPU* cpu) {
+	CounterPrefix* p = malloc((cpu->decoded_size_ + 1) * sizeof(CounterPrefix));
+	if (!p) {
+		return -1;
+	}
+	p[0].loads_ = 0;
+	p[0].stores_ = 0;
+	for (size_t i = 0; i < cpu->decoded_size_; i++) {
+		uint8_t op = cpu->decoded_[i].base_op_;
+		p[i + 1].loads_ = p[i].loads_ + ((op >= OP_LB && op <= OP_LD) || op == OP_FLW || op == OP_FLD || op == OP_VLOAD || op == OP_LR_W || op == OP_AMO_W);
+		p[i + 1].stores_ = p[i].stores_ + ((op >= OP_SB && op <= OP_SD) || op == OP_FSW || op == OP_FSD || op == OP_VSTORE || op == OP_SC_W || op == OP_AMO_W);
+	}
+	cpu->counter_prefix_ = p;
+	return 0;
+}
+
+/**
+ * Persistenter Dekodier-Cache: die dekodierte Form eines Instruktionsspeichers wird unter
+ * dem Inhalts-Hash des Abbilds in <dir>/<hash>.rvdc abgelegt. Die Datei enthaelt keine
+ * Zeiger (Operation, Register, Immediate, Rohwort je Wort) und wird beim Warmstart nur per
+ * mmap eingeblendet; Header und Pruefsumme werden vorher kontrolliert.
+ */
+#define DECODE_CACHE_MAGIC "RVDCACHE"
+#define DECODE_CACHE_VERSION 5
+
+typedef struct {
+    char magic_[8];
+    uint32_t version_;
+    uint32_t entry_size_;
+    uint32_t op_count_;
+    uint32_t xlen_; //RV64 decodes more opcodes
+    uint64_t image_hash_;
+    uint64_t image_size_;
+    uint64_t count_;
+    uint64_t checksum_; //hash_words over the entries
+} DecodeCacheHeader;
+
+uint64_t hash_bytes(const void* data, size_t len, uint64_t hash) {
+	const uint8_t* p = data;
+	for (size_t i = 0; i < len; i++) {
+		hash = (hash ^ p[i]) * 0x100000001B3ull;
+	}
+	return hash;
+}
+
+/*Fuer grosse Bereiche: vier unabhaengige Ketten ueber 64-Bit-Worte statt einer Multiplikation je Byte*/
+static uint64_t hash_words(const void* data, size_t len, uint64_t hash) {
+	const uint8_t* p = data;
+	uint64_t lane[4] = { hash, hash + 1, hash + 2, hash + 3 };
+	size_t i = 0;
+	for (; i + 32 <= len; i += 32) {
+		for (int l = 0; l < 4; l++) {
+			uint64_t w;
+			memcpy(&w, p + i + 8 * l, 8);
+			lane[l] = (lane[l] ^ w) * 0x9E3779B97F4A7C15ull;
+			lane[l] ^= lane[l] >> 29;
+		}
+	}
+	hash = hash_bytes(lane, sizeof(lane), hash);
+	return hash_bytes(p + i, len - i, hash);
+}
+
+uint64_t CPU_image_hash(const CPU* cpu) {
+	uint64_t size = cpu->instr_mem_size_;
+	return hash_words(cpu->instr_mem_, cpu->instr_mem_size_, hash_bytes(&size, sizeof(size), HASH_SEED));
+}
+
+static void decode_cache_path(char* path, size_t len, const char* dir, uint64_t hash) {
+	snprintf(path, len, "%s/%016llx.rvdc", dir, (unsigned long long)hash);
+}
+
+/*Dekodierung aus dem Cache einblenden; 0 wenn es keinen gueltigen Eintrag gibt*/
+int CPU_load_decode_cache(CPU* cpu, const char* dir, uint64_t hash) {
+	char path[4096];
+	decode_cache_path(path, sizeof(path), dir, hash);
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return 0;
+	}
+	struct stat sb;
+	DecodeCacheHeader header;
+	size_t count = cpu->instr_mem_size_ / 4;
+	size_t expected = sizeof(header) + count * sizeof(DecodedInstruction);
+	if (fstat(fd, &sb) < 0 || (size_t)sb.st_size != expected
+			|| pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)
+			|| memcmp(header.magic_, DECODE_CACHE_MAGIC, 8) != 0
+			|| header.version_ != DECODE_CACHE_VERSION
+			|| header.entry_size_ != sizeof(DecodedInstruction)
+			|| header.op_count_ != OP_COUNT
+			|| header.xlen_ != RV_XLEN
+			|| header.image_hash_ != hash
+			|| header.image_size_ != cpu->instr_mem_size_
+			|| header.count_ != count) {
+		close(fd);
+		return 0;
+	}
+	//private mapping: later changes to decoded_ never reach the file
+	uint8_t* map = mmap(NULL, expected, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		return 0;
+	}
+	DecodedInstruction* entries = (DecodedInstruction*)(map + sizeof(header));
+	if (hash_words(entries, count * sizeof(DecodedInstruction), HASH_SEED) != header.checksum_) {
+		munmap(map, expected);
+		return 0;
+	}
+	cpu->decoded_ = entries;
+	cpu->decoded_size_ = count;
+	cpu->decoded_mapping_ = map;
+	cpu->decoded_mapping_size_ = expected;
+	return 1;
+}
+
+/*Dekodierung unter dem Hash ablegen (temporaere Datei + rename, damit Leser nie halbe Dateien sehen)*/
+int CPU_store_decode_cache(const CPU* cpu, const char* dir, uint64_t hash) {
+	char path[4096], tmp[4200];
+	decode_cache_path(path, sizeof(path), dir, hash);
+	snprintf(tmp, sizeof(tmp), "%s.%ld.tmp", path, (long)getpid());
+
+	DecodeCacheHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic_, DECODE_CACHE_MAGIC, 8);
+	header.version_ = DECODE_CACHE_VERSION;
+	header.entry_size_ = sizeof(DecodedInstruction);
+	header.op_count_ = OP_COUNT;
+	header.xlen_ = RV_XLEN;
+	header.image_hash_ = hash;
+	header.image_size_ = cpu->instr_mem_size_;
+	header.count_ = cpu->decoded_size_;
+	header.checksum_ = hash_words(cpu->decoded_, cpu->decoded_size_ * sizeof(DecodedInstruction), HASH_SEED);
+
+	FILE* f = fopen(tmp, "wb");
+	if (!f) {
+		return -1;
+	}
+	int ok = fwrite(&header, sizeof(header), 1, f) == 1
+		&& fwrite(cpu->decoded_, sizeof(DecodedInstruction), cpu->decoded_size_, f) == cpu->decoded_size_;
+	ok = (fclose(f) == 0) && ok;
+	if (!ok || rename(tmp, path) != 0) {
+		unlink(tmp);
+		return -1;
+	}
+	return 0;
+}
+
+typedef void (*instruction_handler)(CPU* cpu, uint32_t instruction);
+
+void spin_branch(CPU* cpu, uint32_t instruction);
+void hook(CPU* cpu, uint32_t instruction);
+
+static const instruction_handler op_handlers[OP_COUNT] = {
+	[OP_ILLEGAL] = illegal,
+	[OP_LUI] = lui, [OP_AUIPC] = auipc, [OP_JAL] = jal, [OP_JALR] = jalr,
+	[OP_BEQ] = beq, [OP_BNE] = bne, [OP_BLT] = blt, [OP_BGE] = bge, [OP_BLTU] = bltu, [OP_BGEU] = bgeu,
+	[OP_LB] = lb, [OP_LH] = lh, [OP_LW] = lw, [OP_LBU] = lbu, [OP_LHU] = lhu,
+	[OP_SB] = sb, [OP_SH] = sh, [OP_SW] = sw,
+#if RV_XLEN == 64
+	[OP_LWU] = lwu, [OP_LD] = ld, [OP_SD] = sd,
+	[OP_ADDIW] = addiw, [OP_SLLIW] = slliw, [OP_SRLIW] = srliw, [OP_SRAIW] = sraiw,
+	[OP_ADDW] = addw, [OP_SUBW] = subw, [OP_SLLW] = sllw, [OP_SRLW] = srlw, [OP_SRAW] = sraw,
+#else
+	[OP_LWU] = illegal, [OP_LD] = illegal, [OP_SD] = illegal,
+	[OP_ADDIW] = illegal, [OP_SLLIW] = illegal, [OP_SRLIW] = illegal, [OP_SRAIW] = illegal,
+	[OP_ADDW] = illegal, [OP_SUBW] = illegal, [OP_SLLW] = illegal, [OP_SRLW] = illegal, [OP_SRAW] = illegal,
+#endif
+	[OP_ADDI] = addi, [OP_SLTI] = slti, [OP_SLTIU] = sltiu, [OP_XORI] = xori, [OP_ORI] = ori,
+	[OP_ANDI] = andi, [OP_SLLI] = slli, [OP_SRLI] = srli, [OP_SRAI] = srai,
+	[OP_ADD] = add, [OP_SUB] = sub, [OP_SLL] = sll, [OP_SLT] = slt, [OP_SLTU] = sltu,
+	[OP_XOR] = xorOperation, [OP_SRL] = srl, [OP_SRA] = sra, [OP_OR] = orOperation, [OP_AND] = andOparation,
+	[OP_ECALL] = ecall, [OP_EBREAK] = ebreak, [OP_MRET] = mret, [OP_WFI] = wfi,
+	[OP_CSRRW] = csrrw, [OP_CSRRS] = csrrs, [OP_CSRRC] = csrrc,
+	[OP_CSRRWI] = csrrwi, [OP_CSRRSI] = csrrsi, [OP_CSRRCI] = csrrci,
+	[OP_FLW] = flw, [OP_FLD] = fld, [OP_FSW] = fsw, [OP_FSD] = fsd,
+	[OP_FMADD] = fmadd, [OP_FMSUB] = fmsub, [OP_FNMSUB] = fnmsub, [OP_FNMADD] = fnmadd,
+	[OP_FADD] = fadd, [OP_FSUB] = fsub, [OP_FMUL] = fmul, [OP_FDIV] = fdiv, [OP_FSQRT] = fsqrt,
+	[OP_FSGNJ] = fsgnj, [OP_FMINMAX] = fmin_max, [OP_FCVT_F_F] = fcvt_f_f, [OP_FCMP] = fcmp,
+	[OP_FCVT_W] = fcvt_w, [OP_FCVT_F_W] = fcvt_f_w, [OP_FMV_X_FCLASS] = fmv_x_fclass, [OP_FMV_W_X] = fmv_w_x,
+	[OP_VSETVL] = vsetvl, [OP_VLOAD] = vload, [OP_VSTORE] = vstore, [OP_VINT] = vint, [OP_VMISC] = vmisc,
+	[OP_FENCE] = fence, [OP_FENCE_I] = fence_i, [OP_LR_W] = lr_w, [OP_SC_W] = sc_w, [OP_AMO_W] = amo_w,
+	[OP_SPIN_BRANCH] = spin_branch, [OP_HOOK] = hook, [OP_UNDECODED] = undecoded,
+};
+
+
+static const DecodedInstruction illegal_instruction = { OP_ILLEGAL };
+
+const DecodedInstruction* CPU_fetch(const CPU* cpu, uint32_t pc) {
+	size_t index = (pc & 0xFFFFF) >> 2; //line given by professor: instr_mem_ + (pc & 0xFFFFF)
+	if (index >= cpu->decoded_size_) {
+		return &illegal_instruction;
+	}
+	return &cpu->decoded_[index];
+}
+
+/*Rueckkante einer moeglichen Warteschleife: eigentliche Operation, dann pruefen ob der Gast nur noch wartet*/
+void spin_branch(CPU* cpu, uint32_t instruction) {
+	const DecodedInstruction* d = CPU_fetch(cpu, cpu->pc_);
+	uint32_t pc = cpu->pc_;
+	op_handlers[d->base_op_](cpu, instruction);
+	if (cpu->pc_ == pc + d->imm_ && cpu->spin_detect_) {
+		CPU_spin_check(cpu, d->aux_, d->flags_);
+	}
+}
+
+/*Einsprung einer ersetzten Gastfunktion: native Version ausfuehren und nach ra zurueckkehren*/
+void hook(CPU* cpu, uint32_t instruction) {
+	const DecodedInstruction* d = CPU_fetch(cpu, cpu->pc_);
+	Hook* h = &cpu->hooks_[d->aux_];
+	if (!h->native_->call_(cpu)) {
+		op_handlers[d->base_op_](cpu, instruction);
+		return;
+	}
+	h->calls_++;
+	CPU_jump(cpu, cpu->regfile_[1]);
+}
+
+void CPU_execute(CPU* cpu) {
+
+	const DecodedInstruction* d = CPU_fetch(cpu, cpu->pc_);
+	op_handlers[d->op_](cpu, d->raw_);
+
+	cpu->regfile_[0] = 0;
+}
+
+void CPU_print_regfile(const CPU* cpu) {
+	printf("\n-----------------------RISC-V program terminate------------------------\n");
+	static const char* const halt_names[] = {
+		[HALT_EBREAK] = "ebreak", [HALT_IDLE] = "idle, nothing left to wake the guest", [HALT_FAULT] = "access fault"
+	};
+	if (cpu->halted_ == HALT_EXIT) {
+		printf("exit code: %d\n", cpu->exit_code_);
+	}
+	else if (cpu->halted_) {
+		printf("halted: %s\n", halt_names[cpu->halted_]);
+	}
+	if (cpu->spin_skipped_) {
+		printf("idle loops: %llu instructions skipped\n", (unsigned long long)cpu->spin_skipped_);
+	}
+	if (cpu->code_redecoded_) {
+		printf("self-modifying code: %llu instructions decoded again\n", (unsigned long long)cpu->code_redecoded_);
+	}
+	printf("Regfile values:\n");
+	for(uint32_t i = 0; i <= 31; i++) {
+		printf("%d: %llX\n",i,(unsigned long long)cpu->regfile_[i]);
+	}
+}
+
+/**
+ * Native Hooks: Einsprungadressen von Gastfunktionen (aus ELF-Symbolen oder einer Map-Datei)
+ * werden durch Host-Implementierungen ersetzt. Der dekodierte Eintrag an der Adresse wird zu
+ * OP_HOOK; die native Funktion liest ihre Argumente aus a0-a7 (weitere vom Stack), schreibt das
+ * Ergebnis nach a0 und der Gast springt nach ra zurueck. Eine native Funktion kann ablehnen
+ * (Rueckgabe 0), dann wird der Rumpf wie bisher emuliert.
+ */
+#define NTOA_BUFFER_SIZE 32 //PRINTF_NTOA_BUFFER_SIZE of Beispielprojekt/printf.c
+#define FLAGS_ZEROPAD 0x1
+#define FLAGS_LEFT 0x2
+#define FLAGS_PLUS 0x4
+#define FLAGS_SPACE 0x8
+#define FLAGS_HASH 0x10
+#define FLAGS_UPPERCASE 0x20
+#define FLAGS_PRECISION 0x400
+
+int symbols_lookup(const SymbolTable* table, const char* name, uint32_t* addr) {
+	for (size_t i = 0; table && i < table->count_; i++) {
+		if (strcmp(table->symbols_[i].name_, name) == 0) {
+			*addr = table->symbols_[i].addr_;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void symbols_add(SymbolTable* table, const char* name, uint32_t addr) {
+	if (table->count_ % 64 == 0) {
+		table->symbols_ = realloc(table->symbols_, (table->count_ + 64) * sizeof(Symbol));
+	}
+	table->symbols_[table->count_].name_ = strdup(name);
+	table->symbols_[table->count_].addr_ = addr;
+	table->count_++;
+}
+
+/*Funktions- und Sprungmarken-Symbole aus .symtab einer ELF32-Datei*/
+static int symbols_read_elf(SymbolTable* table, const uint8_t* file, size_t size) {
+	Elf32_Ehdr eh;
+	if (size < sizeof(eh)) {
+		return -1;
+	}
+	memcpy(&eh, file, sizeof(eh));
+	if (eh.e_ident[EI_CLASS] != ELFCLASS32 || eh.e_shentsize != sizeof(Elf32_Shdr)
+			|| (uint64_t)eh.e_shoff + (uint64_t)eh.e_shnum * sizeof(Elf32_Shdr) > size) {
+		return -1;
+	}
+	for (size_t s = 0; s < eh.e_shnum; s++) {
+		Elf32_Shdr sh, strtab;
+		memcpy(&sh, file + eh.e_shoff + s * sizeof(sh), sizeof(sh));
+		if (sh.sh_type != SHT_SYMTAB || sh.sh_link >= eh.e_shnum) {
+			continue;
+		}
+		memcpy(&strtab, file + eh.e_shoff + sh.sh_link * sizeof(strtab), sizeof(strtab));
+		if ((uint64_t)sh.sh_offset + sh.sh_size > size || (uint64_t)strtab.sh_offset + strtab.sh_size > size
+				|| strtab.sh_size == 0) {
+			return -1;
+		}
+		const char* names = (const char*)file + strtab.sh_offset;
+		for (size_t i = 0; i < sh.sh_size / sizeof(Elf32_Sym); i++) {
+			Elf32_Sym sym;
+			memcpy(&sym, file + sh.sh_offset + i * sizeof(sym), sizeof(sym));
+			int type = ELF32_ST_TYPE(sym.st_info);
+			if ((type == STT_FUNC || type == STT_NOTYPE) && sym.st_shndx != SHN_UNDEF
+					&& sym.st_name != 0 && sym.st_name < strtab.sh_size
+					&& memchr(names + sym.st_name, 0, strtab.sh_size - sym.st_name)) {
+				symbols_add(table, names + sym.st_name, sym.st_value);
+			}
+		}
+	}
+	return 0;
+}
+
+/*Map-Datei: Zeilen "<hex-Adresse> ... <Name>" (nm-Ausgabe, Symbolzeilen einer ld --Map-Datei)*/
+static void symbols_read_map(SymbolTable* table, FILE* f) {
+	char line[1024];
+	while (fgets(line, sizeof(line), f)) {
+		char* first = strtok(line, " \t\r\n");
+		char* last = NULL;
+		for (char* t = strtok(NULL, " \t\r\n"); t; t = strtok(NULL, " \t\r\n")) {
+			last = t;
+		}
+		char* end;
+		unsigned long addr = first ? strtoul(first, &end, 16) : 0;
+		if (!first || !last || *end != '\0' || strncmp(last, "0x", 2) == 0 || strchr(last, '=')) {
+			continue;
+		}
+		symbols_add(table, last, (uint32_t)addr);
+	}
+}
+
+SymbolTable* symbols_load(const char* filename) {
+	FILE* f = fopen(filename, "rb");
+	if (!f) {
+		perror(filename);
+		return NULL;
+	}
+	SymbolTable* table = calloc(1, sizeof(SymbolTable));
+	uint8_t magic[SELFMAG];
+	if (fread(magic, 1, SELFMAG, f) == SELFMAG && memcmp(magic, ELFMAG, SELFMAG) == 0) {
+		struct stat sb;
+		uint8_t* file = NULL;
+		int ok = fstat(fileno(f), &sb) == 0 && (file = malloc(sb.st_size)) != NULL
+			&& fseek(f, 0, SEEK_SET) == 0 && fread(file, 1, sb.st_size, f) == (size_t)sb.st_size
+			&& symbols_read_elf(table, file, sb.st_size) == 0;
+		free(file);
+		if (!ok) {
+			fprintf(stderr, "%s: not a readable ELF32 file\n", filename);
+			fclose(f);
+			free(table);
+			return NULL;
+		}
+	}
+	else {
+		rewind(f);
+		symbols_read_map(table, f);
+	}
+	fclose(f);
+	return table;
+}
+
+void symbols_free(SymbolTable* table) {
+	if (!table) {
+		return;
+	}
+	for (size_t i = 0; i < table->count_; i++) {
+		free(table->symbols_[i].name_);
+	}
+	free(table->symbols_);
+	free(table);
+}
+
+/*Division wie RV32M: x/0 = alle Bits gesetzt, x%0 = x, INT_MIN/-1 = INT_MIN*/
+static int native_udivsi3(CPU* cpu) {
+	xreg_t* a = &cpu->regfile_[10];
+	a[0] = a[1] ? a[0] / a[1] : 0xFFFFFFFF;
+	return 1;
+}
+
+static int native_umodsi3(CPU* cpu) {
+	xreg_t* a = &cpu->regfile_[10];
+	a[0] = a[1] ? a[0] % a[1] : a[0];
+	return 1;
+}
+
+static int native_divsi3(CPU* cpu) {
+	xreg_t* a = &cpu->regfile_[10];
+	if (a[1] == 0) {
+		a[0] = 0xFFFFFFFF;
+	}
+	else if (!(a[0] == 0x80000000 && a[1] == 0xFFFFFFFF)) {
+		a[0] = (uint32_t)((int32_t)a[0] / (int32_t)a[1]);
+	}
+	return 1;
+}
+
+static int native_modsi3(CPU* cpu) {
+	xreg_t* a = &cpu->regfile_[10];
+	if (a[0] == 0x80000000 && a[1] == 0xFFFFFFFF) {
+		a[0] = 0;
+	}
+	else if (a[1] != 0) {
+		a[0] = (uint32_t)((int32_t)a[0] % (int32_t)a[1]);
+	}
+	return 1;
+}
+
+static int native_mulsi3(CPU* cpu) {
+	xreg_t* a = &cpu->regfile_[10];
+	a[0] = a[0] * a[1];
+	return 1;
+}
+
+static int native_putchar(CPU* cpu) {
+	CPU_console_putc(cpu, (char)cpu->regfile_[10]);
+	return 1;
+}
+
+/*Ausgabefunktionen von printf.c: out(character, buffer, idx, maxlen)*/
+enum native_output { OUTPUT_UNKNOWN = 0, OUTPUT_CHAR, OUTPUT_BUFFER, OUTPUT_NULL };
+
+static const char* const native_output_names[] = {
+	[OUTPUT_CHAR] = "_out_char", [OUTPUT_BUFFER] = "_out_buffer", [OUTPUT_NULL] = "_out_null"
+};
+
+/*Adressen einmal in CPU_add_hook aufloesen statt pro Aufruf im Symbolverzeichnis zu suchen*/
+static void native_resolve_outputs(CPU* cpu) {
+	cpu->out_found_ = 0;
+	for (int kind = OUTPUT_CHAR; kind <= OUTPUT_NULL; kind++) {
+		if (symbols_lookup(cpu->symbols_, native_output_names[kind], &cpu->out_addr_[kind])) {
+			cpu->out_found_ |= 1u << kind;
+		}
+	}
+}
+
+static int native_output_kind(const CPU* cpu, uint32_t out) {
+	for (int kind = OUTPUT_CHAR; kind <= OUTPUT_NULL; kind++) {
+		if ((cpu->out_found_ & (1u << kind)) && cpu->out_addr_[kind] == out) {
+			return kind;
+		}
+	}
+	return OUTPUT_UNKNOWN;
+}
+
+static void native_output(CPU* cpu, int kind, char c, uint32_t buffer, uint32_t idx, uint32_t maxlen) {
+	if (kind == OUTPUT_CHAR && c) {
+		CPU_console_putc(cpu, c);
+	}
+	else if (kind == OUTPUT_BUFFER && idx < maxlen) {
+		uint8_t* p = CPU_guest_ptr(cpu, buffer + idx, 1);
+		if (p) {
+			*p = (uint8_t)c;
+			CPU_code_written(cpu, buffer + idx, 1);
+		}
+	}
+}
+
+static int native_out_char(CPU* cpu) {
+	native_output(cpu, OUTPUT_CHAR, (char)cpu->regfile_[10], 0, 0, 0);
+	return 1;
+}
+
+static int native_out_buffer(CPU* cpu) {
+	xreg_t* a = &cpu->regfile_[10];
+	if (a[2] < a[3] && !CPU_guest_ptr(cpu, a[1] + a[2], 1)) {
+		return 0; //let the guest code take the access fault
+	}
+	native_output(cpu, OUTPUT_BUFFER, (char)a[0], a[1], a[2], a[3]);
+	return 1;
+}
+
+static int native_out_null(CPU* cpu) {
+	return 1;
+}
+
+/*_ntoa_format aus printf.c; buf liegt im Gastspeicher (Stackrahmen des Aufrufers)*/
+static uint32_t ntoa_format(CPU* cpu, int kind, uint32_t buffer, uint32_t idx, uint32_t maxlen, char* buf,
+		uint32_t len, int negative, uint32_t base, uint32_t prec, uint32_t width, uint32_t flags) {
+	if (!(flags & FLAGS_LEFT)) {
+		if (width && (flags & FLAGS_ZEROPAD) && (negative || (flags & (FLAGS_PLUS | FLAGS_SPACE)))) {
+			width--;
+		}
+		while (len < prec && len < NTOA_BUFFER_SIZE) {
+			buf[len++] = '0';
+		}
+		while ((flags & FLAGS_ZEROPAD) && len < width && len < NTOA_BUFFER_SIZE) {
+			buf[len++] = '0';
+		}
+	}
+	if (flags & FLAGS_HASH) {
+		if (!(flags & FLAGS_PRECISION) && len && (len == prec || len == width)) {
+			len--;
+			if (len && base == 16) {
+				len--;
+			}
+		}
+		if (base == 16 && len < NTOA_BUFFER_SIZE) {
+			buf[len++] = (flags & FLAGS_UPPERCASE) ? 'X' : 'x';
+		}
+		else if (base == 2 && len < NTOA_BUFFER_SIZE) {
+			buf[len++] = 'b';
+		}
+		if (len < NTOA_BUFFER_SIZE) {
+			buf[len++] = '0';
+		}
+	}
+	if (len < NTOA_BUFFER_SIZE) {
+		if (negative) {
+			buf[len++] = '-';
+		}
+		else if (flags & FLAGS_PLUS) {
+			buf[len++] = '+';
+		}
+		else if (flags & FLAGS_SPACE) {
+			buf[len++] = ' ';
+		}
+	}
+
+	//_out_rev
+	uint32_t start_idx = idx;
+	if (!(flags & FLAGS_LEFT) && !(flags & FLAGS_ZEROPAD)) {
+		for (uint32_t i = len; i < width; i++) {
+			native_output(cpu, kind, ' ', buffer, idx++, maxlen);
+		}
+	}
+	while (len) {
+		native_output(cpu, kind, buf[--len], buffer, idx++, maxlen);
+	}
+	if (flags & FLAGS_LEFT) {
+		while (idx - start_idx < width) {
+			native_output(cpu, kind, ' ', buffer, idx++, maxlen);
+		}
+	}
+	return idx;
+}
+
+/*Argumente ab dem neunten liegen auf dem Stack*/
+static uint8_t* native_stack_args(CPU* cpu, uint32_t count) {
+	return CPU_guest_ptr(cpu, cpu->regfile_[2], 4 * count);
+}
+
+static int native_ntoa_format(CPU* cpu) {
+	xreg_t* a = &cpu->regfile_[10];
+	int kind = native_output_kind(cpu, a[0]);
+	uint8_t* stack = native_stack_args(cpu, 3);
+	uint8_t* buf = CPU_guest_ptr(cpu, a[4], NTOA_BUFFER_SIZE);
+	if (kind == OUTPUT_UNKNOWN || !stack || !buf) {
+		return 0;
+	}
+	uint32_t s[3];
+	memcpy(s, stack, sizeof(s));
+	a[0] = ntoa_format(cpu, kind, a[1], a[2], a[3], (char*)buf, a[5], a[6] & 0xFF, a[7], s[0], s[1], s[2]);
+	CPU_code_written(cpu, (uint32_t)a[4], NTOA_BUFFER_SIZE);
+	return 1;
+}
+
+static int native_ntoa_long(CPU* cpu) {
+	xreg_t* a = &cpu->regfile_[10];
+	int kind = native_output_kind(cpu, a[0]);
+	uint8_t* stack = native_stack_args(cpu, 2);
+	if (kind == OUTPUT_UNKNOWN || !stack || a[6] < 2 || a[6] > 36) {
+		return 0;
+	}
+	uint32_t s[2];
+	memcpy(s, stack, sizeof(s));
+	uint32_t value = a[4], base = a[6], flags = s[1];
+	char buf[NTOA_BUFFER_SIZE];
+	uint32_t len = 0;
+	if (!value) {
+		flags &= ~FLAGS_HASH;
+	}
+	if (!(flags & FLAGS_PRECISION) || value) {
+		do {
+			char digit = (char)(value % base);
+			buf[len++] = digit < 10 ? '0' + digit : ((flags & FLAGS_UPPERCASE) ? 'A' : 'a') + digit - 10;
+			value /= base;
+		} while (value && len < NTOA_BUFFER_SIZE);
+	}
+	a[0] = ntoa_format(cpu, kind, a[1], a[2], a[3], buf, len, a[5] & 0xFF, base, a[7], s[0], flags);
+	return 1;
+}
+
+/*Speicherfunktionen der C-Bibliothek direkt auf data_mem_; Bereiche ausserhalb des RAMs (MMIO,
+  Grenzen) lehnen ab, dort laeuft die Gastfunktion mit ihren normalen Zugriffen bzw. Fehlern*/
+static int native_memmove(CPU* cpu) {
+	xreg_t* a = &cpu->regfile_[10];
+	if (!CPU_is_ram(cpu, a[0], a[2]) || !CPU_is_ram(cpu, a[1], a[2])) {
+		return 0;
+	}
+	memmove(cpu->data_mem_ + a[0], cpu->data_mem_ + a[1], a[2]);
+	CPU_code_written(cpu, a[0], a[2]);
+	return 1; //returns dst, still in a0
+}
+
+static int native_memset(CPU* cpu) {
+	xreg_t* a = &cpu->regfile_[10];
+	if (!CPU_is_ram(cpu, a[0], a[2])) {
+		return 0;
+	}
+	memset(cpu->data_mem_ + a[0], (int)(uint8_t)a[1], a[2]);
+	CPU_code_written(cpu, a[0], a[2]);
+	return 1;
+}
+
+static int native_memchr(CPU* cpu) {
+	xreg_t* a = &cpu->regfile_[10];
+	if (!CPU_is_ram(cpu, a[0], a[2])) {
+		return 0;
+	}
+	const uint8_t* hit = memchr(cpu->data_mem_ + a[0], (int)(uint8_t)a[1], a[2]);
+	a[0] = hit ? (uint32_t)(hit - cpu->data_mem_) : 0;
+	return 1;
+}
+
+/*Laenge bis zum ersten Nullbyte, hoechstens max; 0 wenn der String den RAM verlaesst*/
+static int native_string_length(CPU* cpu, uint32_t s, uint32_t max, xreg_t* len) {
+	uint32_t span = CPU_ram_span(cpu, s, max);
+	const uint8_t* hit = memchr(cpu->data_mem_ + s, 0, span);
+	if (!hit && span < max) {
+		return 0;
+	}
+	*len = hit ? (uint32_t)(hit - (cpu->data_mem_ + s)) : max;
+	return 1;
+}
+
+static int native_strlen(CPU* cpu) {
+	return native_string_length(cpu, cpu->regfile_[10], UINT32_MAX, &cpu->regfile_[10]);
+}
+
+static int native_strnlen(CPU* cpu) {
+	return native_string_length(cpu, cpu->regfile_[10], cpu->regfile_[11], &cpu->regfile_[10]);
+}
+
+static const NativeFunction native_functions[] = {
+	{ "__udivsi3", native_udivsi3 }, { "__umodsi3", native_umodsi3 },
+	{ "__divsi3", native_divsi3 }, { "__modsi3", native_modsi3 }, { "__mulsi3", native_mulsi3 },
+	{ "_putchar", native_putchar }, { "_out_char", native_out_char },
+	{ "_out_buffer", native_out_buffer }, { "_out_null", native_out_null },
+	{ "_ntoa_format", native_ntoa_format }, { "_ntoa_long", native_ntoa_long },
+	{ "memcpy", native_memmove }, { "memmove", native_memmove }, { "memset", native_memset },
+	{ "memchr", native_memchr }, { "strlen", native_strlen }, { "strnlen", native_strnlen },
+	{ "_strnlen_s", native_strnlen },
+};
+
+/*Gastfunktion name durch ihre native Version ersetzen; "all" ersetzt alle im Symbolverzeichnis gefundenen*/
+int CPU_add_hook(CPU* cpu, const char* name) {
+	size_t native_count = sizeof(native_functions) / sizeof(native_functions[0]);
+	int all = strcmp(name, "all") == 0;
+	int found = 0;
+	if (RV_XLEN != 32) {
+		fprintf(stderr, "hook %s: the native functions follow the RV32 calling convention\n", name);
+		return -1;
+	}
+	if (cpu->aot_run_) {
+		fprintf(stderr, "hook %s: translated code (--aot) jumps past the hooked entry\n", name);
+		return -1;
+	}
+	native_resolve_outputs(cpu);
+	for (size_t i = 0; i < native_count; i++) {
+		const NativeFunction* native = &native_functions[i];
+		uint32_t addr;
+		if (!all && strcmp(native->name_, name) != 0) {
+			continue;
+		}
+		found = 1;
+		if (!symbols_lookup(cpu->symbols_, native->name_, &addr)) {
+			if (all) {
+				continue;
+			}
+			fprintf(stderr, "hook %s: symbol not found (use --symbols)\n", name);
+			return -1;
+		}
+		size_t index = (addr & 0xFFFFF) >> 2;
+		if ((addr & 3) || index >= cpu->decoded_size_ || cpu->hook_count_ == CPU_MAX_HOOKS) {
+			fprintf(stderr, "hook %s: cannot hook address %X\n", native->name_, addr);
+			return -1;
+		}
+		Hook* hook = &cpu->hooks_[cpu->hook_count_];
+		hook->native_ = native;
+		hook->addr_ = addr;
+		hook->calls_ = 0;
+		cpu->decoded_[index].op_ = OP_HOOK;
+		cpu->decoded_[index].aux_ = (uint16_t)cpu->hook_count_++;
+	}
+	if (!found) {
+		fprintf(stderr, "hook %s: no native implementation\n", name);
+		return -1;
+	}
+	return 0;
+}
+
+void CPU_print_hooks(const CPU* cpu) {
+	for (size_t i = 0; i < cpu->hook_count_; i++) {
+		printf("hook %s (%X): %llu calls\n", cpu->hooks_[i].native_->name_, cpu->hooks_[i].addr_,
+				(unsigned long long)cpu->hooks_[i].calls_);
+	}
+}
+
+/**
+ * Lockstep mode: one decoded program, N data memories. The lanes' register files
+ * are stored structure-of-arrays so that an ALU operation is a single loop over
+ * LOCKSTEP_LANES words, which the compiler turns into one AVX2 (8 lanes) or
+ * AVX-512 (16 lanes) instruction. Each group step executes the instruction at the
+ * smallest pc of all running lanes for exactly those lanes at that pc; diverged
+ * lanes wait and reconverge when the others catch up. A lane that waits for more
+ * than LOCKSTEP_DETACH_AFTER steps, or hits an instruction the vector path does
+ * not handle, is detached and finished on the scalar interpreter.
+ * Without -march=native, lockstep_execute is built for AVX-512, AVX2 and the
+ * baseline, and the loader picks the variant for the host CPU.
+ */
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(__AVX2__)
+#define LANE_TARGETS __attribute__((target_clones("avx512f", "avx2", "default")))
+#ifndef LOCKSTEP_LANES
+#define LOCKSTEP_LANES 16
+#endif
+#else
+#define LANE_TARGETS
+#endif
+#ifndef LOCKSTEP_LANES
+#define LOCKSTEP_LANES 8
+#endif
+#define LOCKSTEP_DETACH_AFTER 4096
+
+#define LANE_LOOP for (size_t l = 0; l < LOCKSTEP_LANES; l++)
+
+enum lane_state { LANE_UNUSED = 0, LANE_RUNNING, LANE_DONE, LANE_SCALAR };
+
+typedef struct {
+    uint32_t regfile_[32][LOCKSTEP_LANES];
+    uint32_t pc_[LOCKSTEP_LANES];
+    uint32_t steps_[LOCKSTEP_LANES];
+    uint32_t waiting_[LOCKSTEP_LANES];
+    uint64_t loads_[LOCKSTEP_LANES]; //mhpmcounter3-5 of the lanes
+    uint64_t stores_[LOCKSTEP_LANES];
+    uint64_t taken_branches_[LOCKSTEP_LANES];
+    uint8_t state_[LOCKSTEP_LANES];
+    CPU* lane_cpu_[LOCKSTEP_LANES];
+    char* console_[LOCKSTEP_LANES];
+    size_t console_len_[LOCKSTEP_LANES];
+    size_t console_cap_[LOCKSTEP_LANES];
+    const CPU* image_;
+    uint64_t group_steps_;
+    uint64_t lane_steps_;
+} LaneGroup;
+
+static void lane_putchar(LaneGroup* g, size_t l, char c) {
+	if (g->console_len_[l] == g->console_cap_[l]) {
+		g->console_cap_[l] = g->console_cap_[l] ? 2 * g->console_cap_[l] : 256;
+		g->console_[l] = realloc(g->console_[l], g->console_cap_[l]);
+	}
+	g->console_[l][g->console_len_[l]++] = c;
+}
+
+static void lane_blend(uint32_t* dst, const uint32_t* value, const uint32_t* mask) {
+	LANE_LOOP dst[l] = (value[l] & mask[l]) | (dst[l] & ~mask[l]);
+}
+
+/*Speicherzugriffe sind pro Lane; Lanes, die kein RAM treffen (MMIO, Fehler), laufen skalar weiter.
+  Einzige Ausnahme sind Byte-Stores auf das UART-Datenregister, die in den Lane-Puffer gehen*/
+static void lane_check_bounds(LaneGroup* g, uint32_t* mask, const uint32_t* addr, uint32_t width, int console) {
+	LANE_LOOP {
+		if (!mask[l] || (console && addr[l] == UART_BASE + UART_DATA)) continue;
+		const uint8_t* page_attr = g->lane_cpu_[l]->page_attr_;
+		if (page_attr[addr[l] >> PAGE_SHIFT] != PAGE_RAM || page_attr[(addr[l] + width - 1) >> PAGE_SHIFT] != PAGE_RAM) {
+			mask[l] = 0;
+			g->state_[l] = LANE_SCALAR;
+		}
+	}
+}
+
+/*Fuehrt d fuer alle Lanes in mask aus; 0 wenn der Vektorpfad die Operation nicht kennt*/
+LANE_TARGETS static int lockstep_execute(LaneGroup* g, const DecodedInstruction* d, uint32_t pc, uint32_t* mask) {
+	const uint32_t* a = g->regfile_[d->rs1_];
+	const uint32_t* b = g->regfile_[d->rs2_];
+	const uint32_t imm = d->imm_;
+	uint32_t result[LOCKSTEP_LANES];
+	uint32_t next_pc[LOCKSTEP_LANES];
+	uint32_t addr[LOCKSTEP_LANES];
+	int writes_rd = 1;
+
+	LANE_LOOP next_pc[l] = pc + 4;
+
+	switch (d->base_op_) {
+	case OP_LUI: LANE_LOOP result[l] = imm; break;
+	case OP_AUIPC: LANE_LOOP result[l] = pc + imm; break;
+	case OP_JAL:
+		LANE_LOOP result[l] = pc + 4;
+		LANE_LOOP next_pc[l] = pc + imm;
+		break;
+	case OP_JALR:
+		LANE_LOOP result[l] = pc + 4;
+		LANE_LOOP next_pc[l] = (a[l] + imm) & ~1u;
+		break;
+	case OP_BEQ: writes_rd = 0; LANE_LOOP result[l] = a[l] == b[l]; break;
+	case OP_BNE: writes_rd = 0; LANE_LOOP result[l] = a[l] != b[l]; break;
+	case OP_BLT: writes_rd = 0; LANE_LOOP result[l] = (int32_t)a[l] < (int32_t)b[l]; break;
+	case OP_BGE: writes_rd = 0; LANE_LOOP result[l] = (int32_t)a[l] >= (int32_t)b[l]; break;
+	case OP_BLTU: writes_rd = 0; LANE_LOOP result[l] = a[l] < b[l]; break;
+	case OP_BGEU: writes_rd = 0; LANE_LOOP result[l] = a[l] >= b[l]; break;
+	case OP_LB: case OP_LBU: case OP_LH: case OP_LHU: case OP_LW: {
+		uint32_t width = (d->base_op_ == OP_LW) ? 4 : (d->base_op_ == OP_LH || d->base_op_ == OP_LHU) ? 2 : 1;
+		LANE_LOOP addr[l] = a[l] + imm;
+		lane_check_bounds(g, mask, addr, width, 0);
+		LANE_LOOP {
+			if (!mask[l]) continue;
+			const uint8_t* p = g->lane_cpu_[l]->data_mem_ + addr[l];
+			switch (d->base_op_) {
+			case OP_LB: result[l] = (uint32_t)(int32_t)(int8_t)p[0]; break;
+			case OP_LBU: result[l] = p[0]; break;
+			case OP_LH: { int16_t v; memcpy(&v, p, 2); result[l] = (uint32_t)(int32_t)v; break; }
+			case OP_LHU: { uint16_t v; memcpy(&v, p, 2); result[l] = v; break; }
+			default: memcpy(&result[l], p, 4); break;
+			}
+		}
+		break;
+	}
+	case OP_SB: case OP_SH: case OP_SW: {
+		uint32_t width = (d->base_op_ == OP_SW) ? 4 : (d->base_op_ == OP_SH) ? 2 : 1;
+		writes_rd = 0;
+		LANE_LOOP addr[l] = a[l] + imm;
+		lane_check_bounds(g, mask, addr, width, d->base_op_ == OP_SB);
+		LANE_LOOP {
+			if (!mask[l]) continue;
+			if (d->base_op_ == OP_SB && addr[l] == UART_BASE + UART_DATA) {
+				lane_putchar(g, l, (char)b[l]);
+				continue;
+			}
+			memcpy(g->lane_cpu_[l]->data_mem_ + addr[l], &b[l], width);
+		}
+		break;
+	}
+	case OP_ADDI: LANE_LOOP result[l] = a[l] + imm; break;
+	case OP_SLTI: LANE_LOOP result[l] = (int32_t)a[l] < (int32_t)imm; break;
+	case OP_SLTIU: LANE_LOOP result[l] = a[l] < imm; break;
+	case OP_XORI: LANE_LOOP result[l] = a[l] ^ imm; break;
+	case OP_ORI: LANE_LOOP result[l] = a[l] | imm; break;
+	case OP_ANDI: LANE_LOOP result[l] = a[l] & imm; break;
+	case OP_SLLI: LANE_LOOP result[l] = a[l] << imm; break;
+	case OP_SRLI: LANE_LOOP result[l] = a[l] >> imm; break;
+	case OP_SRAI: LANE_LOOP result[l] = (uint32_t)((int32_t)a[l] >> imm); break;
+	case OP_ADD: LANE_LOOP result[l] = a[l] + b[l]; break;
+	case OP_SUB: LANE_LOOP result[l] = a[l] - b[l]; break;
+	case OP_SLL: LANE_LOOP result[l] = a[l] << (b[l] & 0x1f); break;
+	case OP_SLT: LANE_LOOP result[l] = (int32_t)a[l] < (int32_t)b[l]; break;
+	case OP_SLTU: LANE_LOOP result[l] = a[l] < b[l]; break;
+	case OP_XOR: LANE_LOOP result[l] = a[l] ^ b[l]; break;
+	case OP_SRL: LANE_LOOP result[l] = a[l] >> (b[l] & 0x1f); break;
+	case OP_SRA: LANE_LOOP result[l] = (uint32_t)((int32_t)a[l] >> (b[l] & 0x1f)); break;
+	case OP_OR: LANE_LOOP result[l] = a[l] | b[l]; break;
+	case OP_AND: LANE_LOOP result[l] = a[l] & b[l]; break;
+	default:
+		return 0;
+	}
+
+	if (d->base_op_ >= OP_BEQ && d->base_op_ <= OP_BGEU) {
+		LANE_LOOP next_pc[l] = result[l] ? pc + imm : pc + 4;
+		LANE_LOOP g->taken_branches_[l] += result[l] & mask[l];
+	}
+	lane_blend(g->pc_, next_pc, mask);
+	if (writes_rd && d->rd_ != 0) {
+		lane_blend(g->regfile_[d->rd_], result, mask);
+	}
+	return 1;
+}
+
+/*Ein Gruppenschritt; 0 wenn keine Lane mehr im Lockstep laeuft*/
+static int lockstep_step(LaneGroup* g, uint32_t budget) {
+	uint32_t pc = UINT32_MAX;
+	LANE_LOOP {
+		if (g->state_[l] == LANE_RUNNING && g->pc_[l] < pc) pc = g->pc_[l];
+	}
+	if (pc == UINT32_MAX) {
+		return 0;
+	}
+
+	uint32_t mask[LOCKSTEP_LANES];
+	LANE_LOOP mask[l] = (g->state_[l] == LANE_RUNNING && g->pc_[l] == pc) ? 0xFFFFFFFF : 0;
+
+	const DecodedInstruction* d = CPU_fetch(g->image_, pc);
+	if (!lockstep_execute(g, d, pc, mask)) {
+		LANE_LOOP if (mask[l]) g->state_[l] = LANE_SCALAR;
+		return 1;
+	}
+
+	g->group_steps_++;
+	const CounterPrefix* p = g->image_->counter_prefix_ + counter_index(g->image_, pc);
+	uint32_t load = (uint32_t)(p[1].loads_ - p[0].loads_), store = (uint32_t)(p[1].stores_ - p[0].stores_);
+	LANE_LOOP {
+		if (mask[l]) {
+			g->lane_steps_++;
+			g->loads_[l] += load;
+			g->stores_[l] += store;
+			g->waiting_[l] = 0;
+			if (++g->steps_[l] >= budget) g->state_[l] = LANE_DONE;
+		}
+		else if (g->state_[l] == LANE_RUNNING && ++g->waiting_[l] > LOCKSTEP_DETACH_AFTER) {
+			g->state_[l] = LANE_SCALAR;
+		}
+	}
+	return 1;
+}
+
+/*Lanes einer Gruppe im Lockstep ausfuehren und danach skalar zu Ende bringen*/
+static void lockstep_run_group(CPU** lanes, size_t count, const char* const* names, uint32_t budget) {
+	LaneGroup* g = calloc(1, sizeof(LaneGroup));
+	g->image_ = lanes[0];
+	for (size_t l = 0; l < count; l++) {
+		g->lane_cpu_[l] = lanes[l];
+		CPU_end_run(lanes[l], counter_index(lanes[l], lanes[l]->pc_));
+		//the lanes are 32 bits wide and fetch from the shared program
+		g->state_[l] = (RV_XLEN == 32 && !lanes[l]->code_end_) ? LANE_RUNNING : LANE_SCALAR;
+		g->pc_[l] = lanes[l]->pc_;
+		for (uint32_t r = 0; r < 32; r++) g->regfile_[r][l] = (uint32_t)lanes[l]->regfile_[r];
+	}
+
+	while (RV_XLEN == 32 && lockstep_step(g, budget));
+
+	size_t detached = 0;
+	for (size_t l = 0; l < count; l++) {
+		CPU* cpu = lanes[l];
+		CPU_set_pc(cpu, g->pc_[l]);
+		cpu->loads_ += g->loads_[l];
+		cpu->stores_ += g->stores_[l];
+		cpu->taken_branches_ += g->taken_branches_[l];
+		for (uint32_t r = 0; r < 32 && RV_XLEN == 32; r++) cpu->regfile_[r] = g->regfile_[r][l];
+
+		printf("\n======================= lane %zu: %s =======================\n", l, names[l]);
+		fwrite(g->console_[l], 1, g->console_len_[l], stdout);
+		if (g->state_[l] == LANE_SCALAR) {
+			detached++;
+			cpu->cycle_ = g->steps_[l];
+			CPU_run(cpu, budget - g->steps_[l]);
+		}
+		CPU_print_regfile(cpu);
+		free(g->console_[l]);
+	}
+	printf("\nlockstep: %zu lanes, %llu group steps, %llu lane instructions (%.2f lanes/step), %zu detached to scalar\n",
+			count, (unsigned long long)g->group_steps_, (unsigned long long)g->lane_steps_,
+			g->group_steps_ ? (double)g->lane_steps_ / (double)g->group_steps_ : 0.0, detached);
+	free(g);
+}
+
+/*Lanes (alle mit demselben Programm, z.B. aus CPU_clone_program) in Gruppen zu LOCKSTEP_LANES ausfuehren*/
+void CPU_run_lockstep(CPU** lanes, size_t count, const char* const* names, uint64_t budget) {
+	uint32_t steps = budget < UINT32_MAX ? (uint32_t)budget : UINT32_MAX;
+	for (size_t first = 0; first < count; first += LOCKSTEP_LANES) {
+		size_t group = count - first < LOCKSTEP_LANES ? count - first : LOCKSTEP_LANES;
+		lockstep_run_group(lanes + first, group, names + first, steps);
+	}
+}
+
+/**
+ * Deterministischer Scheduler fuer viele kleine Gaeste auf einem festen Pool von Worker-Threads.
+ * Die Zeit laeuft in Runden zu je quantum Instruktionen: in Runde r fuehrt jeder lauffaehige Gast
+ * bis zum Zyklus (r + 1) * quantum aus. Die Gaeste einer Runde werden mit einem aus dem Seed
+ * erzeugten Zufallsgenerator gemischt und in dieser Reihenfolge auf die Run-Queue ihres festen Workers
+ * (Gast g: Worker g mod workers) verteilt; ein Worker nimmt vom Ende der eigenen Queue und stiehlt
+ * vom Anfang fremder Queues. Auf NUMA-Hosts legt jeder Worker vor der ersten Runde den RAM seiner
+ * Gaeste neu an, so liegt er auf seinem Knoten (first touch). Ein Kontextwechsel ist
+ * nur der naechste CPU-Zeiger aus der Queue. Gaeste teilen keinen Zustand und sehen nur virtuelle
+ * Zeit, die Konsolenausgabe jeder Runde wird zeilenweise in der gemischten Reihenfolge ausgegeben:
+ * (Seed, Quantum) bestimmen die Ausgabe bitgenau. Ein Gast in wfi, dessen naechstes Ereignis
+ * hinter der Runde liegt, wird geparkt, bis die Rundenzeit es erreicht.
+ */
+typedef struct {
+    CPU** items_;
+    size_t head_; //thieves take from here
+    size_t tail_; //the owner pushes and pops here
+    pthread_mutex_t lock_;
+} RunQueue;
+
+/*Konsolenausgabe eines Gasts, wird nach jeder Runde zeilenweise weitergegeben*/
+typedef struct {
+    char* text_;
+    size_t len_;
+    size_t cap_;
+    size_t shown_;
+} SchedConsole;
+
+typedef struct {
+    CPU** guests_;
+    size_t count_;
+    RunQueue queues_[SCHED_MAX_WORKERS];
+    size_t workers_;
+    uint64_t quantum_;
+    uint64_t round_end_; //cycle_ every guest runs to in this round
+    uint64_t budget_; //retired instructions per guest, as for a single run
+    pthread_barrier_t start_;
+    pthread_barrier_t end_;
+    int done_;
+    int placing_; //this pass moves the RAM of each worker's guests instead of running them
+    SchedConsole* console_; //one per guest
+    FILE* out_;
+} Scheduler;
+
+static uint64_t sched_random(uint64_t* state) {
+	//splitmix64
+	uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+	return z ^ (z >> 31);
+}
+
+static CPU* run_queue_pop(RunQueue* q) {
+	CPU* cpu = NULL;
+	pthread_mutex_lock(&q->lock_);
+	if (q->tail_ > q->head_) cpu = q->items_[--q->tail_];
+	pthread_mutex_unlock(&q->lock_);
+	return cpu;
+}
+
+static CPU* run_queue_steal(RunQueue* q) {
+	CPU* cpu = NULL;
+	pthread_mutex_lock(&q->lock_);
+	if (q->tail_ > q->head_) cpu = q->items_[q->head_++];
+	pthread_mutex_unlock(&q->lock_);
+	return cpu;
+}
+
+static int sched_finished(const Scheduler* s, const CPU* cpu) {
+	return cpu->halted_ || cpu->cycle_ - cpu->idle_cycles_ >= s->budget_;
+}
+
+/*Gast bis zum Rundenende ausfuehren*/
+static void sched_run_guest(Scheduler* s, CPU* cpu) {
+	uint64_t budget = s->round_end_ - cpu->cycle_;
+	uint64_t left = s->budget_ - (cpu->cycle_ - cpu->idle_cycles_);
+	CPU_run(cpu, budget < left ? budget : left);
+}
+
+typedef struct {
+    Scheduler* s_;
+    size_t index_;
+} SchedWorker;
+
+static void* sched_worker(void* arg) {
+	Scheduler* s = ((SchedWorker*)arg)->s_;
+	size_t self = ((SchedWorker*)arg)->index_;
+	for (;;) {
+		pthread_barrier_wait(&s->start_);
+		if (s->done_) {
+			return NULL;
+		}
+		for (size_t g = self; s->placing_ && g < s->count_; g += s->workers_) {
+			CPU_reback_data(s->guests_[g]);
+		}
+		for (;;) {
+			CPU* cpu = run_queue_pop(&s->queues_[self]);
+			for (size_t i = 1; !cpu && i < s->workers_; i++) {
+				cpu = run_queue_steal(&s->queues_[(self + i) % s->workers_]);
+			}
+			if (!cpu) break;
+			sched_run_guest(s, cpu);
+		}
+		pthread_barrier_wait(&s->end_);
+	}
+}
+
+static void sched_console_write(void* ctx, const char* data, size_t len) {
+	SchedConsole* c = ctx;
+	if (c->len_ + len > c->cap_) {
+		size_t cap = c->cap_ ? c->cap_ : 256;
+		while (cap < c->len_ + len) cap *= 2;
+		char* text = realloc(c->text_, cap);
+		if (!text) return;
+		c->text_ = text;
+		c->cap_ = cap;
+	}
+	memcpy(c->text_ + c->len_, data, len);
+	c->len_ += len;
+}
+
+static int sched_console_read(void* ctx) {
+	return -1; //guests get no input
+}
+
+/*Vollstaendige Konsolenzeilen von Gast g ausgeben, mit Gastnummer davor*/
+static void sched_show_console(Scheduler* s, size_t g, int all) {
+	SchedConsole* c = &s->console_[g];
+	const char* text = c->text_;
+	size_t start = c->shown_, end = c->len_;
+	while (start < end) {
+		const char* nl = memchr(text + start, '\n', end - start);
+		if (!nl && !all) break;
+		size_t stop = nl ? (size_t)(nl - text) + 1 : end;
+		fprintf(s->out_, "[%zu] %.*s%s", g, (int)(stop - start), text + start, nl ? "" : "\n");
+		start = stop;
+	}
+	c->shown_ = start;
+}
+
+/*Runden ausfuehren, bis alle Gaeste fertig sind; Rueckgabe: Anzahl Runden*/
+static uint64_t sched_run(Scheduler* s, uint64_t seed) {
+	CPU** order = malloc(s->count_ * sizeof(CPU*));
+	size_t* index = malloc(s->count_ * sizeof(size_t));
+	uint64_t rng = seed, rounds = 0;
+	for (uint64_t round = 0;; round++) {
+		s->round_end_ = (round + 1) * s->quantum_;
+		size_t runnable = 0;
+		uint64_t wake = UINT64_MAX;
+		for (size_t g = 0; g < s->count_; g++) {
+			CPU* cpu = s->guests_[g];
+			if (sched_finished(s, cpu)) continue;
+			if (cpu->parked_) {
+				if (cpu->next_event_ >= s->round_end_) {
+					wake = cpu->next_event_ < wake ? cpu->next_event_ : wake;
+					continue;
+				}
+				//the wfi has retired; the time up to the event passes idle
+				if (cpu->next_event_ > cpu->cycle_) {
+					cpu->idle_cycles_ += cpu->next_event_ - cpu->cycle_;
+					cpu->cycle_ = cpu->next_event_;
+				}
+				cpu->parked_ = 0;
+			}
+			if (cpu->cycle_ >= s->round_end_) continue;
+			index[runnable] = g;
+			order[runnable++] = cpu;
+		}
+		if (runnable == 0) {
+			if (wake == UINT64_MAX) break;
+			round = wake / s->quantum_ - 1; //every guest is parked: jump to the round of the first event
+			continue;
+		}
+		for (size_t i = runnable; i > 1; i--) {
+			size_t j = sched_random(&rng) % i;
+			CPU* t = order[i - 1]; order[i - 1] = order[j]; order[j] = t;
+			size_t u = index[i - 1]; index[i - 1] = index[j]; index[j] = u;
+		}
+		for (size_t w = 0; w < s->workers_; w++) {
+			s->queues_[w].head_ = s->queues_[w].tail_ = 0;
+		}
+		for (size_t i = 0; i < runnable; i++) {
+			RunQueue* q = &s->queues_[index[i] % s->workers_];
+			q->items_[q->tail_++] = order[i];
+		}
+		pthread_barrier_wait(&s->start_);
+		pthread_barrier_wait(&s->end_);
+		rounds++;
+		for (size_t i = 0; i < runnable; i++) {
+			sched_show_console(s, index[i], 0);
+		}
+	}
+	free(order);
+	free(index);
+	return rounds;
+}
+
+/*Gaeste (jeder mit eigenem Datenspeicher) bis zum Ende ausfuehren; Rueckgabe: Anzahl Runden*/
+uint64_t CPU_run_scheduled(CPU** guests, size_t count, const CPU_Schedule* schedule) {
+	Scheduler* s = calloc(1, sizeof(Scheduler));
+	s->guests_ = guests;
+	s->count_ = count;
+	s->workers_ = schedule->workers_ ? schedule->workers_ : 4;
+	if (s->workers_ > SCHED_MAX_WORKERS) s->workers_ = SCHED_MAX_WORKERS;
+	s->quantum_ = schedule->quantum_ ? schedule->quantum_ : 10000;
+	s->budget_ = schedule->budget_;
+	s->out_ = schedule->out_ ? schedule->out_ : stdout;
+	s->console_ = calloc(count, sizeof(SchedConsole));
+	CPU_Console* saved = malloc(count * sizeof(CPU_Console));
+	for (size_t g = 0; g < count; g++) {
+		CPU* cpu = guests[g];
+		saved[g] = cpu->console_;
+		cpu->console_ = (CPU_Console){ &s->console_[g], sched_console_write, sched_console_read };
+		cpu->virtual_time_ = 1;
+		cpu->park_ = 1;
+	}
+	for (size_t w = 0; w < s->workers_; w++) {
+		s->queues_[w].items_ = malloc(count * sizeof(CPU*));
+		pthread_mutex_init(&s->queues_[w].lock_, NULL);
+	}
+	pthread_barrier_init(&s->start_, NULL, (unsigned)s->workers_ + 1);
+	pthread_barrier_init(&s->end_, NULL, (unsigned)s->workers_ + 1);
+	pthread_t threads[SCHED_MAX_WORKERS];
+	SchedWorker workers[SCHED_MAX_WORKERS];
+	for (size_t w = 0; w < s->workers_; w++) {
+		workers[w] = (SchedWorker){ s, w };
+		pthread_create(&threads[w], NULL, sched_worker, &workers[w]);
+	}
+
+	if (access("/sys/devices/system/node/node1", F_OK) == 0) {
+		//more than one NUMA node; the queues are still empty, so the pass only places
+		s->placing_ = 1;
+		pthread_barrier_wait(&s->start_);
+		pthread_barrier_wait(&s->end_);
+		s->placing_ = 0;
+	}
+	uint64_t rounds = sched_run(s, schedule->seed_);
+	s->done_ = 1;
+	pthread_barrier_wait(&s->start_);
+	for (size_t w = 0; w < s->workers_; w++) {
+		pthread_join(threads[w], NULL);
+	}
+
+	for (size_t g = 0; g < count; g++) {
+		sched_show_console(s, g, 1);
+		guests[g]->console_ = saved[g];
+		guests[g]->park_ = 0;
+		guests[g]->parked_ = 0;
+		free(s->console_[g].text_);
+	}
+	for (size_t w = 0; w < s->workers_; w++) {
+		free(s->queues_[w].items_);
+		pthread_mutex_destroy(&s->queues_[w].lock_);
+	}
+	pthread_barrier_destroy(&s->start_);
+	pthread_barrier_destroy(&s->end_);
+	fflush(s->out_);
+	free(saved);
+	free(s->console_);
+	free(s);
+	return rounds;
+}
+
+/**
+ * Statische Vorab-Uebersetzung (AOT): --aot-emit schreibt den Instruktionsspeicher als C-Datei,
+ * in der jeder Basisblock ein Label ist. Direkte Spruenge werden zu goto, indirekte (jalr) gehen
+ * ueber eine switch-Tabelle auf die Blockanfaenge. Uebersetzt wird RV32I ohne SYSTEM; alles andere
+ * (ecall, CSRs, MMIO-Zugriffe, nicht gefundene Sprungziele) verlaesst den uebersetzten Code und
+ * wird vom Interpreter ausgefuehrt. Die mit
+ *   gcc -O2 -shared -fPIC prog.c -o prog.so
+ * gebaute Bibliothek wird mit --aot prog.so geladen.
+ */
+#define AOT_ABI_VERSION 2
+
+/*muss mit dem in aot_prologue ausgegebenen Typ uebereinstimmen*/
+typedef struct {
+    uint32_t* regs_;
+    uint8_t* mem_;
+    const uint8_t* page_attr_;
+    uint32_t pc_;
+    uint64_t executed_;
+    uint64_t loads_; //for mhpmcounter3-5
+    uint64_t stores_;
+    uint64_t taken_branches_;
+} AotState;
+
+typedef void (*aot_entry)(AotState* s, uint64_t budget);
+
+static const char aot_prologue[] =
+	"/* generated by hu_risc-v_emu --aot-emit; build with: gcc -O2 -shared -fPIC */\n"
+	"#include <stdint.h>\n"
+	"#include <string.h>\n\n"
+	"typedef struct {\n"
+	"    uint32_t* regs_;\n"
+	"    uint8_t* mem_;\n"
+	"    const uint8_t* page_attr_;\n"
+	"    uint32_t pc_;\n"
+	"    uint64_t executed_;\n"
+	"    uint64_t loads_;\n"
+	"    uint64_t stores_;\n"
+	"    uint64_t taken_branches_;\n"
+	"} AotState;\n\n"
+	"#define RAM(a, w) (attr[(uint32_t)(a) >> 12] == 0 && attr[(uint32_t)((a) + (w) - 1) >> 12] == 0)\n"
+	"#define EXIT_AT(k, len, l, s) do { pc += 4 * (k); executed -= (len) - (k); loads -= (l); stores -= (s); goto out; } while (0)\n\n"
+	"static inline uint32_t lh(const uint8_t* p) { int16_t v; memcpy(&v, p, 2); return (uint32_t)(int32_t)v; }\n"
+	"static inline uint32_t lhu(const uint8_t* p) { uint16_t v; memcpy(&v, p, 2); return v; }\n"
+	"static inline uint32_t lw(const uint8_t* p) { uint32_t v; memcpy(&v, p, 4); return v; }\n\n";
+
+static int aot_is_control(uint8_t op) {
+	return op == OP_JAL || op == OP_JALR || (op >= OP_BEQ && op <= OP_BGEU);
+}
+
+static int aot_supported(uint8_t op) {
+	return op != OP_ILLEGAL && op < OP_ECALL;
+}
+
+/*Blockanfaenge: Einsprung 0, Sprungziele, Nachfolger von Spruengen und nicht uebersetzten
+  Instruktionen sowie per lui/auipc+addi gebildete Codeadressen (Funktionszeiger)*/
+static uint8_t* aot_find_leaders(const CPU* cpu) {
+	size_t n = cpu->decoded_size_;
+	uint8_t* leader = calloc(n + 1, 1);
+	leader[0] = 1;
+	for (size_t i = 0; i < n; i++) {
+		const DecodedInstruction* d = &cpu->decoded_[i];
+		uint32_t pc = 4 * (uint32_t)i;
+		if (aot_is_control(d->base_op_) || !aot_supported(d->base_op_)) {
+			leader[i + 1] = 1;
+		}
+		if (d->base_op_ == OP_JAL || (d->base_op_ >= OP_BEQ && d->base_op_ <= OP_BGEU)) {
+			size_t t = ((pc + d->imm_) & 0xFFFFF) >> 2;
+			if (t < n) leader[t] = 1;
+		}
+		if ((d->base_op_ == OP_LUI || d->base_op_ == OP_AUIPC) && i + 1 < n) {
+			const DecodedInstruction* e = &cpu->decoded_[i + 1];
+			if ((e->base_op_ == OP_ADDI || e->base_op_ == OP_JALR) && e->rs1_ == d->rd_) {
+				uint32_t base = (d->base_op_ == OP_AUIPC) ? pc + d->imm_ : d->imm_;
+				size_t t = ((base + e->imm_) & 0xFFFFF) >> 2;
+				if (t < n) leader[t] = 1;
+			}
+		}
+	}
+	return leader;
+}
+
+/*Ende des Blocks ab i: bis einschliesslich des ersten Sprungs, vor dem naechsten Blockanfang*/
+static size_t aot_block_end(const CPU* cpu, const uint8_t* leader, size_t i) {
+	size_t end = i + 1;
+	while (end < cpu->decoded_size_ && !aot_is_control(cpu->decoded_[end - 1].base_op_) && !leader[end]
+			&& aot_supported(cpu->decoded_[end].base_op_)) {
+		end++;
+	}
+	return end;
+}
+
+/*Sprung auf Instruktion t: goto, wenn dort ein uebersetzter Block beginnt, sonst zurueck zum Interpreter*/
+static void aot_emit_goto(FILE* f, const uint8_t* translated, size_t n, size_t t) {
+	if (t < n && translated[t]) fprintf(f, "goto L_%zu;", t);
+	else fprintf(f, "goto out;");
+}
+
+static const char* aot_branch_condition(uint8_t op) {
+	switch (op) {
+	case OP_BEQ: return "x[%u] == x[%u]";
+	case OP_BNE: return "x[%u] != x[%u]";
+	case OP_BLT: return "(int32_t)x[%u] < (int32_t)x[%u]";
+	case OP_BGE: return "(int32_t)x[%u] >= (int32_t)x[%u]";
+	case OP_BLTU: return "x[%u] < x[%u]";
+	default: return "x[%u] >= x[%u]";
+	}
+}
+
+/*Eine Instruktion an Position k eines Blocks der Laenge len; pc ist die Adresse des Blockanfangs*/
+static void aot_emit_instruction(FILE* f, const CPU* cpu, const uint8_t* translated, const DecodedInstruction* d,
+		uint32_t k, uint32_t len, uint32_t index) {
+	unsigned rd = d->rd_, rs1 = d->rs1_, rs2 = d->rs2_;
+	uint32_t imm = d->imm_;
+	uint32_t off = 4 * k;
+	char dst[16];
+	snprintf(dst, sizeof(dst), rd ? "x[%u] = " : "(void)", rd);
+
+	//loads and stores from this instruction to the end of the block are not executed on an exit here
+	const CounterPrefix* p = cpu->counter_prefix_;
+	size_t end = index - k + len;
+	uint32_t tail_loads = (uint32_t)(p[end].loads_ - p[index].loads_);
+	uint32_t tail_stores = (uint32_t)(p[end].stores_ - p[index].stores_);
+	switch (d->base_op_) {
+	case OP_LUI: if (rd) fprintf(f, "\tx[%u] = 0x%Xu;\n", rd, imm); break;
+	case OP_AUIPC: if (rd) fprintf(f, "\tx[%u] = pc + 0x%Xu;\n", rd, off + imm); break;
+	case OP_JAL: {
+		size_t t = ((4 * index + imm) & 0xFFFFF) >> 2;
+		if (rd) fprintf(f, "\tx[%u] = pc + 0x%Xu;\n", rd, off + 4);
+		fprintf(f, "\tpc += 0x%Xu;\n\t", off + imm);
+		aot_emit_goto(f, translated, cpu->decoded_size_, t);
+		fprintf(f, "\n");
+		break;
+	}
+	case OP_JALR:
+		fprintf(f, "\t{ uint32_t t = (x[%u] + 0x%Xu) & ~1u;", rs1, imm);
+		if (rd) fprintf(f, " x[%u] = pc + 0x%Xu;", rd, off + 4);
+		fprintf(f, " pc = t; goto dispatch; }\n");
+		break;
+	case OP_BEQ: case OP_BNE: case OP_BLT: case OP_BGE: case OP_BLTU: case OP_BGEU: {
+		size_t t = ((4 * index + imm) & 0xFFFFF) >> 2;
+		fprintf(f, "\tif (");
+		fprintf(f, aot_branch_condition(d->base_op_), rs1, rs2);
+		fprintf(f, ") { pc += 0x%Xu; taken++; ", off + imm);
+		aot_emit_goto(f, translated, cpu->decoded_size_, t);
+		fprintf(f, " }\n");
+		break;
+	}
+	case OP_LB: case OP_LH: case OP_LW: case OP_LBU: case OP_LHU: {
+		static const char* const load[] = {
+			[OP_LB] = "(uint32_t)(int32_t)(int8_t)mem[a]", [OP_LBU] = "mem[a]",
+			[OP_LH] = "lh(mem + a)", [OP_LHU] = "lhu(mem + a)", [OP_LW] = "lw(mem + a)",
+		};
+		unsigned width = d->base_op_ == OP_LW ? 4 : (d->base_op_ == OP_LH || d->base_op_ == OP_LHU) ? 2 : 1;
+		fprintf(f, "\t{ uint32_t a = x[%u] + 0x%Xu; if (!RAM(a, %u)) EXIT_AT(%u, %u, %u, %u); %s%s; }\n",
+				rs1, imm, width, k, len, tail_loads, tail_stores, dst, load[d->base_op_]);
+		break;
+	}
+	case OP_SB: case OP_SH: case OP_SW: {
+		unsigned width = d->base_op_ == OP_SW ? 4 : d->base_op_ == OP_SH ? 2 : 1;
+		fprintf(f, "\t{ uint32_t a = x[%u] + 0x%Xu; if (!RAM(a, %u)) EXIT_AT(%u, %u, %u, %u); uint32_t v = x[%u]; memcpy(mem + a, &v, %u); }\n",
+				rs1, imm, width, k, len, tail_loads, tail_stores, rs2, width);
+		break;
+	}
+	case OP_ADDI: if (rd) fprintf(f, "\tx[%u] = x[%u] + 0x%Xu;\n", rd, rs1, imm); break;
+	case OP_SLTI: if (rd) fprintf(f, "\tx[%u] = (int32_t)x[%u] < (int32_t)0x%Xu;\n", rd, rs1, imm); break;
+	case OP_SLTIU: if (rd) fprintf(f, "\tx[%u] = x[%u] < 0x%Xu;\n", rd, rs1, imm); break;
+	case OP_XORI: if (rd) fprintf(f, "\tx[%u] = x[%u] ^ 0x%Xu;\n", rd, rs1, imm); break;
+	case OP_ORI: if (rd) fprintf(f, "\tx[%u] = x[%u] | 0x%Xu;\n", rd, rs1, imm); break;
+	case OP_ANDI: if (rd) fprintf(f, "\tx[%u] = x[%u] & 0x%Xu;\n", rd, rs1, imm); break;
+	case OP_SLLI: if (rd) fprintf(f, "\tx[%u] = x[%u] << %u;\n", rd, rs1, imm); break;
+	case OP_SRLI: if (rd) fprintf(f, "\tx[%u] = x[%u] >> %u;\n", rd, rs1, imm); break;
+	case OP_SRAI: if (rd) fprintf(f, "\tx[%u] = (uint32_t)((int32_t)x[%u] >> %u);\n", rd, rs1, imm); break;
+	case OP_ADD: if (rd) fprintf(f, "\tx[%u] = x[%u] + x[%u];\n", rd, rs1, rs2); break;
+	case OP_SUB: if (rd) fprintf(f, "\tx[%u] = x[%u] - x[%u];\n", rd, rs1, rs2); break;
+	case OP_SLL: if (rd) fprintf(f, "\tx[%u] = x[%u] << (x[%u] & 31);\n", rd, rs1, rs2); break;
+	case OP_SLT: if (rd) fprintf(f, "\tx[%u] = (int32_t)x[%u] < (int32_t)x[%u];\n", rd, rs1, rs2); break;
+	case OP_SLTU: if (rd) fprintf(f, "\tx[%u] = x[%u] < x[%u];\n", rd, rs1, rs2); break;
+	case OP_XOR: if (rd) fprintf(f, "\tx[%u] = x[%u] ^ x[%u];\n", rd, rs1, rs2); break;
+	case OP_SRL: if (rd) fprintf(f, "\tx[%u] = x[%u] >> (x[%u] & 31);\n", rd, rs1, rs2); break;
+	case OP_SRA: if (rd) fprintf(f, "\tx[%u] = (uint32_t)((int32_t)x[%u] >> (x[%u] & 31));\n", rd, rs1, rs2); break;
+	case OP_OR: if (rd) fprintf(f, "\tx[%u] = x[%u] | x[%u];\n", rd, rs1, rs2); break;
+	case OP_AND: if (rd) fprintf(f, "\tx[%u] = x[%u] & x[%u];\n", rd, rs1, rs2); break;
+	default: break;
+	}
+}
+
+int CPU_aot_emit(const CPU* cpu, const char* filename) {
+	if (RV_XLEN != 32) {
+		fprintf(stderr, "aot: RV32 only\n");
+		return -1;
+	}
+	FILE* f = fopen(filename, "w");
+	if (!f) {
+		perror(filename);
+		return -1;
+	}
+	size_t n = cpu->decoded_size_;
+	uint8_t* leader = aot_find_leaders(cpu);
+	uint8_t* translated = calloc(n + 1, 1);
+	size_t blocks = 0;
+	for (size_t i = 0; i < n; ) {
+		if (!aot_supported(cpu->decoded_[i].base_op_)) {
+			i++;
+			continue;
+		}
+		translated[i] = 1;
+		blocks++;
+		i = aot_block_end(cpu, leader, i);
+	}
+
+	fputs(aot_prologue, f);
+	fprintf(f, "const uint32_t rv_aot_abi_version = %d;\n", AOT_ABI_VERSION);
+	fprintf(f, "const uint64_t rv_aot_image_hash = 0x%016llXull;\n\n", (unsigned long long)CPU_image_hash(cpu));
+	fprintf(f, "void rv_aot_run(AotState* s, uint64_t budget) {\n"
+			"\tuint32_t* restrict x = s->regs_;\n"
+			"\tuint8_t* restrict mem = s->mem_;\n"
+			"\tconst uint8_t* attr = s->page_attr_;\n"
+			"\tuint32_t pc = s->pc_;\n"
+			"\tuint64_t executed = 0, loads = 0, stores = 0, taken = 0;\n"
+			"\tgoto dispatch;\n");
+
+	for (size_t i = 0; i < n; ) {
+		if (!aot_supported(cpu->decoded_[i].base_op_)) {
+			i++;
+			continue;
+		}
+		size_t end = aot_block_end(cpu, leader, i);
+		uint32_t len = (uint32_t)(end - i);
+		fprintf(f, "L_%zu: /* 0x%05zX */\n", i, 4 * i);
+		fprintf(f, "\tif (budget - executed < %u) goto out;\n\texecuted += %u;\n", len, len);
+		const CounterPrefix* p = cpu->counter_prefix_;
+		if (p[end].loads_ != p[i].loads_) fprintf(f, "\tloads += %u;\n", (uint32_t)(p[end].loads_ - p[i].loads_));
+		if (p[end].stores_ != p[i].stores_) fprintf(f, "\tstores += %u;\n", (uint32_t)(p[end].stores_ - p[i].stores_));
+		for (uint32_t k = 0; k < len; k++) {
+			aot_emit_instruction(f, cpu, translated, &cpu->decoded_[i + k], k, len, (uint32_t)(i + k));
+		}
+		uint8_t last = cpu->decoded_[end - 1].base_op_;
+		if (last != OP_JAL && last != OP_JALR) {
+			//fall through (or branch not taken) into the next block, or leave at an untranslated instruction
+			fprintf(f, "\tpc += 0x%Xu;\n\t", 4 * len);
+			aot_emit_goto(f, translated, n, end);
+			fprintf(f, "\n");
+		}
+		i = end;
+	}
+
+	//lookup table for indirect jumps; targets not found statically go back to the interpreter
+	fprintf(f, "dispatch:\n\tswitch ((pc & 0xFFFFFu) >> 2) {\n");
+	for (size_t i = 0; i < n; i++) {
+		if (translated[i]) fprintf(f, "\tcase %zu: goto L_%zu;\n", i, i);
+	}
+	fprintf(f, "\tdefault: goto out;\n\t}\n");
+	fprintf(f, "out:\n\ts->pc_ = pc;\n\ts->executed_ = executed;\n\ts->loads_ = loads;\n\ts->stores_ = stores;\n\ts->taken_branches_ = taken;\n}\n");
+	fclose(f);
+	free(leader);
+	free(translated);
+	printf("aot: %zu blocks from %zu instructions written to %s\n", blocks, n, filename);
+	return 0;
+}
+
+/*Uebersetzte Bibliothek laden; sie muss zum geladenen Instruktionsspeicher passen*/
+int CPU_aot_load(CPU* cpu, const char* filename) {
+	if (RV_XLEN != 32) {
+		fprintf(stderr, "aot: RV32 only\n");
+		return -1;
+	}
+	//the translated blocks jump to each other directly and would never reach an OP_HOOK entry
+	if (cpu->hook_count_) {
+		fprintf(stderr, "aot: not together with native hooks\n");
+		return -1;
+	}
+	char path[4096];
+	//a bare file name would make dlopen search the library path
+	snprintf(path, sizeof(path), "%s%s", strchr(filename, '/') ? "" : "./", filename);
+	void* lib = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+	if (!lib) {
+		fprintf(stderr, "aot: %s\n", dlerror());
+		return -1;
+	}
+	const uint32_t* abi = dlsym(lib, "rv_aot_abi_version");
+	const uint64_t* hash = dlsym(lib, "rv_aot_image_hash");
+	aot_entry run = (aot_entry)dlsym(lib, "rv_aot_run");
+	if (!abi || !hash || !run || *abi != AOT_ABI_VERSION || *hash != CPU_image_hash(cpu)) {
+		fprintf(stderr, "aot: %s does not match this emulator or instruction memory\n", filename);
+		dlclose(lib);
+		return -1;
+	}
+	if (cpu->aot_lib_) {
+		dlclose(cpu->aot_lib_);
+	}
+	cpu->aot_run_ = run;
+	cpu->aot_lib_ = lib;
+	return 0;
+}
+
+/*Zeitscheibe mit uebersetztem Code; jede Rueckkehr fuehrt eine Instruktion im Interpreter aus.
+  Aendert die den Code (CPU_code_written), geht es ab der naechsten Zeitscheibe interpretiert weiter*/
+void CPU_run_slice_aot(CPU* cpu) {
+	while (cpu->cycle_ < cpu->slice_limit_ && cpu->aot_run_) {
+		CPU_end_run(cpu, counter_index(cpu, cpu->pc_)); //the interpreted run up to here
+		AotState s = { .regs_ = (uint32_t*)cpu->regfile_, .mem_ = cpu->data_mem_, .page_attr_ = cpu->page_attr_, .pc_ = cpu->pc_ }; //never loaded with RV_XLEN 64
+		((aot_entry)cpu->aot_run_)(&s, cpu->slice_limit_ - cpu->cycle_);
+		CPU_set_pc(cpu, s.pc_);
+		cpu->cycle_ += s.executed_;
+		cpu->loads_ += s.loads_;
+		cpu->stores_ += s.stores_;
+		cpu->taken_branches_ += s.taken_branches_;
+		cpu->aot_exits_++;
+		if (cpu->cycle_ >= cpu->slice_limit_) {
+			break;
+		}
+		CPU_execute(cpu);
+		cpu->cycle_++;
+	}
+}
+
+/**
+ * Modelle (Zeitmodell, Caches, Sprungvorhersage): CPU_run fuehrt Zeitscheiben dann nicht in der Interpreterschleife,
+ * sondern in CPU_run_slice_models aus, das nach jeder Instruktion die eingeschalteten Modelle
+ * mit pc, dekodierter Instruktion und Speicheradresse aufruft. Ohne Modell bleibt die
+ * Interpreterschleife unveraendert, CPU_run prueft die Modelle nur einmal je Zeitscheibe.
+ */
+/*Register- und Speicherverhalten je Operation*/
+enum op_class {
+	OPC_RS1 = 0x1, OPC_RS2 = 0x2, OPC_RD = 0x4, OPC_FRS1 = 0x8, OPC_FRS2 = 0x10, OPC_FRD = 0x20,
+	OPC_LOAD = 0x40, OPC_STORE = 0x80, OPC_LONG = 0x100
+};
+
+#define OPC_ALU_I (OPC_RS1 | OPC_RD)
+#define OPC_ALU_R (OPC_RS1 | OPC_RS2 | OPC_RD)
+#define OPC_BRANCH (OPC_RS1 | OPC_RS2)
+#define OPC_FP_R (OPC_FRS1 | OPC_FRS2 | OPC_FRD)
+
+static const uint16_t op_classes[OP_COUNT] = {
+	[OP_LUI] = OPC_RD, [OP_AUIPC] = OPC_RD, [OP_JAL] = OPC_RD, [OP_JALR] = OPC_ALU_I,
+	[OP_BEQ] = OPC_BRANCH, [OP_BNE] = OPC_BRANCH, [OP_BLT] = OPC_BRANCH, [OP_BGE] = OPC_BRANCH,
+	[OP_BLTU] = OPC_BRANCH, [OP_BGEU] = OPC_BRANCH,
+	[OP_LB] = OPC_ALU_I | OPC_LOAD, [OP_LH] = OPC_ALU_I | OPC_LOAD, [OP_LW] = OPC_ALU_I | OPC_LOAD,
+	[OP_LBU] = OPC_ALU_I | OPC_LOAD, [OP_LHU] = OPC_ALU_I | OPC_LOAD, [OP_LWU] = OPC_ALU_I | OPC_LOAD, [OP_LD] = OPC_ALU_I | OPC_LOAD,
+	[OP_SB] = OPC_BRANCH | OPC_STORE, [OP_SH] = OPC_BRANCH | OPC_STORE, [OP_SW] = OPC_BRANCH | OPC_STORE,
+	[OP_SD] = OPC_BRANCH | OPC_STORE,
+	[OP_ADDI] = OPC_ALU_I, [OP_SLTI] = OPC_ALU_I, [OP_SLTIU] = OPC_ALU_I, [OP_XORI] = OPC_ALU_I, [OP_ORI] = OPC_ALU_I,
+	[OP_ANDI] = OPC_ALU_I, [OP_SLLI] = OPC_ALU_I, [OP_SRLI] = OPC_ALU_I, [OP_SRAI] = OPC_ALU_I,
+	[OP_ADD] = OPC_ALU_R, [OP_SUB] = OPC_ALU_R, [OP_SLL] = OPC_ALU_R, [OP_SLT] = OPC_ALU_R, [OP_SLTU] = OPC_ALU_R,
+	[OP_XOR] = OPC_ALU_R, [OP_SRL] = OPC_ALU_R, [OP_SRA] = OPC_ALU_R, [OP_OR] = OPC_ALU_R, [OP_AND] = OPC_ALU_R,
+	[OP_ADDIW] = OPC_ALU_I, [OP_SLLIW] = OPC_ALU_I, [OP_SRLIW] = OPC_ALU_I, [OP_SRAIW] = OPC_ALU_I,
+	[OP_ADDW] = OPC_ALU_R, [OP_SUBW] = OPC_ALU_R, [OP_SLLW] = OPC_ALU_R, [OP_SRLW] = OPC_ALU_R, [OP_SRAW] = OPC_ALU_R,
+	[OP_CSRRW] = OPC_ALU_I, [OP_CSRRS] = OPC_ALU_I, [OP_CSRRC] = OPC_ALU_I,
+	[OP_CSRRWI] = OPC_RD, [OP_CSRRSI] = OPC_RD, [OP_CSRRCI] = OPC_RD,
+	[OP_FLW] = OPC_RS1 | OPC_FRD | OPC_LOAD, [OP_FLD] = OPC_RS1 | OPC_FRD | OPC_LOAD,
+	[OP_FSW] = OPC_RS1 | OPC_FRS2 | OPC_STORE, [OP_FSD] = OPC_RS1 | OPC_FRS2 | OPC_STORE,
+	[OP_FMADD] = OPC_FP_R, [OP_FMSUB] = OPC_FP_R, [OP_FNMSUB] = OPC_FP_R, [OP_FNMADD] = OPC_FP_R,
+	[OP_FADD] = OPC_FP_R, [OP_FSUB] = OPC_FP_R, [OP_FMUL] = OPC_FP_R, [OP_FDIV] = OPC_FP_R | OPC_LONG,
+	[OP_FSQRT] = OPC_FRS1 | OPC_FRD | OPC_LONG, [OP_FSGNJ] = OPC_FP_R, [OP_FMINMAX] = OPC_FP_R,
+	[OP_FCVT_F_F] = OPC_FRS1 | OPC_FRD, [OP_FCMP] = OPC_FRS1 | OPC_FRS2 | OPC_RD, [OP_FCVT_W] = OPC_FRS1 | OPC_RD,
+	[OP_FCVT_F_W] = OPC_RS1 | OPC_FRD, [OP_FMV_X_FCLASS] = OPC_FRS1 | OPC_RD, [OP_FMV_W_X] = OPC_RS1 | OPC_FRD,
+	[OP_VSETVL] = OPC_ALU_I, [OP_VLOAD] = OPC_RS1 | OPC_LOAD, [OP_VSTORE] = OPC_RS1 | OPC_STORE,
+	[OP_LR_W] = OPC_ALU_I | OPC_LOAD, [OP_SC_W] = OPC_ALU_R | OPC_STORE, [OP_AMO_W] = OPC_ALU_R | OPC_LOAD | OPC_STORE,
+};
+
+/**
+ * Zeitmodell (--timing): fuenfstufige In-Order-Pipeline IF ID EX MEM WB mit vollem Forwarding.
+ * Der Interpreter fuehrt jede Instruktion wie sonst aus, danach rechnet das Modell ab, was sie
+ * die Pipeline kostet: einen Takt, dazu Wartetakte fuer langsame Fetches, Load-Use-Abhaengigkeiten
+ * (ein Takt, erkannt in ID), mehrtaktige Operationen in EX (fdiv, fsqrt), Speicherlatenzen in MEM
+ * und das Verwerfen falsch geholter Instruktionen nach Spruengen (statisch "nicht genommen"
+ * vorhergesagt). Ein Wartetakt in einer Stufe haelt die Stufen davor fest und laesst die dahinter
+ * leer laufen, daraus ergibt sich die Belegung jeder Stufe. Abhaengigkeiten werden fuer x- und
+ * f-Register verfolgt, Vektorbefehle zaehlen als ein EX-Takt. Das Modell wird in
+ * CPU_run_slice_models fuer jede ausgefuehrte Instruktion aufgerufen.
+ */
+#define TIMING_NO_REG 0xFFu
+
+struct Timing {
+    CPU_TimingConfig config_;
+    CPU_TimingStats stats_;
+    uint32_t load_reg_; //destination of the previous instruction if it was a load (32.. = f registers)
+};
+
+void CPU_timing_defaults(CPU_TimingConfig* config) {
+	*config = (CPU_TimingConfig){ 1, 1, 1, 1, 1, 2, 1 };
+}
+
+int CPU_enable_timing(CPU* cpu, const CPU_TimingConfig* config) {
+	free(cpu->timing_);
+	cpu->timing_ = NULL;
+	if (!config) {
+		return 0;
+	}
+	cpu->timing_ = calloc(1, sizeof(struct Timing));
+	if (!cpu->timing_) {
+		return -1;
+	}
+	cpu->timing_->config_ = *config;
+	cpu->timing_->load_reg_ = TIMING_NO_REG;
+	return 0;
+}
+
+/*cycles Wartetakte in stage: Stufen davor halten ihre Instruktion, die dahinter laufen leer*/
+static void timing_stall(struct Timing* t, int cause, int stage, uint64_t cycles) {
+	if (cycles == 0) {
+		return;
+	}
+	t->stats_.stalls_[cause] += cycles;
+	t->stats_.events_[cause]++;
+	if (cause == STALL_CONTROL) {
+		return; //the fetched instructions are squashed, every stage did nothing useful
+	}
+	for (int s = 0; s < stage; s++) {
+		t->stats_.held_[s] += cycles;
+	}
+	if (cause == STALL_LOAD_USE) {
+		t->stats_.held_[stage] += cycles;
+	}
+	else {
+		t->stats_.busy_[stage] += cycles;
+	}
+}
+
+static uint64_t timing_extra(uint32_t latency) {
+	return latency > 1 ? latency - 1 : 0;
+}
+
+/*Ausgefuehrte Instruktion d (bei pc, Speicheradresse addr) abrechnen*/
+static void timing_account(CPU* cpu, const DecodedInstruction* d, uint32_t pc, uint32_t addr) {
+	struct Timing* t = cpu->timing_;
+	const CPU_TimingConfig* c = &t->config_;
+	uint32_t cls = op_classes[d->base_op_];
+	t->stats_.instructions_++;
+	for (int s = 0; s < STAGE_COUNT; s++) {
+		t->stats_.busy_[s]++;
+	}
+	timing_stall(t, STALL_FETCH, STAGE_IF, timing_extra(c->fetch_));
+
+	uint32_t reg = t->load_reg_;
+	if (reg != TIMING_NO_REG && (((cls & OPC_RS1) && reg == d->rs1_) || ((cls & OPC_RS2) && reg == d->rs2_)
+			|| ((cls & OPC_FRS1) && reg == 32u + d->rs1_) || ((cls & OPC_FRS2) && reg == 32u + d->rs2_))) {
+		timing_stall(t, STALL_LOAD_USE, STAGE_ID, 1);
+	}
+	if (cls & OPC_LONG) {
+		timing_stall(t, STALL_EXECUTE, STAGE_EX, timing_extra(c->fdiv_));
+	}
+	if (cls & (OPC_LOAD | OPC_STORE)) {
+		uint32_t latency = c->mmio_;
+		if (cpu->page_attr_[addr >> PAGE_SHIFT] <= PAGE_CODE) {
+			//an amo reads and writes in one MEM visit
+			latency = (cls & OPC_LOAD) && (cls & OPC_STORE) ? c->load_ + c->store_ - 1 : (cls & OPC_LOAD) ? c->load_ : c->store_;
+		}
+		timing_stall(t, STALL_MEMORY, STAGE_MEM, timing_extra(latency));
+	}
+
+	t->load_reg_ = TIMING_NO_REG;
+	if ((cls & OPC_LOAD) && (cls & OPC_RD) && d->rd_) t->load_reg_ = d->rd_;
+	if ((cls & OPC_LOAD) && (cls & OPC_FRD)) t->load_reg_ = 32u + d->rd_;
+	if (cpu->pc_ != pc + 4 && !cpu->halted_) {
+		timing_stall(t, STALL_CONTROL, STAGE_EX, d->base_op_ == OP_JAL ? c->jump_ : c->branch_);
+	}
+}
+
+int CPU_timing_stats(const CPU* cpu, CPU_TimingStats* stats) {
+	if (!cpu->timing_) {
+		return -1;
+	}
+	*stats = cpu->timing_->stats_;
+	stats->cycles_ = stats->instructions_ ? stats->instructions_ + STAGE_COUNT - 1 : 0; //fill and drain
+	for (int i = 0; i < STALL_COUNT; i++) {
+		stats->cycles_ += stats->stalls_[i];
+	}
+	return 0;
+}
+
+void CPU_print_timing(const CPU* cpu) {
+	CPU_TimingStats st;
+	if (CPU_timing_stats(cpu, &st) < 0) {
+		return;
+	}
+	static const char* const stall_names[STALL_COUNT] = { "fetch", "load-use", "execute", "memory", "control" };
+	static const char* const stage_names[STAGE_COUNT] = { "IF", "ID", "EX", "MEM", "WB" };
+	double cycles = st.cycles_ ? (double)st.cycles_ : 1.0;
+	printf("\ntiming: %llu cycles, %llu instructions, CPI %.3f\n", (unsigned long long)st.cycles_,
+			(unsigned long long)st.instructions_, st.instructions_ ? (double)st.cycles_ / (double)st.instructions_ : 0.0);
+	printf("stall         cycles  share  instructions\n");
+	for (int i = 0; i < STALL_COUNT; i++) {
+		printf("%-9s %10llu %5.1f%%  %llu\n", stall_names[i], (unsigned long long)st.stalls_[i],
+				100.0 * (double)st.stalls_[i] / cycles, (unsigned long long)st.events_[i]);
+	}
+	printf("stage   busy   held  empty\n");
+	for (int s = 0; s < STAGE_COUNT; s++) {
+		uint64_t empty = st.cycles_ - st.busy_[s] - st.held_[s];
+		printf("%-4s %5.1f%% %5.1f%% %5.1f%%\n", stage_names[s], 100.0 * (double)st.busy_[s] / cycles,
+				100.0 * (double)st.held_[s] / cycles, 100.0 * (double)empty / cycles);
+	}
+}
+
+/**
+ * Cache-Simulation (--cache): beliebig viele L1-Konfigurationen laufen in einem Durchgang
+ * nebeneinander, Instruktionscaches sehen jeden Fetch, Datencaches jeden Load/Store ins RAM
+ * (Geraetezugriffe gehen am Cache vorbei). Gespeichert werden nur Tags, kein Inhalt.
+ * Ersetzung LRU (Zeitstempel), Baum-PLRU oder zufaellig; Write-Back mit Write-Allocate oder
+ * Write-Through ohne Write-Allocate (dann zaehlt jeder Store als Schreibzugriff auf den Speicher).
+ * Mit Sampling wird nur in Fenstern gezaehlt: je period_ Instruktionen zuerst warmup_ zum
+ * Aufwaermen (Caches werden aktualisiert, aber nicht gezaehlt), dann length_ gezaehlt, den Rest
+ * fuehrt die normale Interpreterschleife aus.
+ */
+#define CACHE_MAX 16
+#define CACHE_NO_LINE UINT64_MAX
+
+typedef struct {
+    CPU_CacheConfig config_;
+    CPU_CacheStats stats_;
+    uint32_t line_shift_;
+    uint32_t set_mask_;
+    uint64_t* tags_; //line + 1 per way, 0 = invalid
+    uint64_t* stamps_; //LRU: time of the last access per way
+    uint64_t* plru_; //PLRU: tree bits per set, node n (1..ways-1) points to the colder half
+    uint8_t* dirty_;
+    uint64_t clock_;
+    uint64_t random_;
+    uint64_t last_line_; //line of the last access, always the most recently used of its set
+    uint32_t last_way_;
+    uint64_t* functions_; //accesses and misses per function
+} Cache;
+
+struct CacheModel {
+    Cache caches_[CACHE_MAX];
+    size_t count_;
+    uint64_t period_; //0 = no sampling
+    uint64_t length_;
+    uint64_t warmup_;
+    int counting_; //current window is counted
+    const SymbolTable* symbols_; //function_of_ was built from these
+    Symbol* functions_; //symbols_ sorted by address, names are not copied
+    size_t function_count_;
+    uint32_t* function_of_; //index into functions_ per instruction word, function_count_ = none
+};
+
+static const char* const cache_policy_names[] = { "lru", "plru", "random" };
+
+static struct CacheModel* CPU_cache_model(CPU* cpu) {
+	if (!cpu->caches_) {
+		cpu->caches_ = calloc(1, sizeof(struct CacheModel));
+	}
+	return cpu->caches_;
+}
+
+static void cache_free(Cache* c) {
+	free(c->tags_);
+	free(c->stamps_);
+	free(c->plru_);
+	free(c->dirty_);
+	free(c->functions_);
+}
+
+void CPU_free_caches(CPU* cpu) {
+	struct CacheModel* m = cpu->caches_;
+	if (!m) {
+		return;
+	}
+	for (size_t i = 0; i < m->count_; i++) {
+		cache_free(&m->caches_[i]);
+	}
+	free(m->functions_);
+	free(m->function_of_);
+	free(m);
+	cpu->caches_ = NULL;
+}
+
+static int is_power_of_two(uint64_t x) {
+	return x && !(x & (x - 1));
+}
+
+/*Rueckgabe Index des Caches, -1 bei ungueltiger Konfiguration*/
+int CPU_add_cache(CPU* cpu, const CPU_CacheConfig* config) {
+	const CPU_CacheConfig* k = config;
+	if (k->line_ < 4 || !is_power_of_two(k->line_) || k->ways_ == 0 || k->policy_ > CACHE_RANDOM
+			|| (k->policy_ == CACHE_PLRU && (!is_power_of_two(k->ways_) || k->ways_ > 64))
+			|| k->size_ % ((uint64_t)k->ways_ * k->line_) != 0
+			|| !is_power_of_two(k->size_ / ((uint64_t)k->ways_ * k->line_))) {
+		return -1;
+	}
+	struct CacheModel* m = CPU_cache_model(cpu);
+	if (!m || m->count_ == CACHE_MAX) {
+		return -1;
+	}
+	Cache* c = &m->caches_[m->count_];
+	memset(c, 0, sizeof(*c));
+	uint32_t sets = k->size_ / (k->ways_ * k->line_);
+	size_t lines = (size_t)sets * k->ways_;
+	c->config_ = *k;
+	c->line_shift_ = (uint32_t)__builtin_ctz(k->line_);
+	c->set_mask_ = sets - 1;
+	c->tags_ = calloc(lines, sizeof(uint64_t));
+	c->stamps_ = calloc(lines, sizeof(uint64_t));
+	c->plru_ = calloc(sets, sizeof(uint64_t));
+	c->dirty_ = calloc(lines, 1);
+	c->random_ = 0x9E3779B97F4A7C15ull + m->count_;
+	c->last_line_ = CACHE_NO_LINE;
+	if (!c->tags_ || !c->stamps_ || !c->plru_ || !c->dirty_) {
+		cache_free(c);
+		return -1;
+	}
+	if (m->function_of_) {
+		m->symbols_ = NULL; //rebuild, the new cache needs its function counters
+	}
+	m->counting_ = m->period_ == 0;
+	return (int)m->count_++;
+}
+
+/*period 0: jede Instruktion zaehlt*/
+int CPU_set_cache_sampling(CPU* cpu, uint64_t period, uint64_t length, uint64_t warmup) {
+	if (period && (length == 0 || warmup + length > period)) {
+		return -1;
+	}
+	struct CacheModel* m = CPU_cache_model(cpu);
+	if (!m) {
+		return -1;
+	}
+	m->period_ = period;
+	m->length_ = length;
+	m->warmup_ = warmup;
+	m->counting_ = period == 0;
+	return 0;
+}
+
+int CPU_cache_stats(const CPU* cpu, size_t index, CPU_CacheStats* stats) {
+	if (!cpu->caches_ || index >= cpu->caches_->count_) {
+		return -1;
+	}
+	*stats = cpu->caches_->caches_[index].stats_;
+	return 0;
+}
+
+static void cache_touch(Cache* c, uint32_t set, uint32_t way) {
+	uint32_t ways = c->config_.ways_;
+	c->stamps_[(size_t)set * ways + way] = ++c->clock_;
+	if (c->config_.policy_ == CACHE_PLRU) {
+		uint64_t bits = c->plru_[set];
+		for (uint32_t node = way + ways; node > 1; node >>= 1) {
+			//parent points to the other child
+			if (node & 1) bits &= ~(1ull << (node >> 1));
+			else bits |= 1ull << (node >> 1);
+		}
+		c->plru_[set] = bits;
+	}
+}
+
+static uint32_t cache_victim(Cache* c, uint32_t set) {
+	uint32_t ways = c->config_.ways_;
+	size_t base = (size_t)set * ways;
+	for (uint32_t w = 0; w < ways; w++) {
+		if (!c->tags_[base + w]) return w;
+	}
+	if (c->config_.policy_ == CACHE_PLRU) {
+		uint32_t node = 1;
+		while (node < ways) {
+			node = 2 * node + (uint32_t)((c->plru_[set] >> node) & 1);
+		}
+		return node - ways;
+	}
+	if (c->config_.policy_ == CACHE_RANDOM) {
+		c->random_ ^= c->random_ << 13;
+		c->random_ ^= c->random_ >> 7;
+		c->random_ ^= c->random_ << 17;
+		return (uint32_t)(c->random_ % ways);
+	}
+	uint32_t victim = 0;
+	for (uint32_t w = 1; w < ways; w++) {
+		if (c->stamps_[base + w] < c->stamps_[base + victim]) victim = w;
+	}
+	return victim;
+}
+
+/*Ein Zugriff; count = 0 waehrend des Aufwaermens, fn = Zaehler der laufenden Funktion oder NULL*/
+static void cache_access(Cache* c, uint32_t addr, int write, int count, uint64_t* fn) {
+	uint64_t line = addr >> c->line_shift_;
+	uint32_t set = (uint32_t)line & c->set_mask_;
+	uint32_t ways = c->config_.ways_;
+	size_t base = (size_t)set * ways;
+	int hit = line == c->last_line_;
+	uint32_t way = c->last_way_;
+	for (uint32_t w = 0; !hit && w < ways; w++) {
+		if (c->tags_[base + w] == line + 1) {
+			hit = 1;
+			way = w;
+		}
+	}
+	uint64_t writebacks = 0;
+	if (hit) {
+		if (line != c->last_line_) cache_touch(c, set, way);
+		if (write && c->config_.write_back_) c->dirty_[base + way] = 1;
+		else if (write) writebacks = 1;
+	}
+	else if (write && !c->config_.write_back_) {
+		writebacks = 1; //no write allocate
+	}
+	else {
+		way = cache_victim(c, set);
+		writebacks = c->dirty_[base + way];
+		c->tags_[base + way] = line + 1;
+		c->dirty_[base + way] = (uint8_t)write;
+		cache_touch(c, set, way);
+	}
+	if (hit || write == 0 || c->config_.write_back_) {
+		c->last_line_ = line;
+		c->last_way_ = way;
+	}
+	if (!count) {
+		return;
+	}
+	c->stats_.accesses_++;
+	c->stats_.misses_ += !hit;
+	c->stats_.writes_ += (uint64_t)write;
+	c->stats_.write_misses_ += (uint64_t)(write && !hit);
+	c->stats_.writebacks_ += writebacks;
+	if (fn) {
+		fn[0]++;
+		fn[1] += !hit;
+	}
+}
+
+static int symbol_order(const void* a, const void* b) {
+	const Symbol* x = a;
+	const Symbol* y = b;
+	return (x->addr_ & 0xFFFFF) < (y->addr_ & 0xFFFFF) ? -1 : (x->addr_ & 0xFFFFF) > (y->addr_ & 0xFFFFF);
+}
+
+/*Funktion je Instruktionswort: das Symbol mit der groessten Adresse <= pc*/
+static void cache_build_functions(CPU* cpu) {
+	struct CacheModel* m = cpu->caches_;
+	const SymbolTable* table = cpu->symbols_;
+	size_t count = table->count_;
+	free(m->functions_);
+	free(m->function_of_);
+	m->functions_ = malloc((count ? count : 1) * sizeof(Symbol));
+	m->function_of_ = malloc((cpu->decoded_size_ ? cpu->decoded_size_ : 1) * sizeof(uint32_t));
+	m->function_count_ = count;
+	m->symbols_ = table;
+	if (!m->functions_ || !m->function_of_) {
+		free(m->functions_);
+		free(m->function_of_);
+		m->functions_ = NULL;
+		m->function_of_ = NULL;
+		return;
+	}
+	memcpy(m->functions_, table->symbols_, count * sizeof(Symbol));
+	qsort(m->functions_, count, sizeof(Symbol), symbol_order);
+	size_t next = 0;
+	uint32_t current = (uint32_t)count;
+	for (size_t i = 0; i < cpu->decoded_size_; i++) {
+		while (next < count && (m->functions_[next].addr_ & 0xFFFFF) >> 2 <= i) {
+			current = (uint32_t)next++;
+		}
+		m->function_of_[i] = current;
+	}
+	for (size_t i = 0; i < m->count_; i++) {
+		free(m->caches_[i].functions_);
+		m->caches_[i].functions_ = calloc(2 * (count + 1), sizeof(uint64_t));
+	}
+}
+
+/*Instruktion d bei pc mit Speicheradresse addr an alle Caches melden*/
+static void cache_account(CPU* cpu, const DecodedInstruction* d, uint32_t pc, uint32_t addr) {
+	struct CacheModel* m = cpu->caches_;
+	uint32_t cls = op_classes[d->base_op_];
+	int data = (cls & (OPC_LOAD | OPC_STORE)) && cpu->page_attr_[addr >> PAGE_SHIFT] <= PAGE_CODE;
+	size_t fn = SIZE_MAX;
+	if (m->function_of_ && m->counting_) {
+		size_t index = (pc & 0xFFFFF) >> 2;
+		fn = index < cpu->decoded_size_ ? m->function_of_[index] : m->function_count_;
+	}
+	for (size_t i = 0; i < m->count_; i++) {
+		Cache* c = &m->caches_[i];
+		uint64_t* counters = fn != SIZE_MAX && c->functions_ ? c->functions_ + 2 * fn : NULL;
+		if (c->config_.instruction_) {
+			cache_access(c, pc, 0, m->counting_, counters);
+		}
+		else if (data) {
+			//an amo reads the line, then writes it
+			if (cls & OPC_LOAD) cache_access(c, addr, 0, m->counting_, counters);
+			if (cls & OPC_STORE) cache_access(c, addr, 1, m->counting_, counters);
+		}
+	}
+}
+
+static void format_size(char* text, size_t len, uint64_t bytes) {
+	if (bytes >= 1024 * 1024 && bytes % (1024 * 1024) == 0) snprintf(text, len, "%llu MiB", (unsigned long long)(bytes >> 20));
+	else if (bytes >= 1024 && bytes % 1024 == 0) snprintf(text, len, "%llu KiB", (unsigned long long)(bytes >> 10));
+	else snprintf(text, len, "%llu B", (unsigned long long)bytes);
+}
+
+static double percent(uint64_t part, uint64_t whole) {
+	return whole ? 100.0 * (double)part / (double)whole : 0.0;
+}
+
+/*Je Cache eine Zeile, dazu die top_functions Funktionen mit den meisten Misses*/
+void CPU_print_caches(const CPU* cpu, size_t top_functions) {
+	const struct CacheModel* m = cpu->caches_;
+	if (!m || !m->count_) {
+		return;
+	}
+	printf("\ncaches");
+	if (m->period_) {
+		printf(" (sampled: %llu of every %llu instructions counted after %llu warm-up)",
+				(unsigned long long)m->length_, (unsigned long long)m->period_, (unsigned long long)m->warmup_);
+	}
+	printf(":\n");
+	for (size_t i = 0; i < m->count_; i++) {
+		const Cache* c = &m->caches_[i];
+		const CPU_CacheConfig* k = &c->config_;
+		const CPU_CacheStats* st = &c->stats_;
+		char size[32];
+		format_size(size, sizeof(size), k->size_);
+		printf("%zu %s %s %u-way %u B %s%s: %llu accesses, %llu misses (%.2f%%)", i, k->instruction_ ? "I" : "D",
+				size, k->ways_, k->line_, cache_policy_names[k->policy_], k->instruction_ ? "" : k->write_back_ ? " wb" : " wt",
+				(unsigned long long)st->accesses_, (unsigned long long)st->misses_, percent(st->misses_, st->accesses_));
+		if (!k->instruction_) {
+			printf(", %llu writes (%llu misses), %llu %s", (unsigned long long)st->writes_,
+					(unsigned long long)st->write_misses_, (unsigned long long)st->writebacks_,
+					k->write_back_ ? "writebacks" : "memory writes");
+		}
+		printf("\n");
+		if (!c->functions_ || !top_functions) {
+			continue;
+		}
+		//selection of the top entries, the table is small
+		size_t count = m->function_count_ + 1;
+		uint8_t* shown = calloc(count, 1);
+		if (!shown) {
+			continue;
+		}
+		for (size_t n = 0; n < top_functions; n++) {
+			size_t best = count;
+			for (size_t f = 0; f < count; f++) {
+				if (!shown[f] && c->functions_[2 * f + 1] && (best == count || c->functions_[2 * f + 1] > c->functions_[2 * best + 1])) {
+					best = f;
+				}
+			}
+			if (best == count) {
+				break;
+			}
+			shown[best] = 1;
+			const uint64_t* fn = c->functions_ + 2 * best;
+			printf("    %-24s %10llu accesses %8llu misses (%.2f%%)\n",
+					best < m->function_count_ ? m->functions_[best].name_ : "?",
+					(unsigned long long)fn[0], (unsigned long long)fn[1], percent(fn[1], fn[0]));
+		}
+		free(shown);
+	}
+}
+
+/**
+ * Sprungvorhersage (--predictor): mehrere Praediktoren laufen in einem Durchgang nebeneinander
+ * und sehen dieselben Spruenge. Bedingte Spruenge sagt der Praediktor vorher (bimodal: 2-Bit-
+ * Zaehler je pc; gshare: Zaehler indiziert mit pc xor globaler Historie; TAGE-lite: bimodale
+ * Basistabelle und vier getaggte Tabellen mit geometrisch wachsender Historienlaenge, die
+ * laengste passende liefert die Vorhersage). Ziele von jal/jalr kommen aus einem direkt
+ * abgebildeten BTB, Ruecksprunge (jalr x0, 0(ra/t0)) aus einem Return-Address-Stack; Aufrufe
+ * (jal/jalr mit rd = ra/t0) legen die Ruecksprungadresse ab. Die Sprungrichtung liefert der
+ * ausgefuehrte Handler (pc_ nach der Instruktion). Je Instruktionswort werden Ausfuehrungen,
+ * genommene Spruenge und Fehlvorhersagen je Praediktor gezaehlt.
+ */
+#define PREDICTOR_MAX 8
+#define TAGE_TABLES 4
+#define TAGE_TAG_BITS 9
+#define TAGE_AGING 0x40000u //branches between two halvings of the useful counters
+
+typedef struct {
+    uint16_t tag_;
+    uint8_t counter_; //3 bit, taken from 4
+    uint8_t useful_; //2 bit
+} TageEntry;
+
+typedef struct {
+    CPU_PredictorConfig config_;
+    CPU_PredictorStats stats_;
+    uint8_t* counters_; //2 bit, 2^bits_ entries (TAGE: base table)
+    TageEntry* tagged_; //TAGE_TABLES tables of 2^(bits_ - 2) entries
+    uint32_t lengths_[TAGE_TABLES]; //history bits per tagged table
+    uint64_t history_; //global history, newest outcome in bit 0
+    uint32_t* btb_pc_; //pc + 1 per entry, 0 = empty
+    uint32_t* btb_target_;
+    uint32_t* ras_;
+    uint32_t ras_top_;
+    uint32_t ras_count_;
+    uint64_t* misses_; //mispredictions per instruction word
+} Predictor;
+
+struct PredictorModel {
+    Predictor predictors_[PREDICTOR_MAX];
+    size_t count_;
+    size_t size_; //instruction words of the per-branch arrays
+    uint64_t* executions_; //per instruction word
+    uint64_t* taken_;
+};
+
+static const char* const predictor_names[] = { "bimodal", "gshare", "tage" };
+
+static void predictor_free(Predictor* p) {
+	free(p->counters_);
+	free(p->tagged_);
+	free(p->btb_pc_);
+	free(p->btb_target_);
+	free(p->ras_);
+	free(p->misses_);
+}
+
+void CPU_free_predictors(CPU* cpu) {
+	struct PredictorModel* m = cpu->predictors_;
+	if (!m) {
+		return;
+	}
+	for (size_t i = 0; i < m->count_; i++) {
+		predictor_free(&m->predictors_[i]);
+	}
+	free(m->executions_);
+	free(m->taken_);
+	free(m);
+	cpu->predictors_ = NULL;
+}
+
+void CPU_predictor_defaults(CPU_PredictorConfig* config, uint32_t kind) {
+	config->kind_ = kind;
+	config->bits_ = 12;
+	config->history_ = kind == PREDICTOR_TAGE ? 32 : kind == PREDICTOR_GSHARE ? 12 : 0;
+	config->btb_bits_ = 9;
+	config->ras_ = 16;
+}
+
+/*Rueckgabe Index des Praediktors, -1 bei ungueltiger Konfiguration*/
+int CPU_add_predictor(CPU* cpu, const CPU_PredictorConfig* config) {
+	const CPU_PredictorConfig* k = config;
+	if (k->kind_ > PREDICTOR_TAGE || k->bits_ < 4 || k->bits_ > 24 || k->history_ > 64 || k->btb_bits_ > 24
+			|| (k->kind_ == PREDICTOR_TAGE && k->history_ < 2 * TAGE_TABLES)) {
+		return -1;
+	}
+	if (!cpu->predictors_) {
+		cpu->predictors_ = calloc(1, sizeof(struct PredictorModel));
+	}
+	struct PredictorModel* m = cpu->predictors_;
+	if (!m || m->count_ == PREDICTOR_MAX) {
+		return -1;
+	}
+	Predictor* p = &m->predictors_[m->count_];
+	memset(p, 0, sizeof(*p));
+	p->config_ = *k;
+	size_t entries = (size_t)1 << k->bits_;
+	p->counters_ = malloc(entries);
+	if (k->kind_ == PREDICTOR_TAGE) {
+		p->tagged_ = calloc(TAGE_TABLES * (entries >> 2), sizeof(TageEntry));
+		for (int t = 0; t < TAGE_TABLES; t++) {
+			p->lengths_[t] = k->history_ >> (TAGE_TABLES - 1 - t);
+		}
+	}
+	if (k->btb_bits_) {
+		p->btb_pc_ = calloc((size_t)1 << k->btb_bits_, sizeof(uint32_t));
+		p->btb_target_ = calloc((size_t)1 << k->btb_bits_, sizeof(uint32_t));
+	}
+	if (k->ras_) {
+		p->ras_ = calloc(k->ras_, sizeof(uint32_t));
+	}
+	if (!p->counters_ || (k->kind_ == PREDICTOR_TAGE && !p->tagged_) || (k->btb_bits_ && (!p->btb_pc_ || !p->btb_target_))
+			|| (k->ras_ && !p->ras_)) {
+		predictor_free(p);
+		return -1;
+	}
+	memset(p->counters_, 1, entries); //weakly not taken
+	m->size_ = 0; //per-branch arrays are (re)allocated with the next slice
+	return (int)m->count_++;
+}
+
+int CPU_predictor_stats(const CPU* cpu, size_t index, CPU_PredictorStats* stats) {
+	if (!cpu->predictors_ || index >= cpu->predictors_->count_) {
+		return -1;
+	}
+	*stats = cpu->predictors_->predictors_[index].stats_;
+	return 0;
+}
+
+/*Historie auf bits Bit falten (xor der Stuecke)*/
+static uint32_t fold_history(uint64_t history, uint32_t length, uint32_t bits) {
+	if (length < 64) history &= (1ull << length) - 1;
+	uint32_t folded = 0;
+	for (; history; history >>= bits) {
+		folded ^= (uint32_t)(history & ((1ull << bits) - 1));
+	}
+	return folded;
+}
+
+static void counter_update(uint8_t* counter, int taken, uint8_t max) {
+	if (taken && *counter < max) (*counter)++;
+	else if (!taken && *counter > 0) (*counter)--;
+}
+
+/*TAGE-lite: Vorhersage und Aktualisierung in einem Schritt, Rueckgabe 1 bei Fehlvorhersage*/
+static int tage_branch(Predictor* p, uint32_t pc, int taken) {
+	uint32_t bits = p->config_.bits_ - 2;
+	size_t size = (size_t)1 << bits;
+	TageEntry* entry[TAGE_TABLES];
+	uint16_t tags[TAGE_TABLES];
+	int provider = -1, alternate = -1;
+	for (int t = TAGE_TABLES - 1; t >= 0; t--) {
+		uint32_t length = p->lengths_[t];
+		uint32_t index = ((pc >> 2) ^ (pc >> (2 + bits)) ^ fold_history(p->history_, length, bits)) & (uint32_t)(size - 1);
+		tags[t] = (uint16_t)(((pc >> 2) ^ fold_history(p->history_, length, TAGE_TAG_BITS)
+				^ (fold_history(p->history_, length, TAGE_TAG_BITS - 1) << 1)) & ((1u << TAGE_TAG_BITS) - 1));
+		entry[t] = &p->tagged_[t * size + index];
+		if (entry[t]->tag_ == tags[t]) {
+			if (provider < 0) provider = t;
+			else if (alternate < 0) alternate = t;
+		}
+	}
+	uint8_t* base = &p->counters_[(pc >> 2) & ((1u << p->config_.bits_) - 1)];
+	int base_taken = *base >= 2;
+	int alternate_taken = alternate >= 0 ? entry[alternate]->counter_ >= 4 : base_taken;
+	int predicted = provider >= 0 ? entry[provider]->counter_ >= 4 : base_taken;
+
+	if (provider >= 0) {
+		counter_update(&entry[provider]->counter_, taken, 7);
+		if (predicted != alternate_taken) {
+			counter_update(&entry[provider]->useful_, predicted == taken, 3);
+		}
+	}
+	else {
+		counter_update(base, taken, 3);
+	}
+	if (predicted != taken && provider < TAGE_TABLES - 1) {
+		//allocate in a longer table, otherwise age the candidates
+		int allocated = 0;
+		for (int t = provider + 1; t < TAGE_TABLES && !allocated; t++) {
+			if (entry[t]->useful_ == 0) {
+				entry[t]->tag_ = tags[t];
+				entry[t]->counter_ = taken ? 4 : 3;
+				allocated = 1;
+			}
+		}
+		for (int t = provider + 1; t < TAGE_TABLES && !allocated; t++) {
+			entry[t]->useful_--;
+		}
+	}
+	if ((p->stats_.branches_ & (TAGE_AGING - 1)) == 0) {
+		for (size_t i = 0; i < TAGE_TABLES * size; i++) {
+			p->tagged_[i].useful_ >>= 1;
+		}
+	}
+	return predicted != taken;
+}
+
+/*Bedingter Sprung bei pc; Rueckgabe 1 bei Fehlvorhersage der Richtung oder des Ziels*/
+static int predictor_branch(Predictor* p, uint32_t pc, int taken) {
+	uint32_t mask = (1u << p->config_.bits_) - 1;
+	int miss;
+	p->stats_.branches_++;
+	if (p->config_.kind_ == PREDICTOR_TAGE) {
+		miss = tage_branch(p, pc, taken);
+	}
+	else {
+		uint32_t index = (pc >> 2) & mask;
+		if (p->config_.kind_ == PREDICTOR_GSHARE) index ^= fold_history(p->history_, p->config_.history_, p->config_.bits_);
+		uint8_t* counter = &p->counters_[index & mask];
+		miss = (*counter >= 2) != taken;
+		counter_update(counter, taken, 3);
+	}
+	p->history_ = (p->history_ << 1) | (uint64_t)taken;
+	p->stats_.mispredicted_ += (uint64_t)miss;
+	return miss;
+}
+
+/*jal/jalr bei pc mit Ziel target; Rueckgabe 1 wenn BTB bzw. RAS ein anderes Ziel lieferten*/
+static int predictor_jump(Predictor* p, const DecodedInstruction* d, uint32_t pc, uint32_t target) {
+	int link = d->rd_ == 1 || d->rd_ == 5;
+	int miss;
+	if (d->base_op_ == OP_JALR && d->rd_ == 0 && (d->rs1_ == 1 || d->rs1_ == 5)) {
+		p->stats_.returns_++;
+		miss = 1;
+		if (p->ras_count_) {
+			p->ras_top_ = (p->ras_top_ + p->config_.ras_ - 1) % p->config_.ras_;
+			miss = p->ras_[p->ras_top_] != target;
+			p->ras_count_--;
+		}
+		p->stats_.return_misses_ += (uint64_t)miss;
+	}
+	else {
+		p->stats_.jumps_++;
+		miss = 1;
+		if (p->btb_pc_) {
+			uint32_t index = (pc >> 2) & ((1u << p->config_.btb_bits_) - 1);
+			miss = p->btb_pc_[index] != pc + 1 || p->btb_target_[index] != target;
+			p->btb_pc_[index] = pc + 1;
+			p->btb_target_[index] = target;
+		}
+		p->stats_.target_misses_ += (uint64_t)miss;
+	}
+	if (link && p->ras_) {
+		p->ras_[p->ras_top_] = pc + 4;
+		p->ras_top_ = (p->ras_top_ + 1) % p->config_.ras_;
+		if (p->ras_count_ < p->config_.ras_) p->ras_count_++;
+	}
+	return miss;
+}
+
+static int predictor_alloc_branches(CPU* cpu) {
+	struct PredictorModel* m = cpu->predictors_;
+	size_t size = cpu->decoded_size_ ? cpu->decoded_size_ : 1;
+	free(m->executions_);
+	free(m->taken_);
+	m->executions_ = calloc(size, sizeof(uint64_t));
+	m->taken_ = calloc(size, sizeof(uint64_t));
+	int ok = m->executions_ && m->taken_;
+	for (size_t i = 0; i < m->count_; i++) {
+		free(m->predictors_[i].misses_);
+		m->predictors_[i].misses_ = calloc(size, sizeof(uint64_t));
+		ok = ok && m->predictors_[i].misses_;
+	}
+	m->size_ = size;
+	return ok ? 0 : -1;
+}
+
+/*Ausgefuehrte Instruktion d bei pc an alle Praediktoren melden, wenn sie ein Sprung war*/
+static void predictor_account(CPU* cpu, const DecodedInstruction* d, uint32_t pc) {
+	int branch = is_branch(d->base_op_);
+	if ((!branch && d->base_op_ != OP_JAL && d->base_op_ != OP_JALR) || cpu->halted_) {
+		return;
+	}
+	struct PredictorModel* m = cpu->predictors_;
+	size_t index = (pc & 0xFFFFF) >> 2;
+	uint32_t target = cpu->pc_;
+	int taken = target != pc + 4;
+	int counted = index < m->size_;
+	if (counted) {
+		m->executions_[index]++;
+		m->taken_[index] += (uint64_t)taken;
+	}
+	for (size_t i = 0; i < m->count_; i++) {
+		Predictor* p = &m->predictors_[i];
+		int miss = branch ? predictor_branch(p, pc, taken) : predictor_jump(p, d, pc, target);
+		if (counted) p->misses_[index] += (uint64_t)miss;
+	}
+}
+
+/*Je Praediktor eine Zeile, dazu die top_branches Spruenge mit den meisten Fehlvorhersagen*/
+void CPU_print_predictors(const CPU* cpu, size_t top_branches) {
+	const struct PredictorModel* m = cpu->predictors_;
+	if (!m || !m->count_) {
+		return;
+	}
+	printf("\npredictors:\n");
+	for (size_t i = 0; i < m->count_; i++) {
+		const Predictor* p = &m->predictors_[i];
+		const CPU_PredictorConfig* k = &p->config_;
+		const CPU_PredictorStats* st = &p->stats_;
+		printf("%zu %s %u entries", i, predictor_names[k->kind_], 1u << k->bits_);
+		if (k->kind_ != PREDICTOR_BIMODAL) {
+			printf(", %u history bits", k->history_);
+		}
+		printf(": %llu branches, %llu mispredicted (%.2f%%); BTB %u: %llu jumps, %llu target misses (%.2f%%);"
+				" RAS %u: %llu returns, %llu misses (%.2f%%)\n",
+				(unsigned long long)st->branches_, (unsigned long long)st->mispredicted_, percent(st->mispredicted_, st->branches_),
+				k->btb_bits_ ? 1u << k->btb_bits_ : 0, (unsigned long long)st->jumps_, (unsigned long long)st->target_misses_,
+				percent(st->target_misses_, st->jumps_), k->ras_, (unsigned long long)st->returns_,
+				(unsigned long long)st->return_misses_, percent(st->return_misses_, st->returns_));
+		if (!p->misses_ || !top_branches) {
+			continue;
+		}
+		//selection of the top entries, as many passes as entries shown
+		uint64_t last = UINT64_MAX;
+		size_t last_index = 0, shown = 0;
+		while (shown < top_branches) {
+			size_t best = m->size_;
+			for (size_t w = 0; w < m->size_; w++) {
+				uint64_t misses = p->misses_[w];
+				if (misses && (misses < last || (misses == last && w > last_index))
+						&& (best == m->size_ || misses > p->misses_[best])) {
+					best = w;
+				}
+			}
+			if (best == m->size_) {
+				break;
+			}
+			printf("    pc 0x%08zx %10llu executions %5.1f%% taken %8llu mispredicted (%.2f%%)\n", best << 2,
+					(unsigned long long)m->executions_[best], percent(m->taken_[best], m->executions_[best]),
+					(unsigned long long)p->misses_[best], percent(p->misses_[best], m->executions_[best]));
+			last = p->misses_[best];
+			last_index = best;
+			shown++;
+		}
+	}
+}
+
+/*Zeitscheibe des Interpreters mit Modellen; endet mit Sampling spaetestens an der naechsten Fenstergrenze*/
+void CPU_run_slice_models(CPU* cpu) {
+	struct CacheModel* m = cpu->caches_;
+	int caches = m && m->count_;
+	if (cpu->predictors_ && cpu->predictors_->size_ != cpu->decoded_size_ && predictor_alloc_branches(cpu) < 0) {
+		cpu->slice_limit_ = cpu->cycle_; //no memory for the per-branch counters
+		return;
+	}
+	if (caches && cpu->symbols_ && m->symbols_ != cpu->symbols_) {
+		cache_build_functions(cpu);
+	}
+	if (caches && m->period_) {
+		uint64_t phase = cpu->cycle_ % m->period_;
+		uint64_t start = cpu->cycle_ - phase;
+		uint64_t end = start + m->period_;
+		if (phase < m->warmup_) end = start + m->warmup_;
+		else if (phase < m->warmup_ + m->length_) end = start + m->warmup_ + m->length_;
+		else caches = 0;
+		m->counting_ = phase >= m->warmup_;
+		if (end < cpu->slice_limit_) cpu->slice_limit_ = end;
+	}
+	if (!caches && !cpu->timing_ && !cpu->predictors_) {
+		while (cpu->cycle_ < cpu->slice_limit_) {
+			CPU_execute(cpu);
+			cpu->cycle_++;
+		}
+		return;
+	}
+	while (cpu->cycle_ < cpu->slice_limit_) {
+		uint32_t pc = cpu->pc_;
+		const DecodedInstruction* d = CPU_fetch(cpu, pc);
+		uint32_t addr = cpu->regfile_[d->rs1_] + d->imm_; //before rd may overwrite rs1
+		CPU_execute(cpu);
+		cpu->cycle_++;
+		if (cpu->timing_) timing_account(cpu, d, pc, addr);
+		if (caches) cache_account(cpu, d, pc, addr);
+		if (cpu->predictors_) predictor_account(cpu, d, pc);
+	}
+}
+
+/**
+ * Basisblockvektoren (--bbv): die Ausfuehrung wird in Intervalle zu interval_ Instruktionen
+ * geteilt, je Intervall wird eine Zeile im SimPoint-Format "T:<block>:<count> :<block>:<count> ..."
+ * geschrieben. Ein Block ist eine gerade Strecke ab ihrem Einsprung (Block-Id = Instruktionswort + 1),
+ * count die darin ausgefuehrten Instruktionen. Gezaehlt wird dort, wo die Leistungszaehler eine
+ * Strecke ohnehin abrechnen (CPU_end_run bei jedem genommenen Sprung und Trap), der Interpreter
+ * selbst bleibt unveraendert. CPU_run beendet Zeitscheiben an den Intervallgrenzen.
+ */
+int CPU_enable_bbv(CPU* cpu, uint64_t interval, FILE* out) {
+	CPU_disable_bbv(cpu);
+	if (!interval || !out) {
+		return 0;
+	}
+	if (cpu->aot_run_) {
+		return -1; //translated code does not report its runs
+	}
+	struct BlockVectors* v = calloc(1, sizeof(struct BlockVectors));
+	if (!v || !(v->counts_ = calloc(cpu->decoded_size_ + 1, sizeof(uint64_t)))) {
+		free(v);
+		return -1;
+	}
+	v->interval_ = interval;
+	v->next_ = cpu->cycle_ - cpu->idle_cycles_ + interval;
+	v->size_ = cpu->decoded_size_ + 1;
+	v->out_ = out;
+	CPU_end_run(cpu, counter_index(cpu, cpu->pc_)); //the run so far is not part of the vectors
+	CPU_set_pc(cpu, cpu->pc_);
+	cpu->bbv_ = v;
+	return 0;
+}
+
+void CPU_disable_bbv(CPU* cpu) {
+	if (cpu->bbv_) {
+		free(cpu->bbv_->counts_);
+		free(cpu->bbv_);
+		cpu->bbv_ = NULL;
+	}
+}
+
+/*Offene Strecke bis pc_ abrechnen und das Intervall schreiben*/
+static void bbv_write(CPU* cpu) {
+	struct BlockVectors* v = cpu->bbv_;
+	CPU_end_run(cpu, counter_index(cpu, cpu->pc_));
+	CPU_set_pc(cpu, cpu->pc_);
+	fputc('T', v->out_);
+	for (size_t i = 0; i < v->size_; i++) {
+		if (v->counts_[i]) {
+			fprintf(v->out_, ":%zu:%llu ", i + 1, (unsigned long long)v->counts_[i]);
+			v->counts_[i] = 0;
+		}
+	}
+	fputc('\n', v->out_);
+	v->intervals_++;
+}
+
+/*Intervallgrenze erreicht (aus CPU_run)*/
+void CPU_bbv_interval(CPU* cpu) {
+	bbv_write(cpu);
+	cpu->bbv_->next_ += cpu->bbv_->interval_;
+}
+
+/*Angefangenes Intervall schreiben, falls es Instruktionen enthaelt; Rueckgabe Zahl der Intervalle*/
+uint64_t CPU_bbv_flush(CPU* cpu) {
+	struct BlockVectors* v = cpu->bbv_;
+	if (!v) {
+		return 0;
+	}
+	if (cpu->cycle_ - cpu->idle_cycles_ + v->interval_ > v->next_) {
+		bbv_write(cpu);
+		v->next_ = cpu->cycle_ - cpu->idle_cycles_ + v->interval_;
+	}
+	fflush(v->out_);
+	return v->intervals_;
+}
+
+/**
+ * Gesampelte Simulation (--simpoints): die Ausfuehrung laeuft funktional (ohne Modelle) bis zum
+ * Anfang jedes gewaehlten Intervalls abzueglich warmup_ und legt dort einen Checkpoint ab:
+ * Architekturzustand (Register, CSRs, Zeit, Zeitgeber-Ereignisse, Zaehler) und die Seiten des
+ * Datenspeichers, die sich vom Anfangsabbild unterscheiden. Die Sample-CPUs werden vorher angelegt
+ * und eingerichtet (configure_, z.B. Modelle und Hooks), ein Pool von Threads uebernimmt die
+ * Checkpoints, sobald sie da sind, waehrend der funktionale Lauf weitergeht: Anfangsabbild und
+ * Seiten einspielen, warmup_ Instruktionen mit Modellen vorlaufen, Statistik loeschen, dann ein
+ * Intervall messen. Konsole, Dateien und Blockgeraet sind nicht Teil des Checkpoints, die
+ * Konsolenausgabe der Samples wird verworfen.
+ */
+#define CHECKPOINT_PAGE 4096u
+
+typedef struct {
+    CPU state_; //architectural fields only, see CPU_copy_state
+    uint32_t* pages_; //page numbers that differ from the initial data memory
+    uint8_t* data_; //their contents, CHECKPOINT_PAGE bytes each
+    size_t page_count_;
+    uint64_t warmup_; //instructions from the checkpoint to the interval start
+} Checkpoint;
+
+typedef struct {
+    const CPU_Sampling* sampling_;
+    const uint8_t* base_; //initial data memory
+    CPU** samples_;
+    Checkpoint** checkpoints_; //by point, NULL until the fast-forward got there
+    size_t* order_; //points sorted by interval
+    size_t produced_; //checkpoints in order_ that are ready
+    size_t taken_;
+    int done_; //no more checkpoints will come
+    pthread_mutex_t lock_;
+    pthread_cond_t ready_;
+} Sampler;
+
+/*Architekturzustand von from nach to (gleiches Programm)*/
+static void CPU_copy_state(CPU* to, const CPU* from) {
+	memcpy(to->regfile_, from->regfile_, sizeof(to->regfile_));
+	memcpy(to->fregs_, from->fregs_, sizeof(to->fregs_));
+	memcpy(to->vregs_, from->vregs_, sizeof(to->vregs_));
+	to->fcsr_ = from->fcsr_;
+	to->vl_ = from->vl_;
+	to->vtype_ = from->vtype_;
+	to->vsew_ = from->vsew_;
+	to->vlmul_ = from->vlmul_;
+	to->brk_ = from->brk_;
+	to->cycle_ = from->cycle_;
+	to->idle_cycles_ = from->idle_cycles_;
+	memcpy(to->events_, from->events_, sizeof(to->events_));
+	to->event_count_ = from->event_count_;
+	to->next_event_ = from->next_event_;
+	to->mtimecmp_ = from->mtimecmp_;
+	to->mstatus_ = from->mstatus_;
+	to->mie_ = from->mie_;
+	to->mip_ = from->mip_;
+	to->mtvec_ = from->mtvec_;
+	to->mscratch_ = from->mscratch_;
+	to->mepc_ = from->mepc_;
+	to->mcause_ = from->mcause_;
+	to->mtval_ = from->mtval_;
+	to->loads_ = from->loads_;
+	to->stores_ = from->stores_;
+	to->taken_branches_ = from->taken_branches_;
+	memcpy(to->counter_offset_, from->counter_offset_, sizeof(to->counter_offset_));
+	to->lr_addr_ = from->lr_addr_;
+	to->lr_value_ = from->lr_value_;
+	to->lr_valid_ = from->lr_valid_;
+	to->pc_ = from->pc_;
+}
+
+static void checkpoint_free(Checkpoint* cp) {
+	if (cp) {
+		free(cp->pages_);
+		free(cp->data_);
+		free(cp);
+	}
+}
+
+static Checkpoint* checkpoint_take(const CPU* cpu, const uint8_t* base, uint64_t warmup) {
+	Checkpoint* cp = calloc(1, sizeof(Checkpoint));
+	size_t pages = cpu->data_mem_size_ / CHECKPOINT_PAGE;
+	if (!cp || !(cp->pages_ = malloc(pages * sizeof(uint32_t)))) {
+		free(cp);
+		return NULL;
+	}
+	for (size_t p = 0; p < pages; p++) {
+		if (memcmp(cpu->data_mem_ + p * CHECKPOINT_PAGE, base + p * CHECKPOINT_PAGE, CHECKPOINT_PAGE) != 0) {
+			cp->pages_[cp->page_count_++] = (uint32_t)p;
+		}
+	}
+	cp->data_ = malloc(cp->page_count_ * CHECKPOINT_PAGE + 1);
+	if (!cp->data_) {
+		checkpoint_free(cp);
+		return NULL;
+	}
+	for (size_t i = 0; i < cp->page_count_; i++) {
+		memcpy(cp->data_ + i * CHECKPOINT_PAGE, cpu->data_mem_ + (size_t)cp->pages_[i] * CHECKPOINT_PAGE, CHECKPOINT_PAGE);
+	}
+	CPU_copy_state(&cp->state_, cpu);
+	cp->warmup_ = warmup;
+	return cp;
+}
+
+/*Statistik aller Modelle loeschen, ihr Zustand (Caches, Tabellen, Pipeline) bleibt*/
+static void CPU_clear_model_stats(CPU* cpu) {
+	if (cpu->timing_) {
+		memset(&cpu->timing_->stats_, 0, sizeof(cpu->timing_->stats_));
+	}
+	struct CacheModel* m = cpu->caches_;
+	for (size_t i = 0; m && i < m->count_; i++) {
+		memset(&m->caches_[i].stats_, 0, sizeof(m->caches_[i].stats_));
+		if (m->caches_[i].functions_) {
+			memset(m->caches_[i].functions_, 0, 2 * (m->function_count_ + 1) * sizeof(uint64_t));
+		}
+	}
+	struct PredictorModel* b = cpu->predictors_;
+	for (size_t i = 0; b && i < b->count_; i++) {
+		memset(&b->predictors_[i].stats_, 0, sizeof(b->predictors_[i].stats_));
+		if (b->predictors_[i].misses_) {
+			memset(b->predictors_[i].misses_, 0, b->size_ * sizeof(uint64_t));
+		}
+	}
+	if (b && b->executions_) {
+		memset(b->executions_, 0, b->size_ * sizeof(uint64_t));
+		memset(b->taken_, 0, b->size_ * sizeof(uint64_t));
+	}
+}
+
+/*Checkpoint in die vorbereitete Sample-CPU einspielen, aufwaermen und ein Intervall messen*/
+static void sample_run(Sampler* s, CPU* cpu, const Checkpoint* cp) {
+	memcpy(cpu->data_mem_, s->base_, cpu->data_mem_size_);
+	for (size_t i = 0; i < cp->page_count_; i++) {
+		memcpy(cpu->data_mem_ + (size_t)cp->pages_[i] * CHECKPOINT_PAGE, cp->data_ + i * CHECKPOINT_PAGE, CHECKPOINT_PAGE);
+	}
+	CPU_code_written(cpu, 0, cpu->code_end_); //the checkpoint may hold other code
+	CPU_copy_state(cpu, &cp->state_);
+	CPU_set_pc(cpu, cp->state_.pc_);
+	if (cp->warmup_) {
+		CPU_run(cpu, cp->warmup_);
+	}
+	CPU_clear_model_stats(cpu);
+	if (!cpu->halted_) {
+		CPU_run(cpu, s->sampling_->interval_);
+	}
+}
+
+static void* sample_thread(void* arg) {
+	Sampler* s = arg;
+	pthread_mutex_lock(&s->lock_);
+	for (;;) {
+		while (s->taken_ == s->produced_ && !s->done_) {
+			pthread_cond_wait(&s->ready_, &s->lock_);
+		}
+		if (s->taken_ == s->produced_) {
+			break;
+		}
+		size_t point = s->order_[s->taken_++];
+		pthread_mutex_unlock(&s->lock_);
+		sample_run(s, s->samples_[point], s->checkpoints_[point]);
+		pthread_mutex_lock(&s->lock_);
+		checkpoint_free(s->checkpoints_[point]);
+		s->checkpoints_[point] = NULL;
+	}
+	pthread_mutex_unlock(&s->lock_);
+	return NULL;
+}
+
+static void sample_discard(void* ctx, const char* data, size_t len) {
+}
+
+static int sample_no_input(void* ctx) {
+	return -1;
+}
+
+/*Rueckgabe Zahl der gemessenen Samples (samples[i] != NULL), -1 bei Fehlern*/
+int CPU_run_sampled(CPU* cpu, const CPU_SamplePoint* points, size_t count, const CPU_Sampling* sampling, CPU** samples) {
+	if (!sampling->interval_ || cpu->smp_) {
+		return -1;
+	}
+	static const CPU_Console discard = { NULL, sample_discard, sample_no_input };
+	Sampler s;
+	memset(&s, 0, sizeof(s));
+	s.sampling_ = sampling;
+	s.samples_ = samples;
+	uint8_t* base = malloc(cpu->data_mem_size_);
+	s.base_ = base;
+	s.checkpoints_ = calloc(count ? count : 1, sizeof(Checkpoint*));
+	s.order_ = malloc((count ? count : 1) * sizeof(size_t));
+	int ok = base && s.checkpoints_ && s.order_;
+	for (size_t i = 0; i < count; i++) {
+		samples[i] = NULL;
+	}
+	//sample CPUs are set up before any thread runs: hooks patch the shared program
+	for (size_t i = 0; ok && i < count; i++) {
+		samples[i] = CPU_clone_program(cpu);
+		ok = samples[i] != NULL;
+		if (ok) {
+			CPU_set_console(samples[i], &discard);
+			samples[i]->spin_detect_ = cpu->spin_detect_;
+			samples[i]->misaligned_trap_ = cpu->misaligned_trap_;
+			ok = !sampling->configure_ || sampling->configure_(samples[i], sampling->ctx_) >= 0;
+		}
+	}
+	if (!ok) {
+		for (size_t i = 0; i < count; i++) {
+			CPU_destroy(samples[i]);
+			samples[i] = NULL;
+		}
+		free(base);
+		free(s.checkpoints_);
+		free(s.order_);
+		return -1;
+	}
+	memcpy(base, cpu->data_mem_, cpu->data_mem_size_);
+	for (size_t i = 0; i < count; i++) {
+		size_t j = i;
+		for (; j > 0 && points[s.order_[j - 1]].interval_ > points[i].interval_; j--) {
+			s.order_[j] = s.order_[j - 1];
+		}
+		s.order_[j] = i;
+	}
+
+	pthread_mutex_init(&s.lock_, NULL);
+	pthread_cond_init(&s.ready_, NULL);
+	size_t workers = sampling->workers_ ? sampling->workers_ : 4;
+	if (workers > SCHED_MAX_WORKERS) workers = SCHED_MAX_WORKERS;
+	if (workers > count) workers = count;
+	pthread_t threads[SCHED_MAX_WORKERS];
+	size_t started = 0;
+	while (started < workers && pthread_create(&threads[started], NULL, sample_thread, &s) == 0) {
+		started++;
+	}
+
+	//fast-forward: functional run from checkpoint to checkpoint, the workers run behind it
+	for (size_t k = 0; k < count && started; k++) {
+		size_t point = s.order_[k];
+		uint64_t start = points[point].interval_ * sampling->interval_;
+		uint64_t warmup = sampling->warmup_ < start ? sampling->warmup_ : start;
+		uint64_t retired;
+		while ((retired = cpu->cycle_ - cpu->idle_cycles_) < start - warmup && !cpu->halted_) {
+			CPU_run(cpu, start - warmup - retired);
+		}
+		Checkpoint* cp = cpu->halted_ ? NULL : checkpoint_take(cpu, base, warmup);
+		if (!cp) {
+			break;
+		}
+		pthread_mutex_lock(&s.lock_);
+		s.checkpoints_[point] = cp;
+		s.produced_++;
+		pthread_cond_signal(&s.ready_);
+		pthread_mutex_unlock(&s.lock_);
+	}
+	pthread_mutex_lock(&s.lock_);
+	s.done_ = 1;
+	pthread_cond_broadcast(&s.ready_);
+	pthread_mutex_unlock(&s.lock_);
+	for (size_t t = 0; t < started; t++) {
+		pthread_join(threads[t], NULL);
+	}
+	pthread_cond_destroy(&s.ready_);
+	pthread_mutex_destroy(&s.lock_);
+
+	int measured = 0;
+	for (size_t k = 0; k < count; k++) {
+		size_t point = s.order_[k];
+		if (k < s.produced_) {
+			measured++;
+		}
+		else {
+			CPU_destroy(samples[point]);
+			samples[point] = NULL;
+		}
+	}
+	free(base);
+	free(s.checkpoints_);
+	free(s.order_);
+	return measured;
+}
+
+/*Gewichtete Zusammenfassung: Summen je Intervall mit den normierten Gewichten der gemessenen Samples*/
+void CPU_print_sampled(CPU* const* samples, const CPU_SamplePoint* points, size_t count, const CPU_Sampling* sampling) {
+	double total = 0.0;
+	size_t measured = 0, first = count;
+	for (size_t i = 0; i < count; i++) {
+		if (samples[i]) {
+			total += points[i].weight_;
+			measured++;
+			first = first < count ? first : i;
+		}
+	}
+	printf("\nsampled simulation: %zu of %zu points, %llu instructions per interval, %llu warm-up\n", measured, count,
+			(unsigned long long)sampling->interval_, (unsigned long long)sampling->warmup_);
+	if (!measured || total <= 0.0) {
+		return;
+	}
+	double instructions = (double)sampling->interval_;
+	CPU_TimingStats st;
+	printf("point   interval  weight%s\n", CPU_timing_stats(samples[first], &st) == 0 ? "     CPI" : "");
+	for (size_t i = 0; i < count; i++) {
+		if (!samples[i]) {
+			continue;
+		}
+		printf("%5zu %10llu  %6.4f", i, (unsigned long long)points[i].interval_, points[i].weight_ / total);
+		if (CPU_timing_stats(samples[i], &st) == 0) {
+			printf("  %6.3f", st.instructions_ ? (double)st.cycles_ / (double)st.instructions_ : 0.0);
+		}
+		printf("\n");
+	}
+
+	if (CPU_timing_stats(samples[first], &st) == 0) {
+		static const char* const stall_names[STALL_COUNT] = { "fetch", "load-use", "execute", "memory", "control" };
+		double cycles = 0.0, retired = 0.0, stalls[STALL_COUNT] = { 0 };
+		for (size_t i = 0; i < count; i++) {
+			if (samples[i] && CPU_timing_stats(samples[i], &st) == 0) {
+				double w = points[i].weight_ / total;
+				cycles += w * (double)st.cycles_;
+				retired += w * (double)st.instructions_;
+				for (int c = 0; c < STALL_COUNT; c++) {
+					stalls[c] += w * (double)st.stalls_[c];
+				}
+			}
+		}
+		printf("timing: CPI %.3f (weighted), stall share", retired > 0.0 ? cycles / retired : 0.0);
+		for (int c = 0; c < STALL_COUNT; c++) {
+			printf(" %s %.1f%%", stall_names[c], cycles > 0.0 ? 100.0 * stalls[c] / cycles : 0.0);
+		}
+		printf("\n");
+	}
+	const struct CacheModel* m = samples[first]->caches_;
+	for (size_t c = 0; m && c < m->count_; c++) {
+		double accesses = 0.0, misses = 0.0, writebacks = 0.0;
+		for (size_t i = 0; i < count; i++) {
+			CPU_CacheStats cs;
+			if (samples[i] && CPU_cache_stats(samples[i], c, &cs) == 0) {
+				double w = points[i].weight_ / total;
+				accesses += w * (double)cs.accesses_;
+				misses += w * (double)cs.misses_;
+				writebacks += w * (double)cs.writebacks_;
+			}
+		}
+		const CPU_CacheConfig* k = &m->caches_[c].config_;
+		char size[32];
+		format_size(size, sizeof(size), k->size_);
+		printf("cache %zu %s %s %u-way %u B %s: miss rate %.2f%%, %.3f misses and %.3f writebacks per 1000 instructions\n",
+				c, k->instruction_ ? "I" : "D", size, k->ways_, k->line_, cache_policy_names[k->policy_],
+				accesses > 0.0 ? 100.0 * misses / accesses : 0.0, 1000.0 * misses / instructions, 1000.0 * writebacks / instructions);
+	}
+	const struct PredictorModel* b = samples[first]->predictors_;
+	for (size_t p = 0; b && p < b->count_; p++) {
+		double branches = 0.0, mispredicted = 0.0, jumps = 0.0, jump_misses = 0.0;
+		for (size_t i = 0; i < count; i++) {
+			CPU_PredictorStats ps;
+			if (samples[i] && CPU_predictor_stats(samples[i], p, &ps) == 0) {
+				double w = points[i].weight_ / total;
+				branches += w * (double)ps.branches_;
+				mispredicted += w * (double)ps.mispredicted_;
+				jumps += w * (double)(ps.jumps_ + ps.returns_);
+				jump_misses += w * (double)(ps.target_misses_ + ps.return_misses_);
+			}
+		}
+		printf("predictor %zu %s 2^%u: branches mispredicted %.2f%% (%.3f per 1000 instructions), jump targets missed %.2f%%\n",
+				p, predictor_names[b->predictors_[p].config_.kind_], b->predictors_[p].config_.bits_,
+				branches > 0.0 ? 100.0 * mispredicted / branches : 0.0, 1000.0 * mispredicted / instructions,
+				jumps > 0.0 ? 100.0 * jump_misses / jumps : 0.0);
+	}
+}
@@ -0,0 +1,217 @@
+/**
+ * HU Risc-V Emulator als Bibliothek: beliebig viele unabhaengige Maschinen (CPU) in einem
+ * Prozess, ohne globalen Zustand und ohne exit(). Ablauf:
+ *
+ *   CPU* cpu = CPU_create();
+ *   CPU_load_program(cpu, code, code_size, NULL);
+ *   CPU_load_data(cpu, data, data_size);
+ *   int reason = CPU_run(cpu, budget);   //HALT_NONE: budget used up, run again to continue
+ *   ... CPU_get_reg / CPU_read_mem / CPU_exit_code ...
+ *   CPU_destroy(cpu);
+ *
+ * Fehler werden als Rueckgabewert < 0 bzw. NULL gemeldet. Eine CPU darf nur von einem Thread
+ * gleichzeitig benutzt werden; verschiedene CPUs sind voneinander unabhaengig.
+ */
+#ifndef RV_EMU_H
+#define RV_EMU_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+typedef struct CPU CPU;
+typedef struct SymbolTable SymbolTable;
+
+/*Speicherbelegung des Gasts*/
+#define CPU_DATA_MEM_SIZE 0x400000u //RAM from address 0
+#define UART_BASE 0x5000u //console address of the original emulator
+#define CLINT_BASE 0x02000000u
+#define TOHOST_BASE 0x10000000u
+#define BLOCK_BASE 0x10001000u
+#define DMA_BASE 0x10002000u
+
+#define SMP_MAX_HARTS 32
+#define SCHED_MAX_WORKERS 64
+
+/*Grund, warum der Gast angehalten wurde (Rueckgabe von CPU_run)*/
+enum halt_reason { HALT_NONE = 0, HALT_EXIT, HALT_EBREAK, HALT_IDLE, HALT_FAULT };
+
+/*Leistungszaehler: Nummern wie in cycle/time/instret/hpmcounterN, mhpmevent3.. liefert HPM_*-Nummer*/
+enum counter_id {
+	COUNTER_CYCLE = 0, COUNTER_TIME = 1, COUNTER_INSTRET = 2,
+	HPM_LOADS = 3, HPM_STORES = 4, HPM_TAKEN_BRANCHES = 5, HPM_JIT_EXITS = 6,
+	COUNTER_COUNT
+};
+
+/*Rueckgabe von CPU_load_program*/
+enum program_source { PROGRAM_DECODED = 0, PROGRAM_FROM_CACHE = 1, PROGRAM_CACHED = 2 };
+
+/*Konsole des Gasts: UART, write/read auf fd 1/0 und die putchar-Hooks; ohne Funktionen stdout/stdin*/
+typedef struct {
+    void* ctx_;
+    void (*write_)(void* ctx, const char* data, size_t len);
+    int (*read_)(void* ctx); //next input byte, -1 at the end of the input
+} CPU_Console;
+
+/*Erzeugen und Laden*/
+CPU* CPU_create(void);
+CPU* CPU_clone_program(const CPU* image); //shares image's program, image must outlive the clone
+CPU* CPU_create_hart(CPU* boot, uint32_t hartid); //also shares boot's data memory, create after CPU_load_data
+void CPU_destroy(CPU* cpu);
+int CPU_load_program(CPU* cpu, const void* code, size_t size, const char* cache_dir); //program_source or -1
+int CPU_load_program_fd(CPU* cpu, int fd, const char* cache_dir);
+int CPU_load_data(CPU* cpu, const void* data, size_t size);
+int CPU_load_data_fd(CPU* cpu, int fd);
+int CPU_map_data(CPU* cpu, int fd, size_t size); //copy-on-write view of a file of CPU_DATA_MEM_SIZE bytes
+
+/*Grosse Host-Seiten (2 MiB) fuer RAM und dekodiertes Programm, vor dem Laden setzen; ohne sie normale Seiten*/
+enum host_pages { HOST_PAGES_NORMAL = 0, HOST_PAGES_TRANSPARENT, HOST_PAGES_HUGETLB };
+int CPU_set_host_pages(CPU* cpu, int pages); //moves the RAM, returns the host_pages it got or -1; clones inherit it
+
+/*Einrichtung*/
+void CPU_set_console(CPU* cpu, const CPU_Console* console);
+void CPU_set_spin_skip(CPU* cpu, int enabled);
+void CPU_set_misaligned_trap(CPU* cpu, int enabled); //0 (default): misaligned loads/stores in RAM are emulated
+int CPU_enable_code_in_ram(CPU* cpu); //after CPU_load_program, before clones and models: program at RAM address 0, fetched from RAM; data loaded into its range is refused (-1)
+int CPU_attach_block_device(CPU* cpu, const char* filename);
+SymbolTable* symbols_load(const char* filename); //ELF file or map file (nm, ld --Map)
+void symbols_free(SymbolTable* table);
+void CPU_set_symbols(CPU* cpu, const SymbolTable* symbols); //must outlive cpu
+int CPU_add_hook(CPU* cpu, const char* name); //needs symbols, patches the (shared) decoded program
+int CPU_aot_emit(const CPU* cpu, const char* filename);
+int CPU_aot_load(CPU* cpu, const char* filename);
+
+/*Ausfuehren: bis zu budget Instruktionen, Rueckgabe halt_reason*/
+int CPU_run(CPU* cpu, uint64_t budget);
+
+/*Zustand*/
+uint64_t CPU_get_reg(const CPU* cpu, uint32_t reg); //XLEN bits (library built with -DRV_XLEN=64: RV64)
+void CPU_set_reg(CPU* cpu, uint32_t reg, uint64_t value);
+uint32_t CPU_get_pc(const CPU* cpu);
+void CPU_set_pc(CPU* cpu, uint32_t pc);
+int CPU_read_mem(const CPU* cpu, uint32_t addr, void* buffer, uint32_t len); //RAM only, -1 otherwise
+int CPU_write_mem(CPU* cpu, uint32_t addr, const void* buffer, uint32_t len);
+int CPU_halt_reason(const CPU* cpu);
+int32_t CPU_exit_code(const CPU* cpu);
+uint64_t CPU_counter(const CPU* cpu, uint32_t id);
+void CPU_print_regfile(const CPU* cpu);
+void CPU_print_hooks(const CPU* cpu);
+
+/*Zeitmodell einer fuenfstufigen In-Order-Pipeline mit Forwarding; Latenzen in Takten (1 = keine Wartezeit)*/
+enum pipeline_stage { STAGE_IF = 0, STAGE_ID, STAGE_EX, STAGE_MEM, STAGE_WB, STAGE_COUNT };
+enum timing_stall { STALL_FETCH = 0, STALL_LOAD_USE, STALL_EXECUTE, STALL_MEMORY, STALL_CONTROL, STALL_COUNT };
+
+typedef struct {
+    uint32_t fetch_; //IF per instruction
+    uint32_t load_; //MEM for loads from RAM
+    uint32_t store_;
+    uint32_t mmio_; //MEM for device accesses
+    uint32_t fdiv_; //EX for fdiv/fsqrt
+    uint32_t branch_; //cycles lost by a taken branch or jalr (resolved in EX, predicted not taken)
+    uint32_t jump_; //cycles lost by jal (resolved in ID)
+} CPU_TimingConfig;
+
+typedef struct {
+    uint64_t cycles_;
+    uint64_t instructions_;
+    uint64_t stalls_[STALL_COUNT]; //cycles by cause
+    uint64_t events_[STALL_COUNT]; //instructions that caused them
+    uint64_t busy_[STAGE_COUNT]; //cycles a stage worked on an instruction
+    uint64_t held_[STAGE_COUNT]; //cycles it held one that could not advance; the rest it was empty
+} CPU_TimingStats;
+
+void CPU_timing_defaults(CPU_TimingConfig* config); //classic 5-stage: every latency 1, branch 2, jump 1
+int CPU_enable_timing(CPU* cpu, const CPU_TimingConfig* config); //NULL switches the model off
+int CPU_timing_stats(const CPU* cpu, CPU_TimingStats* stats); //-1 without model
+void CPU_print_timing(const CPU* cpu);
+
+/*Cache-Simulation: mehrere Konfigurationen nebeneinander; Sampling zaehlt je period Instruktionen nur length nach warmup*/
+enum cache_policy { CACHE_LRU = 0, CACHE_PLRU, CACHE_RANDOM };
+
+typedef struct {
+    uint32_t size_; //bytes; size_ / (ways_ * line_) sets, a power of two
+    uint32_t ways_;
+    uint32_t line_; //bytes, power of two
+    uint32_t policy_; //cache_policy, PLRU needs a power of two ways_ <= 64
+    int write_back_; //1: write-back + write-allocate, 0: write-through, no write-allocate
+    int instruction_; //1: sees the fetches, 0: loads and stores to RAM
+} CPU_CacheConfig;
+
+typedef struct {
+    uint64_t accesses_;
+    uint64_t misses_;
+    uint64_t writes_;
+    uint64_t write_misses_;
+    uint64_t writebacks_; //dirty lines evicted, write-through: stores passed to memory
+} CPU_CacheStats;
+
+int CPU_add_cache(CPU* cpu, const CPU_CacheConfig* config); //index or -1
+int CPU_set_cache_sampling(CPU* cpu, uint64_t period, uint64_t length, uint64_t warmup); //period 0 = count everything
+int CPU_cache_stats(const CPU* cpu, size_t index, CPU_CacheStats* stats);
+void CPU_print_caches(const CPU* cpu, size_t top_functions); //per-function misses need symbols
+
+/*Sprungvorhersage: mehrere Praediktoren nebeneinander, jeder mit eigenem BTB (jal/jalr) und Return-Address-Stack*/
+enum predictor_kind { PREDICTOR_BIMODAL = 0, PREDICTOR_GSHARE, PREDICTOR_TAGE };
+
+typedef struct {
+    uint32_t kind_; //predictor_kind
+    uint32_t bits_; //log2 of the counter table entries (TAGE: base table, tagged tables have a quarter each)
+    uint32_t history_; //global history bits, TAGE: length of the longest table (8..64)
+    uint32_t btb_bits_; //log2 of the BTB entries, 0 = no BTB
+    uint32_t ras_; //RAS depth, 0 = no RAS
+} CPU_PredictorConfig;
+
+typedef struct {
+    uint64_t branches_;
+    uint64_t mispredicted_;
+    uint64_t jumps_; //jal/jalr except returns, predicted by the BTB
+    uint64_t target_misses_;
+    uint64_t returns_; //predicted by the RAS
+    uint64_t return_misses_;
+} CPU_PredictorStats;
+
+void CPU_predictor_defaults(CPU_PredictorConfig* config, uint32_t kind); //4096 entries, BTB 512, RAS 16
+int CPU_add_predictor(CPU* cpu, const CPU_PredictorConfig* config); //index or -1
+int CPU_predictor_stats(const CPU* cpu, size_t index, CPU_PredictorStats* stats);
+void CPU_print_predictors(const CPU* cpu, size_t top_branches);
+
+/*Basisblockvektoren im SimPoint-Format, ein Intervall je interval Instruktionen; nach dem Laden, nicht mit AOT*/
+int CPU_enable_bbv(CPU* cpu, uint64_t interval, FILE* out); //interval 0 or out NULL switches off
+uint64_t CPU_bbv_flush(CPU* cpu); //writes the started interval, returns the intervals written
+
+/*Gesampelte Simulation: funktional bis zu jedem Intervall vorspulen, Checkpoint, Samples parallel mit Modellen messen*/
+typedef struct {
+    uint64_t interval_; //retired instructions per interval (as for CPU_enable_bbv)
+    double weight_;
+} CPU_SamplePoint;
+
+typedef struct {
+    uint64_t interval_; //instructions per interval
+    uint64_t warmup_; //instructions run with models before each interval, not counted
+    size_t workers_; //0 = 4
+    int (*configure_)(CPU* sample, void* ctx); //sets up the models of each sample CPU, < 0 = error
+    void* ctx_;
+} CPU_Sampling;
+
+int CPU_run_sampled(CPU* cpu, const CPU_SamplePoint* points, size_t count, const CPU_Sampling* sampling, CPU** samples);
+void CPU_print_sampled(CPU* const* samples, const CPU_SamplePoint* points, size_t count, const CPU_Sampling* sampling);
+
+/*FNV-1a, 64 Bit (Schluessel des Dekodier-Caches)*/
+#define HASH_SEED 0xCBF29CE484222325ull
+uint64_t hash_bytes(const void* data, size_t len, uint64_t hash);
+
+/*Mehrere Maschinen: Berichte der Lanes gehen auf stdout, die Konsolenzeilen der Gaeste auf out_*/
+void CPU_run_lockstep(CPU** lanes, size_t count, const char* const* names, uint64_t budget);
+int CPU_run_smp(CPU** harts, size_t count, uint64_t budget); //harts[0] = boot, the others from CPU_create_hart
+
+typedef struct {
+    size_t workers_; //0 = 4
+    uint64_t quantum_; //0 = 10000
+    uint64_t seed_;
+    uint64_t budget_; //instructions per guest
+    FILE* out_; //tagged console lines, NULL = stdout
+} CPU_Schedule;
+
+uint64_t CPU_run_scheduled(CPU** guests, size_t count, const CPU_Schedule* schedule); //returns the rounds
+
+#endif
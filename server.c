@@ -0,0 +1,373 @@
+#define _GNU_SOURCE //memfd_create
+/**
+ * Serverbetrieb: ein Prozess nimmt Auftraege ueber ein Unix-Socket an (Protokoll in server.h).
+ * Geladene Abbilder bleiben unter ihrem Hash dekodiert im Speicher; der Datenspeicher eines
+ * Abbilds liegt in einer memfd-Datei, die jeder Auftrag privat einblendet (copy-on-write):
+ * ein Auftrag kostet keine Dekodierung und kein Kopieren der 4 MiB, nur die Seiten, die der
+ * Gast beschreibt. Ein fester Pool von Worker-Threads bedient die angenommenen Verbindungen.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "rv_emu.h"
+#include "server.h"
+
+#define SERVER_MAX_IMAGES 64
+#define SERVER_MAX_PROGRAM 0x100000u //instruction fetch wraps at 1 MiB
+#define SERVER_MAX_INPUT (16u << 20)
+#define SERVER_DEFAULT_BUDGET 1000000
+#define SERVER_SLICE 100000 //instructions between two looks at the output buffer
+#define SERVER_OUTPUT_CHUNK 4096
+
+typedef struct {
+    uint64_t id_;
+    CPU* program_; //decoded program, only cloned, never run
+    int data_fd_; //memfd with the initial data memory, CPU_DATA_MEM_SIZE bytes
+    size_t data_size_;
+    size_t refs_; //running jobs, under Server.lock_
+    uint64_t used_; //for evicting the least recently used image
+} ServerImage;
+
+typedef struct {
+    const ServerOptions* opt_;
+    ServerImage images_[SERVER_MAX_IMAGES];
+    size_t image_count_;
+    uint64_t clock_;
+    int* pending_; //accepted connections, ring buffer
+    size_t head_;
+    size_t count_;
+    size_t capacity_;
+    pthread_mutex_t lock_;
+    pthread_cond_t ready_;
+} Server;
+
+/*Zustand eines laufenden Auftrags: Ausgabepuffer und Eingabe des Gasts*/
+typedef struct {
+    int fd_;
+    int failed_; //the client went away, the job stops
+    char output_[SERVER_OUTPUT_CHUNK];
+    size_t output_len_;
+    const uint8_t* input_;
+    size_t input_len_;
+    size_t input_pos_;
+} ServerJob;
+
+static int read_full(int fd, void* buffer, size_t len) {
+	uint8_t* p = buffer;
+	while (len) {
+		ssize_t n = read(fd, p, len);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return -1;
+		p += n;
+		len -= (size_t)n;
+	}
+	return 0;
+}
+
+static int write_full(int fd, const void* buffer, size_t len) {
+	const uint8_t* p = buffer;
+	while (len) {
+		ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return -1;
+		p += n;
+		len -= (size_t)n;
+	}
+	return 0;
+}
+
+static int send_reply(int fd, uint32_t type, const void* data, size_t len) {
+	ServerReply reply = { type, (uint32_t)len };
+	return write_full(fd, &reply, sizeof(reply)) == 0 && write_full(fd, data, len) == 0 ? 0 : -1;
+}
+
+static int send_error(int fd, const char* message) {
+	return send_reply(fd, SERVER_ERROR, message, strlen(message));
+}
+
+static void job_flush(ServerJob* job) {
+	if (job->output_len_ && !job->failed_) {
+		job->failed_ = send_reply(job->fd_, SERVER_OUTPUT, job->output_, job->output_len_) < 0;
+	}
+	job->output_len_ = 0;
+}
+
+static void job_write(void* ctx, const char* data, size_t len) {
+	ServerJob* job = ctx;
+	while (len) {
+		size_t n = SERVER_OUTPUT_CHUNK - job->output_len_;
+		if (n > len) n = len;
+		memcpy(job->output_ + job->output_len_, data, n);
+		job->output_len_ += n;
+		data += n;
+		len -= n;
+		if (job->output_len_ == SERVER_OUTPUT_CHUNK) {
+			job_flush(job);
+		}
+	}
+}
+
+static int job_read(void* ctx) {
+	ServerJob* job = ctx;
+	return job->input_pos_ < job->input_len_ ? job->input_[job->input_pos_++] : -1;
+}
+
+static ServerImage* server_find_image(Server* s, uint64_t id) {
+	for (size_t i = 0; i < s->image_count_; i++) {
+		if (s->images_[i].program_ && s->images_[i].id_ == id) {
+			return &s->images_[i];
+		}
+	}
+	return NULL;
+}
+
+static void image_release(ServerImage* image) {
+	CPU_destroy(image->program_);
+	close(image->data_fd_);
+	image->program_ = NULL;
+}
+
+/*Freier Platz fuer ein Abbild, notfalls das am laengsten unbenutzte ohne laufende Auftraege verdraengen*/
+static ServerImage* server_image_slot(Server* s) {
+	if (s->image_count_ < SERVER_MAX_IMAGES) {
+		return &s->images_[s->image_count_++];
+	}
+	ServerImage* victim = NULL;
+	for (size_t i = 0; i < s->image_count_; i++) {
+		ServerImage* image = &s->images_[i];
+		if (!image->program_) return image;
+		if (image->refs_ == 0 && (!victim || image->used_ < victim->used_)) victim = image;
+	}
+	if (victim) {
+		image_release(victim);
+	}
+	return victim;
+}
+
+/*SERVER_LOAD: Programm dekodieren, Datenspeicher in eine memfd-Datei legen*/
+static int server_load(Server* s, int fd, const ServerRequest* request) {
+	uint64_t program_len = request->length_[0], data_len = request->length_[1];
+	if (program_len > SERVER_MAX_PROGRAM || data_len > CPU_DATA_MEM_SIZE) {
+		send_error(fd, "image too large");
+		return -1;
+	}
+	uint8_t* program = malloc(program_len + data_len + 1);
+	if (!program || read_full(fd, program, program_len + data_len) < 0) {
+		free(program);
+		return -1;
+	}
+	const uint8_t* data = program + program_len;
+	uint64_t id = hash_bytes(&program_len, sizeof(program_len), HASH_SEED);
+	id = hash_bytes(program, program_len, id);
+	id = hash_bytes(&data_len, sizeof(data_len), id);
+	id = hash_bytes(data, data_len, id);
+
+	pthread_mutex_lock(&s->lock_);
+	ServerImage* image = server_find_image(s, id);
+	if (image) {
+		image->used_ = ++s->clock_;
+	}
+	pthread_mutex_unlock(&s->lock_);
+	if (image) {
+		free(program);
+		return send_reply(fd, SERVER_IMAGE, &id, sizeof(id));
+	}
+
+	ServerImage loaded = {
+		.id_ = id,
+		.program_ = CPU_create(),
+		.data_fd_ = memfd_create("rv_emu data", MFD_CLOEXEC),
+		.data_size_ = (size_t)data_len,
+	};
+	int ok = loaded.program_ && loaded.data_fd_ >= 0
+		&& CPU_load_program(loaded.program_, program, program_len, s->opt_->cache_dir_) >= 0
+		&& ftruncate(loaded.data_fd_, CPU_DATA_MEM_SIZE) == 0
+		&& pwrite(loaded.data_fd_, data, data_len, 0) == (ssize_t)data_len;
+	free(program);
+	if (!ok) {
+		CPU_destroy(loaded.program_);
+		if (loaded.data_fd_ >= 0) close(loaded.data_fd_);
+		return send_error(fd, "cannot load image");
+	}
+
+	pthread_mutex_lock(&s->lock_);
+	image = server_find_image(s, id); //another connection may have loaded it meanwhile
+	if (!image && (image = server_image_slot(s)) != NULL) {
+		*image = loaded;
+		loaded.program_ = NULL;
+	}
+	if (image) {
+		image->used_ = ++s->clock_;
+	}
+	pthread_mutex_unlock(&s->lock_);
+	if (loaded.program_) {
+		image_release(&loaded);
+	}
+	return image ? send_reply(fd, SERVER_IMAGE, &id, sizeof(id)) : send_error(fd, "image cache full");
+}
+
+/*SERVER_RUN: neue CPU auf dem Abbild, Ausgabe waehrend des Laufs zuruecksenden*/
+static int server_run(Server* s, int fd, const ServerRequest* request) {
+	uint64_t input_len = request->length_[0];
+	if (input_len > SERVER_MAX_INPUT) {
+		send_error(fd, "input too large");
+		return -1;
+	}
+	uint8_t* input = malloc(input_len + 1);
+	if (!input || read_full(fd, input, input_len) < 0) {
+		free(input);
+		return -1;
+	}
+
+	//refs_ keeps the image, whose program the clone shares, from being evicted during the job
+	pthread_mutex_lock(&s->lock_);
+	ServerImage* image = server_find_image(s, request->image_);
+	if (image) {
+		image->refs_++;
+		image->used_ = ++s->clock_;
+	}
+	pthread_mutex_unlock(&s->lock_);
+	if (!image) {
+		free(input);
+		return send_error(fd, "unknown image");
+	}
+
+	CPU* cpu = CPU_clone_program(image->program_);
+	if (!cpu || CPU_map_data(cpu, image->data_fd_, image->data_size_) < 0) {
+		CPU_destroy(cpu);
+		cpu = NULL;
+	}
+	if (!cpu) {
+		pthread_mutex_lock(&s->lock_);
+		image->refs_--;
+		pthread_mutex_unlock(&s->lock_);
+		free(input);
+		return send_error(fd, "cannot create machine");
+	}
+
+	ServerJob* job = calloc(1, sizeof(ServerJob));
+	job->fd_ = fd;
+	job->input_ = input;
+	job->input_len_ = input_len;
+	CPU_set_console(cpu, &(CPU_Console){ job, job_write, job_read });
+	CPU_set_spin_skip(cpu, s->opt_->spin_skip_);
+
+	uint64_t budget = request->budget_ ? request->budget_ : SERVER_DEFAULT_BUDGET;
+	int halted = HALT_NONE;
+	while (budget && !job->failed_) {
+		uint64_t slice = budget < SERVER_SLICE ? budget : SERVER_SLICE;
+		halted = CPU_run(cpu, slice);
+		if (halted != HALT_NONE) break;
+		budget -= slice;
+		job_flush(job);
+	}
+	job_flush(job);
+
+	ServerResult result = { .halt_reason_ = halted, .exit_code_ = CPU_exit_code(cpu) };
+	for (uint32_t i = 0; i < COUNTER_COUNT; i++) {
+		result.counters_[i] = CPU_counter(cpu, i);
+	}
+	int failed = job->failed_;
+	CPU_destroy(cpu);
+	pthread_mutex_lock(&s->lock_);
+	image->refs_--;
+	pthread_mutex_unlock(&s->lock_);
+	free(job);
+	free(input);
+	return failed ? -1 : send_reply(fd, SERVER_RESULT, &result, sizeof(result));
+}
+
+static void server_connection(Server* s, int fd) {
+	ServerRequest request;
+	while (read_full(fd, &request, sizeof(request)) == 0) {
+		int result;
+		switch (request.type_) {
+		case SERVER_LOAD: result = server_load(s, fd, &request); break;
+		case SERVER_RUN: result = server_run(s, fd, &request); break;
+		default: send_error(fd, "unknown request"); result = -1; break;
+		}
+		if (result < 0) break;
+	}
+	close(fd);
+}
+
+static void* server_worker(void* arg) {
+	Server* s = arg;
+	for (;;) {
+		pthread_mutex_lock(&s->lock_);
+		while (s->count_ == 0) {
+			pthread_cond_wait(&s->ready_, &s->lock_);
+		}
+		int fd = s->pending_[s->head_];
+		s->head_ = (s->head_ + 1) % s->capacity_;
+		s->count_--;
+		pthread_mutex_unlock(&s->lock_);
+		server_connection(s, fd);
+	}
+	return NULL;
+}
+
+static void server_push(Server* s, int fd) {
+	pthread_mutex_lock(&s->lock_);
+	if (s->count_ == s->capacity_) {
+		size_t capacity = s->capacity_ ? 2 * s->capacity_ : 16;
+		int* pending = malloc(capacity * sizeof(int));
+		for (size_t i = 0; i < s->count_; i++) {
+			pending[i] = s->pending_[(s->head_ + i) % s->capacity_];
+		}
+		free(s->pending_);
+		s->pending_ = pending;
+		s->capacity_ = capacity;
+		s->head_ = 0;
+	}
+	s->pending_[(s->head_ + s->count_) % s->capacity_] = fd;
+	s->count_++;
+	pthread_cond_signal(&s->ready_);
+	pthread_mutex_unlock(&s->lock_);
+}
+
+int server_main(const ServerOptions* opt) {
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	if (strlen(opt->socket_) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "%s: socket path too long\n", opt->socket_);
+		return EXIT_FAILURE;
+	}
+	strcpy(addr.sun_path, opt->socket_);
+	int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	unlink(opt->socket_);
+	if (listen_fd < 0 || bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(listen_fd, 64) < 0) {
+		perror(opt->socket_);
+		return EXIT_FAILURE;
+	}
+
+	Server* s = calloc(1, sizeof(Server));
+	s->opt_ = opt;
+	pthread_mutex_init(&s->lock_, NULL);
+	pthread_cond_init(&s->ready_, NULL);
+	size_t workers = opt->workers_ ? opt->workers_ : 4;
+	for (size_t w = 0; w < workers; w++) {
+		pthread_t thread;
+		pthread_create(&thread, NULL, server_worker, s);
+		pthread_detach(thread);
+	}
+	printf("serving on %s with %zu workers\n", opt->socket_, workers);
+	fflush(stdout);
+
+	for (;;) {
+		int fd = accept(listen_fd, NULL, NULL);
+		if (fd < 0 && errno == EINTR) continue;
+		if (fd < 0) {
+			perror("accept");
+			return EXIT_FAILURE;
+		}
+		server_push(s, fd);
+	}
+}
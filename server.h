@@ -0,0 +1,54 @@
+/**
+ * Serverbetrieb (--serve <socket>): Auftraege ueber ein lokales Unix-Socket (SOCK_STREAM).
+ * Jede Anfrage ist ein ServerRequest, gefolgt von ihren Nutzdaten; alle Zahlen in
+ * Host-Bytereihenfolge. Auf einer Verbindung laufen die Anfragen nacheinander, parallel
+ * wird ueber mehrere Verbindungen gearbeitet.
+ *
+ *   SERVER_LOAD  length_[0] Byte Instruktionsspeicher, length_[1] Byte Datenspeicher.
+ *                Antwort: SERVER_IMAGE mit der Image-Id (uint64_t, Hash beider Speicher).
+ *   SERVER_RUN   image_, budget_ (0 = 1000000 Instruktionen), length_[0] Byte Eingabe
+ *                fuer UART und fd 0. Antwort: beliebig viele SERVER_OUTPUT mit Konsolenausgabe,
+ *                am Ende SERVER_RESULT mit einem ServerResult.
+ *
+ * Fehler werden als SERVER_ERROR mit einem Text beantwortet.
+ */
+#ifndef RV_EMU_SERVER_H
+#define RV_EMU_SERVER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "rv_emu.h"
+
+enum server_request { SERVER_LOAD = 1, SERVER_RUN = 2 };
+enum server_reply { SERVER_IMAGE = 1, SERVER_OUTPUT = 2, SERVER_RESULT = 3, SERVER_ERROR = 4 };
+
+typedef struct {
+    uint32_t type_; //server_request
+    uint32_t reserved_;
+    uint64_t image_;
+    uint64_t budget_;
+    uint64_t length_[2];
+} ServerRequest;
+
+typedef struct {
+    uint32_t type_; //server_reply
+    uint32_t length_; //bytes that follow
+} ServerReply;
+
+typedef struct {
+    int32_t halt_reason_;
+    int32_t exit_code_;
+    uint64_t counters_[COUNTER_COUNT]; //CPU_counter at the end of the job
+} ServerResult;
+
+typedef struct {
+    const char* socket_;
+    size_t workers_;
+    const char* cache_dir_;
+    int spin_skip_;
+} ServerOptions;
+
+int server_main(const ServerOptions* opt);
+
+#endif